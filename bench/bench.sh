@@ -0,0 +1,160 @@
+#!/bin/bash
+# Benchmark the bish compiler and the scripts it generates.
+#
+# Usage: bench/bench.sh [-b] [BISH]
+#
+# Compiles each workload (bench/*.bish, and every module of tests/),
+# and runs the generated script. For each it reports the compile time,
+# the size of the generated script, the run time (the fastest of
+# $BENCH_RUNS runs, default 3) and the number of processes forked by
+# the run. These are compared against bench/baseline.tsv; with -b, the
+# results replace the baseline instead.
+#
+# Forks are counted with strace if it is installed. Otherwise the
+# growth of the system-wide process counter in /proc/stat is used,
+# which also counts anything else started meanwhile.
+#
+# The baseline records which of the two counted its forks, and forks
+# are only compared when they were counted the same way. The run fails
+# if a workload does not compile or pass when it did in the baseline,
+# or (when counted with strace) forks more processes.
+
+root=$(cd "$(dirname "$0")/.." && pwd)
+baseline_file="$root/bench/baseline.tsv"
+update_baseline=0
+if [ "$1" = "-b" ]; then
+    update_baseline=1
+    shift
+fi
+bish=$(cd "$(dirname "${1:-$root/bish}")" && pwd)/$(basename "${1:-$root/bish}")
+runs=${BENCH_RUNS:-3}
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+
+if command -v strace > /dev/null; then
+    fork_counter=strace
+else
+    fork_counter=/proc/stat
+fi
+
+# Print the current time in microseconds.
+now_us() {
+    if [ -n "$EPOCHREALTIME" ]; then
+        echo "${EPOCHREALTIME//[!0-9]/}"
+    else
+        echo $(( $(date +%s%N) / 1000 ))
+    fi
+}
+
+# Print the number of processes forked by the given command, which is
+# run in the current directory with its output discarded.
+count_forks() {
+    if [ "$fork_counter" = strace ]; then
+        strace -f -qq -e trace=fork,vfork,clone,clone3 -e signal=none \
+            -o "$work/strace" "$@" > /dev/null 2>&1
+        local status=$?
+        grep -c -E '^[0-9]+ +(fork|vfork|clone|clone3)\(' "$work/strace"
+        return $status
+    fi
+    local before after status
+    before=$(awk '$1 == "processes" { print $2 }' /proc/stat)
+    "$@" > /dev/null 2>&1
+    status=$?
+    after=$(awk '$1 == "processes" { print $2 }' /proc/stat)
+    # Discount the awk reading the counter, and the command itself.
+    echo $(( after - before - 2 ))
+    return $status
+}
+
+# Print the result of the given workload as a line of the baseline:
+# name, status, compile ms, script bytes, run ms and forks.
+measure() {
+    local file=$1 name=$2 dir script start end run best status forks
+    dir=$(dirname "$file")
+    script="$work/$(basename "$file" .bish).bash"
+    start=$(now_us)
+    # The exit makes the subshell report a crash of the compiler to
+    # its own stderr.
+    if ! (cd "$dir" && "$bish" "$(basename "$file")"; exit $?) > "$script" 2> /dev/null; then
+        printf '%s\tcompile-error\t-\t-\t-\t-\n' "$name"
+        return
+    fi
+    end=$(now_us)
+    local compile=$(( end - start )) size
+    size=$(wc -c < "$script")
+    best=
+    status=ok
+    for (( run = 0; run < runs; run++ )); do
+        start=$(now_us)
+        (cd "$dir" && bash "$script" > /dev/null 2>&1) || status=fail
+        end=$(now_us)
+        if [ -z "$best" ] || (( end - start < best )); then best=$(( end - start )); fi
+    done
+    forks=$(cd "$dir" && count_forks bash "$script")
+    printf '%s\t%s\t%d.%03d\t%d\t%d.%03d\t%d\n' "$name" "$status" \
+        $(( compile / 1000 )) $(( compile % 1000 )) "$size" \
+        $(( best / 1000 )) $(( best % 1000 )) "$forks"
+}
+
+results="$work/results.tsv"
+printf '# forks counted with %s\n' "$fork_counter" > "$results"
+printf '# workload\tstatus\tcompile_ms\tscript_bytes\trun_ms\tforks\n' >> "$results"
+for file in "$root"/bench/*.bish "$root"/tests/*.bish; do
+    name=${file#$root/}
+    measure "$file" "$name" >> "$results"
+done
+
+if [ "$update_baseline" = 1 ]; then
+    cp "$results" "$baseline_file"
+    echo "Wrote $baseline_file (forks counted with $fork_counter)."
+    exit 0
+fi
+
+if [ ! -f "$baseline_file" ]; then
+    echo "No baseline; run bench/bench.sh -b to create it." >&2
+    exit 1
+fi
+
+# Print the results next to the baseline.
+awk -F '\t' -v counter="$fork_counter" '
+function delta(now, before) {
+    if (before == "" || before == "-" || now == "-") return ""
+    return sprintf(" (%+g)", now - before)
+}
+NR == FNR && /^# forks counted with / {
+    base_counter = substr($0, length("# forks counted with ") + 1)
+    next
+}
+/^#/ {
+    if (NR != FNR && !header) {
+        header = 1
+        printf "%-36s %-13s %20s %17s %21s %6s\n", "workload", "status",
+            "compile", "bytes", "run", "forks"
+    }
+    next
+}
+NR == FNR { base[$1] = $0; next }
+{
+    split(base[$1], b, "\t")
+    # Forks counted differently are not comparable.
+    if (base_counter != counter) b[6] = ""
+    printf "%-36s %-13s %10s%-10s %8s%-9s %10s%-11s %6s%s\n", $1, $2,
+        $3, delta($3, b[3]), $4, delta($4, b[4]), $5, delta($5, b[5]), $6, delta($6, b[6])
+    if (b[1] == "") next
+    if (counter == "strace" && $6 != "-" && b[6] != "" && b[6] != "-" && $6 > b[6]) {
+        regressions = regressions "\n  " $1 ": " b[6] " -> " $6 " forks"
+    } else if (b[2] == "ok" && $2 != "ok") {
+        regressions = regressions "\n  " $1 ": " $2
+    }
+}
+END {
+    printf "(times in ms, forks counted with %s; changes from the baseline in parentheses)\n", counter
+    if (base_counter != counter) {
+        printf "(forks not compared: the baseline counted them with %s)\n",
+            base_counter == "" ? "an unknown counter" : base_counter
+    }
+    if (regressions != "") {
+        printf "Regressions against the baseline:%s\n", regressions
+        exit 1
+    }
+}' "$baseline_file" "$results"
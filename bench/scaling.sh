@@ -0,0 +1,74 @@
+#!/bin/bash
+# Measure how compile time and peak memory grow with the size of the
+# program, on programs generated by tools/StressGen.
+#
+# Usage: bench/scaling.sh [-o FILE] [BISH]
+#
+# Compiles programs of $SCALING_MIN (default 250) functions, doubling
+# up to $SCALING_MAX (default 4000), in call chains of depth
+# $SCALING_DEPTH (default 4) over $SCALING_IMPORTS (default 4)
+# imported modules. Prints the compile time and peak RSS of each, with
+# bars to plot them, and the growth exponent from the previous size:
+# 1 is linear, 2 quadratic. With -o, the measurements are also written
+# to FILE as TSV (e.g. for gnuplot).
+
+root=$(cd "$(dirname "$0")/.." && pwd)
+output=
+if [ "$1" = "-o" ]; then
+    output=$2
+    shift 2
+fi
+bish=$(cd "$(dirname "${1:-$root/bish}")" && pwd)/$(basename "${1:-$root/bish}")
+stressgen="$root/tools/StressGen"
+min=${SCALING_MIN:-250}
+max=${SCALING_MAX:-4000}
+depth=${SCALING_DEPTH:-4}
+imports=${SCALING_IMPORTS:-4}
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+
+if [ ! -x "$stressgen" ]; then
+    echo "$stressgen not found; build it with make -C tools StressGen" >&2
+    exit 1
+fi
+
+results="$work/results.tsv"
+printf '# functions\tdepth\timports\tseconds\tmax_rss_kb\tstatus\n' > "$results"
+for (( n = min; n <= max; n *= 2 )); do
+    "$stressgen" -n "$n" -d "$depth" -m "$imports" -x "$bish" "$work/$n" >> "$results" || break
+    rm -rf "${work:?}/$n"
+done
+if [ -n "$output" ]; then cp "$results" "$output"; fi
+
+awk -F '\t' '
+function bar(value, largest,   n, s) {
+    n = largest > 0 ? int(30 * value / largest + 0.5) : 0
+    s = ""
+    while (n-- > 0) s = s "#"
+    return s
+}
+function exponent(now, before, ratio) {
+    if (before <= 0 || now <= 0 || ratio <= 1) return "-"
+    return sprintf("%.2f", log(now / before) / log(ratio))
+}
+/^#/ { next }
+{
+    count++
+    n[count] = $1; t[count] = $4; rss[count] = $5; status[count] = $6
+    if ($4 > max_t) max_t = $4
+    if ($5 > max_rss) max_rss = $5
+}
+END {
+    printf "%9s %10s %6s  %-30s %9s %6s  %-30s\n", "functions", "seconds", "growth", "",
+        "RSS KB", "growth", ""
+    for (i = 1; i <= count; i++) {
+        if (status[i] != 0) {
+            printf "%9d failed to compile (status %d)\n", n[i], status[i]
+            continue
+        }
+        ratio = i > 1 ? n[i] / n[i - 1] : 0
+        printf "%9d %10.3f %6s  %-30s %9d %6s  %-30s\n", n[i], t[i],
+            (i > 1 ? exponent(t[i], t[i - 1], ratio) : "-"), bar(t[i], max_t),
+            rss[i], (i > 1 ? exponent(rss[i], rss[i - 1], ratio) : "-"), bar(rss[i], max_rss)
+    }
+}' "$results"
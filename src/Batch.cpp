@@ -0,0 +1,145 @@
+#include <fstream>
+#include <iostream>
+#include <pthread.h>
+#include <set>
+#include <sstream>
+#include "Batch.h"
+#include "BuildCache.h"
+#include "CodeGen.h"
+#include "Compile.h"
+#include "IRArena.h"
+#include "ModuleCache.h"
+#include "Mutex.h"
+#include "Parser.h"
+
+using namespace Bish;
+
+namespace {
+
+// State shared by the worker threads of a batch.
+class Batch {
+public:
+    Batch(const std::vector<std::string> &in, const std::vector<std::string> &out,
+          CodeGenerators::CodeGeneratorConstructor cg, const CompileOptions &o,
+          const BuildCache *b)
+        : inputs(in), outputs(out), cg_constructor(cg), options(o), build_cache(b), next(0),
+          failed(false) {}
+
+    const std::vector<std::string> &inputs;
+    const std::vector<std::string> &outputs;
+    CodeGenerators::CodeGeneratorConstructor cg_constructor;
+    const CompileOptions &options;
+    // The cache of compiled scripts, or NULL.
+    const BuildCache *build_cache;
+    ModuleCache cache;
+    Mutex mutex;
+    unsigned next;
+    bool failed;
+
+    // Return the index of the next input to compile, or -1 if there
+    // are none left.
+    int take() {
+        ScopedLock lock(mutex);
+        if (next >= inputs.size()) return -1;
+        return next++;
+    }
+
+    void fail(const std::string &msg) {
+        ScopedLock lock(mutex);
+        std::cerr << msg << std::endl;
+        failed = true;
+    }
+};
+
+// Return the output path in 'outdir' for the given input path.
+std::string output_path(const std::string &input, const std::string &outdir,
+                        const std::string &extension) {
+    std::string name = input.substr(input.find_last_of('/') + 1);
+    const std::string suffix = ".bish";
+    if (name.size() > suffix.size() &&
+        name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0) {
+        name.erase(name.size() - suffix.size());
+    }
+    return outdir + "/" + name + "." + extension;
+}
+
+// Worker thread: compile inputs until there are none left.
+void *compile_worker(void *arg) {
+    Batch *batch = (Batch *)arg;
+    int i;
+    while ((i = batch->take()) >= 0) {
+        std::ofstream out(batch->outputs[i].c_str());
+        if (!out) {
+            batch->fail("Could not open " + batch->outputs[i] + " for writing.");
+            continue;
+        }
+        // All IR of this compilation is freed with the arena.
+        IRArena arena;
+        IRArena::Scope arena_scope(&arena);
+        if (batch->build_cache) {
+            std::string compiled;
+            if (!batch->build_cache->fetch(batch->inputs[i], compiled)) {
+                // Parsed through the module cache, which records the
+                // modules it imports.
+                std::ostringstream s;
+                CodeGenerator *cg = batch->cg_constructor(s);
+                compile(batch->cache.get(batch->inputs[i]), cg, &batch->cache, batch->options);
+                delete cg;
+                compiled = s.str();
+                batch->build_cache->store(batch->inputs[i], &batch->cache, compiled);
+            }
+            out << compiled;
+            continue;
+        }
+        Parser p(&batch->cache);
+        Module *m = p.parse(batch->inputs[i]);
+        CodeGenerator *cg = batch->cg_constructor(out);
+        compile(m, cg, &batch->cache, batch->options);
+        delete cg;
+    }
+    return NULL;
+}
+
+}
+
+int Bish::compile_batch(const std::vector<std::string> &inputs, const std::string &outdir,
+                        const std::string &generator, unsigned jobs,
+                        const CompileOptions &options, const std::string &cache_dir) {
+    CodeGenerators::CodeGeneratorConstructor cg_constructor = CodeGenerators::get(generator);
+    if (cg_constructor == NULL) {
+        std::cerr << "No code generator " << generator << std::endl;
+        return 1;
+    }
+    if (CodeGenerators::executes(generator)) {
+        std::cerr << "The " << generator << " code generator only runs scripts, with -r." << std::endl;
+        return 1;
+    }
+    std::vector<std::string> outputs;
+    std::set<std::string> seen;
+    for (std::vector<std::string>::const_iterator I = inputs.begin(), E = inputs.end(); I != E; ++I) {
+        outputs.push_back(output_path(*I, outdir, generator));
+        if (!seen.insert(outputs.back()).second) {
+            std::cerr << "Inputs would overwrite " << outputs.back() << std::endl;
+            return 1;
+        }
+    }
+
+    BuildCache *build_cache = cache_dir.empty() ? NULL : new BuildCache(cache_dir, generator, options);
+    Batch batch(inputs, outputs, cg_constructor, options, build_cache);
+    if (jobs < 1) jobs = 1;
+    if (jobs > inputs.size()) jobs = inputs.size();
+    std::vector<pthread_t> threads(jobs);
+    unsigned started = 0;
+    for (; started < jobs; started++) {
+        if (pthread_create(&threads[started], NULL, &compile_worker, &batch) != 0) break;
+    }
+    if (started == 0) {
+        // Fall back to compiling on this thread.
+        compile_worker(&batch);
+    }
+    for (unsigned i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    delete build_cache;
+    return batch.failed ? 1 : 0;
+}
@@ -0,0 +1,23 @@
+#ifndef __BISH_BATCH_H__
+#define __BISH_BATCH_H__
+
+#include <string>
+#include <vector>
+#include "Compile.h"
+
+namespace Bish {
+
+// Compile each of the given input files into the directory 'outdir',
+// using 'jobs' threads. Each output file is named after its input,
+// with the '.bish' extension replaced by the code generator name. The
+// standard library and imported modules are parsed once and shared by
+// all compilations. With a 'cache_dir', scripts are kept in and reused
+// from a BuildCache there. Return nonzero on error.
+int compile_batch(const std::vector<std::string> &inputs, const std::string &outdir,
+                  const std::string &generator, unsigned jobs,
+                  const CompileOptions &options=CompileOptions(),
+                  const std::string &cache_dir=std::string());
+
+}
+
+#endif
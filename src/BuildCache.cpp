@@ -0,0 +1,120 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <set>
+#include <sstream>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "BuildCache.h"
+#include "Config.h"
+#include "Util.h"
+
+using namespace Bish;
+
+namespace {
+
+const char *const header = "bish-cache 1";
+
+// Return the absolute form of the given path, or the path itself if it
+// does not exist.
+std::string module_key(const std::string &path) {
+    std::string key = abspath(path);
+    return key.empty() ? path : key;
+}
+
+}
+
+BuildCache::BuildCache(const std::string &d, const std::string &generator,
+                       const CompileOptions &options) : dir(d) {
+    // The compiler itself is identified by the version of its
+    // executable, where the system lets us find it.
+    std::ostringstream s;
+    s << BISH_VERSION << " " << file_stamp("/proc/self/exe") << " " << generator
+      << " target " << options.target() << (options.profile() ? " profile" : "")
+      << (options.compact() ? " compact" : "");
+    key = s.str();
+}
+
+std::string BuildCache::entry_path(const std::string &module) const {
+    return dir + "/" + hash_string(module_key(module) + "\n" + key);
+}
+
+// Set 'script' to the cached script of the module at the given path,
+// and return true, if neither it nor any module it was compiled with
+// has changed. A module whose file was written without changing its
+// contents is still up to date.
+bool BuildCache::fetch(const std::string &path, std::string &script) const {
+    std::ifstream in(entry_path(path).c_str(), std::ios::binary);
+    std::string line;
+    if (!in || !std::getline(in, line) || line != header) return false;
+    if (!std::getline(in, line) || line != "key " + key) return false;
+    if (!std::getline(in, line) || line != "module " + module_key(path)) return false;
+    while (std::getline(in, line) && line.compare(0, 4, "dep ") == 0) {
+        // dep <stamp> <hash> <path>
+        std::string::size_type stamp_end = line.find(' ', 4);
+        if (stamp_end == std::string::npos) return false;
+        std::string::size_type hash_end = line.find(' ', stamp_end + 1);
+        if (hash_end == std::string::npos) return false;
+        const std::string stamp = line.substr(4, stamp_end - 4);
+        const std::string hash = line.substr(stamp_end + 1, hash_end - stamp_end - 1);
+        const std::string dep = line.substr(hash_end + 1);
+        const std::string current = file_stamp(dep);
+        if (current.empty()) return false;
+        if (current != stamp && file_hash(dep) != hash) return false;
+    }
+    if (line.compare(0, 7, "script ") != 0) return false;
+    const std::string::size_type length = convert_string<std::string::size_type>(line.substr(7));
+    script.resize(length);
+    if (length > 0 && !in.read(&script[0], length)) return false;
+    return true;
+}
+
+// Record the given script as compiled from the module at the given
+// path, the modules it imports and the standard library. Failing to
+// write the entry only makes the next compilation slower, so errors
+// are ignored.
+void BuildCache::store(const std::string &path, ModuleCache *cache,
+                       const std::string &script) const {
+    const std::string module = module_key(path);
+    const std::string stdlib = get_stdlib_path();
+    std::vector<std::string> deps(1, module);
+    std::vector<std::string> imports = cache->imports(module);
+    deps.insert(deps.end(), imports.begin(), imports.end());
+    deps.push_back(stdlib);
+    imports = cache->imports(stdlib);
+    deps.insert(deps.end(), imports.begin(), imports.end());
+
+    std::ostringstream entry;
+    entry << header << "\n" << "key " << key << "\n" << "module " << module << "\n";
+    std::set<std::string> seen;
+    for (std::vector<std::string>::const_iterator I = deps.begin(), E = deps.end(); I != E; ++I) {
+        if (!seen.insert(*I).second) continue;
+        // The stamp is read before the contents, so that a change made
+        // while hashing shows as a new stamp.
+        const std::string stamp = file_stamp(*I);
+        const std::string hash = file_hash(*I);
+        if (stamp.empty() || hash.empty() || I->find('\n') != std::string::npos) return;
+        entry << "dep " << stamp << " " << hash << " " << *I << "\n";
+    }
+    entry << "script " << script.size() << "\n" << script;
+
+    if (mkdir(dir.c_str(), 0777) < 0 && errno != EEXIST) return;
+    std::string tmp = dir + "/tmp.XXXXXX";
+    std::vector<char> name(tmp.begin(), tmp.end());
+    name.push_back('\0');
+    int fd = mkstemp(&name[0]);
+    if (fd < 0) return;
+    close(fd);
+    tmp = &name[0];
+    {
+        std::ofstream out(tmp.c_str(), std::ios::binary);
+        out << entry.str();
+        out.close();
+        if (!out) {
+            unlink(tmp.c_str());
+            return;
+        }
+    }
+    if (rename(tmp.c_str(), entry_path(path).c_str()) < 0) unlink(tmp.c_str());
+}
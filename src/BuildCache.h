@@ -0,0 +1,48 @@
+#ifndef __BISH_BUILD_CACHE_H__
+#define __BISH_BUILD_CACHE_H__
+
+#include <string>
+#include <utility>
+#include <vector>
+#include "Compile.h"
+#include "ModuleCache.h"
+
+namespace Bish {
+
+/* Cache of compiled scripts in a directory, kept across runs of the
+ * compiler (see --cache). The entry of a module records the script
+ * compiled from it, and the path and content hash of every module in
+ * its import graph, including itself and the standard library. It is
+ * used while none of those modules has changed, without parsing any
+ * of them.
+ *
+ * Link-time passes (inlining, constant propagation, dead code
+ * removal) work on the whole program, so the script of a module is
+ * only valid for the exact set of modules it was compiled with, and
+ * is cached as a whole rather than function by function.
+ *
+ * Entries are keyed by the path of the module, the code generator,
+ * the compile options and the version of the compiler. They are
+ * replaced atomically, so several compilers may share a cache. */
+class BuildCache {
+public:
+    BuildCache(const std::string &dir, const std::string &generator,
+               const CompileOptions &options);
+    // Set 'script' to the cached script of the module at the given
+    // path, and return true, if it is up to date.
+    bool fetch(const std::string &path, std::string &script) const;
+    // Record the script compiled from the module at the given path,
+    // which was parsed through the given module cache.
+    void store(const std::string &path, ModuleCache *cache, const std::string &script) const;
+private:
+    std::string dir;
+    // Identifies the code generator, options and compiler an entry was
+    // compiled with.
+    std::string key;
+
+    std::string entry_path(const std::string &module) const;
+};
+
+}
+
+#endif
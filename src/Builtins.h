@@ -1,6 +1,7 @@
 #ifndef __BISH_BUILTINS_H__
 #define __BISH_BUILTINS_H__
 
+#include <cassert>
 #include <map>
 #include <vector>
 #include "IR.h"
@@ -11,22 +12,56 @@ class Builtins {
 public:
     Builtins() {
         add("args", Type::Array(Type::String()));
+        // The type of the array operations depends on their operands.
+        add_function("len", Intrinsic::Length, Type::Integer());
+        add_function("append", Intrinsic::Append, Type::Undef());
+        add_function("slice", Intrinsic::Slice, Type::Undef());
+        add_function("lines", Intrinsic::Lines, Type::Array(Type::String()));
+        add_function("read_file", Intrinsic::ReadFile, Type::String());
     }
 
     const std::vector<Name> &names() const { return builtin_symbols; }
-    const Type &type(const Name &n) { return *builtin_types[n]; }
+    const Type &type(const Name &n) const {
+        std::map<Name, Type*>::const_iterator I = builtin_types.find(n);
+        assert(I != builtin_types.end());
+        return *I->second;
+    }
+
+    // Return true (and the operator in 'op') if the given name refers
+    // to a builtin function.
+    bool function(const Name &n, Intrinsic::Operator &op) const {
+        std::map<Name, Intrinsic::Operator>::const_iterator I = function_ops.find(n);
+        if (I == function_ops.end()) return false;
+        op = I->second;
+        return true;
+    }
+    // The type of the value of a builtin function, or Undef if it
+    // depends on the arguments.
+    const Type &function_type(Intrinsic::Operator op) const {
+        std::map<Intrinsic::Operator, Type*>::const_iterator I = function_types.find(op);
+        assert(I != function_types.end());
+        return *I->second;
+    }
 private:
     std::vector<Name> builtin_symbols;
     std::map<Name, Type*> builtin_types;
+    std::map<Name, Intrinsic::Operator> function_ops;
+    std::map<Intrinsic::Operator, Type*> function_types;
 
     void add(const std::string &name, const Type &type) {
         Name n(name);
         builtin_symbols.push_back(n);
         builtin_types[n] = new Type(type);
     }
+
+    void add_function(const std::string &name, Intrinsic::Operator op, const Type &type) {
+        function_ops[Name(name)] = op;
+        function_types[op] = new Type(type);
+    }
 };
 
-// Singleton instance.
+// Singleton instance. It is never modified after construction, so it
+// can be used from several threads.
 static Builtins builtins;
 
 }
@@ -1,12 +1,93 @@
 #include "ByReferencePass.h"
+#include "CallGraph.h"
+#include "IRAncestorsPass.h"
 
 using namespace Bish;
 
+namespace {
+
+// Constructs the set of names of the local variables (including
+// parameters) of a function.
+class GetLocalNames : public IRVisitor {
+public:
+    GetLocalNames(Function *f) {
+        for (std::vector<Variable *>::const_iterator I = f->args.begin(), E = f->args.end(); I != E; ++I) {
+            names.insert((*I)->name.str());
+        }
+        if (f->body) f->body->accept(this);
+    }
+
+    const std::set<std::string> &locals() const { return names; }
+
+    virtual void visit(Assignment *node) {
+        add(node->location->variable);
+        IRVisitor::visit(node);
+    }
+
+    virtual void visit(ForLoop *node) {
+        add(node->variable);
+        IRVisitor::visit(node);
+    }
+private:
+    std::set<std::string> names;
+
+    void add(const Variable *v) {
+        if (!v->global) names.insert(v->name.str());
+    }
+};
+
+// Constructs the set of variables a function assigns, appends to or
+// loops over.
+class GetWrittenVariables : public IRVisitor {
+public:
+    GetWrittenVariables(Function *f) {
+        if (f->body) f->body->accept(this);
+    }
+
+    const std::set<Variable *> &written() const { return vars; }
+
+    virtual void visit(Assignment *node) {
+        vars.insert(node->location->variable);
+        IRVisitor::visit(node);
+    }
+
+    virtual void visit(ForLoop *node) {
+        vars.insert(node->variable);
+        IRVisitor::visit(node);
+    }
+
+    virtual void visit(Intrinsic *node) {
+        if (node->op == Intrinsic::Append) vars.insert(node->target->variable);
+        IRVisitor::visit(node);
+    }
+private:
+    std::set<Variable *> vars;
+};
+
+// Constructs a list of all FunctionCall nodes in a module.
+class GetAllCalls : public IRVisitor {
+public:
+    GetAllCalls(Module *m) {
+        m->accept(this);
+    }
+
+    const std::vector<FunctionCall *> &calls() const { return call_vec; }
+
+    virtual void visit(FunctionCall *call) {
+        call_vec.push_back(call);
+        IRVisitor::visit(call);
+    }
+private:
+    std::vector<FunctionCall *> call_vec;
+};
+
+}
+
 void ByReferencePass::initialize_unique_naming(Module *m) {
     unique_id = 0;
     for (Block::iterator I = m->global_variables->begin(), E = m->global_variables->end();
          I != E; ++I) {
-        if (const Assignment *A = dynamic_cast<const Assignment *>(*I)) {
+        if (const Assignment *A = dyn_cast<Assignment>(*I)) {
             used_names.insert(A->location->variable->name);
         }
     }
@@ -40,10 +121,107 @@ void ByReferencePass::visit(Module *node) {
         }
     }
 
+    if (namerefs) choose_namerefs(node);
+
     // Now visit as normal.
     IRVisitor::visit(node);
 }
 
+// Decide which array parameters can be declared as namerefs. Start by
+// assuming all of them, except those which are written, and fall back
+// to copying for any parameter with a call site that could not resolve
+// the name correctly, until no more change.
+void ByReferencePass::choose_namerefs(Module *m) {
+    IRAncestorsPass ancestors;
+    m->accept(&ancestors);
+    CallGraphBuilder cgb;
+    CallGraph cg = cgb.build(m);
+
+    // Parameters get unique names, so they can never shadow the
+    // variable they refer to (e.g. "local -n arr=arr").
+    unsigned ref_id = 0;
+    for (std::vector<Function *>::const_iterator I = m->functions.begin(), E = m->functions.end(); I != E; ++I) {
+        for (std::vector<Variable *>::const_iterator AI = (*I)->args.begin(), AE = (*I)->args.end(); AI != AE; ++AI) {
+            if ((*AI)->is_reference()) {
+                (*AI)->name = Name("_ref_" + as_string(ref_id++) + "_" + (*AI)->name.str());
+            }
+        }
+    }
+
+    // Names of the locals of each function and all functions it calls.
+    std::map<Function *, std::set<std::string> > closure_locals;
+    for (std::vector<Function *>::const_iterator I = m->functions.begin(), E = m->functions.end(); I != E; ++I) {
+        Function *f = *I;
+        std::set<std::string> &names = closure_locals[f];
+        std::vector<Function *> closure = cg.transitive_calls(f);
+        closure.push_back(f);
+        for (std::vector<Function *>::iterator CI = closure.begin(), CE = closure.end(); CI != CE; ++CI) {
+            GetLocalNames locals(*CI);
+            names.insert(locals.locals().begin(), locals.locals().end());
+        }
+        for (std::vector<Variable *>::const_iterator AI = f->args.begin(), AE = f->args.end(); AI != AE; ++AI) {
+            if ((*AI)->is_reference()) {
+                (*AI)->nameref = true;
+                (*AI)->reference->nameref = true;
+            }
+        }
+    }
+
+    // A parameter the function (or a function it passes it on to)
+    // writes is copied, so that the caller's array is unchanged.
+    std::set<Variable *> written;
+    for (std::vector<Function *>::const_iterator I = m->functions.begin(), E = m->functions.end(); I != E; ++I) {
+        GetWrittenVariables writes(*I);
+        written.insert(writes.written().begin(), writes.written().end());
+    }
+    GetAllCalls all(m);
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (std::vector<FunctionCall *>::const_iterator I = all.calls().begin(), E = all.calls().end(); I != E; ++I) {
+            FunctionCall *call = *I;
+            for (unsigned i = 0; i < call->args.size(); i++) {
+                const std::vector<IRNode *> &values = call->args[i]->values;
+                Location *loc = values.size() == 1 ? dyn_cast<Location>(values[0]) : NULL;
+                if (loc && written.count(call->function->args[i]) && !written.count(loc->variable)) {
+                    written.insert(loc->variable);
+                    changed = true;
+                }
+            }
+        }
+    }
+    for (std::set<Variable *>::iterator I = written.begin(), E = written.end(); I != E; ++I) {
+        if ((*I)->nameref) {
+            (*I)->nameref = false;
+            (*I)->reference->nameref = false;
+        }
+    }
+
+    changed = true;
+    while (changed) {
+        changed = false;
+        for (std::vector<FunctionCall *>::const_iterator I = all.calls().begin(), E = all.calls().end(); I != E; ++I) {
+            FunctionCall *call = *I;
+            Function *f = call->function;
+            for (unsigned i = 0; i < call->args.size(); i++) {
+                Variable *p = f->args[i];
+                if (!p->nameref) continue;
+                const std::vector<IRNode *> &values = call->args[i]->values;
+                Location *loc = values.size() == 1 ? dyn_cast<Location>(values[0]) : NULL;
+                // A nameref parameter passed on forwards the name it
+                // refers to, which its own callers have checked.
+                bool ok = loc && loc->is_variable() &&
+                    (loc->variable->nameref || closure_locals[f].count(loc->variable->name.str()) == 0);
+                if (!ok) {
+                    p->nameref = false;
+                    p->reference->nameref = false;
+                    changed = true;
+                }
+            }
+        }
+    }
+}
+
 void ByReferencePass::visit(FunctionCall *node) {
     IRVisitor::visit(node);
     Function *f = node->function;
@@ -12,17 +12,31 @@ namespace Bish {
  * only used for arrays, which must be passed by reference. The
  * mechanism currently used for pass-by-reference is using a unique
  * global variable to communicate between functions using the value,
- * instead of a function parameter. */
+ * instead of a function parameter.
+ *
+ * By default the global holds a copy of the array. If namerefs are
+ * enabled (bash 4.3+), it instead holds the name of the caller's
+ * array, and the parameter is declared with 'local -n', so no copy is
+ * made. Because bash resolves namerefs with dynamic scoping, array
+ * parameters are renamed uniquely, and a parameter only uses a nameref
+ * if every caller passes a variable whose name is not also a local of
+ * the callee or of any function it (transitively) calls. A parameter
+ * which the callee, or a function it passes it on to, assigns or
+ * appends to is always copied, so that the caller's array is
+ * unchanged either way. */
 class ByReferencePass : public IRVisitor {
 public:
+    ByReferencePass(bool n=false) : namerefs(n) {}
     virtual void visit(Module *);
     virtual void visit(FunctionCall *);
 private:
+    bool namerefs;
     unsigned unique_id;
     std::set<Name> used_names;
     std::map<Function *, std::map<unsigned, Variable *> > reference_vars;
     Name get_unique_name();
     void initialize_unique_naming(Module *m);
+    void choose_namerefs(Module *m);
 };
 
 }
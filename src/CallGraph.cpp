@@ -52,9 +52,9 @@ void CallGraphBuilder::visit(Function *f) {
 void CallGraphBuilder::visit(FunctionCall *call) {
     IRVisitor::visit(call);
 
-    Block *b = dynamic_cast<Block *>(call->parent());
+    Block *b = dyn_cast<Block>(call->parent());
     assert(b);
-    Function *f = dynamic_cast<Function *>(b->parent());
+    Function *f = dyn_cast<Function>(b->parent());
     // The parent of a block can be null if the block is the Module
     // global variable block. Currently, don't add function calls from
     // the global variable initializers to the callgraph.
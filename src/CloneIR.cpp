@@ -0,0 +1,226 @@
+#include <cassert>
+#include "CloneIR.h"
+
+using namespace Bish;
+
+Module *CloneIR::clone(Module *m) {
+    return clone_as<Module>(m);
+}
+
+Function *CloneIR::clone(Function *f) {
+    return clone_as<Function>(f);
+}
+
+Variable *CloneIR::clone(Variable *v) {
+    return clone_as<Variable>(v);
+}
+
+IRNode *CloneIR::clone(IRNode *n) {
+    if (n == NULL) return NULL;
+    std::map<IRNode *, IRNode *>::iterator I = clones.find(n);
+    if (I != clones.end()) return I->second;
+    result = NULL;
+    n->accept(this);
+    assert(result);
+    return result;
+}
+
+template <class T>
+T *CloneIR::clone_as(T *n) {
+    if (n == NULL) return NULL;
+    return cast<T>(clone((IRNode *)n));
+}
+
+// Return a shallow copy of the given node, detached from its
+// parent. The copy is registered before any children are cloned, so
+// that cycles (e.g. recursive calls) resolve to the copy.
+template <class T>
+T *CloneIR::copy(T *n) {
+    T *c = new T(*n);
+    c->set_parent(NULL);
+    IRDebugInfo info = c->debug_info();
+    if (info.file) {
+        // Re-intern the file name so the copy does not refer to the
+        // arena of the original.
+        std::map<const std::string *, const std::string *>::iterator I = strings.find(info.file);
+        if (I == strings.end()) {
+            I = strings.insert(std::make_pair(info.file, IRArena::intern(*info.file))).first;
+        }
+        info.file = I->second;
+        c->set_debug_info(info);
+    }
+    clones[n] = c;
+    return c;
+}
+
+InterpolatedString *CloneIR::clone(InterpolatedString *s) {
+    InterpolatedString *c = new InterpolatedString();
+    for (InterpolatedString::const_iterator I = s->begin(), E = s->end(); I != E; ++I) {
+        if ((*I).is_str()) {
+            c->push_str((*I).str());
+        } else {
+            assert((*I).is_var());
+            c->push_var(clone((*I).var()));
+        }
+    }
+    return c;
+}
+
+void CloneIR::visit(Module *node) {
+    Module *m = copy(node);
+    std::vector<Function *> functions;
+    for (std::vector<Function *>::const_iterator I = node->functions.begin(),
+             E = node->functions.end(); I != E; ++I) {
+        functions.push_back(clone(*I));
+    }
+    m->set_functions(functions);
+    m->global_variables = clone_as<Block>(node->global_variables);
+    m->main = clone(node->main);
+    result = m;
+}
+
+void CloneIR::visit(Block *node) {
+    Block *b = copy(node);
+    for (unsigned i = 0; i < b->nodes.size(); i++) {
+        b->nodes[i] = clone(node->nodes[i]);
+    }
+    result = b;
+}
+
+void CloneIR::visit(Variable *node) {
+    Variable *v = copy(node);
+    v->reference = clone(node->reference);
+    result = v;
+}
+
+void CloneIR::visit(Location *node) {
+    Location *l = copy(node);
+    l->variable = clone(node->variable);
+    l->offset = clone(node->offset);
+    result = l;
+}
+
+void CloneIR::visit(Function *node) {
+    Function *f = copy(node);
+    for (unsigned i = 0; i < f->args.size(); i++) {
+        f->args[i] = clone(node->args[i]);
+    }
+    f->body = clone_as<Block>(node->body);
+    f->return_value = clone(node->return_value);
+    result = f;
+}
+
+void CloneIR::visit(FunctionCall *node) {
+    FunctionCall *call = copy(node);
+    call->function = clone(node->function);
+    for (unsigned i = 0; i < call->args.size(); i++) {
+        call->args[i] = clone_as<Assignment>(node->args[i]);
+    }
+    result = call;
+}
+
+void CloneIR::visit(ExternCall *node) {
+    ExternCall *call = copy(node);
+    call->body = clone(node->body);
+    result = call;
+}
+
+void CloneIR::visit(Intrinsic *node) {
+    Intrinsic *i = copy(node);
+    i->target = clone_as<Location>(node->target);
+    for (unsigned j = 0; j < i->args.size(); j++) {
+        i->args[j] = clone(node->args[j]);
+    }
+    result = i;
+}
+
+void CloneIR::visit(IORedirection *node) {
+    IORedirection *ior = copy(node);
+    ior->a = clone(node->a);
+    ior->b = clone(node->b);
+    result = ior;
+}
+
+void CloneIR::visit(IfStatement *node) {
+    IfStatement *s = copy(node);
+    s->pblock = new PredicatedBlock(clone(node->pblock->condition), clone(node->pblock->body));
+    for (unsigned i = 0; i < s->elses.size(); i++) {
+        s->elses[i] = new PredicatedBlock(clone(node->elses[i]->condition),
+                                          clone(node->elses[i]->body));
+    }
+    s->elseblock = clone(node->elseblock);
+    result = s;
+}
+
+void CloneIR::visit(ImportStatement *node) {
+    result = copy(node);
+}
+
+void CloneIR::visit(ReturnStatement *node) {
+    ReturnStatement *s = copy(node);
+    s->value = clone(node->value);
+    result = s;
+}
+
+void CloneIR::visit(LoopControlStatement *node) {
+    result = copy(node);
+}
+
+void CloneIR::visit(ForLoop *node) {
+    ForLoop *loop = copy(node);
+    loop->variable = clone(node->variable);
+    loop->lower = clone(node->lower);
+    loop->upper = clone(node->upper);
+    loop->limit = clone(node->limit);
+    loop->body = clone(node->body);
+    result = loop;
+}
+
+void CloneIR::visit(Assignment *node) {
+    Assignment *a = copy(node);
+    a->location = clone_as<Location>(node->location);
+    for (unsigned i = 0; i < a->values.size(); i++) {
+        a->values[i] = clone(node->values[i]);
+    }
+    result = a;
+}
+
+void CloneIR::visit(BinOp *node) {
+    BinOp *op = copy(node);
+    op->a = clone(node->a);
+    op->b = clone(node->b);
+    result = op;
+}
+
+void CloneIR::visit(UnaryOp *node) {
+    UnaryOp *op = copy(node);
+    op->a = clone(node->a);
+    result = op;
+}
+
+void CloneIR::visit(Integer *node) {
+    result = copy(node);
+}
+
+void CloneIR::visit(Fractional *node) {
+    result = copy(node);
+}
+
+void CloneIR::visit(String *node) {
+    String *s = copy(node);
+    s->value = clone(node->value);
+    result = s;
+}
+
+void CloneIR::visit(Boolean *node) {
+    result = copy(node);
+}
+
+void CloneIR::visit(MapLiteral *node) {
+    MapLiteral *m = copy(node);
+    for (unsigned i = 0; i < m->keys.size(); i++) {
+        m->keys[i] = clone(node->keys[i]);
+        m->values[i] = clone(node->values[i]);
+    }
+    result = m;
+}
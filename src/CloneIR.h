@@ -0,0 +1,63 @@
+#ifndef __BISH_CLONE_IR_H__
+#define __BISH_CLONE_IR_H__
+
+#include <map>
+#include "IR.h"
+#include "IRVisitor.h"
+
+namespace Bish {
+
+// Produces deep copies of IR. Each node is copied exactly once per
+// CloneIR instance, so nodes shared in the original (e.g. a Function
+// and its callers, a Variable and its uses, or a function argument
+// assignment that is both a statement and a FunctionCall argument)
+// are shared in the copy as well. Parent links are not copied: run
+// IRAncestorsPass over the result. The copy is allocated in the
+// current IRArena, and does not refer to memory of the original.
+// Example:
+//     CloneIR cloner;
+//     Module *copy = cloner.clone(m);
+class CloneIR : public IRVisitor {
+public:
+    Module *clone(Module *m);
+    Function *clone(Function *f);
+    Variable *clone(Variable *v);
+    IRNode *clone(IRNode *n);
+    // Use 'to' in place of a copy of 'from', e.g. to keep referring to
+    // a Function instead of copying it.
+    void map(IRNode *from, IRNode *to) { clones[from] = to; }
+
+    virtual void visit(Module *);
+    virtual void visit(Block *);
+    virtual void visit(Variable *);
+    virtual void visit(Location *);
+    virtual void visit(Function *);
+    virtual void visit(FunctionCall *);
+    virtual void visit(ExternCall *);
+    virtual void visit(Intrinsic *);
+    virtual void visit(IORedirection *);
+    virtual void visit(IfStatement *);
+    virtual void visit(ImportStatement *);
+    virtual void visit(ReturnStatement *);
+    virtual void visit(LoopControlStatement *);
+    virtual void visit(ForLoop *);
+    virtual void visit(Assignment *);
+    virtual void visit(BinOp *);
+    virtual void visit(UnaryOp *);
+    virtual void visit(Integer *);
+    virtual void visit(Fractional *);
+    virtual void visit(String *);
+    virtual void visit(Boolean *);
+    virtual void visit(MapLiteral *);
+private:
+    IRNode *result;
+    std::map<IRNode *, IRNode *> clones;
+    std::map<const std::string *, const std::string *> strings;
+    InterpolatedString *clone(InterpolatedString *s);
+    template <class T> T *clone_as(T *n);
+    template <class T> T *copy(T *n);
+};
+
+}
+
+#endif
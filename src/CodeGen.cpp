@@ -1,5 +1,8 @@
+#include <pthread.h>
 #include "CodeGen.h"
 #include "CodeGen_Bash.h"
+#include "CodeGen_Sh.h"
+#include "Interpreter.h"
 
 using namespace Bish;
 
@@ -10,12 +13,25 @@ static CodeGenerator* create_instance(std::ostream &os) {
 
 CodeGenerators::CodeGeneratorsMap CodeGenerators::generator_map;
 
-void CodeGenerators::initialize() {
+namespace {
+pthread_once_t generators_once = PTHREAD_ONCE_INIT;
+}
+
+void CodeGenerators::register_all() {
     /*
       We are saving a function pointer which will construct
       the actual code generator object when needed.
     */
     generator_map["bash"] = &create_instance<CodeGen_Bash>;
+    generator_map["sh"] = &create_instance<CodeGen_Sh>;
+    generator_map["dash"] = &create_instance<CodeGen_Sh>;
+    generator_map["interp"] = &create_instance<Interpreter>;
+}
+
+// Register all code generators. The map is only modified here, once,
+// so it can be read from several threads afterwards.
+void CodeGenerators::initialize() {
+    pthread_once(&generators_once, &register_all);
 }
 
 const CodeGenerators::CodeGeneratorsMap& CodeGenerators::all() {
@@ -29,3 +45,12 @@ CodeGenerators::CodeGeneratorConstructor CodeGenerators::get(const std::string &
     }
     return it->second;
 }
+
+bool CodeGenerators::executes(const std::string &name) {
+    CodeGeneratorConstructor constructor = get(name);
+    if (constructor == NULL) return false;
+    CodeGenerator *cg = constructor(std::cout);
+    const bool result = cg->executes();
+    delete cg;
+    return result;
+}
@@ -3,14 +3,28 @@
 
 #include <iostream>
 #include <map>
+#include <string>
+#include <vector>
 #include "IRVisitor.h"
 
 namespace Bish {
 
+class CompileOptions;
+
 class CodeGenerator : public IRVisitor {
 public:
     CodeGenerator(std::ostream &os): stream(os) {}
     std::ostream &ostream() { return stream; }
+    // Called with the options of a compilation before it is emitted.
+    virtual void set_options(const CompileOptions &options) {}
+    // The interpreter of the emitted script, for its '#!' line.
+    virtual std::string interpreter() const = 0;
+    // True if visiting a module runs it instead of emitting a script,
+    // in which case it is run with the arguments given to set_args,
+    // and status() is its exit status.
+    virtual bool executes() const { return false; }
+    virtual void set_args(const std::vector<std::string> &args) {}
+    virtual int status() const { return 0; }
 
 protected:
     std::ostream &stream;
@@ -25,8 +39,12 @@ public:
     static void initialize();
     static const CodeGeneratorsMap &all();
     static CodeGeneratorConstructor get(const std::string &name);
+    // True if the named code generator runs modules instead of
+    // emitting scripts.
+    static bool executes(const std::string &name);
 private:
     static CodeGeneratorsMap generator_map;
+    static void register_all();
 };
 
 }
@@ -1,9 +1,264 @@
+#include <algorithm>
 #include <cassert>
+#include <cmath>
+#include <cstring>
+#include <sstream>
 #include "CodeGen_Bash.h"
+#include "Compile.h"
 
 using namespace Bish;
 
+namespace {
+
+// Counts the commands a statement runs in a forked process: external
+// commands and the function calls of pipelines. The statements of
+// nested blocks are counted by themselves.
+// Return true if the given command is a single bash builtin, which
+// does not fork unless its output is captured or piped.
+bool is_simple_builtin(InterpolatedString *s) {
+    static const char *builtins[] = {
+        "echo", "printf", ":", "true", "false", "test", "[", "cd", "pwd", "read", "export",
+        "unset", "shift", "set", "kill", "wait", "umask", NULL
+    };
+    InterpolatedString::const_iterator I = s->begin(), E = s->end();
+    if (I == E || !(*I).is_str()) return false;
+    const std::string &first = (*I).str();
+    const std::string word = first.substr(0, first.find(' '));
+    bool builtin = false;
+    for (int i = 0; builtins[i] && !builtin; i++) builtin = word == builtins[i];
+    if (!builtin) return false;
+    // Pipelines, lists and substitutions fork.
+    for (; I != E; ++I) {
+        if ((*I).is_str() && (*I).str().find_first_of("|&;()`\n") != std::string::npos) return false;
+    }
+    return true;
+}
+
+class CountForks : public IRVisitor {
+public:
+    unsigned count;
+    CountForks(IRNode *stmt) : count(0), command(stmt) {
+        // A command which is a statement of its own runs in the shell,
+        // also when its output is redirected to a file.
+        IORedirection *r;
+        while ((r = dyn_cast<IORedirection>(command)) && r->op != IORedirection::Pipe) command = r->a;
+        stmt->accept(this);
+    }
+
+    virtual void visit(Block *) {}
+
+    virtual void visit(ExternCall *node) {
+        // "echo $?" is emitted as "$?".
+        if (node->persistent || CodeGen_Bash::is_echo_status(node->body)) return;
+        if (node == command && is_simple_builtin(node->body)) return;
+        count++;
+    }
+
+    virtual void visit(IORedirection *node) {
+        if (node->op == IORedirection::Pipe) {
+            if (dyn_cast<FunctionCall>(node->a)) count++;
+            if (dyn_cast<FunctionCall>(node->b)) count++;
+        }
+        IRVisitor::visit(node);
+    }
+private:
+    IRNode *command;
+};
+
+// Return true if the given string starts with the value of the given
+// variable.
+bool starts_with_variable(InterpolatedString *s, const Variable *v) {
+    InterpolatedString::const_iterator I = s->begin();
+    return I != s->end() && (*I).is_var() && (*I).var() == v;
+}
+
+// Collects the loops of a module.
+class FindLoops : public IRVisitor {
+public:
+    std::vector<ForLoop *> loops;
+
+    virtual void visit(ForLoop *node) {
+        loops.push_back(node);
+        IRVisitor::visit(node);
+    }
+};
+
+// Collects the global variables holding maps, and those holding
+// integers.
+class FindGlobalDeclarations : public IRVisitor {
+public:
+    std::set<Variable *> maps, integers;
+
+    virtual void visit(Assignment *node) {
+        Variable *v = node->location->variable;
+        if (v->global && v->type().map()) maps.insert(v);
+        if (v->global && v->type().integer() && !v->nameref) integers.insert(v);
+        IRVisitor::visit(node);
+    }
+};
+
+// Return true if the given name was generated by a compiler pass
+// (e.g. _0, _global_retval_0, _ref_0_values or _inline0__1).
+bool is_temporary(const std::string &name) {
+    const char *prefixes[] = { "_global_retval_", "_global_ref_", "_ref_", "_rv_", "_tail_",
+                               "_licm", "_inline" };
+    for (unsigned i = 0; i < sizeof(prefixes) / sizeof(prefixes[0]); i++) {
+        if (name.compare(0, std::strlen(prefixes[i]), prefixes[i]) == 0) return true;
+    }
+    return name.size() > 1 && name[0] == '_' &&
+        name.find_first_not_of("0123456789", 1) == std::string::npos;
+}
+
+// Return the given number as a name of the form _a, _b, ..., _z, _aa,
+// _ab, ...
+std::string short_name(unsigned n) {
+    std::string letters;
+    for (n++; n > 0; n = (n - 1) / 26) {
+        letters.insert(letters.begin(), (char)('a' + (n - 1) % 26));
+    }
+    return "_" + letters;
+}
+
+// Renames the temporary variables of a module to the shortest names
+// used by no other variable, in the given scope. Variables of the same
+// name are the same bash variable, so they get the same new name.
+class ShortenTemporaries : public IRVisitor {
+public:
+    ShortenTemporaries(Module *m, LetScope &scope) {
+        m->accept(this);
+        std::map<std::string, std::string> renamed;
+        unsigned next = 0;
+        for (std::vector<Variable *>::const_iterator I = variables.begin(), E = variables.end(); I != E; ++I) {
+            const std::string name = (*I)->name.str();
+            if (!is_temporary(name)) continue;
+            std::map<std::string, std::string>::iterator R = renamed.find(name);
+            if (R == renamed.end()) {
+                std::string candidate = short_name(next);
+                while (names.count(candidate)) candidate = short_name(++next);
+                if (candidate.size() < name.size()) {
+                    next++;
+                } else {
+                    candidate = name;
+                }
+                R = renamed.insert(std::make_pair(name, candidate)).first;
+            }
+            scope.add(*I, R->second);
+        }
+    }
+
+    virtual void visit(Variable *node) {
+        if (visited(node)) return;
+        visited_set.insert(node);
+        variables.push_back(node);
+        names.insert(node->name.str());
+        if (node->reference) node->reference->accept(this);
+    }
+
+    virtual void visit(Function *node) {
+        if (node->return_value) node->return_value->accept(this);
+        IRVisitor::visit(node);
+    }
+
+    virtual void visit(ExternCall *node) {
+        add_variables(node->body);
+        IRVisitor::visit(node);
+    }
+
+    virtual void visit(String *node) {
+        add_variables(node->value);
+        IRVisitor::visit(node);
+    }
+private:
+    std::vector<Variable *> variables;
+    std::set<std::string> names;
+
+    void add_variables(InterpolatedString *s) {
+        for (InterpolatedString::const_iterator I = s->begin(), E = s->end(); I != E; ++I) {
+            if ((*I).is_var()) (*I).var()->accept(this);
+        }
+    }
+};
+
+// Return the operator of the given arithmetic operation in bash, or
+// NULL if it is not arithmetic.
+const char *arithmetic_operator(BinOp::Operator op) {
+    switch (op) {
+    case BinOp::Add: return "+";
+    case BinOp::Sub: return "-";
+    case BinOp::Mul: return "*";
+    case BinOp::Div: return "/";
+    case BinOp::Mod: return "%";
+    default: return NULL;
+    }
+}
+
+// Collects the local integer variables assigned in a function body,
+// other than its arguments.
+class FindIntegerLocals : public IRVisitor {
+public:
+    std::set<Variable *> variables;
+
+    FindIntegerLocals(Function *f) : function(f) {
+        f->body->accept(this);
+    }
+
+    virtual void visit(Assignment *node) {
+        Variable *v = node->location->variable;
+        if (!v->global && v->type().integer() && !v->nameref &&
+            std::find(function->args.begin(), function->args.end(), v) == function->args.end()) {
+            variables.insert(v);
+        }
+        IRVisitor::visit(node);
+    }
+private:
+    Function *function;
+};
+
+// Return true if the given assignment stores integer arithmetic in a
+// variable.
+bool arithmetic_assignment(const Assignment *n) {
+    if (!n->location->is_variable() || n->values.size() != 1) return false;
+    const Variable *v = n->location->variable;
+    if (!v->type().integer() || v->nameref) return false;
+    const IRNode *value = n->values[0];
+    if (!value->type().integer()) return false;
+    if (const BinOp *b = dyn_cast<BinOp>(value)) return arithmetic_operator(b->op) != NULL;
+    const UnaryOp *u = dyn_cast<UnaryOp>(value);
+    return u && u->op == UnaryOp::Negate;
+}
+
+// Return the given string as a single-quoted shell word.
+std::string single_quote(const std::string &s) {
+    std::string result = "'";
+    for (unsigned i = 0; i < s.size(); i++) {
+        if (s[i] == '\'') {
+            result += "'\\''";
+        } else {
+            result += s[i];
+        }
+    }
+    return result + "'";
+}
+
+// Return the source location "file:line" for the profile.
+std::string profile_location(const IRDebugInfo &info, const std::string &path) {
+    std::string file = info.file ? *info.file : path;
+    if (info.lineno == 0) return file;
+    std::ostringstream s;
+    s << file << ":" << info.lineno;
+    return s.str();
+}
+
+}
+
+void CodeGen_Bash::set_options(const CompileOptions &options) {
+    wait_any = options.target_at_least(4, 3);
+    profile = options.profile();
+    compact = options.compact();
+}
+
 void CodeGen_Bash::indent() {
+    if (compact) return;
     for (unsigned i = 0; i < indent_level; i++) {
         stream << "    ";
     }
@@ -12,7 +267,7 @@ void CodeGen_Bash::indent() {
 // Return true if the given node is a statement that should be
 // emitted. This excludes side-effecting statements like 'import'.
 bool CodeGen_Bash::should_emit_statement(const IRNode *node) const {
-    return dynamic_cast<const ImportStatement*>(node) == NULL;
+    return !isa<ImportStatement>(node);
 }
 
 // Return true if the given assignment node should have 'local'
@@ -22,17 +277,47 @@ bool CodeGen_Bash::should_use_local(const Assignment *n) const {
 }
 
 void CodeGen_Bash::visit(Module *n) {
+    LetScope temporaries;
+    if (compact) {
+        ShortenTemporaries shorten(n, temporaries);
+        push_let_scope(&temporaries);
+    }
+    scales = new FractionalScales(n);
+    output_fractional_helpers();
+    output_persistent_helpers(n);
+    if (profile) output_profile_helpers();
+    // Global maps and integers are declared before any function uses
+    // them.
+    output_global_declarations(n);
     // Define the functions first.
+    for (std::vector<Function *>::const_iterator I = n->functions.begin(),
+             E = n->functions.end(); I != E; ++I) {
+        if (profile && (*I)->body) {
+            unsigned id = profile_functions.size();
+            profile_functions[*I] = id;
+        }
+    }
+    if (profile) {
+        // Loops are numbered first, as the tables are defined before
+        // the global statements are emitted.
+        FindLoops finder;
+        n->accept(&finder);
+        for (unsigned i = 0; i < finder.loops.size(); i++) {
+            profile_loops[finder.loops[i]] = i;
+        }
+    }
     for (std::vector<Function *>::const_iterator I = n->functions.begin(),
              E = n->functions.end(); I != E; ++I) {
         (*I)->accept(this);
     }
-    // Special case for command-line arguments. TODO: tie this into Builtins somehow.
-    stream << "args=( \"$0\" \"$@\" );\n";
+    if (profile) output_profile_tables(n);
+    output_args();
     // Global variables next.
-    disable_use_local();
-    n->global_variables->accept(this);
-    reset_use_local();
+    if (!compact || !n->global_variables->nodes.empty()) {
+        disable_use_local();
+        n->global_variables->accept(this);
+        reset_use_local();
+    }
 
     // Insert a call to bish_main().
     assert(n->main);
@@ -40,6 +325,9 @@ void CodeGen_Bash::visit(Module *n) {
     visit(call_main);
     stream << ";\n";
     delete call_main;
+    delete scales;
+    scales = NULL;
+    if (compact) pop_let_scope();
 }
 
 void CodeGen_Bash::visit(Block *n) {
@@ -52,7 +340,13 @@ void CodeGen_Bash::visit(Block *n) {
         unsigned i = 1;
         for (std::vector<Variable *>::const_iterator I = f->args.begin(), E = f->args.end(); I != E; ++I) {
             indent();
-            stream << "local " << (*I)->name.str() << "=";
+            declared_locals.insert(*I);
+            if ((*I)->nameref) {
+                stream << "local -n " << lookup_name(*I) << "=\"${" <<
+                    lookup_name((*I)->reference) << "}\";\n";
+                continue;
+            }
+            stream << "local " << lookup_name(*I) << "=";
             if ((*I)->is_reference()) {
                 bool array = (*I)->type().array();
                 if (array) stream << "( ";
@@ -63,14 +357,31 @@ void CodeGen_Bash::visit(Block *n) {
                 stream << "\"${" << i++ << "}\";\n";
             }
         }
+        output_integer_locals(f);
+        if (f->memo) output_memo_lookup(f);
     }
 
     for (std::vector<IRNode *>::const_iterator I = n->nodes.begin(), E = n->nodes.end();
          I != E; ++I) {
         if (should_emit_statement(*I)) {
+            if (profile && profile_function >= 0) {
+                CountForks forks(*I);
+                if (forks.count) {
+                    indent();
+                    stream << "_bish_prof_fork " << profile_function << " " << forks.count << ";\n";
+                }
+            }
             indent();
-            (*I)->accept(this);
-            if (!dynamic_cast<Block *>(*I)) {
+            output_fractional_temps(*I);
+            if (isa<IORedirection>(*I)) {
+                // The output of a command statement is not captured.
+                disable_functioncall_wrap();
+                output_command(*I);
+                reset_functioncall_wrap();
+            } else {
+                (*I)->accept(this);
+            }
+            if (!isa<Block>(*I)) {
                 stream << ";\n";
             }
         }
@@ -78,16 +389,22 @@ void CodeGen_Bash::visit(Block *n) {
     // Bash doesn't allow empty functions: must insert a call to a null command.
     if (n->nodes.empty()) {
         indent();
-        stream << ": # Empty function\n";
+        stream << (compact ? ":\n" : ": # Empty function\n");
     }
     indent_level--;
     if (should_print_block_braces()) {
         indent();
-        stream << "}\n";
+        // The jobs started by 'spawn' are waited for by wait() in
+        // stdlib.bish.
+        stream << (n->background ? "} & _bish_spawned+=( $! );\n" : "}\n");
     }
 }
 
 void CodeGen_Bash::visit(Variable *n) {
+    if (n->type().map()) {
+        output_map_keys(n);
+        return;
+    }
     if (should_quote_variable()) stream << "\"";
     bool array = n->type().array();
     stream << "${";
@@ -97,7 +414,17 @@ void CodeGen_Bash::visit(Variable *n) {
     if (should_quote_variable()) stream << "\"";
 }
 
+// A map is only used as a whole as the list of a loop, which iterates
+// over its keys. Keys are always quoted, so that each is one word.
+void CodeGen_Bash::output_map_keys(Variable *v) {
+    stream << "\"${!" << lookup_name(v) << "[@]}\"";
+}
+
 void CodeGen_Bash::visit(Location *n) {
+    if (n->is_variable() && n->variable->type().map()) {
+        output_map_keys(n->variable);
+        return;
+    }
     if (should_quote_variable()) stream << "\"";
     if (n->is_variable()) {
         bool array = n->variable->type().array();
@@ -116,11 +443,21 @@ void CodeGen_Bash::visit(Location *n) {
 
 void CodeGen_Bash::visit(ReturnStatement *n) {
     if (n->value == NULL) {
+        if (memo_function) {
+            stream << memo_table(memo_function) << "[$_bish_memo_key]=\"${" <<
+                lookup_name(memo_function->return_value) << "}\"; ";
+        }
         stream << "return";
         return;
     }
-    bool external = dynamic_cast<ExternCall*>(n->value) != NULL;
-    stream << "echo ";
+    if (is_boolean_op(n->value)) {
+        output_condition_test(n->value);
+        output_echo();
+        stream << "$(( ! $? )); exit";
+        return;
+    }
+    bool external = n->value && isa<ExternCall>(n->value);
+    output_echo();
     enable_functioncall_wrap();
     // Defensively wrap external calls in quotes in case they return
     // space-separated strings. Not sure how to handle this yet in the
@@ -144,31 +481,20 @@ void CodeGen_Bash::visit(LoopControlStatement *n) {
 }
 
 void CodeGen_Bash::visit(IfStatement *n) {
-    stream << "if [[ ";
-    // Disable comparison wrap because this is within [[ ... ]]
-    disable_comparison_wrap();
-    enable_functioncall_wrap();
-    n->pblock->condition->accept(this);
-    if (!dynamic_cast<BinOp*>(n->pblock->condition)) {
-        stream << " -eq 1";
-    }
-    reset_comparison_wrap();
-    reset_functioncall_wrap();
-    stream << " ]]; then\n";
+    stream << "if ";
+    output_fractional_temps(n->pblock->condition);
+    output_test(n->pblock->condition);
+    stream << "; then\n";
     disable_block_braces();
     n->pblock->body->accept(this);
 
     for (std::vector<PredicatedBlock *>::const_iterator I = n->elses.begin(),
              E = n->elses.end(); I != E; ++I) {
         indent();
-        stream << "elif [[ ";
-        // Disable comparison wrap because this is within [[ ... ]]
-        disable_comparison_wrap();
-        enable_functioncall_wrap();
-        (*I)->condition->accept(this);
-        reset_functioncall_wrap();
-        reset_comparison_wrap();
-        stream << " ]]; then\n";
+        stream << "elif ";
+        output_fractional_temps((*I)->condition);
+        output_test((*I)->condition);
+        stream << "; then\n";
         (*I)->body->accept(this);
     }
     if (n->elseblock) {
@@ -183,38 +509,232 @@ void CodeGen_Bash::visit(IfStatement *n) {
 }
 
 void CodeGen_Bash::visit(ForLoop *n) {
-    stream << "for " << lookup_name(n->variable) << " in ";
+    int probe = -1;
+    if (profile) {
+        probe = profile_loops[n];
+        stream << "_bish_prof_loop_start;\n";
+        indent();
+    }
+    std::string jobs;
+    if (n->parallel) {
+        // The output of each job is kept in a file of its own, and
+        // written in order once all jobs finished.
+        std::ostringstream name;
+        name << "_bish_jobs_" << parallel_count++;
+        jobs = name.str();
+        stream << jobs << "=();\n";
+        indent();
+        stream << jobs << "_dir=$(mktemp -d);\n";
+        indent();
+        stream << jobs << "_pids=();\n";
+        indent();
+    }
     if (n->upper) {
-        stream << "$(seq ";
-        n->lower->accept(this);
-        stream << " ";
-        n->upper->accept(this);
-        stream << ")";
+        output_range_loop(n);
+        stream << "; do\n";
+    } else if (n->stream) {
+        // Command output is read a line at a time while the command
+        // runs, instead of being captured and split into words. It is
+        // read from descriptor 3, so that the body keeps the standard
+        // input of the loop, and a last line without a newline is
+        // still iterated.
+        const std::string var = lookup_name(n->variable);
+        stream << "while IFS= read -r " << var << " <&3 || [[ -n \"${" << var << "}\" ]]; do\n";
     } else {
+        stream << "for " << lookup_name(n->variable) << " in ";
         disable_quote_variable();
         n->lower->accept(this);
         reset_quote_variable();
+        stream << "; do\n";
+    }
+    output_loop_body(n, jobs, probe);
+    indent();
+    stream << "done";
+    if (n->stream) {
+        stream << " 3< <(";
+        disable_functioncall_wrap();
+        output_command(n->lower);
+        reset_functioncall_wrap();
+        stream << ")";
+    }
+    if (n->parallel) {
+        // A plain 'wait' would also wait for coprocesses. Jobs already
+        // waited for to free a slot are no longer known to bash.
+        stream << ";\n";
+        indent();
+        stream << "for _bish_pid in \"${" << jobs << "_pids[@]}\"; do wait \"${_bish_pid}\" 2>/dev/null; done;\n";
+        indent();
+        stream << "cat /dev/null \"${" << jobs << "[@]}\";\n";
+        indent();
+        stream << "rm -r \"${" << jobs << "_dir}\"";
+    }
+    if (probe >= 0) {
+        stream << ";\n";
+        indent();
+        stream << "_bish_prof_loop_end " << probe;
+    }
+}
+
+// Emit the header of the given loop over a range. Ranges are iterated
+// with an arithmetic loop, so that the range is never materialized as
+// a list of words. The upper bound is evaluated once, when the loop
+// starts, as the body may change it.
+void CodeGen_Bash::output_range_loop(ForLoop *n) {
+    const std::string var = lookup_name(n->variable);
+    const std::string bound = output_range_bound(n);
+    disable_quote_variable();
+    stream << "for (( " << var << " = ";
+    n->lower->accept(this);
+    if (!bound.empty()) {
+        stream << ", " << bound << " = ";
+        n->upper->accept(this);
+    }
+    stream << "; " << var << " <= ";
+    if (bound.empty()) {
+        n->upper->accept(this);
+    } else {
+        stream << bound;
+    }
+    stream << "; " << var << "++ ))";
+    reset_quote_variable();
+}
+
+// Return the name of the variable holding the upper bound of the given
+// loop over a range, declaring it local in a function, or the empty
+// string if the bound is a constant.
+std::string CodeGen_Bash::output_range_bound(ForLoop *n) {
+    if (isa<Integer>(n->upper)) return "";
+    std::ostringstream name;
+    name << "_bish_end_" << range_bound_count++;
+    if (use_local.top()) stream << "local " << name.str() << "; ";
+    return name.str();
+}
+
+// Emit the body of the given loop. The body of a parallel loop is
+// started as a background job, once fewer than its limit of jobs
+// are running.
+void CodeGen_Bash::output_loop_body(ForLoop *n, const std::string &jobs, int probe) {
+    if (probe >= 0) {
+        indent_level++;
+        indent();
+        stream << "_bish_prof_iter " << probe << ";\n";
+        indent_level--;
     }
-    stream << "; do\n";
     disable_block_braces();
+    if (!n->parallel) {
+        n->body->accept(this);
+        reset_block_braces();
+        return;
+    }
+    const std::string count = "${#" + jobs + "[@]}";
+    indent_level++;
+    if (n->limit) {
+        indent();
+        disable_quote_variable();
+        stream << "if (( " << count << " >= ";
+        n->limit->accept(this);
+        stream << " )); then wait";
+        if (wait_any) {
+            stream << " -n";
+        } else {
+            // Without 'wait -n', wait for the job started 'limit'
+            // jobs ago.
+            stream << " \"${" << jobs << "_pids[" << count << " - ";
+            n->limit->accept(this);
+            stream << "]}\"";
+        }
+        stream << "; fi;\n";
+        reset_quote_variable();
+    }
+    indent();
+    stream << "{\n";
     n->body->accept(this);
-    reset_block_braces();
     indent();
-    stream << "done";
+    stream << "} > \"${" << jobs << "_dir}/" << count << "\" &\n";
+    indent();
+    stream << jobs << "_pids+=( $! );\n";
+    indent();
+    stream << jobs << "+=( \"${" << jobs << "_dir}/" << count << "\" );\n";
+    indent_level--;
+    reset_block_braces();
 }
 
 void CodeGen_Bash::visit(Function *n) {
-    if (n->body == NULL) return;
-    stream << "\nfunction " << function_name(n) << " ";
-    stream << "() ";
+    if (n->body == NULL || omitted(n)) return;
+    // The values of a memoized function are kept in a global table.
+    if (n->memo) stream << (compact ? "" : "\n") << "declare -A " << memo_table(n) << ";";
+    if (profile) {
+        // The function is wrapped by one recording its calls, so that
+        // every return passes the exit probe.
+        const unsigned id = profile_functions[n];
+        output_function_start(function_name(n));
+        stream << "{\n";
+        stream << "    _bish_prof_enter " << id << ";\n";
+        stream << "    _bish_prof_" << function_name(n) << " \"$@\";\n";
+        stream << "    _bish_prof_leave " << id << ";\n";
+        stream << "}\n";
+        output_function_start("_bish_prof_" + function_name(n));
+        profile_function = id;
+    } else {
+        output_function_start(function_name(n));
+    }
+    declared_locals.clear();
+    memo_function = n->memo ? n : NULL;
     push_function_args_insert(n);
     if (n->body) n->body->accept(this);
+    profile_function = -1;
+    memo_function = NULL;
+}
+
+// Emit the lookup of the arguments of the given memoized function in
+// its table, returning the value kept for them if there is one. Each
+// argument is preceded by its length in the key, so that different
+// arguments never have the same key (and it is never empty).
+void CodeGen_Bash::output_memo_lookup(const Function *f) {
+    const std::string table = memo_table(f);
+    indent();
+    stream << "local _bish_memo_key=\"";
+    if (f->args.empty()) stream << "_";
+    for (std::vector<Variable *>::const_iterator I = f->args.begin(), E = f->args.end(); I != E; ++I) {
+        const std::string name = lookup_name(*I);
+        stream << "${#" << name << "}:${" << name << "}";
+    }
+    stream << "\";\n";
+    indent();
+    stream << "if [[ -n \"${" << table << "[$_bish_memo_key]+set}\" ]]; then\n";
+    indent_level++;
+    indent();
+    stream << lookup_name(f->return_value) << "=\"${" << table << "[$_bish_memo_key]}\";\n";
+    indent();
+    stream << "return;\n";
+    indent_level--;
+    indent();
+    stream << "fi;\n";
+}
+
+void CodeGen_Bash::output_function_start(const std::string &name) {
+    if (compact) {
+        stream << name << "()";
+    } else {
+        stream << "\nfunction " << name << " () ";
+    }
+}
+
+void CodeGen_Bash::output_echo() {
+    stream << "echo ";
+}
+
+void CodeGen_Bash::output_args() {
+    // Special case for command-line arguments. TODO: tie this into Builtins somehow.
+    stream << "args=( \"$0\" \"$@\" );\n";
 }
 
 void CodeGen_Bash::visit(FunctionCall *n) {
     const int nargs = n->args.size();
     if (should_functioncall_wrap()) stream << "$(";
-    stream << function_name(n->function);
+    // The arguments of an omitted function are still expanded, as
+    // they may run commands.
+    stream << (omitted(n->function) ? ":" : function_name(n->function));
     for (int i = 0; i < nargs; i++) {
         // Variables passed by reference are communicated by a global
         // variable, not a function argument.
@@ -227,48 +747,279 @@ void CodeGen_Bash::visit(FunctionCall *n) {
     if (should_functioncall_wrap()) stream << ")";
 }
 
+// Builtin array operations are parameter expansions, so they need
+// neither a subshell nor a copy of the array. Reads of files are
+// emitted by the assignment of their value (see output_read).
+void CodeGen_Bash::visit(Intrinsic *n) {
+    assert(!n->reads_file());
+    const std::string name = lookup_name(n->target->variable);
+    const bool array = n->target->variable->type().array() || n->target->variable->type().map();
+    switch (n->op) {
+    case Intrinsic::Length:
+        stream << "${#" << name << (array ? "[@]" : "") << "}";
+        break;
+    case Intrinsic::Append:
+        stream << name << "+=( ";
+        enable_functioncall_wrap();
+        enable_quote_variable();
+        output_fractional_value(n->args[0], scales->scale(n->target->variable));
+        reset_quote_variable();
+        reset_functioncall_wrap();
+        stream << " )";
+        break;
+    case Intrinsic::Slice:
+        // The offset and length of ${x[@]:offset:length} are
+        // arithmetic expressions. The offset is parenthesized, since
+        // ${x[@]:-2} would be the default value expansion.
+        if (should_quote_variable()) stream << "\"";
+        stream << "${" << name << "[@]:(";
+        disable_quote_variable();
+        n->args[0]->accept(this);
+        stream << ")";
+        if (n->args.size() > 1) {
+            stream << ":(";
+            n->args[1]->accept(this);
+            stream << ")-(";
+            n->args[0]->accept(this);
+            stream << ")";
+        }
+        reset_quote_variable();
+        stream << "}";
+        if (should_quote_variable()) stream << "\"";
+        break;
+    default:
+        assert(false && "Unknown intrinsic");
+    }
+}
+
+// Emit the read of a file into the given variable with builtins,
+// without the subshell of a command substitution. Like '$(<path)',
+// read_file() drops the trailing newlines: the innermost expansion is
+// what follows the last other character. The variable is cleared
+// first, so that it is empty if the file can not be opened.
+void CodeGen_Bash::output_read(Variable *v, Intrinsic *read) {
+    const std::string name = lookup_name(v);
+    if (read->op == Intrinsic::Lines) {
+        stream << name << "=(); mapfile -t " << name << " < ";
+    } else {
+        stream << name << "=''; IFS= read -r -d '' " << name << " < ";
+    }
+    enable_quote_variable();
+    enable_functioncall_wrap();
+    read->args[0]->accept(this);
+    reset_functioncall_wrap();
+    reset_quote_variable();
+    if (read->op == Intrinsic::ReadFile) {
+        stream << "; " << name << "=${" << name << "%${" << name << "##*[!$'\\n']}}";
+    }
+}
+
 void CodeGen_Bash::visit(ExternCall *n) {
+    if (should_functioncall_wrap() && is_echo_status(n->body)) {
+        // $(echo $?) is just $?, without the subshell.
+        stream << "$?";
+        return;
+    }
     if (should_functioncall_wrap()) stream << "$(";
-    disable_quote_variable();
-    output_interpolated_string(n->body);
-    reset_quote_variable();
+    output_interpolated_string(n->body->begin(), n->body->end());
     if (should_functioncall_wrap()) stream << ")";
 }
 
-void CodeGen_Bash::output_interpolated_string(InterpolatedString *n) {
-    for (InterpolatedString::const_iterator I = n->begin(), E = n->end();
-         I != E; ++I) {
+// Emit the given items of an interpolated string. Its variables are
+// expanded unquoted, as the whole string is quoted if necessary.
+void CodeGen_Bash::output_interpolated_string(InterpolatedString::const_iterator I,
+                                              InterpolatedString::const_iterator E) {
+    for (; I != E; ++I) {
         if ((*I).is_str()) {
             stream << (*I).str();
         } else {
             assert((*I).is_var());
-            visit((*I).var());
+            Variable *v = (*I).var();
+            stream << "${" << lookup_name(v) << (v->type().array() ? "[@]" : "") << "}";
         }
     }
 }
 
 void CodeGen_Bash::visit(IORedirection *n) {
+    disable_functioncall_wrap();
+    if (is_persistent(n->b)) {
+        // Outside of an assignment, the command is run as usual.
+        stream << "$(printf '%s\\n' ";
+        enable_quote_variable();
+        enable_functioncall_wrap();
+        n->a->accept(this);
+        reset_functioncall_wrap();
+        reset_quote_variable();
+        stream << " | ";
+        n->b->accept(this);
+        stream << ")";
+        reset_functioncall_wrap();
+        return;
+    }
+    stream << "$(";
+    output_command(n);
+    stream << ")";
+    reset_functioncall_wrap();
+}
+
+// Emit the given pipeline or redirection of commands. Files are
+// redirected by bash itself, so no process copies their contents.
+void CodeGen_Bash::output_command(IRNode *n) {
+    IORedirection *r = dyn_cast<IORedirection>(n);
+    if (r == NULL) {
+        output_pipeline_stage(n);
+        return;
+    }
     std::string bash_op;
-    switch (n->op) {
+    switch (r->op) {
     case IORedirection::Pipe:
-        bash_op = "|";
+        output_command(r->a);
+        stream << " | ";
+        output_command(r->b);
+        return;
+    case IORedirection::Write:
+        bash_op = ">";
+        break;
+    case IORedirection::Append:
+        bash_op = ">>";
+        break;
+    case IORedirection::Read:
+        bash_op = "<";
+        break;
+    case IORedirection::HereString:
+        bash_op = "<<<";
         break;
-    default:
-        assert(false && "Unimplemented redirection.");
     }
-
-    disable_functioncall_wrap();
-    stream << "$(";
-    n->a->accept(this);
+    // A pipeline is redirected as a whole, e.g. reading its first
+    // command's input from the file.
+    IORedirection *pipe = dyn_cast<IORedirection>(r->a);
+    bool group = pipe && pipe->op == IORedirection::Pipe;
+    if (group) stream << "{ ";
+    output_command(r->a);
+    if (group) stream << "; }";
     stream << " " << bash_op << " ";
-    n->b->accept(this);
-    stream << ")";
+    enable_quote_variable();
+    enable_functioncall_wrap();
+    r->b->accept(this);
     reset_functioncall_wrap();
+    reset_quote_variable();
+}
+
+// Emit the given node as a command of a pipeline. A function called
+// there prints its return value after returning, so that it becomes
+// the output of the stage.
+void CodeGen_Bash::output_pipeline_stage(IRNode *n) {
+    FunctionCall *call = dyn_cast<FunctionCall>(n);
+    if (call == NULL || call->function->return_value == NULL) {
+        n->accept(this);
+        return;
+    }
+    stream << "{ ";
+    call->accept(this);
+    stream << "; ";
+    output_echo();
+    stream << "\"${" << lookup_name(call->function->return_value) << "}\"; }";
 }
 
 void CodeGen_Bash::visit(Assignment *n) {
     Location *loc = n->location;
-    if (should_use_local(n)) stream << "local ";
+    // Boolean values are evaluated by a [[ ... ]] test preceding the
+    // assignment, whose exit status is then stored in the variable.
+    // This avoids forking a subshell to produce the value.
+    bool condition = n->values.size() == 1 && is_boolean_op(n->values[0]);
+    if (condition) output_condition_test(n->values[0]);
+    if (loc->variable->nameref) {
+        // Pass the name of the array to a nameref parameter. A nameref
+        // parameter is passed on as the name it refers to.
+        Location *value = dyn_cast<Location>(n->values[0]);
+        assert(value && value->is_variable());
+        stream << lookup_name(loc->variable) << "=";
+        if (value->variable->nameref) {
+            stream << "\"${!" << lookup_name(value->variable) << "}\"";
+        } else {
+            stream << lookup_name(value->variable);
+        }
+        return;
+    }
+    IORedirection *pipe = dyn_cast<IORedirection>(n->values[0]);
+    if (pipe && is_persistent(pipe->b)) {
+        if (should_use_local(n) && loc->is_variable()) {
+            stream << "local " << lookup_name(loc->variable) << "; ";
+        }
+        output_persistent_call(loc, pipe);
+        return;
+    }
+    Intrinsic *read = dyn_cast<Intrinsic>(n->values[0]);
+    if (read && read->reads_file()) {
+        if (should_use_local(n)) {
+            stream << "local " << lookup_name(loc->variable) << "; ";
+            declared_locals.insert(loc->variable);
+        }
+        output_read(loc->variable, read);
+        return;
+    }
+    const int scale = scales->scale(loc->variable);
+    if (FractionalScales::fractional(loc->variable->type()) && n->values.size() == 1 &&
+        !n->values[0]->type().array()) {
+        // Fractional arithmetic, and array elements of a different
+        // scale, are stored by a helper function.
+        IRNode *value = n->values[0];
+        Location *copy = dyn_cast<Location>(value);
+        if (FractionalScales::arithmetic(value) ||
+            (copy && scale != FractionalScales::Unknown && scales->scale(copy) != scale)) {
+            if (should_use_local(n) && loc->is_variable()) {
+                stream << "local " << lookup_name(loc->variable) << "; ";
+            }
+            output_fractional_store(loc, value, scale);
+            return;
+        }
+    }
+    if (MapLiteral *map = dyn_cast<MapLiteral>(n->values[0])) {
+        // A local map is declared as an associative array here, and a
+        // global one before the global variables (see
+        // output_global_declarations).
+        if (should_use_local(n)) {
+            stream << "local -A ";
+            declared_locals.insert(loc->variable);
+        }
+        stream << lookup_name(loc->variable) << "=";
+        map->accept(this);
+        return;
+    }
+    if (loc->is_array_ref() && loc->variable->type().map()) {
+        // 'local' would declare an indexed array instead.
+        stream << lookup_name(loc->variable) << "[";
+        loc->offset->accept(this);
+        stream << "]=";
+        enable_functioncall_wrap();
+        n->values[0]->accept(this);
+        reset_functioncall_wrap();
+        return;
+    }
+    // Integer variables are declared before the global variables, and
+    // when their function starts (see output_global_declarations and
+    // output_integer_locals).
+    const bool declared_integer = loc->is_variable() && integer_variables.count(loc->variable);
+    if (declared_integer && arithmetic_assignment(n)) {
+        output_arithmetic_assignment(n);
+        return;
+    }
+    String *str = n->values.size() == 1 ? dyn_cast<String>(n->values[0]) : NULL;
+    if (append_in_place && str && loc->is_variable() && loc->variable->type().string() &&
+        starts_with_variable(str->value, loc->variable) &&
+        (!should_use_local(n) || declared_locals.count(loc->variable))) {
+        // Appending to a string in place copies only the appended
+        // text, so building a string in a loop takes linear time. A
+        // variable not yet local to the function may be the caller's.
+        stream << lookup_name(loc->variable) << "+=\"";
+        output_interpolated_string(str->value->begin() + 1, str->value->end());
+        stream << "\"";
+        return;
+    }
+    if (should_use_local(n) && !declared_integer) {
+        stream << "local ";
+        if (loc->is_variable()) declared_locals.insert(loc->variable);
+    }
     if (loc->is_variable()) {
         stream << lookup_name(loc->variable) << "=";
     } else {
@@ -277,13 +1028,17 @@ void CodeGen_Bash::visit(Assignment *n) {
         loc->offset->accept(this);
         stream << "]=";
     }
+    if (condition) {
+        stream << "$(( ! $? ))";
+        return;
+    }
     enable_functioncall_wrap();
     const int nvals = n->values.size();
     assert(nvals > 0);
     bool array = nvals > 1 || n->values[0]->type().array();
     if (array) stream << "( ";
     for (int i = 0; i < nvals; i++) {
-        n->values[i]->accept(this);
+        output_fractional_value(n->values[i], scale);
         if (i < nvals - 1) stream << " ";
     }
     if (array) stream << " )";
@@ -344,48 +1099,709 @@ void CodeGen_Bash::visit(BinOp *n) {
         break;
     }
 
-    bool reset_wrap = false;
-    if (should_comparison_wrap() && (n->op == BinOp::And || n->op == BinOp::Or)) {
-        reset_wrap = true;
-        // Disable wrapping comparisons in [[]] because we need to
-        // wrap them all from the outside for And and Or operations.
-        disable_comparison_wrap();
-        stream << "$([[ ";
+    if (comparison && should_comparison_wrap()) {
+        output_condition_value(n);
+        return;
+    }
+
+    std::map<IRNode *, Location *>::iterator T = fractional_temps.find(n);
+    if (T != fractional_temps.end()) {
+        // Computed before the statement; comparisons as 1 or 0.
+        if (comparison) disable_quote_variable();
+        T->second->accept(this);
+        if (comparison) {
+            reset_quote_variable();
+            stream << " -eq 1";
+        }
+        return;
+    }
+    if (FractionalScales::comparison(n)) {
+        // The operands are compared as integers of the same scale.
+        const int scale = scales->scale(n);
+        assert(scale != FractionalScales::Unknown);
+        stream << "$(( ";
+        output_fixed(n->a, scale);
+        stream << " )) " << bash_op << " $(( ";
+        output_fixed(n->b, scale);
+        stream << " ))";
+        return;
+    }
+    assert(!FractionalScales::arithmetic(n));
+
+    if (n->op == BinOp::And || n->op == BinOp::Or) {
+        // Bish gives 'and' and 'or' equal precedence, so nested
+        // logical operators are always parenthesized.
+        bool paren_a = is_logical_op(n->a), paren_b = is_logical_op(n->b);
+        if (paren_a) stream << "( ";
+        output_condition(n->a);
+        if (paren_a) stream << " )";
+        stream << " " << bash_op << " ";
+        if (paren_b) stream << "( ";
+        output_condition(n->b);
+        if (paren_b) stream << " )";
+        return;
     }
 
-    if (comparison && should_comparison_wrap()) stream << "$([[ ";
     if (!comparison) stream << "$((";
     if (!string) disable_quote_variable();
     n->a->accept(this);
     stream << " " << bash_op << " ";
     n->b->accept(this);
-    if (comparison && should_comparison_wrap()) stream << " ]] && echo 1 || echo 0)";
     if (!comparison) stream << "))";
     if (!string) reset_quote_variable();
-
-    if (reset_wrap && (n->op == BinOp::And || n->op == BinOp::Or)) {
-        reset_comparison_wrap();
-        stream << " ]] && echo 1 || echo 0)";
-    }
 }
 
 void CodeGen_Bash::visit(UnaryOp *n) {
-    bool negate_binop = dynamic_cast<BinOp*>(n->a);
+    std::map<IRNode *, Location *>::iterator T = fractional_temps.find(n);
+    if (T != fractional_temps.end()) {
+        T->second->accept(this);
+        return;
+    }
     switch (n->op) {
     case UnaryOp::Negate:
+        assert(!FractionalScales::arithmetic(n));
         stream << "-";
+        n->a->accept(this);
         break;
     case UnaryOp::Not:
-        stream << "$(! [[ ";
-        disable_comparison_wrap();
+        if (should_comparison_wrap()) {
+            output_condition_value(n);
+        } else {
+            stream << "! ( ";
+            output_condition(n->a);
+            stream << " )";
+        }
         break;
     }
-    n->a->accept(this);
-    if (n->op == UnaryOp::Not) {
-        // Don't need the '-eq 1' if the argument is a binary operator (like '==').
-        if (!negate_binop) stream << " -eq 1";
-        stream << " ]] && echo 1 || echo 0)";
-        reset_comparison_wrap();
+}
+
+// Emit the given node as an expression for use inside [[ ... ]].
+// Comparisons and logical operators are emitted as-is; any other
+// value is a boolean stored as 1 or 0, so it is compared against 1.
+void CodeGen_Bash::output_condition(IRNode *n) {
+    n->accept(this);
+    if (!is_boolean_op(n)) stream << " -eq 1";
+}
+
+// Emit the given node as a '[[ ... ]]' test command.
+void CodeGen_Bash::output_test(IRNode *n) {
+    stream << "[[ ";
+    // Disable comparison wrap because this is within [[ ... ]]
+    disable_comparison_wrap();
+    enable_functioncall_wrap();
+    output_condition(n);
+    reset_functioncall_wrap();
+    reset_comparison_wrap();
+    stream << " ]]";
+}
+
+// Emit a test of the given node. The following statement can read
+// the result from '$?'.
+void CodeGen_Bash::output_condition_test(IRNode *n) {
+    output_test(n);
+    stream << "; ";
+}
+
+// Emit the given node as a 1 or 0 value. This requires a subshell,
+// so it is only used where a test cannot precede the statement.
+void CodeGen_Bash::output_condition_value(IRNode *n) {
+    stream << "$(";
+    output_test(n);
+    stream << " && echo 1 || echo 0)";
+}
+
+namespace {
+
+std::string power_of_ten(int scale) {
+    return "1" + std::string(scale, '0');
+}
+
+// Bash arithmetic is 64-bit, so scaled integers (and every
+// intermediate value computing them) must have at most this many
+// digits.
+const int MaxFixedDigits = 18;
+
+int decimal_digits(double value) {
+    int digits = 1;
+    for (value = std::fabs(value); value >= 10; value /= 10) digits++;
+    return digits;
+}
+
+// Return the number of digits of the given fractional expression
+// computed as a scaled integer with the given scale (see
+// CodeGen_Bash::output_fixed), if no variable it reads has more than
+// 'digits' integer digits. 'peak' is raised to the number of digits
+// of the largest intermediate value.
+int fixed_digits(FractionalScales *scales, IRNode *n, int scale, int digits, int &peak) {
+    int result = 0, computed = scale;
+    if (Fractional *f = dyn_cast<Fractional>(n)) {
+        result = decimal_digits(f->value * std::pow(10.0, scale));
+    } else if (isa<Location>(n) || isa<Variable>(n)) {
+        computed = scales->scale(n);
+        result = digits + computed;
+    } else if (BinOp *b = dyn_cast<BinOp>(n)) {
+        const int sa = scales->scale(b->a), sb = scales->scale(b->b);
+        switch (b->op) {
+        case BinOp::Add:
+        case BinOp::Sub:
+            result = std::max(fixed_digits(scales, b->a, scale, digits, peak),
+                              fixed_digits(scales, b->b, scale, digits, peak)) + 1;
+            break;
+        case BinOp::Mul:
+            computed = sa + sb;
+            result = fixed_digits(scales, b->a, sa, digits, peak) +
+                fixed_digits(scales, b->b, sb, digits, peak);
+            break;
+        case BinOp::Div:
+            // The divisor is a non-zero integer.
+            result = fixed_digits(scales, b->a, scale + sb, digits, peak);
+            fixed_digits(scales, b->b, sb, digits, peak);
+            break;
+        case BinOp::Mod:
+            computed = scales->scale(b);
+            result = std::max(fixed_digits(scales, b->a, computed, digits, peak),
+                              fixed_digits(scales, b->b, computed, digits, peak));
+            break;
+        default:
+            assert(false && "Not fractional arithmetic.");
+        }
+    } else if (UnaryOp *u = dyn_cast<UnaryOp>(n)) {
+        result = fixed_digits(scales, u->a, scale, digits, peak);
+    }
+    peak = std::max(peak, result);
+    if (computed < scale) {
+        result += scale - computed;
+    } else if (computed > scale) {
+        result = std::max(result - (computed - scale), 1);
+    }
+    peak = std::max(peak, result);
+    return result;
+}
+
+// Append the variables (and array elements) read by the given
+// fractional expression, each variable once.
+void find_fixed_reads(IRNode *n, std::vector<IRNode *> &reads) {
+    if (Location *l = dyn_cast<Location>(n)) {
+        for (unsigned i = 0; l->is_variable() && i < reads.size(); i++) {
+            Location *r = dyn_cast<Location>(reads[i]);
+            if (r && r->is_variable() && r->variable == l->variable) return;
+        }
+        reads.push_back(n);
+    } else if (isa<Variable>(n)) {
+        if (std::find(reads.begin(), reads.end(), n) == reads.end()) reads.push_back(n);
+    } else if (BinOp *b = dyn_cast<BinOp>(n)) {
+        find_fixed_reads(b->a, reads);
+        find_fixed_reads(b->b, reads);
+    } else if (UnaryOp *u = dyn_cast<UnaryOp>(n)) {
+        find_fixed_reads(u->a, reads);
+    }
+}
+
+// Append the fractional expressions of the given expression which
+// are computed before the statement containing it: arithmetic
+// (including the operands of comparisons), and comparisons of values
+// without a known scale. Each is stored with the given scale, or the
+// scale it is computed with if that is Unknown.
+void find_fractional_temps(FractionalScales *scales, IRNode *n, int scale,
+                           std::vector<std::pair<IRNode *, int> > &temps) {
+    if (FractionalScales::arithmetic(n)) {
+        if (scale == FractionalScales::Unknown) scale = scales->scale(n);
+        temps.push_back(std::make_pair(n, scale));
+    } else if (FractionalScales::comparison(n)) {
+        BinOp *b = dyn_cast<BinOp>(n);
+        scale = scales->scale(n);
+        if (scale == FractionalScales::Unknown) {
+            temps.push_back(std::make_pair(n, scale));
+        } else {
+            // Stored, so that they fall back to awk if they are too
+            // large for bash arithmetic.
+            if (FractionalScales::arithmetic(b->a)) temps.push_back(std::make_pair(b->a, scale));
+            if (FractionalScales::arithmetic(b->b)) temps.push_back(std::make_pair(b->b, scale));
+        }
+    } else if (BinOp *b = dyn_cast<BinOp>(n)) {
+        find_fractional_temps(scales, b->a, FractionalScales::Unknown, temps);
+        find_fractional_temps(scales, b->b, FractionalScales::Unknown, temps);
+    } else if (UnaryOp *u = dyn_cast<UnaryOp>(n)) {
+        find_fractional_temps(scales, u->a, FractionalScales::Unknown, temps);
+    } else if (IORedirection *r = dyn_cast<IORedirection>(n)) {
+        find_fractional_temps(scales, r->a, FractionalScales::Unknown, temps);
+    }
+}
+
+class FindPersistentCommands : public IRVisitor {
+public:
+    std::vector<ExternCall *> commands;
+    virtual void visit(ExternCall *node) {
+        if (node->persistent) commands.push_back(node);
+    }
+};
+
+}
+
+// Define a helper function '<function> <variable> <line>', which
+// sends the line to a coprocess running the given command, and
+// stores the line it answers in the variable. The coprocess is
+// started when the function is first called in a shell, after
+// running 'setup'. Bash warns about starting a second coprocess, so
+// the warnings are discarded, but not those of the command.
+void CodeGen_Bash::output_coprocess_helper(const std::string &function, const std::string &coproc,
+                                           const std::string &setup, const std::string &command) {
+    stream << "\nfunction " << function << " () {\n"
+           << "    if [[ \"${" << function << "_shell}\" != \"${BASHPID}\" ]]; then\n";
+    if (!setup.empty()) stream << "        " << setup << "\n";
+    stream << "        { coproc " << coproc << " { { " << command << "; } 2>&3 3>&-; }; } 3>&2 2>/dev/null;\n"
+           << "        " << function << "_shell=\"${BASHPID}\";\n"
+           << "    fi;\n"
+           << "    printf '%s\\n' \"$2\" >&\"${" << coproc << "[1]}\";\n"
+           << "    IFS= read -r \"$1\" <&\"${" << coproc << "[0]}\";\n"
+           << "}\n";
+}
+
+// Define a coprocess helper for each persistent command, so that
+// evaluating it (e.g. in a loop) does not start a new process.
+void CodeGen_Bash::output_persistent_helpers(Module *m) {
+    FindPersistentCommands find;
+    m->accept(&find);
+    for (unsigned i = 0; i < find.commands.size(); i++) {
+        ExternCall *call = find.commands[i];
+        if (persistent_commands.count(call)) continue;
+        std::ostringstream name;
+        name << persistent_commands.size();
+        persistent_commands[call] = "_bish_persistent_" + name.str();
+        output_coprocess_helper(persistent_commands[call], "_BISH_PERSISTENT_" + name.str(), "",
+                                command_text(call->body));
+    }
+}
+
+// Store the line a persistent command answers to the input of the
+// given pipe in 'target'.
+void CodeGen_Bash::output_persistent_call(Location *target, IORedirection *pipe) {
+    ExternCall *call = dyn_cast<ExternCall>(pipe->b);
+    assert(call && persistent_commands.count(call));
+    stream << persistent_commands[call] << " \"";
+    output_location_name(target);
+    stream << "\" ";
+    enable_quote_variable();
+    enable_functioncall_wrap();
+    pipe->a->accept(this);
+    reset_functioncall_wrap();
+    reset_quote_variable();
+}
+
+// Define the probes recording the profile of a run, and write the
+// profile to $BISH_PROFILE (default bish.prof) when the script exits.
+// The clock is read from EPOCHREALTIME (bash 5) or SECONDS, without
+// forking. Functions keep a stack of their start times, from which
+// the time spent in callees is subtracted for their exclusive time.
+void CodeGen_Bash::output_profile_helpers() {
+    stream << "\n_bish_prof_file=\"${BISH_PROFILE:-${PWD}/bish.prof}\";\n"
+           << "_bish_prof_depth=0;\n"
+           << "_bish_prof_loop_depth=0;\n"
+           << "if [[ -n \"${EPOCHREALTIME}\" ]]; then\n"
+           << "    _bish_prof_clock_name=EPOCHREALTIME;\n"
+           << "    function _bish_prof_clock () { _bish_prof_now=${EPOCHREALTIME//[!0-9]/}; }\n"
+           << "else\n"
+           << "    _bish_prof_clock_name=SECONDS;\n"
+           << "    function _bish_prof_clock () { _bish_prof_now=$(( SECONDS * 1000000 )); }\n"
+           << "fi;\n"
+           << "\nfunction _bish_prof_enter () {\n"
+           << "    _bish_prof_clock;\n"
+           << "    _bish_prof_start[_bish_prof_depth]=${_bish_prof_now};\n"
+           << "    _bish_prof_callees[_bish_prof_depth]=0;\n"
+           << "    _bish_prof_loops_at[_bish_prof_depth]=${_bish_prof_loop_depth};\n"
+           << "    _bish_prof_depth=$(( _bish_prof_depth + 1 ));\n"
+           << "    _bish_prof_calls[$1]=$(( ${_bish_prof_calls[$1]:-0} + 1 ));\n"
+           << "}\n"
+           << "\nfunction _bish_prof_leave () {\n"
+           << "    local _bish_status=$? _bish_t;\n"
+           << "    _bish_prof_clock;\n"
+           << "    _bish_prof_depth=$(( _bish_prof_depth - 1 ));\n"
+           // Loops left by 'return' are not timed.
+           << "    _bish_prof_loop_depth=${_bish_prof_loops_at[_bish_prof_depth]};\n"
+           << "    _bish_t=$(( _bish_prof_now - _bish_prof_start[_bish_prof_depth] ));\n"
+           << "    _bish_prof_incl[$1]=$(( ${_bish_prof_incl[$1]:-0} + _bish_t ));\n"
+           << "    _bish_prof_excl[$1]=$(( ${_bish_prof_excl[$1]:-0} + _bish_t - _bish_prof_callees[_bish_prof_depth] ));\n"
+           << "    if (( _bish_prof_depth > 0 )); then\n"
+           << "        _bish_prof_callees[_bish_prof_depth - 1]=$(( _bish_prof_callees[_bish_prof_depth - 1] + _bish_t ));\n"
+           << "    fi;\n"
+           << "    return ${_bish_status};\n"
+           << "}\n"
+           << "\nfunction _bish_prof_fork () {\n"
+           << "    local _bish_status=$?;\n"
+           << "    _bish_prof_forks[$1]=$(( ${_bish_prof_forks[$1]:-0} + $2 ));\n"
+           << "    return ${_bish_status};\n"
+           << "}\n"
+           << "\nfunction _bish_prof_loop_start () {\n"
+           << "    local _bish_status=$?;\n"
+           << "    _bish_prof_clock;\n"
+           << "    _bish_prof_loop_began[_bish_prof_loop_depth]=${_bish_prof_now};\n"
+           << "    _bish_prof_loop_depth=$(( _bish_prof_loop_depth + 1 ));\n"
+           << "    return ${_bish_status};\n"
+           << "}\n"
+           << "\nfunction _bish_prof_iter () {\n"
+           << "    _bish_prof_iters[$1]=$(( ${_bish_prof_iters[$1]:-0} + 1 ));\n"
+           << "}\n"
+           << "\nfunction _bish_prof_loop_end () {\n"
+           << "    local _bish_status=$?;\n"
+           << "    _bish_prof_clock;\n"
+           << "    _bish_prof_loop_depth=$(( _bish_prof_loop_depth - 1 ));\n"
+           << "    _bish_prof_loop_time[$1]=$(( ${_bish_prof_loop_time[$1]:-0} + _bish_prof_now - _bish_prof_loop_began[_bish_prof_loop_depth] ));\n"
+           << "    return ${_bish_status};\n"
+           << "}\n"
+           << "\nfunction _bish_prof_write () {\n"
+           << "    local i;\n"
+           << "    {\n"
+           << "        printf '# bish profile\\tclock %s\\n' \"${_bish_prof_clock_name}\";\n"
+           << "        for i in \"${!_bish_prof_calls[@]}\"; do\n"
+           << "            printf 'function\\t%s\\t%s\\t%d\\t%d\\t%d\\t%d\\n' \"${_bish_prof_names[i]}\" \"${_bish_prof_where[i]}\" \\\n"
+           << "                \"${_bish_prof_calls[i]}\" \"${_bish_prof_incl[i]:-0}\" \"${_bish_prof_excl[i]:-0}\" \"${_bish_prof_forks[i]:-0}\";\n"
+           << "        done;\n"
+           << "        for i in \"${!_bish_prof_iters[@]}\"; do\n"
+           << "            printf 'loop\\t%s\\t%d\\t%d\\n' \"${_bish_prof_loops[i]}\" \"${_bish_prof_iters[i]}\" \"${_bish_prof_loop_time[i]:-0}\";\n"
+           << "        done;\n"
+           << "    } > \"${_bish_prof_file}\";\n"
+           << "}\n"
+           << "trap _bish_prof_write EXIT;\n";
+}
+
+// Define the names and source locations of the profiled functions and
+// loops, indexed as in the probes.
+void CodeGen_Bash::output_profile_tables(Module *m) {
+    std::vector<const Function *> functions(profile_functions.size());
+    for (std::map<const Function *, unsigned>::const_iterator I = profile_functions.begin(),
+             E = profile_functions.end(); I != E; ++I) {
+        functions[I->second] = I->first;
+    }
+    stream << "_bish_prof_names=(";
+    for (unsigned i = 0; i < functions.size(); i++) {
+        stream << " " << single_quote(functions[i]->name.str('.'));
+    }
+    stream << " );\n_bish_prof_where=(";
+    for (unsigned i = 0; i < functions.size(); i++) {
+        stream << " " << single_quote(profile_location(functions[i]->debug_info(), m->path));
+    }
+    std::vector<const ForLoop *> loops(profile_loops.size());
+    for (std::map<const ForLoop *, unsigned>::const_iterator I = profile_loops.begin(),
+             E = profile_loops.end(); I != E; ++I) {
+        loops[I->second] = I->first;
+    }
+    stream << " );\n_bish_prof_loops=(";
+    for (unsigned i = 0; i < loops.size(); i++) {
+        stream << " " << single_quote(profile_location(loops[i]->debug_info(), m->path));
+    }
+    stream << " );\n";
+}
+
+// Define the helper functions for fractional arithmetic used by the
+// module. _bish_fixed stores a scaled integer as a decimal string
+// without trailing zeros; _bish_awk evaluates an expression in reverse
+// Polish notation with an awk coprocess.
+void CodeGen_Bash::output_fractional_helpers() {
+    if (scales->uses_fixed()) {
+        stream << "\nfunction _bish_fixed () {\n"
+               << "    local _bish_n=\"$2\" _bish_sign= _bish_v;\n"
+               << "    if (( _bish_n < 0 )); then _bish_sign=-; _bish_n=$(( -_bish_n )); fi;\n"
+               << "    printf -v _bish_v '%s%d.%0*d' \"${_bish_sign}\" $(( _bish_n / $3 )) \"$4\" $(( _bish_n % $3 ));\n"
+               << "    while [[ ${_bish_v} == *.?*0 ]]; do _bish_v=\"${_bish_v%0}\"; done;\n"
+               << "    printf -v \"$1\" '%s' \"${_bish_v}\";\n"
+               << "}\n";
+    }
+    if (scales->uses_awk()) {
+        output_coprocess_helper("_bish_awk", "_BISH_AWK",
+            // mawk buffers its input unless it is interactive.
+            "local _bish_awk_flags=; "
+            "[[ \"$(awk -W version 2>&1)\" == mawk* ]] && _bish_awk_flags=\"-W interactive\";",
+            "awk ${_bish_awk_flags} '{\n"
+            "            n = 0;\n"
+            "            for (i = 2; i <= NF; i++) {\n"
+            "                t = $i;\n"
+            "                if (t ~ /[0-9]/) { s[++n] = t + 0; continue; }\n"
+            "                if (t == \"neg\") { s[n] = -s[n]; continue; }\n"
+            "                a = s[n - 1]; b = s[n--];\n"
+            "                if (t == \"+\") a += b;\n"
+            "                else if (t == \"-\") a -= b;\n"
+            "                else if (t == \"*\") a *= b;\n"
+            "                else if (t == \"/\") a /= b;\n"
+            "                else if (t == \"%\") a %= b;\n"
+            "                else if (t == \"<\") a = a < b;\n"
+            "                else if (t == \"<=\") a = a <= b;\n"
+            "                else if (t == \">\") a = a > b;\n"
+            "                else if (t == \">=\") a = a >= b;\n"
+            "                else if (t == \"==\") a = a == b;\n"
+            "                else a = a != b;\n"
+            "                s[n] = a;\n"
+            "            }\n"
+            "            if ($1 == \"c\") r = sprintf(\"%d\", s[n]);\n"
+            "            else if ($1 == \"g\") { r = sprintf(\"%.15g\", s[n]); if (r !~ /[.eEn]/) r = r \".0\"; }\n"
+            "            else {\n"
+            "                r = sprintf(\"%.\" substr($1, 2) \"f\", s[n]);\n"
+            "                if (r ~ /\\./) { sub(/0+$/, \"\", r); sub(/\\.$/, \".0\", r); }\n"
+            "            }\n"
+            "            print r;\n"
+            "            fflush();\n"
+            "        }'");
+    }
+}
+
+// Compute the fractional expressions of the given statement or
+// condition which can not be emitted in place, and store them in
+// temporary variables.
+void CodeGen_Bash::output_fractional_temps(IRNode *n) {
+    std::vector<std::pair<IRNode *, int> > temps;
+    if (Assignment *a = dyn_cast<Assignment>(n)) {
+        Variable *v = a->location->variable;
+        bool array = a->values.size() > 1 || a->values[0]->type().array();
+        for (unsigned i = 0; i < a->values.size(); i++) {
+            // A single fractional value is stored by the assignment itself.
+            if (!array && FractionalScales::arithmetic(a->values[i])) continue;
+            find_fractional_temps(scales, a->values[i], scales->scale(v), temps);
+        }
+    } else if (Intrinsic *i = dyn_cast<Intrinsic>(n)) {
+        if (i->op == Intrinsic::Append) {
+            find_fractional_temps(scales, i->args[0], scales->scale(i->target->variable), temps);
+        }
+    } else if (ReturnStatement *r = dyn_cast<ReturnStatement>(n)) {
+        if (r->value) find_fractional_temps(scales, r->value, FractionalScales::Unknown, temps);
+    } else {
+        find_fractional_temps(scales, n, FractionalScales::Unknown, temps);
+    }
+
+    for (unsigned i = 0; i < temps.size(); i++) {
+        std::ostringstream name;
+        name << "_bish_fp_" << fractional_temp_count++;
+        Location *temp = new Location(new Variable(Name(name.str())));
+        if (use_local.top()) stream << "local " << name.str() << "; ";
+        output_fractional_store(temp, temps[i].first, temps[i].second);
+        fractional_temps[temps[i].first] = temp;
+        stream << "; ";
+    }
+}
+
+// Store the given fractional value (or comparison) in 'target' with
+// the given scale. If the scales of the value are known, it is computed
+// as a scaled integer: e.g. 1.5 * x, where x has 2 fractional digits,
+// is 15 * x' with 3 digits, x' being x without the decimal point.
+// Otherwise, or if the variables it reads are too large for that to
+// fit in 64 bits, the value is computed by awk.
+void CodeGen_Bash::output_fractional_store(Location *target, IRNode *value, int scale) {
+    bool fixed = scale != FractionalScales::Unknown &&
+        scales->scale(value) != FractionalScales::Unknown;
+    // The most integer digits of the variables read for which every
+    // intermediate value fits.
+    int digits = 0;
+    std::vector<IRNode *> reads;
+    if (fixed) {
+        find_fixed_reads(value, reads);
+        for (digits = MaxFixedDigits; digits > 0; digits--) {
+            int peak = 0;
+            fixed_digits(scales, value, scale, digits, peak);
+            if (peak <= MaxFixedDigits) break;
+        }
+        fixed = digits > 0;
+    }
+    if (fixed && !reads.empty()) {
+        // A value is written with its integer digits, a point and its
+        // fractional digits; negative values may have one integer
+        // digit less, for the sign.
+        stream << "if [[ ";
+        for (unsigned i = 0; i < reads.size(); i++) {
+            if (i > 0) stream << " && ";
+            stream << "${#";
+            if (Location *l = dyn_cast<Location>(reads[i])) {
+                output_location_name(l);
+            } else {
+                stream << lookup_name(dyn_cast<Variable>(reads[i]));
+            }
+            stream << "} -le " << digits + 1 + scales->scale(reads[i]);
+        }
+        stream << " ]]; then ";
+    }
+    stream << (fixed ? "_bish_fixed" : "_bish_awk") << " \"";
+    output_location_name(target);
+    stream << "\" \"";
+    if (fixed) {
+        stream << "$(( ";
+        output_fixed(value, scale);
+        stream << " ))\" " << power_of_ten(scale) << " " << scale;
+        if (reads.empty()) return;
+        stream << "; else _bish_awk \"";
+        output_location_name(target);
+        stream << "\" \"f" << scale << " ";
+        output_awk(value);
+        stream << "\"; fi";
+        return;
+    }
+    if (FractionalScales::comparison(value)) {
+        stream << "c";
+    } else if (scale == FractionalScales::Unknown) {
+        stream << "g";
+    } else {
+        stream << "f" << scale;
+    }
+    stream << " ";
+    output_awk(value);
+    stream << "\"";
+}
+
+// Emit the given value of a fractional variable with the given
+// scale. Literals are written with exactly that many digits, and
+// computed values have been stored in temporary variables.
+void CodeGen_Bash::output_fractional_value(IRNode *n, int scale) {
+    if (Fractional *f = dyn_cast<Fractional>(n)) {
+        stream << FractionalScales::format(f->value, scale);
+    } else {
+        n->accept(this);
+    }
+}
+
+// Emit the given fractional expression as an arithmetic expression
+// of its value times 10 ** scale.
+void CodeGen_Bash::output_fixed(IRNode *n, int scale) {
+    if (Fractional *f = dyn_cast<Fractional>(n)) {
+        stream << FractionalScales::format(f->value * std::pow(10.0, scale), 0);
+        return;
+    }
+    std::map<IRNode *, Location *>::iterator T = fractional_temps.find(n);
+    if (T != fractional_temps.end()) {
+        // The operand of a comparison, stored with its scale.
+        output_fixed_variable(T->second, scale, scale);
+        return;
+    }
+    if (Location *l = dyn_cast<Location>(n)) {
+        output_fixed_variable(l, scales->scale(l), scale);
+        return;
+    }
+    if (Variable *v = dyn_cast<Variable>(n)) {
+        Location l(v);
+        output_fixed_variable(&l, scales->scale(v), scale);
+        return;
+    }
+    // The scale of the terms emitted below, before rescaling.
+    int computed = scale;
+    BinOp *b = dyn_cast<BinOp>(n);
+    if (b && b->op == BinOp::Mul) {
+        computed = scales->scale(b->a) + scales->scale(b->b);
+    } else if (b && b->op == BinOp::Mod) {
+        computed = scales->scale(b);
+    }
+    if (computed != scale) stream << "(";
+    stream << "(";
+    if (b) {
+        switch (b->op) {
+        case BinOp::Add:
+        case BinOp::Sub:
+            output_fixed(b->a, scale);
+            stream << (b->op == BinOp::Add ? " + " : " - ");
+            output_fixed(b->b, scale);
+            break;
+        case BinOp::Mul:
+            output_fixed(b->a, scales->scale(b->a));
+            stream << " * ";
+            output_fixed(b->b, scales->scale(b->b));
+            break;
+        case BinOp::Div:
+            output_fixed(b->a, scale + scales->scale(b->b));
+            stream << " / ";
+            output_fixed(b->b, scales->scale(b->b));
+            break;
+        case BinOp::Mod:
+            output_fixed(b->a, computed);
+            stream << " % ";
+            output_fixed(b->b, computed);
+            break;
+        default:
+            assert(false && "Not fractional arithmetic.");
+        }
+    } else {
+        UnaryOp *u = dyn_cast<UnaryOp>(n);
+        assert(u && u->op == UnaryOp::Negate);
+        stream << "-";
+        output_fixed(u->a, scale);
+    }
+    stream << ")";
+    if (computed < scale) {
+        stream << " * " << power_of_ten(scale - computed) << ")";
+    } else if (computed > scale) {
+        stream << " / " << power_of_ten(computed - scale) << ")";
+    }
+}
+
+// Emit the value of the given fractional variable, stored with at
+// most 'stored' fractional digits, times 10 ** scale. A value "-1.5"
+// stored with two fractional digits is -1 * 100 + -1 * (15 - 10) * 10,
+// i.e. the integer part, and the fractional part with a leading 1 (so
+// that bash does not read leading zeros as octal) padded to 'stored'
+// digits. The leading 1 also tells how many digits there are, since
+// trailing zeros are not written.
+void CodeGen_Bash::output_fixed_variable(Location *n, int stored, int scale) {
+    assert(stored != FractionalScales::Unknown);
+    const std::string unit = power_of_ten(stored);
+    if (stored != scale) stream << "(";
+    stream << "(${";
+    output_location_name(n);
+    stream << "%.*} * " << unit << " + ${";
+    output_location_name(n);
+    stream << "%%[0-9]*}1 * (_bish_f = 1${";
+    output_location_name(n);
+    stream << "#*.}, ";
+    for (int digits = 1; digits < stored; digits++) {
+        stream << "_bish_f < " << power_of_ten(digits + 1) << " ? (_bish_f - " << power_of_ten(digits)
+               << ") * " << power_of_ten(stored - digits) << " : ";
+    }
+    stream << "_bish_f - " << unit << "))";
+    if (stored < scale) {
+        stream << " * " << power_of_ten(scale - stored) << ")";
+    } else if (stored > scale) {
+        stream << " / " << power_of_ten(stored - scale) << ")";
+    }
+}
+
+// Emit the given fractional expression for _bish_awk, in reverse
+// Polish notation.
+void CodeGen_Bash::output_awk(IRNode *n) {
+    if (Fractional *f = dyn_cast<Fractional>(n)) {
+        stream << FractionalScales::format(f->value, FractionalScales::Unknown);
+    } else if (Location *l = dyn_cast<Location>(n)) {
+        stream << "${";
+        output_location_name(l);
+        stream << "}";
+    } else if (Variable *v = dyn_cast<Variable>(n)) {
+        stream << "${" << lookup_name(v) << "}";
+    } else if (BinOp *b = dyn_cast<BinOp>(n)) {
+        output_awk(b->a);
+        stream << " ";
+        output_awk(b->b);
+        switch (b->op) {
+        case BinOp::Add: stream << " +"; break;
+        case BinOp::Sub: stream << " -"; break;
+        case BinOp::Mul: stream << " *"; break;
+        case BinOp::Div: stream << " /"; break;
+        case BinOp::Mod: stream << " %"; break;
+        case BinOp::Eq: stream << " =="; break;
+        case BinOp::NotEq: stream << " !="; break;
+        case BinOp::LT: stream << " <"; break;
+        case BinOp::LTE: stream << " <="; break;
+        case BinOp::GT: stream << " >"; break;
+        case BinOp::GTE: stream << " >="; break;
+        default: assert(false && "Not fractional arithmetic.");
+        }
+    } else {
+        UnaryOp *u = dyn_cast<UnaryOp>(n);
+        assert(u && u->op == UnaryOp::Negate);
+        output_awk(u->a);
+        stream << " neg";
+    }
+}
+
+// Emit the name of the given variable or array element, without '$'.
+void CodeGen_Bash::output_location_name(Location *n) {
+    stream << lookup_name(n->variable);
+    if (n->is_array_ref()) {
+        stream << "[";
+        disable_quote_variable();
+        n->offset->accept(this);
+        reset_quote_variable();
+        stream << "]";
     }
 }
 
@@ -399,12 +1815,133 @@ void CodeGen_Bash::visit(Fractional *n) {
 
 void CodeGen_Bash::visit(String *n) {
     stream << "\"";
-    disable_quote_variable();
-    output_interpolated_string(n->value);
-    reset_quote_variable();
+    output_interpolated_string(n->value->begin(), n->value->end());
     stream << "\"";
 }
 
 void CodeGen_Bash::visit(Boolean *n) {
     stream << n->value;
 }
+
+void CodeGen_Bash::visit(MapLiteral *n) {
+    enable_functioncall_wrap();
+    stream << "(";
+    for (unsigned i = 0; i < n->keys.size(); i++) {
+        stream << " [";
+        n->keys[i]->accept(this);
+        stream << "]=";
+        n->values[i]->accept(this);
+    }
+    stream << " )";
+    reset_functioncall_wrap();
+}
+
+// Declare the global maps as associative arrays, and the global
+// integers as integers, before any function assigns them. A 'declare'
+// in a function would declare a local variable ('-g' needs bash 4.2).
+void CodeGen_Bash::output_global_declarations(Module *m) {
+    FindGlobalDeclarations finder;
+    m->accept(&finder);
+    std::set<std::string> maps, integers;
+    for (std::set<Variable *>::const_iterator I = finder.maps.begin(), E = finder.maps.end(); I != E; ++I) {
+        maps.insert(lookup_name(*I));
+    }
+    for (std::set<std::string>::const_iterator I = maps.begin(), E = maps.end(); I != E; ++I) {
+        stream << "declare -A " << *I << ";\n";
+    }
+    if (!typed_integers) return;
+    for (std::set<Variable *>::const_iterator I = finder.integers.begin(), E = finder.integers.end(); I != E; ++I) {
+        integers.insert(lookup_name(*I));
+        integer_variables.insert(*I);
+    }
+    if (integers.empty()) return;
+    stream << "declare -i";
+    for (std::set<std::string>::const_iterator I = integers.begin(), E = integers.end(); I != E; ++I) {
+        stream << " " << *I;
+    }
+    stream << ";\n";
+}
+
+// Declare the integer variables of the given function as local
+// integers when it starts, so that their assignments, wherever they
+// are, need neither 'local' nor '$(( ))'.
+void CodeGen_Bash::output_integer_locals(Function *f) {
+    if (!typed_integers) return;
+    FindIntegerLocals finder(f);
+    std::set<std::string> names;
+    for (std::set<Variable *>::const_iterator I = finder.variables.begin(), E = finder.variables.end(); I != E; ++I) {
+        names.insert(lookup_name(*I));
+        declared_locals.insert(*I);
+        integer_variables.insert(*I);
+    }
+    if (names.empty()) return;
+    indent();
+    stream << "local -i";
+    for (std::set<std::string>::const_iterator I = names.begin(), E = names.end(); I != E; ++I) {
+        stream << " " << *I;
+    }
+    stream << ";\n";
+}
+
+// Emit the given arithmetic assignment to a variable declared as an
+// integer: '(( x = a * (b + 1), 1 ))', or 'x+=k' and 'x+=-k' for steps
+// by a constant. The expression is evaluated once, by the arithmetic
+// command, which ends with 1 so that it does not fail when the value
+// is 0 (and become the status of a function or script it ends).
+void CodeGen_Bash::output_arithmetic_assignment(Assignment *n) {
+    const std::string name = lookup_name(n->location->variable);
+    BinOp *b = dyn_cast<BinOp>(n->values[0]);
+    Location *a = b ? dyn_cast<Location>(b->a) : NULL;
+    Integer *step = b ? dyn_cast<Integer>(b->b) : NULL;
+    if (a && a->is_variable() && a->variable == n->location->variable && step &&
+        (b->op == BinOp::Add || b->op == BinOp::Sub)) {
+        stream << name << "+=" << (b->op == BinOp::Sub ? "-" : "") << step->value;
+        return;
+    }
+    stream << "(( " << name << " = ";
+    output_arithmetic(n->values[0]);
+    stream << ", 1 ))";
+}
+
+// Emit the given integer expression for an arithmetic context, where
+// variables are named without being expanded. Operations nested in
+// the IR are parenthesized; anything else (e.g. a function call) is
+// expanded as usual.
+void CodeGen_Bash::output_arithmetic(IRNode *n) {
+    Location *loc = dyn_cast<Location>(n);
+    if (loc && loc->is_variable() && loc->type().integer() && !loc->variable->nameref) {
+        stream << lookup_name(loc->variable);
+        return;
+    }
+    if (Integer *i = dyn_cast<Integer>(n)) {
+        stream << i->value;
+        return;
+    }
+    if (fractional_temps.count(n) == 0 && n->type().integer()) {
+        BinOp *b = dyn_cast<BinOp>(n);
+        if (b && arithmetic_operator(b->op)) {
+            output_arithmetic_operand(b->a);
+            stream << " " << arithmetic_operator(b->op) << " ";
+            output_arithmetic_operand(b->b);
+            return;
+        }
+        UnaryOp *u = dyn_cast<UnaryOp>(n);
+        if (u && u->op == UnaryOp::Negate) {
+            stream << "-";
+            output_arithmetic_operand(u->a);
+            return;
+        }
+    }
+    disable_quote_variable();
+    enable_functioncall_wrap();
+    n->accept(this);
+    reset_functioncall_wrap();
+    reset_quote_variable();
+}
+
+void CodeGen_Bash::output_arithmetic_operand(IRNode *n) {
+    const bool paren = isa<BinOp>(n) || isa<UnaryOp>(n);
+    if (paren) stream << "(";
+    output_arithmetic(n);
+    if (paren) stream << ")";
+}
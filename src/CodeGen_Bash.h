@@ -1,11 +1,13 @@
 #ifndef __BISH_CODEGEN_BASH_H__
 #define __BISH_CODEGEN_BASH_H__
 
+#include <set>
 #include <stack>
 #include <map>
 #include "IR.h"
 #include "IRVisitor.h"
 #include "CodeGen.h"
+#include "FractionalScales.h"
 
 namespace Bish {
 
@@ -32,12 +34,25 @@ class CodeGen_Bash : public CodeGenerator {
 public:
     CodeGen_Bash(std::ostream &os) : CodeGenerator(os) {
         indent_level = 0;
+        scales = NULL;
+        fractional_temp_count = 0;
+        parallel_count = 0;
+        range_bound_count = 0;
+        wait_any = false;
+        profile = false;
+        profile_function = -1;
+        append_in_place = true;
+        typed_integers = true;
+        compact = false;
+        memo_function = NULL;
         enable_block_braces();
         disable_functioncall_wrap();
         enable_quote_variable();
         enable_comparison_wrap();
         enable_use_local();
     }
+    virtual void set_options(const CompileOptions &options);
+    virtual std::string interpreter() const { return "/usr/bin/env bash"; }
     virtual void visit(Module *);
     virtual void visit(Block *);
     virtual void visit(Variable *);
@@ -49,6 +64,7 @@ public:
     virtual void visit(Function *);
     virtual void visit(FunctionCall *);
     virtual void visit(ExternCall *);
+    virtual void visit(Intrinsic *);
     virtual void visit(IORedirection *);
     virtual void visit(Assignment *);
     virtual void visit(BinOp *);
@@ -57,7 +73,18 @@ public:
     virtual void visit(Fractional *);
     virtual void visit(String *);
     virtual void visit(Boolean *);
-private:
+    virtual void visit(MapLiteral *);
+
+    // Return true if the given string is just "echo $?".
+    static bool is_echo_status(InterpolatedString *s) {
+        std::string str;
+        for (InterpolatedString::const_iterator I = s->begin(), E = s->end(); I != E; ++I) {
+            if (!(*I).is_str()) return false;
+            str += (*I).str();
+        }
+        return str == "echo $?";
+    }
+protected:
     std::stack<LetScope *> let_stack;
     std::stack<Function *> function_args_insert;
     std::stack<bool> block_print_braces;
@@ -66,6 +93,41 @@ private:
     std::stack<bool> comparison_wrap;
     std::stack<bool> use_local;
     unsigned indent_level;
+    // Local variables declared so far by the function being emitted.
+    std::set<const Variable *> declared_locals;
+    // Fractional arithmetic is computed with scaled integers where
+    // the scale is known, and with an awk coprocess where it is not.
+    FractionalScales *scales;
+    // Variables holding fractional values computed before a statement.
+    std::map<IRNode *, Location *> fractional_temps;
+    unsigned fractional_temp_count;
+    // Helper function feeding each persistent command's coprocess.
+    std::map<ExternCall *, std::string> persistent_commands;
+    // Number of parallel loops, naming their job lists.
+    unsigned parallel_count;
+    // Number of variables holding the upper bound of a range.
+    unsigned range_bound_count;
+    // True if 'wait -n' (bash 4.3) can wait for any one job to finish.
+    bool wait_any;
+    // With profiling, the index of each function and loop in the
+    // profile. 'profile_function' is the index of the function being
+    // emitted, or -1.
+    bool profile;
+    std::map<const Function *, unsigned> profile_functions;
+    std::map<const ForLoop *, unsigned> profile_loops;
+    int profile_function;
+    // True if a string may be appended to with '+='.
+    bool append_in_place;
+    // True if integer variables are declared with 'declare -i' and
+    // 'local -i', and assigned arithmetic without '$(( ))'.
+    bool typed_integers;
+    // The variables declared as integers so far.
+    std::set<const Variable *> integer_variables;
+    // True if the script is emitted without indentation, comments or
+    // empty functions, and with short names for temporary variables.
+    bool compact;
+    // The memoized function being emitted, or NULL.
+    const Function *memo_function;
 
     inline void disable_block_braces() { block_print_braces.push(false); }
     inline void enable_block_braces() { block_print_braces.push(true); }
@@ -94,15 +156,90 @@ private:
 
     inline bool should_emit_statement(const IRNode *node) const;
 
-    void output_interpolated_string(InterpolatedString *n);
+    void output_interpolated_string(InterpolatedString::const_iterator I,
+                                    InterpolatedString::const_iterator E);
+    void output_pipeline_stage(IRNode *n);
+    virtual void output_command(IRNode *n);
+    // The constructs below differ between shells: the start of a
+    // function definition, the command printing a value, the
+    // command-line arguments, the header of a loop over a range, the
+    // test of a condition, and the read of a file into a variable.
+    virtual void output_function_start(const std::string &name);
+    virtual void output_echo();
+    virtual void output_args();
+    virtual void output_range_loop(ForLoop *n);
+    virtual void output_test(IRNode *n);
+    virtual void output_read(Variable *v, Intrinsic *read);
+    std::string output_range_bound(ForLoop *n);
+    void output_loop_body(ForLoop *n, const std::string &jobs, int probe);
+    void output_profile_helpers();
+    void output_profile_tables(Module *m);
+    void output_condition(IRNode *n);
+    void output_condition_test(IRNode *n);
+    void output_condition_value(IRNode *n);
+    void output_coprocess_helper(const std::string &function, const std::string &coproc,
+                                 const std::string &setup, const std::string &command);
+    void output_persistent_helpers(Module *m);
+    void output_persistent_call(Location *target, IORedirection *pipe);
+    void output_fractional_helpers();
+    void output_fractional_temps(IRNode *n);
+    void output_fractional_store(Location *target, IRNode *value, int scale);
+    void output_fractional_value(IRNode *n, int scale);
+    void output_fixed(IRNode *n, int scale);
+    void output_fixed_variable(Location *n, int stored, int scale);
+    void output_awk(IRNode *n);
+    void output_location_name(Location *n);
+    void output_memo_lookup(const Function *f);
+    void output_global_declarations(Module *m);
+    void output_integer_locals(Function *f);
+    void output_arithmetic_assignment(Assignment *n);
+    void output_arithmetic(IRNode *n);
+    void output_arithmetic_operand(IRNode *n);
+    void output_map_keys(Variable *v);
+
+    // Return true if the given node is a command run as a coprocess.
+    bool is_persistent(IRNode *n) const {
+        ExternCall *call = dyn_cast<ExternCall>(n);
+        return call && call->persistent;
+    }
 
     bool is_equals_op(IRNode *n) const {
-        if (BinOp *b = dynamic_cast<BinOp*>(n)) {
+        if (BinOp *b = dyn_cast<BinOp>(n)) {
             return b->op == BinOp::Eq;
         }
         return false;
     }
 
+    bool is_logical_op(IRNode *n) const {
+        if (BinOp *b = dyn_cast<BinOp>(n)) {
+            return b->op == BinOp::And || b->op == BinOp::Or;
+        }
+        return false;
+    }
+
+    // Return true if the given node is a comparison, logical or 'not'
+    // operator, i.e. it can be emitted directly inside [[ ... ]].
+    bool is_boolean_op(IRNode *n) const {
+        if (BinOp *b = dyn_cast<BinOp>(n)) {
+            switch (b->op) {
+            case BinOp::Eq:
+            case BinOp::NotEq:
+            case BinOp::LT:
+            case BinOp::LTE:
+            case BinOp::GT:
+            case BinOp::GTE:
+            case BinOp::And:
+            case BinOp::Or:
+                return true;
+            default:
+                return false;
+            }
+        } else if (UnaryOp *u = dyn_cast<UnaryOp>(n)) {
+            return u->op == UnaryOp::Not;
+        }
+        return false;
+    }
+
     void indent();
     void push_let_scope(LetScope *s) { let_stack.push(s); }
     LetScope *pop_let_scope() { LetScope *s = let_stack.top(); let_stack.pop(); return s; }
@@ -132,20 +269,46 @@ private:
     std::string lookup_name(const Variable *v) {
         std::string tmp;
         if (lookup_let(v, tmp)) {
-            assert(false);
             return tmp;
         } else {
             return v->name.str();
         }
     }
 
+    // Return the text of the given command, as it is emitted with
+    // quoting disabled.
+    std::string command_text(InterpolatedString *s) {
+        std::string text;
+        for (InterpolatedString::const_iterator I = s->begin(), E = s->end(); I != E; ++I) {
+            if ((*I).is_str()) {
+                text += (*I).str();
+            } else {
+                Variable *v = (*I).var();
+                text += "${" + lookup_name(v) + (v->type().array() ? "[@]" : "") + "}";
+            }
+        }
+        return text;
+    }
+
     std::string function_name(const Function *f) {
         // Ensure a function name is always qualified somehow.
-        if (f->name.namespace_id.empty()) {
+        if (f->name.namespaces().empty()) {
             return "bish_" + f->name.str();
         }
         return f->name.str();
     }
+
+    // Return true if the given function is empty and not emitted, so
+    // that calls to it are emitted as ':'.
+    bool omitted(const Function *f) const {
+        return compact && !profile && !f->memo && f->body && f->body->nodes.empty();
+    }
+
+    // Return the name of the associative array holding the values
+    // returned by the given memoized function.
+    std::string memo_table(const Function *f) {
+        return "_bish_memo_" + function_name(f);
+    }
 };
 
 }
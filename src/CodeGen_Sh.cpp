@@ -0,0 +1,241 @@
+#include <cassert>
+#include <string>
+#include "CodeGen_Sh.h"
+#include "Errors.h"
+
+using namespace Bish;
+
+namespace {
+
+// Rejects the constructs which are only implemented with bash
+// features (arrays, coprocesses, process substitution, ...), naming
+// the first one found.
+class CheckPortable : public IRVisitor {
+public:
+    CheckPortable(Module *m) {
+        m->accept(this);
+    }
+
+    virtual void visit(Block *node) {
+        if (node->background) unsupported("background jobs ('spawn')", node);
+        IRVisitor::visit(node);
+    }
+
+    virtual void visit(Variable *node) {
+        if (node->type().map()) unsupported("maps", node);
+        if (node->type().array()) unsupported("arrays", node);
+        if (node->type().fractional()) unsupported("fractional numbers", node);
+    }
+
+    virtual void visit(Function *node) {
+        if (node->memo) unsupported("memoized functions", node);
+        IRVisitor::visit(node);
+    }
+
+    virtual void visit(Location *node) {
+        if (node->is_array_ref()) unsupported(node->variable->type().map() ? "maps" : "arrays", node);
+        IRVisitor::visit(node);
+    }
+
+    virtual void visit(Assignment *node) {
+        if (node->values.size() > 1) unsupported("arrays", node);
+        IRVisitor::visit(node);
+    }
+
+    virtual void visit(ForLoop *node) {
+        if (node->stream) unsupported("streamed loops", node);
+        if (node->parallel) unsupported("parallel loops", node);
+        IRVisitor::visit(node);
+    }
+
+    virtual void visit(Intrinsic *node) {
+        if (node->op != Intrinsic::Length && node->op != Intrinsic::ReadFile) unsupported("arrays", node);
+        IRVisitor::visit(node);
+    }
+
+    virtual void visit(ExternCall *node) {
+        if (node->persistent) unsupported("persistent commands", node);
+        IRVisitor::visit(node);
+    }
+
+    virtual void visit(String *node) {
+        for (InterpolatedString::const_iterator I = node->value->begin(), E = node->value->end(); I != E; ++I) {
+            if ((*I).is_var()) visit((*I).var());
+        }
+    }
+
+    virtual void visit(Fractional *node) {
+        unsupported("fractional numbers", node);
+    }
+
+    virtual void visit(MapLiteral *node) {
+        unsupported("maps", node);
+    }
+private:
+    void unsupported(const char *what, IRNode *node) {
+        bish_abort() << "The sh code generator does not support " << what << " " << node->debug_info();
+    }
+};
+
+}
+
+void CodeGen_Sh::visit(Module *n) {
+    if (profile) bish_abort() << "The sh code generator does not support profiling.";
+    CheckPortable check(n);
+    CodeGen_Bash::visit(n);
+}
+
+// Emit the given pipeline or redirection of commands. There are no
+// here-strings, so the string is piped to the command instead.
+void CodeGen_Sh::output_command(IRNode *n) {
+    IORedirection *r = dyn_cast<IORedirection>(n);
+    if (r == NULL || r->op != IORedirection::HereString) {
+        CodeGen_Bash::output_command(n);
+        return;
+    }
+    output_echo();
+    enable_quote_variable();
+    enable_functioncall_wrap();
+    r->b->accept(this);
+    reset_functioncall_wrap();
+    reset_quote_variable();
+    stream << " | ";
+    output_command(r->a);
+}
+
+void CodeGen_Sh::output_function_start(const std::string &name) {
+    if (compact) {
+        stream << name << "()";
+    } else {
+        stream << "\n" << name << "() ";
+    }
+}
+
+// The 'echo' of dash interprets backslashes, so values are printed
+// with printf.
+void CodeGen_Sh::output_echo() {
+    stream << "printf '%s\\n' ";
+}
+
+// The command-line arguments are an array, which programs for sh can
+// not use.
+void CodeGen_Sh::output_args() {}
+
+// Emit the header of the given loop over a range as a 'while' loop.
+// The variable is incremented by the test, so 'continue' increments
+// it too. The upper bound is evaluated once, before the loop.
+void CodeGen_Sh::output_range_loop(ForLoop *n) {
+    const std::string var = lookup_name(n->variable);
+    const std::string bound = output_range_bound(n);
+    disable_quote_variable();
+    if (!bound.empty()) {
+        stream << bound << "=";
+        n->upper->accept(this);
+        stream << "; ";
+    }
+    stream << var << "=$(( ";
+    n->lower->accept(this);
+    stream << " - 1 )); while [ \"$(( " << var << " += 1 ))\" -le \"";
+    if (bound.empty()) {
+        n->upper->accept(this);
+    } else {
+        stream << "${" << bound << "}";
+    }
+    stream << "\" ]";
+    reset_quote_variable();
+}
+
+// Emit the given node as a test command. Each comparison is a
+// '[ ... ]' command, joined with the others by '&&' and '||'. Any
+// other value is a boolean stored as 1 or 0, so it is compared
+// against 1.
+void CodeGen_Sh::output_test(IRNode *n) {
+    BinOp *b = dyn_cast<BinOp>(n);
+    if (b && (b->op == BinOp::And || b->op == BinOp::Or)) {
+        output_test_group(b->a);
+        stream << (b->op == BinOp::And ? " && " : " || ");
+        output_test_group(b->b);
+        return;
+    }
+    UnaryOp *u = dyn_cast<UnaryOp>(n);
+    if (u && u->op == UnaryOp::Not) {
+        stream << "! ";
+        output_test_group(u->a);
+        return;
+    }
+    if (!is_boolean_op(n)) {
+        stream << "[ ";
+        output_test_operand(n);
+        stream << " -eq 1 ]";
+        return;
+    }
+    const bool string = b->a->type().string() || b->b->type().string();
+    std::string op;
+    switch (b->op) {
+    case BinOp::Eq:
+        op = string ? "=" : "-eq";
+        break;
+    case BinOp::NotEq:
+        op = string ? "!=" : "-ne";
+        break;
+    case BinOp::LT:
+        op = string ? "\\<" : "-lt";
+        break;
+    case BinOp::LTE:
+        op = "-le";
+        break;
+    case BinOp::GT:
+        op = string ? "\\>" : "-gt";
+        break;
+    case BinOp::GTE:
+        op = "-ge";
+        break;
+    default:
+        assert(false && "Not a comparison.");
+    }
+    stream << "[ ";
+    output_test_operand(b->a);
+    stream << " " << op << " ";
+    output_test_operand(b->b);
+    stream << " ]";
+}
+
+// Emit the test of an operand of a logical operator. Bish gives 'and'
+// and 'or' equal precedence, so nested logical operators are always
+// grouped.
+void CodeGen_Sh::output_test_group(IRNode *n) {
+    UnaryOp *u = dyn_cast<UnaryOp>(n);
+    const bool group = is_logical_op(n) || (u && u->op == UnaryOp::Not);
+    if (group) stream << "{ ";
+    output_test(n);
+    if (group) stream << "; }";
+}
+
+// Emit an operand of '[ ... ]'. It is quoted, so that it stays one
+// word if it is empty or contains spaces.
+void CodeGen_Sh::output_test_operand(IRNode *n) {
+    if (isa<String>(n)) {
+        n->accept(this);
+        return;
+    }
+    stream << "\"";
+    disable_quote_variable();
+    enable_functioncall_wrap();
+    n->accept(this);
+    reset_functioncall_wrap();
+    reset_quote_variable();
+    stream << "\"";
+}
+
+// There is no way to read a whole file with the builtins of sh, so
+// read_file() substitutes 'cat'.
+void CodeGen_Sh::output_read(Variable *v, Intrinsic *read) {
+    assert(read->op == Intrinsic::ReadFile);
+    stream << lookup_name(v) << "=$(cat ";
+    enable_quote_variable();
+    enable_functioncall_wrap();
+    read->args[0]->accept(this);
+    reset_functioncall_wrap();
+    reset_quote_variable();
+    stream << ")";
+}
@@ -0,0 +1,40 @@
+#ifndef __BISH_CODEGEN_SH_H__
+#define __BISH_CODEGEN_SH_H__
+
+#include "CodeGen_Bash.h"
+
+namespace Bish {
+
+/** Emits POSIX sh, e.g. for dash or busybox ash, from the same
+ * lowered IR as CodeGen_Bash. Tests use '[ ... ]' joined by '&&' and
+ * '||' instead of '[[ ... ]]', loops over a range are 'while' loops
+ * counting with '$(( ))', and functions are defined without the
+ * 'function' keyword. Functions still declare their variables with
+ * 'local', which all of these shells support, and read_file() runs
+ * 'cat'. Programs using arrays (including lines()), maps, fractional
+ * numbers, 'spawn', parallel or streamed loops, persistent commands,
+ * memoized functions or profiling are rejected, as they are only
+ * implemented with bash features. */
+class CodeGen_Sh : public CodeGen_Bash {
+public:
+    CodeGen_Sh(std::ostream &os) : CodeGen_Bash(os) {
+        append_in_place = false;
+        typed_integers = false;
+    }
+    virtual std::string interpreter() const { return "/bin/sh"; }
+    virtual void visit(Module *);
+protected:
+    virtual void output_command(IRNode *n);
+    virtual void output_function_start(const std::string &name);
+    virtual void output_echo();
+    virtual void output_args();
+    virtual void output_range_loop(ForLoop *n);
+    virtual void output_test(IRNode *n);
+    virtual void output_read(Variable *v, Intrinsic *read);
+private:
+    void output_test_group(IRNode *n);
+    void output_test_operand(IRNode *n);
+};
+
+}
+#endif
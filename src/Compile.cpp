@@ -1,23 +1,44 @@
 #include <cassert>
 #include <cstdlib>
+#include <sstream>
 #include "ByReferencePass.h"
 #include "CodeGen.h"
 #include "CodeGen_Bash.h"
 #include "Compile.h"
 #include "Config.h"
-#include "Parser.h"
+#include "ConstantFoldingPass.h"
+#include "DeadCodePass.h"
+#include "ForkReport.h"
+#include "InlinePass.h"
+#include "LoopInvariantPass.h"
+#include "ModuleCache.h"
 #include "ReturnValuesPass.h"
+#include "Stats.h"
+#include "TailRecursionPass.h"
 #include "TypeChecker.h"
 #include "Util.h"
 
 using namespace Bish;
 
+bool CompileOptions::set_target(const std::string &version) {
+    unsigned major = 0, minor = 0;
+    char dot = 0, rest = 0;
+    std::istringstream s(version);
+    if (!(s >> major >> dot >> minor) || dot != '.' || s >> rest) return false;
+    target_major = major;
+    target_minor = minor;
+    return true;
+}
+
+std::string CompileOptions::target() const {
+    return as_string(target_major) + "." + as_string(target_minor);
+}
+
 namespace {
 
 // Add necessary stdlib functions to the given module.
-void link_stdlib(Bish::Module *m) {
-    Parser p;
-    Module *stdlib = p.parse(get_stdlib_path());
+void link_stdlib(Bish::Module *m, ModuleCache *cache) {
+    Module *stdlib = cache->get(get_stdlib_path());
     // TODO: this seems clunky. Trying to avoid importing stdlib if
     // the user is compiling stdlib itself.
     if (m->path.compare(stdlib->path) != 0) {
@@ -26,34 +47,104 @@ void link_stdlib(Bish::Module *m) {
 }
 
 // Run an ordered list of post-link passes over the IR.
-void link_time_passes(Bish::Module *m) {
+void link_time_passes(Bish::Module *m, const CompileOptions &options) {
+    CompileStats::Timer timer("link_time_passes");
+
+    // Move calls of pure functions with unchanging arguments out of
+    // loops, before they are inlined.
+    {
+        CompileStats::Timer timer("loop_invariant");
+        LoopInvariantPass licm;
+        m->accept(&licm);
+    }
+
+    // Substitute small functions (e.g. stdlib wrappers) at their call
+    // sites. Not when profiling, so that every function keeps its
+    // own entry in the profile.
+    if (!options.profile()) {
+        CompileStats::Timer timer("inline");
+        InlinePass inliner;
+        m->accept(&inliner);
+    }
+
     // Type checking
-    TypeChecker types;
-    m->accept(&types);
+    {
+        CompileStats::Timer timer("type_check");
+        TypeChecker types;
+        m->accept(&types);
+    }
+
+    // Evaluate constant expressions and remove branches that are
+    // never taken.
+    {
+        CompileStats::Timer timer("constant_folding");
+        ConstantFoldingPass constants;
+        m->accept(&constants);
+    }
+
+    // Run self-recursive functions whose recursive calls are tail
+    // calls as loops.
+    {
+        CompileStats::Timer timer("tail_recursion");
+        TailRecursionPass tails;
+        m->accept(&tails);
+    }
 
     // Adjust the IR to handle values that should be passed by
     // reference (e.g. arrays) to functions.
-    ByReferencePass refs;
-    m->accept(&refs);
+    // Namerefs (local -n) were introduced in bash 4.3.
+    {
+        CompileStats::Timer timer("by_reference");
+        ByReferencePass refs(options.target_at_least(4, 3));
+        m->accept(&refs);
+    }
 
     // Convert function return values into global variable
     // assignments.
-    ReturnValuesPass retvals;
-    m->accept(&retvals);
+    {
+        CompileStats::Timer timer("return_values");
+        ReturnValuesPass retvals;
+        m->accept(&retvals);
+    }
+
+    // Remove unreachable functions and unused temporaries.
+    {
+        CompileStats::Timer timer("dead_code");
+        DeadCodePass dce;
+        m->accept(&dce);
+    }
 }
 
 }
 
 // Link and compile the given Module using the given code generator.
-void Bish::compile(Module *m, CodeGenerator *cg) {
-    link_stdlib(m);
-
-    link_time_passes(m);
-    
-    cg->ostream() << "#!/usr/bin/env bash\n"
-    << "# Autogenerated script, compiled from the Bish language.\n"
-    << "# Bish version " << BISH_VERSION << "\n"
-    << "# Please see " << BISH_URL << " for more information about Bish.\n";
+void Bish::compile(Module *m, CodeGenerator *cg, ModuleCache *cache, const CompileOptions &options) {
+    ModuleCache local_cache;
+    {
+        CompileStats::Timer timer("link_stdlib");
+        link_stdlib(m, cache ? cache : &local_cache);
+    }
+
+    link_time_passes(m, options);
+
+    if (options.report_forks()) {
+        // Written in one piece, as batch compilations run in parallel.
+        std::ostringstream report;
+        ForkReport forks(report);
+        m->accept(&forks);
+        std::cerr << report.str();
+    }
+
+    CompileStats::Timer timer("codegen");
+    cg->set_options(options);
+    if (!cg->executes() && options.compact()) {
+        cg->ostream() << "#!" << cg->interpreter() << "\n";
+    } else if (!cg->executes()) {
+        cg->ostream() << "#!" << cg->interpreter() << "\n"
+        << "# Autogenerated script, compiled from the Bish language.\n"
+        << "# Bish version " << BISH_VERSION << "\n"
+        << "# Please see " << BISH_URL << " for more information about Bish.\n";
+    }
     m->accept(cg);
 
     cg->ostream().flush();
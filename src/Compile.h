@@ -2,12 +2,47 @@
 #define __BISH_COMPILE_H__
 
 #include <iostream>
+#include <string>
 #include "CodeGen.h"
 #include "IR.h"
+#include "ModuleCache.h"
 
 namespace Bish {
 
-void compile(Module *m, Bish::CodeGenerator *c);
+// Options controlling compilation.
+class CompileOptions {
+public:
+    CompileOptions() : target_major(4), target_minor(0), report_forks_(false), profile_(false), compact_(false) {}
+    // Set the oldest bash version the output must run on, given as
+    // "<major>.<minor>". Return false if the version is malformed.
+    bool set_target(const std::string &version);
+    std::string target() const;
+    // Return true if the target bash version is at least the given one.
+    bool target_at_least(unsigned major, unsigned minor) const {
+        return target_major > major || (target_major == major && target_minor >= minor);
+    }
+    // Report each function call that forks a subshell on stderr.
+    void set_report_forks(bool b) { report_forks_ = b; }
+    bool report_forks() const { return report_forks_; }
+    // Make the compiled script record a profile of its run time.
+    void set_profile(bool b) { profile_ = b; }
+    bool profile() const { return profile_; }
+    // Emit a script without indentation, comments or empty functions,
+    // with short names for the temporary variables of the compiler.
+    void set_compact(bool b) { compact_ = b; }
+    bool compact() const { return compact_; }
+private:
+    unsigned target_major, target_minor;
+    bool report_forks_;
+    bool profile_;
+    bool compact_;
+};
+
+// Link and compile the given Module using the given code
+// generator. The standard library is obtained from the given module
+// cache, or parsed anew if no cache is given.
+void compile(Module *m, Bish::CodeGenerator *c, ModuleCache *cache=NULL,
+             const CompileOptions &options=CompileOptions());
 
 }
 
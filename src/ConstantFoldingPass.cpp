@@ -0,0 +1,358 @@
+#include <climits>
+#include "CloneIR.h"
+#include "ConstantFoldingPass.h"
+#include "GetAllBlocks.h"
+#include "ReplaceIRNodes.h"
+
+using namespace Bish;
+
+namespace {
+
+// Counts the assignments to, and the distinct variables of, each
+// variable name in a module, and collects the text of the external
+// commands (which may assign any variable).
+class GetVariableNames : public IRVisitor {
+public:
+    GetVariableNames(Module *m) {
+        m->accept(this);
+    }
+
+    unsigned assignments(const Variable *v) const { return count(assigned, v); }
+    unsigned variables(const Variable *v) const { return count(distinct, v); }
+    bool in_command(const Variable *v) const { return commands.find(v->name.base()) != std::string::npos; }
+
+    // Variables are shared between their uses, so they are not
+    // subject to the visited check.
+    virtual void visit(Variable *v) {
+        distinct[v->name.str()].insert(v);
+    }
+
+    virtual void visit(Assignment *node) {
+        // Function call arguments are shared with the enclosing block.
+        if (seen.insert(node).second) assign(node->location->variable);
+        IRVisitor::visit(node);
+    }
+
+    virtual void visit(Intrinsic *node) {
+        if (node->op == Intrinsic::Append) assign(node->target->variable);
+        IRVisitor::visit(node);
+    }
+
+    virtual void visit(ForLoop *node) {
+        assign(node->variable);
+        IRVisitor::visit(node);
+    }
+
+    virtual void visit(ExternCall *node) {
+        for (InterpolatedString::const_iterator I = node->body->begin(), E = node->body->end(); I != E; ++I) {
+            if ((*I).is_str()) commands += (*I).str() + "\n";
+        }
+        IRVisitor::visit(node);
+    }
+private:
+    std::map<std::string, unsigned> assigned;
+    std::map<std::string, std::set<Variable *> > distinct;
+    std::set<Assignment *> seen;
+    std::string commands;
+
+    void assign(Variable *v) {
+        assigned[v->name.str()]++;
+        visit(v);
+    }
+
+    template <class T>
+    static unsigned count(const std::map<std::string, T> &m, const Variable *v) {
+        typename std::map<std::string, T>::const_iterator I = m.find(v->name.str());
+        return I == m.end() ? 0 : size(I->second);
+    }
+    static unsigned size(unsigned n) { return n; }
+    static unsigned size(const std::set<Variable *> &s) { return s.size(); }
+};
+
+// Determines whether an expression contains a call of any kind.
+class HasCalls : public IRVisitor {
+public:
+    HasCalls(IRNode *n) : result(false) {
+        n->accept(this);
+    }
+
+    bool value() const { return result; }
+
+    virtual void visit(FunctionCall *) { result = true; }
+    virtual void visit(ExternCall *) { result = true; }
+    virtual void visit(IORedirection *) { result = true; }
+private:
+    bool result;
+};
+
+Integer *make_integer(long long value) {
+    if (value < INT_MIN || value > INT_MAX) return NULL;
+    Integer *i = new Integer(as_string(value));
+    i->set_type(Type::Integer());
+    return i;
+}
+
+Boolean *make_boolean(bool value) {
+    Boolean *b = new Boolean(value);
+    b->set_type(Type::Boolean());
+    return b;
+}
+
+// Return true if the given string has no variables and no escapes,
+// so that equal text means equal values. Store its text in 'out'.
+bool plain_string(String *s, std::string &out) {
+    out.clear();
+    for (InterpolatedString::const_iterator I = s->value->begin(), E = s->value->end(); I != E; ++I) {
+        if (!(*I).is_str()) return false;
+        out += (*I).str();
+    }
+    return out.find('\\') == std::string::npos;
+}
+
+IRNode *fold_integers(BinOp::Operator op, long long a, long long b) {
+    switch (op) {
+    case BinOp::Add: return make_integer(a + b);
+    case BinOp::Sub: return make_integer(a - b);
+    case BinOp::Mul: return make_integer(a * b);
+    // Division by zero is left to fail at run time.
+    case BinOp::Div: return b == 0 ? NULL : make_integer(a / b);
+    case BinOp::Mod: return b == 0 ? NULL : make_integer(a % b);
+    case BinOp::Eq: return make_boolean(a == b);
+    case BinOp::NotEq: return make_boolean(a != b);
+    case BinOp::LT: return make_boolean(a < b);
+    case BinOp::LTE: return make_boolean(a <= b);
+    case BinOp::GT: return make_boolean(a > b);
+    case BinOp::GTE: return make_boolean(a >= b);
+    default: return NULL;
+    }
+}
+
+IRNode *fold_booleans(BinOp::Operator op, bool a, bool b) {
+    switch (op) {
+    case BinOp::Eq: return make_boolean(a == b);
+    case BinOp::NotEq: return make_boolean(a != b);
+    case BinOp::And: return make_boolean(a && b);
+    case BinOp::Or: return make_boolean(a || b);
+    default: return NULL;
+    }
+}
+
+// Only equality is folded: ordering depends on the locale of bash.
+IRNode *fold_strings(BinOp::Operator op, const std::string &a, const std::string &b) {
+    switch (op) {
+    case BinOp::Eq: return make_boolean(a == b);
+    case BinOp::NotEq: return make_boolean(a != b);
+    default: return NULL;
+    }
+}
+
+}
+
+void ConstantFoldingPass::visit(Module *node) {
+    find_constants(node);
+    IRVisitor::visit(node);
+
+    ReplaceIRNodes replace(folded);
+    node->accept(&replace);
+
+    GetAllBlocks all(node);
+    for (std::vector<Block *>::const_iterator I = all.blocks().begin(), E = all.blocks().end(); I != E; ++I) {
+        remove_dead_branches(*I);
+    }
+}
+
+// Fold the global variable initializers in order, recording the
+// globals that are constant. Initializers run before any function,
+// unless they call one: later globals may then be read before they
+// are initialized.
+void ConstantFoldingPass::find_constants(Module *m) {
+    GetVariableNames names(m);
+    bool propagate = true;
+    for (std::vector<IRNode *>::iterator I = m->global_variables->nodes.begin(),
+             E = m->global_variables->nodes.end(); I != E; ++I) {
+        (*I)->accept(this);
+        if (HasCalls(*I).value()) propagate = false;
+        Assignment *a = dyn_cast<Assignment>(*I);
+        if (!propagate || a == NULL || !a->location->is_variable() || a->values.size() != 1) continue;
+        Variable *v = a->location->variable;
+        if (!v->global || v->type().array()) continue;
+        if (names.assignments(v) != 1 || names.variables(v) != 1 || names.in_command(v)) continue;
+        if (IRNode *value = literal(a->values[0])) constants[v] = value;
+    }
+}
+
+// Replace if statements whose conditions are literals with the
+// branch taken, if any.
+void ConstantFoldingPass::remove_dead_branches(Block *b) {
+    for (unsigned i = 0; i < b->nodes.size(); ) {
+        IfStatement *s = dyn_cast<IfStatement>(b->nodes[i]);
+        if (s == NULL) {
+            i++;
+            continue;
+        }
+        std::vector<PredicatedBlock *> branches(1, s->pblock), live;
+        branches.insert(branches.end(), s->elses.begin(), s->elses.end());
+        IRNode *otherwise = s->elseblock;
+        for (std::vector<PredicatedBlock *>::iterator I = branches.begin(), E = branches.end(); I != E; ++I) {
+            Boolean *c = dyn_cast<Boolean>((*I)->condition);
+            if (c == NULL) {
+                live.push_back(*I);
+            } else if (c->value) {
+                // Later branches are never taken.
+                otherwise = (*I)->body;
+                break;
+            }
+        }
+        if (!live.empty()) {
+            s->pblock = live[0];
+            s->elses.assign(live.begin() + 1, live.end());
+            s->elseblock = otherwise;
+            i++;
+            continue;
+        }
+        // No condition is evaluated, so the statement is replaced by
+        // the statements of the branch taken. Bash locals are
+        // function scoped, so this does not change their scope.
+        b->nodes.erase(b->nodes.begin() + i);
+        if (Block *taken = dyn_cast<Block>(otherwise)) {
+            b->nodes.insert(b->nodes.begin() + i, taken->nodes.begin(), taken->nodes.end());
+        } else if (otherwise) {
+            b->nodes.insert(b->nodes.begin() + i, otherwise);
+        }
+    }
+}
+
+// Return the node the given node is replaced with, or the node
+// itself if it is not replaced.
+IRNode *ConstantFoldingPass::value(IRNode *n) {
+    std::map<IRNode *, IRNode *>::iterator I = folded.find(n);
+    return I == folded.end() ? n : I->second;
+}
+
+// Return the literal value of the given node, or NULL if it is not
+// known at compile time.
+IRNode *ConstantFoldingPass::literal(IRNode *n) {
+    n = value(n);
+    std::string text;
+    if (dyn_cast<Integer>(n) || dyn_cast<Boolean>(n)) return n;
+    if (String *s = dyn_cast<String>(n)) return plain_string(s, text) ? n : NULL;
+    return NULL;
+}
+
+void ConstantFoldingPass::fold(IRNode *n, IRNode *value) {
+    if (value && folded.count(n) == 0) folded[n] = value;
+}
+
+void ConstantFoldingPass::visit(Location *node) {
+    IRVisitor::visit(node);
+    if (!node->is_variable()) return;
+    std::map<Variable *, IRNode *>::iterator I = constants.find(node->variable);
+    if (I != constants.end() && folded.count(node) == 0) {
+        // Every read gets its own copy of the value.
+        CloneIR cloner;
+        IRNode *value = cloner.clone(I->second);
+        value->set_type(I->second->type());
+        fold(node, value);
+    }
+}
+
+// Range bounds are variables rather than locations.
+void ConstantFoldingPass::visit(ForLoop *node) {
+    IRVisitor::visit(node);
+    IRNode *bounds[] = { node->lower, node->upper };
+    for (unsigned i = 0; i < 2; i++) {
+        Variable *v = dyn_cast<Variable>(bounds[i]);
+        std::map<Variable *, IRNode *>::iterator I = constants.find(v);
+        if (v && I != constants.end()) fold(v, I->second);
+    }
+}
+
+void ConstantFoldingPass::visit(Assignment *node) {
+    // The assigned location is not read.
+    if (node->location->offset) node->location->offset->accept(this);
+    for (std::vector<IRNode *>::const_iterator I = node->values.begin(),
+             E = node->values.end(); I != E; ++I) {
+        (*I)->accept(this);
+    }
+}
+
+void ConstantFoldingPass::visit(Intrinsic *node) {
+    // The target is an array (or, for len(), possibly a string),
+    // which must remain a variable.
+    for (std::vector<IRNode *>::const_iterator I = node->args.begin(),
+             E = node->args.end(); I != E; ++I) {
+        (*I)->accept(this);
+    }
+}
+
+void ConstantFoldingPass::visit(BinOp *node) {
+    IRVisitor::visit(node);
+    IRNode *a = literal(node->a), *b = literal(node->b);
+    if (node->op == BinOp::And || node->op == BinOp::Or) {
+        // With one literal operand, the result is either the other
+        // operand or the literal, e.g. 'x and true' is 'x'. The other
+        // operand is only dropped if it has no side effects.
+        Boolean *ba = dyn_cast<Boolean>(a), *bb = dyn_cast<Boolean>(b);
+        const bool identity = node->op == BinOp::And;
+        if (ba && !bb) {
+            fold(node, ba->value == identity ? value(node->b) : ba);
+            return;
+        } else if (bb && !ba) {
+            if (bb->value == identity) {
+                fold(node, value(node->a));
+            } else if (!HasCalls(node->a).value()) {
+                fold(node, bb);
+            }
+            return;
+        }
+    }
+    if (a == NULL || b == NULL) return;
+    std::string sa, sb;
+    if (Integer *ia = dyn_cast<Integer>(a)) {
+        if (Integer *ib = dyn_cast<Integer>(b)) {
+            fold(node, fold_integers(node->op, ia->value, ib->value));
+        }
+    } else if (Boolean *ba = dyn_cast<Boolean>(a)) {
+        if (Boolean *bb = dyn_cast<Boolean>(b)) {
+            fold(node, fold_booleans(node->op, ba->value, bb->value));
+        }
+    } else if (String *stra = dyn_cast<String>(a)) {
+        String *strb = dyn_cast<String>(b);
+        if (strb && plain_string(stra, sa) && plain_string(strb, sb)) {
+            fold(node, fold_strings(node->op, sa, sb));
+        }
+    }
+}
+
+// Constants interpolated in a string become part of its text.
+void ConstantFoldingPass::visit(String *node) {
+    std::map<Variable *, std::string> text;
+    for (InterpolatedString::const_iterator I = node->value->begin(), E = node->value->end(); I != E; ++I) {
+        if (!(*I).is_var()) continue;
+        std::map<Variable *, IRNode *>::iterator C = constants.find((*I).var());
+        if (C == constants.end()) continue;
+        std::string s;
+        if (Integer *i = dyn_cast<Integer>(C->second)) {
+            text[C->first] = as_string(i->value);
+        } else if (String *str = dyn_cast<String>(C->second)) {
+            // Text bash expands (e.g. "$(date)") is left to the
+            // variable, which expands it once.
+            if (plain_string(str, s) && s.find_first_of("$`") == std::string::npos) text[C->first] = s;
+        }
+    }
+    if (!text.empty()) node->value->substitute(text);
+}
+
+void ConstantFoldingPass::visit(UnaryOp *node) {
+    IRVisitor::visit(node);
+    IRNode *a = literal(node->a);
+    if (a == NULL) return;
+    switch (node->op) {
+    case UnaryOp::Negate:
+        if (Integer *i = dyn_cast<Integer>(a)) fold(node, make_integer(-(long long)i->value));
+        break;
+    case UnaryOp::Not:
+        if (Boolean *b = dyn_cast<Boolean>(a)) fold(node, make_boolean(!b->value));
+        break;
+    }
+}
@@ -0,0 +1,43 @@
+#ifndef __BISH_CONSTANT_FOLDING_PASS_H__
+#define __BISH_CONSTANT_FOLDING_PASS_H__
+
+#include <map>
+#include "IR.h"
+#include "IRVisitor.h"
+
+namespace Bish {
+
+/** This pass evaluates operators whose operands are all literals
+ * (e.g. '2 * 60 * 60' or '"a" == "b"') at compile time, and removes
+ * the branches of if statements whose conditions become literals.
+ * Global variables that are initialized to a literal and never
+ * assigned again are propagated to the places they are read, as long
+ * as no other variable of the same name exists (bash variables are
+ * dynamically scoped), including to the strings they are
+ * interpolated in. Must run after TypeChecker. */
+class ConstantFoldingPass : public IRVisitor {
+public:
+    virtual void visit(Module *);
+    virtual void visit(Location *);
+    virtual void visit(ForLoop *);
+    virtual void visit(Assignment *);
+    virtual void visit(Intrinsic *);
+    virtual void visit(BinOp *);
+    virtual void visit(UnaryOp *);
+    virtual void visit(String *);
+private:
+    // Replacements of folded nodes and propagated variable reads.
+    std::map<IRNode *, IRNode *> folded;
+    // Literal values of propagated global variables.
+    std::map<Variable *, IRNode *> constants;
+
+    void find_constants(Module *m);
+    void remove_dead_branches(Block *b);
+    IRNode *value(IRNode *n);
+    IRNode *literal(IRNode *n);
+    void fold(IRNode *n, IRNode *value);
+};
+
+}
+
+#endif
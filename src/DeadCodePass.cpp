@@ -0,0 +1,180 @@
+#include <set>
+#include "CallGraph.h"
+#include "DeadCodePass.h"
+#include "GetAllBlocks.h"
+#include "IRAncestorsPass.h"
+
+using namespace Bish;
+
+namespace {
+
+// Constructs the set of functions called directly from an IR node,
+// e.g. the global variable initializers.
+class GetCalledFunctions : public IRVisitor {
+public:
+    GetCalledFunctions(IRNode *n) {
+        n->accept(this);
+    }
+
+    const std::set<Function *> &functions() const { return called; }
+
+    virtual void visit(FunctionCall *call) {
+        called.insert(call->function);
+        IRVisitor::visit(call);
+    }
+private:
+    std::set<Function *> called;
+};
+
+// Constructs the set of names of all variables read in a module.
+class GetReadVariables : public IRVisitor {
+public:
+    GetReadVariables(Module *m) {
+        m->accept(this);
+    }
+
+    bool is_read(const Variable *v) const { return names.count(v->name.str()); }
+
+    // Variables are shared between their uses, so they are not
+    // subject to the visited check.
+    virtual void visit(Variable *v) {
+        names.insert(v->name.str());
+        if (v->reference) names.insert(v->reference->name.str());
+    }
+
+    virtual void visit(Assignment *node) {
+        // The assigned variable is written, not read.
+        if (node->location->offset) node->location->offset->accept(this);
+        for (std::vector<IRNode *>::const_iterator I = node->values.begin(),
+                 E = node->values.end(); I != E; ++I) {
+            (*I)->accept(this);
+        }
+    }
+
+    virtual void visit(FunctionCall *call) {
+        // Arguments are passed by expanding the variables they are
+        // assigned to.
+        for (std::vector<Assignment *>::const_iterator I = call->args.begin(),
+                 E = call->args.end(); I != E; ++I) {
+            visit((*I)->location->variable);
+        }
+        // A call in a pipeline prints the return value of the callee.
+        if (call->function->return_value) visit(call->function->return_value);
+        IRVisitor::visit(call);
+    }
+
+    virtual void visit(ExternCall *node) {
+        visit(node->body);
+    }
+
+    virtual void visit(String *node) {
+        visit(node->value);
+    }
+private:
+    std::set<std::string> names;
+
+    void visit(InterpolatedString *s) {
+        for (InterpolatedString::const_iterator I = s->begin(), E = s->end(); I != E; ++I) {
+            if ((*I).is_var()) visit((*I).var());
+        }
+    }
+};
+
+// Determines whether an expression may have side effects, i.e. whether
+// it contains a call of any kind.
+class HasSideEffects : public IRVisitor {
+public:
+    HasSideEffects(IRNode *n) : result(false) {
+        n->accept(this);
+    }
+
+    bool value() const { return result; }
+
+    virtual void visit(FunctionCall *) { result = true; }
+    virtual void visit(ExternCall *) { result = true; }
+    virtual void visit(IORedirection *) { result = true; }
+private:
+    bool result;
+};
+
+// Return true if the given name was generated by the compiler
+// (e.g. _0, _rv_0, _global_retval_0 or _global_ref_0), possibly
+// renamed by inlining (e.g. _inline0__0).
+bool is_temporary(std::string name) {
+    const std::string inlined = "_inline";
+    while (name.compare(0, inlined.size(), inlined) == 0) {
+        std::size_t end = name.find_first_not_of("0123456789", inlined.size());
+        if (end == std::string::npos || end == inlined.size() || name[end] != '_') return false;
+        name.erase(0, end + 1);
+    }
+    const char *prefixes[] = { "_global_retval_", "_global_ref_", "_rv_", "_" };
+    for (unsigned i = 0; i < sizeof(prefixes) / sizeof(prefixes[0]); i++) {
+        const std::string prefix(prefixes[i]);
+        if (name.size() > prefix.size() && name.compare(0, prefix.size(), prefix) == 0 &&
+            name.find_first_not_of("0123456789", prefix.size()) == std::string::npos) {
+            return true;
+        }
+    }
+    return false;
+}
+
+}
+
+void DeadCodePass::visit(Module *m) {
+    remove_unreachable_functions(m);
+    while (remove_dead_stores(m));
+}
+
+// Remove all functions not reachable from main or from the global
+// variable initializers.
+void DeadCodePass::remove_unreachable_functions(Module *m) {
+    // The call graph relies on parent links, which earlier passes do
+    // not maintain.
+    IRAncestorsPass ancestors;
+    m->accept(&ancestors);
+    CallGraphBuilder cgb;
+    CallGraph cg = cgb.build(m);
+
+    GetCalledFunctions global_calls(m->global_variables);
+    std::vector<Function *> roots(global_calls.functions().begin(), global_calls.functions().end());
+    roots.push_back(m->main);
+    std::set<Function *> reachable(roots.begin(), roots.end());
+    for (std::vector<Function *>::iterator I = roots.begin(), E = roots.end(); I != E; ++I) {
+        std::vector<Function *> calls = cg.transitive_calls(*I);
+        reachable.insert(calls.begin(), calls.end());
+    }
+
+    std::vector<Function *> functions;
+    for (std::vector<Function *>::iterator I = m->functions.begin(), E = m->functions.end(); I != E; ++I) {
+        if (reachable.count(*I)) functions.push_back(*I);
+    }
+    m->set_functions(functions);
+}
+
+// Remove assignments to temporaries that are never read. Return true
+// if any assignment was removed.
+bool DeadCodePass::remove_dead_stores(Module *m) {
+    GetReadVariables reads(m);
+    GetAllBlocks all(m);
+    bool changed = false;
+    for (std::vector<Block *>::const_iterator BI = all.blocks().begin(), BE = all.blocks().end();
+         BI != BE; ++BI) {
+        std::vector<IRNode *> &nodes = (*BI)->nodes;
+        std::vector<IRNode *> kept;
+        for (std::vector<IRNode *>::iterator I = nodes.begin(), E = nodes.end(); I != E; ++I) {
+            Assignment *a = dyn_cast<Assignment>(*I);
+            bool dead = a && is_temporary(a->location->variable->name.str()) &&
+                !reads.is_read(a->location->variable);
+            for (unsigned i = 0; dead && i < a->values.size(); i++) {
+                dead = !HasSideEffects(a->values[i]).value();
+            }
+            if (dead) {
+                changed = true;
+            } else {
+                kept.push_back(*I);
+            }
+        }
+        nodes.swap(kept);
+    }
+    return changed;
+}
@@ -0,0 +1,25 @@
+#ifndef __BISH_DEAD_CODE_PASS_H__
+#define __BISH_DEAD_CODE_PASS_H__
+
+#include "IR.h"
+#include "IRVisitor.h"
+
+namespace Bish {
+
+/** This pass removes code that cannot affect the output of a linked
+ * module: functions that are not reachable from main (or from the
+ * global variable initializers), and assignments to compiler
+ * generated temporaries (e.g. _global_retval_0 or _global_ref_0) that
+ * are never read and whose value has no side effects. Variables are
+ * matched by name, since bash variables are dynamically scoped. */
+class DeadCodePass : public IRVisitor {
+public:
+    virtual void visit(Module *);
+private:
+    void remove_unreachable_functions(Module *m);
+    bool remove_dead_stores(Module *m);
+};
+
+}
+
+#endif
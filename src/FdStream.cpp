@@ -0,0 +1,52 @@
+#include <cerrno>
+#include <unistd.h>
+#include "FdStream.h"
+
+using namespace Bish;
+
+FdStreamBuf::FdStreamBuf(int f, std::size_t size) : fd(f), ok_(true), buffer(size) {
+    setp(&buffer[0], &buffer[0] + buffer.size());
+}
+
+FdStreamBuf::~FdStreamBuf() {
+    close();
+}
+
+void FdStreamBuf::close() {
+    if (fd < 0) return;
+    flush_buffer();
+    ::close(fd);
+    fd = -1;
+}
+
+FdStreamBuf::int_type FdStreamBuf::overflow(int_type c) {
+    flush_buffer();
+    if (fd < 0) return traits_type::eof();
+    if (!traits_type::eq_int_type(c, traits_type::eof())) {
+        *pptr() = traits_type::to_char_type(c);
+        pbump(1);
+    }
+    return traits_type::not_eof(c);
+}
+
+int FdStreamBuf::sync() {
+    flush_buffer();
+    return 0;
+}
+
+// Write out the buffered data.
+void FdStreamBuf::flush_buffer() {
+    const char *p = pbase();
+    std::size_t left = pptr() - pbase();
+    while (fd >= 0 && ok_ && left > 0) {
+        ssize_t n = write(fd, p, left);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            ok_ = false;
+            break;
+        }
+        p += n;
+        left -= n;
+    }
+    setp(&buffer[0], &buffer[0] + buffer.size());
+}
@@ -0,0 +1,52 @@
+#ifndef __BISH_FD_STREAM_H__
+#define __BISH_FD_STREAM_H__
+
+#include <ostream>
+#include <streambuf>
+#include <vector>
+
+namespace Bish {
+
+// Stream buffer writing to a file descriptor through a buffer of
+// the given size. Writes that fail (e.g. because the reader of a
+// pipe has exited) are dropped, and reported by ok().
+class FdStreamBuf : public std::streambuf {
+public:
+    FdStreamBuf(int fd, std::size_t size=64 * 1024);
+    ~FdStreamBuf();
+    // Flush the buffer and close the file descriptor.
+    void close();
+    // Return false if any write failed.
+    bool ok() const { return ok_; }
+protected:
+    virtual int_type overflow(int_type c);
+    virtual int sync();
+private:
+    int fd;
+    bool ok_;
+    std::vector<char> buffer;
+
+    void flush_buffer();
+
+    // Disallow copying.
+    FdStreamBuf(const FdStreamBuf &);
+    FdStreamBuf &operator=(const FdStreamBuf &);
+};
+
+// Output stream writing to a file descriptor, which is closed when
+// the stream is destroyed.
+// Example:
+//     FdOStream os(fd);
+//     os << "echo hello\n";
+class FdOStream : public std::ostream {
+public:
+    FdOStream(int fd) : std::ostream(NULL), buf(fd) { rdbuf(&buf); }
+    void close() { buf.close(); }
+    bool ok() const { return buf.ok(); }
+private:
+    FdStreamBuf buf;
+};
+
+}
+
+#endif
@@ -8,7 +8,7 @@ FindCallsToModule::FindCallsToModule(Module *m) {
         Function *f = *I;
         // Skip calls to the module's main function.
         if (f == m->main) continue;
-        to_find.insert(f->name.name);
+        to_find.insert(f->name.base());
     }
 }
 
@@ -22,7 +22,7 @@ std::vector<FunctionCall *> FindCallsToModule::function_calls() const {
 
 void FindCallsToModule::visit(FunctionCall *call) {
     IRVisitor::visit(call);
-    if (to_find.count(call->function->name.name)) {
+    if (to_find.count(call->function->name.base())) {
         calls.insert(call->function->name);
         fcalls.push_back(call);
     }
@@ -0,0 +1,100 @@
+#ifndef __BISH_FLAT_HASH_H__
+#define __BISH_FLAT_HASH_H__
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace Bish {
+
+// FNV-1a hash of a string.
+struct StringHash {
+    std::size_t operator()(const std::string &s) const {
+        std::size_t h = 2166136261u;
+        for (std::size_t i = 0; i < s.size(); i++) {
+            h = (h ^ (unsigned char)s[i]) * 16777619u;
+        }
+        return h;
+    }
+};
+
+// Hash of an integer, spreading its low bits.
+struct IntegerHash {
+    std::size_t operator()(unsigned k) const {
+        return k * 2654435761u;
+    }
+};
+
+/* Hash map with open addressing: keys and values are stored in one
+ * array, and collisions probe the following slots. Entries can not be
+ * removed, so a table only grows; map a key to a sentinel value
+ * instead. Key and Value must be default constructible. Pointers to
+ * values are invalidated by insertion.
+ * Example:
+ *     FlatHashMap<std::string, int, StringHash> m;
+ *     m.insert("a", 1);
+ *     int *v = m.find("a");
+ */
+template <class Key, class Value, class Hash>
+class FlatHashMap {
+public:
+    FlatHashMap() : slots(16), used(0) {}
+
+    // Return the value of the given key, or NULL if it has none.
+    Value *find(const Key &k) {
+        Slot &s = slots[probe(k)];
+        return s.full ? &s.value : NULL;
+    }
+
+    const Value *find(const Key &k) const {
+        const Slot &s = slots[probe(k)];
+        return s.full ? &s.value : NULL;
+    }
+
+    // Set the value of the given key, and return it.
+    Value &insert(const Key &k, const Value &v) {
+        // Grow when three quarters full, so probe sequences stay short.
+        if (4 * (used + 1) > 3 * slots.size()) grow();
+        Slot &s = slots[probe(k)];
+        if (!s.full) {
+            s.full = true;
+            s.key = k;
+            used++;
+        }
+        s.value = v;
+        return s.value;
+    }
+
+    std::size_t size() const { return used; }
+private:
+    struct Slot {
+        bool full;
+        Key key;
+        Value value;
+        Slot() : full(false), key(), value() {}
+    };
+    // The number of slots is a power of two.
+    std::vector<Slot> slots;
+    std::size_t used;
+
+    // Return the index of the slot of the given key, or of the empty
+    // slot where it would be inserted.
+    std::size_t probe(const Key &k) const {
+        const std::size_t mask = slots.size() - 1;
+        std::size_t i = Hash()(k) & mask;
+        while (slots[i].full && !(slots[i].key == k)) i = (i + 1) & mask;
+        return i;
+    }
+
+    void grow() {
+        std::vector<Slot> old(slots.size() * 2);
+        old.swap(slots);
+        for (std::size_t i = 0; i < old.size(); i++) {
+            if (old[i].full) slots[probe(old[i].key)] = old[i];
+        }
+    }
+};
+
+}
+
+#endif
@@ -0,0 +1,43 @@
+#include "ForkReport.h"
+
+using namespace Bish;
+
+void ForkReport::report(FunctionCall *call, const std::string &reason) {
+    count++;
+    stream << "Call to " << call->function->name.str('.') << " forks a subshell: " << reason;
+    std::string where = call->debug_info().str();
+    if (!where.empty()) stream << ", " << where;
+    stream << "\n";
+}
+
+// A call that is a statement of its own runs in the calling shell,
+// also when its output is redirected to a file.
+void ForkReport::visit(Block *node) {
+    for (std::vector<IRNode *>::const_iterator I = node->nodes.begin(), E = node->nodes.end(); I != E; ++I) {
+        IRNode *stmt = *I;
+        IORedirection *r;
+        while ((r = dyn_cast<IORedirection>(stmt)) && r->op != IORedirection::Pipe) stmt = r->a;
+        if (FunctionCall *call = dyn_cast<FunctionCall>(stmt)) handled.insert(call);
+    }
+    IRVisitor::visit(node);
+}
+
+void ForkReport::visit(IORedirection *node) {
+    IRNode *stages[] = { node->a, node->b };
+    for (unsigned i = 0; node->op == IORedirection::Pipe && i < 2; i++) {
+        if (FunctionCall *call = dyn_cast<FunctionCall>(stages[i])) {
+            if (handled.insert(call).second) report(call, "it is a pipeline stage");
+        }
+    }
+    IRVisitor::visit(node);
+}
+
+// Any other call is used as a value. ReturnValuesPass has moved
+// calls returning a value out of expressions, so this call captures
+// the output of a function without a return value.
+void ForkReport::visit(FunctionCall *node) {
+    if (handled.insert(node).second) {
+        report(node, "its output is captured, but it returns no value");
+    }
+    IRVisitor::visit(node);
+}
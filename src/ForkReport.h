@@ -0,0 +1,36 @@
+#ifndef __BISH_FORK_REPORT_H__
+#define __BISH_FORK_REPORT_H__
+
+#include <iostream>
+#include "IR.h"
+#include "IRVisitor.h"
+
+namespace Bish {
+
+// Report every call to a function which the generated bash runs in
+// a subshell instead of in the calling shell, with the reason. Run
+// this over a module after the link-time passes.
+// Example:
+//     ForkReport report(std::cerr);
+//     m->accept(&report);
+class ForkReport : public IRVisitor {
+public:
+    ForkReport(std::ostream &os) : stream(os), count(0) {}
+    // Return the number of calls reported.
+    unsigned forks() const { return count; }
+
+    virtual void visit(Block *);
+    virtual void visit(IORedirection *);
+    virtual void visit(FunctionCall *);
+private:
+    std::ostream &stream;
+    unsigned count;
+    // Calls emitted as a statement or as a pipeline stage.
+    std::set<FunctionCall *> handled;
+
+    void report(FunctionCall *call, const std::string &reason);
+};
+
+}
+
+#endif
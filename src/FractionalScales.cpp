@@ -0,0 +1,230 @@
+#include <algorithm>
+#include <cstdio>
+#include "FractionalScales.h"
+
+using namespace Bish;
+
+const int FractionalScales::Unknown;
+const int FractionalScales::MaxScale;
+const int FractionalScales::DivisionScale;
+
+namespace {
+
+// Return the number of fractional digits of the given literal, at
+// least one, or Unknown if it has too many.
+int literal_scale(double value) {
+    std::string s = FractionalScales::format(value, FractionalScales::Unknown);
+    if (s.find_first_of("eEn") != std::string::npos) return FractionalScales::Unknown;
+    size_t dot = s.find('.');
+    int digits = dot == std::string::npos ? 1 : s.size() - dot - 1;
+    return digits > FractionalScales::MaxScale ? FractionalScales::Unknown : digits;
+}
+
+}
+
+FractionalScales::FractionalScales(Module *m) : fixed(false), awk(false) {
+    m->accept(this);
+    // Values may be copies of each other, so scales propagate until
+    // nothing changes. Scales only grow, and never beyond MaxScale.
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (unsigned i = 0; i < values.size(); i++) {
+            int &current = scales[find(values[i].first)];
+            if (current == Unknown) continue;
+            int s = scale(values[i].second, false);
+            int next = s == Unknown ? Unknown : std::max(current, s);
+            if (next != current) {
+                current = next;
+                changed = true;
+            }
+        }
+    }
+    for (unsigned i = 0; i < operations.size(); i++) {
+        if (scale(operations[i]) == Unknown) {
+            awk = true;
+        } else {
+            // Scaled integers too large for bash are computed by awk.
+            fixed = true;
+            if (arithmetic(operations[i])) awk = true;
+        }
+    }
+    for (unsigned i = 0; i < values.size(); i++) {
+        if (arithmetic(values[i].second) && scale(values[i].first) == Unknown) awk = true;
+    }
+}
+
+bool FractionalScales::fractional(const Type &t) {
+    return t.fractional() || (t.array() && t.element().fractional());
+}
+
+bool FractionalScales::arithmetic(IRNode *n) {
+    if (BinOp *b = dyn_cast<BinOp>(n)) {
+        switch (b->op) {
+        case BinOp::Add:
+        case BinOp::Sub:
+        case BinOp::Mul:
+        case BinOp::Div:
+        case BinOp::Mod:
+            return b->type().fractional();
+        default:
+            return false;
+        }
+    } else if (UnaryOp *u = dyn_cast<UnaryOp>(n)) {
+        return u->op == UnaryOp::Negate && u->type().fractional();
+    }
+    return false;
+}
+
+bool FractionalScales::comparison(IRNode *n) {
+    if (BinOp *b = dyn_cast<BinOp>(n)) {
+        switch (b->op) {
+        case BinOp::Eq:
+        case BinOp::NotEq:
+        case BinOp::LT:
+        case BinOp::LTE:
+        case BinOp::GT:
+        case BinOp::GTE:
+            return b->a->type().fractional();
+        default:
+            return false;
+        }
+    }
+    return false;
+}
+
+std::string FractionalScales::format(double value, int scale) {
+    char buf[64];
+    if (scale == Unknown) {
+        snprintf(buf, sizeof(buf), "%.15g", value);
+    } else {
+        snprintf(buf, sizeof(buf), "%.*f", scale, value);
+    }
+    std::string s(buf);
+    if (scale != Unknown && s.find('.') != std::string::npos) {
+        // Written as the generated code writes computed values, so that
+        // they do not depend on the scale: 3.75, not 3.750.
+        s.erase(std::max(s.find_last_not_of('0'), s.find('.') + 1) + 1);
+    }
+    // Values without a fractional part are still written as fractional.
+    if (scale == Unknown && s.find_first_of(".eEn") == std::string::npos) s += ".0";
+    return s;
+}
+
+Variable *FractionalScales::find(Variable *v) {
+    std::map<Variable *, Variable *>::iterator I = parent.find(v);
+    if (I == parent.end() || I->second == v) return v;
+    Variable *root = find(I->second);
+    I->second = root;
+    return root;
+}
+
+void FractionalScales::unify(Variable *a, Variable *b) {
+    Variable *ra = find(a), *rb = find(b);
+    if (ra == rb) return;
+    int sa = scales[ra], sb = scales[rb];
+    parent[ra] = rb;
+    scales[rb] = (sa == Unknown || sb == Unknown) ? Unknown : std::max(sa, sb);
+    scales.erase(ra);
+}
+
+// Record that 'value' is stored in 'v'. Variables are copied as they
+// are when 'copy' is set, so they share the scale of 'v'; anything
+// else is converted to the scale of 'v' when it is stored.
+void FractionalScales::assign(Variable *v, IRNode *value, bool copy) {
+    Location *l = dyn_cast<Location>(value);
+    if (l && (copy || l->is_variable())) {
+        unify(v, l->variable);
+    } else if (Intrinsic *i = dyn_cast<Intrinsic>(value)) {
+        assert(i->op == Intrinsic::Slice);
+        unify(v, i->target->variable);
+    } else {
+        values.push_back(std::make_pair(v, value));
+    }
+}
+
+int FractionalScales::scale(Variable *v) {
+    if (!fractional(v->type())) return Unknown;
+    std::map<Variable *, int>::iterator I = scales.find(find(v));
+    if (I == scales.end() || I->second == 0) return Unknown;
+    return I->second;
+}
+
+int FractionalScales::scale(IRNode *n) {
+    return scale(n, true);
+}
+
+// Return the scale of the given expression. Before the analysis is
+// final, variables without a known value yet have scale zero.
+int FractionalScales::scale(IRNode *n, bool final) {
+    if (Fractional *f = dyn_cast<Fractional>(n)) {
+        return literal_scale(f->value);
+    } else if (Location *l = dyn_cast<Location>(n)) {
+        if (final) return scale(l->variable);
+        return fractional(l->variable->type()) ? scales[find(l->variable)] : Unknown;
+    } else if (Variable *v = dyn_cast<Variable>(n)) {
+        if (final) return scale(v);
+        return fractional(v->type()) ? scales[find(v)] : Unknown;
+    } else if (BinOp *b = dyn_cast<BinOp>(n)) {
+        if (!arithmetic(b) && !comparison(b)) return Unknown;
+        int sa = scale(b->a, final), sb = scale(b->b, final);
+        if (sa == Unknown || sb == Unknown) return Unknown;
+        switch (b->op) {
+        case BinOp::Mul:
+            // Products are exact, up to MaxScale digits.
+            return std::min(sa + sb, MaxScale);
+        case BinOp::Div:
+            return std::max(std::max(sa, sb), DivisionScale);
+        default:
+            return std::max(sa, sb);
+        }
+    } else if (UnaryOp *u = dyn_cast<UnaryOp>(n)) {
+        return arithmetic(u) ? scale(u->a, final) : Unknown;
+    }
+    return Unknown;
+}
+
+void FractionalScales::visit(Assignment *node) {
+    IRVisitor::visit(node);
+    Variable *v = node->location->variable;
+    if (!fractional(v->type())) return;
+    // The elements of an array can not be converted one by one.
+    bool array = node->values.size() > 1 || v->type().array();
+    for (unsigned i = 0; i < node->values.size(); i++) {
+        assign(v, node->values[i], array);
+    }
+}
+
+void FractionalScales::visit(FunctionCall *node) {
+    IRVisitor::visit(node);
+    for (unsigned i = 0; i < node->args.size(); i++) {
+        Variable *param = node->function->args[i];
+        if (!fractional(param->type())) continue;
+        unify(node->args[i]->location->variable, param);
+        if (param->reference) unify(param, param->reference);
+    }
+}
+
+void FractionalScales::visit(Intrinsic *node) {
+    IRVisitor::visit(node);
+    if (node->op == Intrinsic::Append && fractional(node->target->variable->type())) {
+        assign(node->target->variable, node->args[0], true);
+    }
+}
+
+void FractionalScales::visit(ForLoop *node) {
+    IRVisitor::visit(node);
+    if (node->upper == NULL && fractional(node->variable->type())) {
+        assign(node->variable, node->lower, true);
+    }
+}
+
+void FractionalScales::visit(BinOp *node) {
+    IRVisitor::visit(node);
+    if (arithmetic(node) || comparison(node)) operations.push_back(node);
+}
+
+void FractionalScales::visit(UnaryOp *node) {
+    IRVisitor::visit(node);
+    if (arithmetic(node)) operations.push_back(node);
+}
@@ -0,0 +1,80 @@
+#ifndef __BISH_FRACTIONAL_SCALES_H__
+#define __BISH_FRACTIONAL_SCALES_H__
+
+#include <map>
+#include <string>
+#include <vector>
+#include "IR.h"
+#include "IRVisitor.h"
+
+namespace Bish {
+
+/** Fractional values are stored in bash as decimal strings. This
+ * analysis finds for every fractional variable a scale, i.e. the
+ * number of fractional digits all of its values are stored with, so
+ * that code generation can compute with them as scaled integers in
+ * bash's own arithmetic. Variables which share their values (copies,
+ * arguments and the parameters they are passed to, arrays and their
+ * elements) get the same scale. A variable has no known scale if one
+ * of its values has more than MaxScale fractional digits, or does not
+ * have a scale itself.
+ * Example:
+ *     FractionalScales scales(m);
+ *     int s = scales.scale(v);
+ */
+class FractionalScales : public IRVisitor {
+public:
+    static const int Unknown = -1;
+    static const int MaxScale = 6;
+    // Number of fractional digits of a quotient, at least.
+    static const int DivisionScale = 6;
+
+    FractionalScales(Module *m);
+    // Return the scale of the values of the given variable, or Unknown.
+    int scale(Variable *v);
+    // Return the scale the given fractional expression is computed
+    // with, or Unknown if it can not be computed as a scaled integer.
+    int scale(IRNode *n);
+    // Return true if some fractional arithmetic or comparison is
+    // computed as a scaled integer, or with awk, respectively.
+    bool uses_fixed() const { return fixed; }
+    bool uses_awk() const { return awk; }
+
+    // Return true if the given type is fractional, or an array of
+    // fractional values.
+    static bool fractional(const Type &t);
+    // Return true if the given node is fractional arithmetic.
+    static bool arithmetic(IRNode *n);
+    // Return true if the given node compares two fractional values.
+    static bool comparison(IRNode *n);
+    // Return the given value with at most the given number of
+    // fractional digits (and no trailing zeros), or in the shortest
+    // exact form if the scale is Unknown.
+    static std::string format(double value, int scale);
+
+    virtual void visit(Assignment *);
+    virtual void visit(FunctionCall *);
+    virtual void visit(Intrinsic *);
+    virtual void visit(ForLoop *);
+    virtual void visit(BinOp *);
+    virtual void visit(UnaryOp *);
+private:
+    // Union-find of the variables sharing a scale.
+    std::map<Variable *, Variable *> parent;
+    // Scale of each set, by its root. Zero while no value is known.
+    std::map<Variable *, int> scales;
+    // Values assigned to fractional variables, other than copies.
+    std::vector<std::pair<Variable *, IRNode *> > values;
+    // Fractional arithmetic and comparisons.
+    std::vector<IRNode *> operations;
+    bool fixed, awk;
+
+    Variable *find(Variable *v);
+    void unify(Variable *a, Variable *b);
+    void assign(Variable *v, IRNode *value, bool copy);
+    int scale(IRNode *n, bool final);
+};
+
+}
+
+#endif
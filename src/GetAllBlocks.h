@@ -0,0 +1,32 @@
+#ifndef __BISH_GET_ALL_BLOCKS_H__
+#define __BISH_GET_ALL_BLOCKS_H__
+
+#include <vector>
+#include "IR.h"
+
+namespace Bish {
+
+// Constructs an ordered list of all Block nodes in an IR node (usually
+// a module or a function).
+// Example:
+//     GetAllBlocks all(m);
+//     all.blocks();
+class GetAllBlocks : public IRVisitor {
+public:
+    GetAllBlocks(IRNode *node) {
+        node->accept(this);
+    }
+
+    const std::vector<Block *> &blocks() const { return block_vec; }
+
+    virtual void visit(Block *b) {
+        block_vec.push_back(b);
+        IRVisitor::visit(b);
+    }
+private:
+    std::vector<Block *> block_vec;
+};
+
+}
+
+#endif
@@ -2,11 +2,58 @@
 #include <iostream>
 #include "CallGraph.h"
 #include "FindCalls.h"
+#include "FlatHash.h"
 #include "IR.h"
+#include "Mutex.h"
 #include "Util.h"
 
 namespace Bish {
 
+Name::Name(const std::string &n) : entry(intern(std::vector<std::string>(), n)) {}
+
+Name::Name(const std::string &n, const std::string &ns)
+    : entry(intern(std::vector<std::string>(1, ns), n)) {}
+
+void Name::add_namespace(const std::string &ns) {
+    std::vector<std::string> namespaces(1, ns);
+    namespaces.insert(namespaces.end(), entry->namespaces.begin(), entry->namespaces.end());
+    entry = intern(namespaces, entry->base);
+}
+
+// Return the canonical entry of the given name. The pool is shared
+// between threads, like the global pool of IRArena::intern.
+const Name::Entry *Name::intern(const std::vector<std::string> &namespaces, const std::string &base) {
+    static FlatHashMap<std::string, const Entry *, StringHash> pool;
+    static Mutex pool_mutex;
+    // Namespaces can not contain NUL, so the key is unambiguous.
+    std::string key;
+    for (std::vector<std::string>::const_iterator I = namespaces.begin(),
+             E = namespaces.end(); I != E; ++I) {
+        key += *I;
+        key += '\0';
+    }
+    key += base;
+    {
+        ScopedLock lock(pool_mutex);
+        if (const Entry **e = pool.find(key)) return *e;
+    }
+    const Entry *unqualified = namespaces.empty() ? NULL : intern(std::vector<std::string>(), base);
+    ScopedLock lock(pool_mutex);
+    // Another thread may have added it meanwhile.
+    if (const Entry **e = pool.find(key)) return *e;
+    Entry *e = new Entry();
+    e->base = base;
+    e->namespaces = namespaces;
+    for (std::vector<std::string>::const_iterator I = namespaces.begin(),
+             E = namespaces.end(); I != E; ++I) {
+        e->str += *I + '_';
+    }
+    e->str += base;
+    e->id = pool.size();
+    e->base_id = unqualified ? unqualified->id : e->id;
+    return pool.insert(key, e);
+}
+
 void Module::set_main(Function *f) {
     add_function(f);
     main = f;
@@ -14,6 +61,37 @@ void Module::set_main(Function *f) {
 
 void Module::add_function(Function *f) {
     functions.push_back(f);
+    index_function(f);
+}
+
+void Module::set_functions(const std::vector<Function *> &fs) {
+    functions = fs;
+    index_functions();
+}
+
+void Module::remove_functions(const std::set<Function *> &fs) {
+    if (fs.empty()) return;
+    std::vector<Function *> kept;
+    kept.reserve(functions.size());
+    for (std::vector<Function *>::const_iterator I = functions.begin(),
+             E = functions.end(); I != E; ++I) {
+        if (fs.find(*I) == fs.end()) kept.push_back(*I);
+    }
+    functions.swap(kept);
+    index_functions();
+}
+
+void Module::index_function(Function *f) {
+    const unsigned id = f->name.base_id();
+    if (function_index.find(id) == NULL) function_index.insert(id, f);
+}
+
+void Module::index_functions() {
+    function_index = FlatHashMap<unsigned, Function *, IntegerHash>();
+    for (std::vector<Function *>::const_iterator I = functions.begin(),
+             E = functions.end(); I != E; ++I) {
+        index_function(*I);
+    }
 }
 
 void Module::add_global(Assignment *a) {
@@ -27,16 +105,11 @@ void Module::set_path(const std::string &p) {
 }
 
 Function *Module::get_function(const Name &name) const {
-    for (std::vector<Function *>::const_iterator I = functions.begin(),
-             E = functions.end(); I != E; ++I) {
-        if (name.name == (*I)->name.name) {
-            return *I;
-        }
-    }
-    return NULL;
+    Function *const *f = function_index.find(name.base_id());
+    return f ? *f : NULL;
 }
 
-void Module::import(Module *m) {
+std::vector<Function *> Module::import(Module *m) {
     FindCallsToModule find(m);
     accept(&find);
     CallGraphBuilder cgb;
@@ -44,6 +117,7 @@ void Module::import(Module *m) {
 
     std::set<Name> to_link = find.functions();
     std::map<Name, Function *> linked;
+    std::vector<Function *> added;
     for (std::set<Name>::iterator I = to_link.begin(), E = to_link.end(); I != E; ++I) {
         const Name &name = *I;
         // FindCallsToModule only compares function names to allow the
@@ -51,12 +125,13 @@ void Module::import(Module *m) {
         // namespace. Therefore, to_link can contain functions with
         // the same name but belonging to a different namespace. Don't
         // process those here:
-        if (!name.namespace_id.empty() && !name.has_namespace(m->namespace_id)) continue;
+        if (!name.namespaces().empty() && !name.has_namespace(m->namespace_id)) continue;
         Function *f = m->get_function(name);
         assert(f);
-        assert(f->name.namespace_id.empty());
+        assert(f->name.namespaces().empty());
         f->name.add_namespace(m->namespace_id);
         add_function(f);
+        added.push_back(f);
         linked[f->name] = f;
         // Make sure to pull in functions that f calls as well.
         std::vector<Function *> calls = cg.transitive_calls(f);
@@ -66,6 +141,7 @@ void Module::import(Module *m) {
             if (f->body == NULL || to_link.count(f->name) || linked.count(f->name)) continue;
             f->name.add_namespace(m->namespace_id);
             add_function(f);
+            added.push_back(f);
             linked[f->name] = f;
         }
     }
@@ -92,26 +168,24 @@ void Module::import(Module *m) {
     }
 
     // Finally, erase the old dummy functions.
-    for (std::vector<Function *>::iterator I = functions.begin(), E = functions.end(); I != E; ) {
-        if (to_erase.find(*I) != to_erase.end()) {
-            delete *I;
-            I = functions.erase(I);
-        } else {
-            ++I;
-        }
+    remove_functions(to_erase);
+    for (std::set<Function *>::iterator I = to_erase.begin(), E = to_erase.end(); I != E; ++I) {
+        delete *I;
     }
+    return added;
 }
 
 Type get_primitive_type(const IRNode *n) {
-    if (const Integer *v = dynamic_cast<const Integer*>(n)) {
+    switch (n->kind()) {
+    case IRNode::IntegerKind:
         return Type::Integer();
-    } else if (const Fractional *v = dynamic_cast<const Fractional*>(n)) {
+    case IRNode::FractionalKind:
         return Type::Fractional();
-    } else if (const String *v = dynamic_cast<const String*>(n)) {
+    case IRNode::StringKind:
         return Type::String();
-    } else if (const Boolean *v = dynamic_cast<const Boolean*>(n)) {
+    case IRNode::BooleanKind:
         return Type::Boolean();
-    } else {
+    default:
         return Type::Undef();
     }
 }
@@ -2,11 +2,16 @@
 #define __BISH_IR_H__
 
 #include <iostream>
+#include <map>
+#include <set>
 #include <cassert>
 #include <sstream>
 #include <string>
 #include <vector>
+#include "FlatHash.h"
+#include "IRArena.h"
 #include "IRVisitor.h"
+#include "SourceFile.h"
 #include "Util.h"
 #include "Type.h"
 
@@ -16,55 +21,163 @@ namespace Bish {
 // related to IRNodes.
 class IRDebugInfo {
 public:
-    // Name of source file
-    std::string file;
+    // Name of source file (interned), or NULL if unknown.
+    const std::string *file;
     // Index into source text where the IRNode begins.
     unsigned start;
     // Index into source text where the IRNode ends.
     unsigned end;
     // Line number in source text where IRNode resides.
     unsigned lineno;
-    IRDebugInfo() : file(""), start(0), end(0), lineno(0) {}
+    IRDebugInfo() : file(NULL), start(0), end(0), lineno(0) {}
     IRDebugInfo(const std::string &f, unsigned s, unsigned e, unsigned lno) :
+        file(IRArena::intern(f)), start(s), end(e), lineno(lno) {}
+    IRDebugInfo(const std::string *f, unsigned s, unsigned e, unsigned lno) :
         file(f), start(s), end(e), lineno(lno) {}
     IRDebugInfo(const IRDebugInfo &a) :
         file(a.file), start(a.start), end(a.end), lineno(a.lineno) {}
 
     std::string str() const {
         std::stringstream s;
-        if (file.empty()) return "";
-        s << "in file '" << file << "' line " << lineno << ":\n    ";
-        s << strip(read_line_from_file(file, lineno));
+        if (file == NULL || file->empty()) return "";
+        s << "in file '" << *file << "' line " << lineno << ":\n    ";
+        s << strip(SourceFile::line(*file, lineno));
         return s.str();
     }
 };
 std::ostream &operator<<(std::ostream &os, const IRDebugInfo &a);
 
-class IRNode {
+class IRNode : public ArenaObject {
 public:
-    IRNode() : type_(Type::Undef()), parent_(NULL) {}
-    IRNode(const IRDebugInfo &info) : type_(Type::Undef()), parent_(NULL), debug_info_(info) {}
+    // The concrete class of a node, set by BaseIRNode. Test it with
+    // isa, cast and dyn_cast below rather than dynamic_cast, which
+    // walks the class hierarchy.
+    typedef enum { ModuleKind, BlockKind, VariableKind, LocationKind, FunctionKind,
+                   FunctionCallKind, ExternCallKind, IntrinsicKind, IORedirectionKind,
+                   IfStatementKind, ImportStatementKind, ReturnStatementKind,
+                   LoopControlStatementKind, ForLoopKind, AssignmentKind, BinOpKind,
+                   UnaryOpKind, IntegerKind, FractionalKind, StringKind, BooleanKind,
+                   MapLiteralKind } Kind;
+
+    IRNode(Kind k) : kind_(k), type_(Type::Undef()), parent_(NULL) { clear_marks(); }
+    IRNode(Kind k, const IRDebugInfo &info) :
+        kind_(k), type_(Type::Undef()), parent_(NULL), debug_info_(info) {
+        clear_marks();
+    }
+    IRNode(const IRNode &n) :
+        kind_(n.kind_), type_(n.type_), parent_(n.parent_), debug_info_(n.debug_info_) {
+        clear_marks();
+    }
     virtual ~IRNode() {}
     virtual void accept(IRVisitor *v) = 0;
+    Kind kind() const { return kind_; }
     const Type &type() const { return type_; }
     void set_type(const Type &t) { type_ = t; }
     IRNode *parent() const { return parent_; }
     void set_parent(IRNode *p) { parent_ = p; }
     IRDebugInfo debug_info() const { return debug_info_; }
+    void set_debug_info(const IRDebugInfo &info) { debug_info_ = info; }
+private:
+    Kind kind_;
 protected:
     Type type_;
     IRNode *parent_;
     IRDebugInfo debug_info_;
+private:
+    friend class VisitMarks;
+    // The epoch of the VisitMarks holding each slot, if they contain
+    // this node. Epochs start at 1.
+    unsigned marks_[VisitMarks::Slots];
+
+    void clear_marks() {
+        for (int i = 0; i < VisitMarks::Slots; i++) marks_[i] = 0;
+    }
 };
 
+inline bool VisitMarks::contains(IRNode *n) const {
+    if (slot >= 0) return n->marks_[slot] == epoch;
+    return slot == Fallback && fallback.find(n) != fallback.end();
+}
+
+inline void VisitMarks::insert(IRNode *n) {
+    if (slot == Unclaimed) claim();
+    if (slot >= 0) {
+        n->marks_[slot] = epoch;
+    } else {
+        fallback.insert(n);
+    }
+}
+
+// The kind of each class of IRNode.
+template<typename T> struct IRNodeKindOf;
+#define BISH_IR_NODE_KIND(T)                                      \
+    template<> struct IRNodeKindOf<T> {                           \
+        static const IRNode::Kind value = IRNode::T##Kind;        \
+    }
+BISH_IR_NODE_KIND(Module);
+BISH_IR_NODE_KIND(Block);
+BISH_IR_NODE_KIND(Variable);
+BISH_IR_NODE_KIND(Location);
+BISH_IR_NODE_KIND(Function);
+BISH_IR_NODE_KIND(FunctionCall);
+BISH_IR_NODE_KIND(ExternCall);
+BISH_IR_NODE_KIND(Intrinsic);
+BISH_IR_NODE_KIND(IORedirection);
+BISH_IR_NODE_KIND(IfStatement);
+BISH_IR_NODE_KIND(ImportStatement);
+BISH_IR_NODE_KIND(ReturnStatement);
+BISH_IR_NODE_KIND(LoopControlStatement);
+BISH_IR_NODE_KIND(ForLoop);
+BISH_IR_NODE_KIND(Assignment);
+BISH_IR_NODE_KIND(BinOp);
+BISH_IR_NODE_KIND(UnaryOp);
+BISH_IR_NODE_KIND(Integer);
+BISH_IR_NODE_KIND(Fractional);
+BISH_IR_NODE_KIND(String);
+BISH_IR_NODE_KIND(Boolean);
+BISH_IR_NODE_KIND(MapLiteral);
+#undef BISH_IR_NODE_KIND
+
+// Return true if the given (non-NULL) node is a T.
+template<typename T>
+inline bool isa(const IRNode *n) {
+    assert(n && "isa on a NULL node");
+    return n->kind() == IRNodeKindOf<T>::value;
+}
+
+// Return the given node as a T, which it must be.
+template<typename T>
+inline T *cast(IRNode *n) {
+    assert(isa<T>(n) && "cast to the wrong kind of node");
+    return static_cast<T *>(n);
+}
+
+template<typename T>
+inline const T *cast(const IRNode *n) {
+    assert(isa<T>(n) && "cast to the wrong kind of node");
+    return static_cast<const T *>(n);
+}
+
+// Return the given node as a T if it is one, or else NULL. Unlike
+// isa and cast, the node may be NULL.
+template<typename T>
+inline T *dyn_cast(IRNode *n) {
+    return n && n->kind() == IRNodeKindOf<T>::value ? static_cast<T *>(n) : NULL;
+}
+
+template<typename T>
+inline const T *dyn_cast(const IRNode *n) {
+    return n && n->kind() == IRNodeKindOf<T>::value ? static_cast<const T *>(n) : NULL;
+}
+
 // This is the "curiously recurring template" pattern. It's used to
 // avoid having to implement the 'accept' method in every derived
-// class.
+// class, and to set the kind of every node.
 template<typename T>
 class BaseIRNode : public IRNode {
 public:
-    BaseIRNode() {}
-    BaseIRNode(const IRDebugInfo &info) : IRNode(info) {}
+    BaseIRNode() : IRNode(IRNodeKindOf<T>::value) {}
+    BaseIRNode(const IRDebugInfo &info) : IRNode(IRNodeKindOf<T>::value, info) {}
     void accept(IRVisitor *v) {
         v->visit((T *)this);
     }
@@ -74,48 +187,55 @@ class Block : public BaseIRNode<Block> {
 public:
     typedef std::vector<IRNode *>::iterator iterator;
     std::vector<IRNode *> nodes;
-    Block() {}
-    Block(const std::vector<IRNode *> &n) {
+    // True if this block runs as a background job ('spawn').
+    bool background;
+    Block() : background(false) {}
+    Block(const std::vector<IRNode *> &n) : background(false) {
         nodes.insert(nodes.begin(), n.begin(), n.end());
     }
     iterator begin() { return nodes.begin(); }
     iterator end() { return nodes.end(); }
 };
 
-// The name of a symbol, with optional namespace qualifier(s).
+// The name of a symbol, with optional namespace qualifier(s). Names
+// are interned: a Name is a handle to the canonical entry of its
+// strings in a global pool, so names are copied and compared for
+// equality without touching their strings, and each distinct name has
+// a small integer id (e.g. to key hash tables).
 class Name {
 public:
-    std::vector<std::string> namespace_id;
-    std::string name;
-    Name(const std::string &n) : name(n) {}
-    Name(const std::string &n, const std::string &ns) : name(n) {
-        namespace_id.push_back(ns);
-    }
-    Name(const Name &n) : name(n.name) {
-        namespace_id.insert(namespace_id.begin(), n.namespace_id.begin(), n.namespace_id.end());
-    }
+    Name(const std::string &n);
+    Name(const std::string &n, const std::string &ns);
+
+    // Return the unqualified name.
+    const std::string &base() const { return entry->base; }
+    // Return the namespaces qualifying the name, outermost first.
+    const std::vector<std::string> &namespaces() const { return entry->namespaces; }
+    // Return the id of the name, unique among all names.
+    unsigned id() const { return entry->id; }
+    // Return the id of the unqualified name.
+    unsigned base_id() const { return entry->base_id; }
 
     std::string str(const char sep='_') const {
+        if (sep == '_') return entry->str;
         std::string result;
-        for (std::vector<std::string>::const_iterator I = namespace_id.begin(),
-                 E = namespace_id.end(); I != E; ++I) {
+        for (std::vector<std::string>::const_iterator I = entry->namespaces.begin(),
+                 E = entry->namespaces.end(); I != E; ++I) {
             result += *I + sep;
         }
-        result += name;
+        result += entry->base;
         return result;
     }
 
-    void add_namespace(const std::string &ns) {
-        namespace_id.insert(namespace_id.begin(), ns);
-    }
+    void add_namespace(const std::string &ns);
 
     bool namespaces_equal(const Name &b) const {
-        return namespace_id == b.namespace_id;
+        return entry->namespaces == b.entry->namespaces;
     }
 
     bool has_namespace(const std::string &ns) const {
-        for (std::vector<std::string>::const_iterator I = namespace_id.begin(),
-                 E = namespace_id.end(); I != E; ++I) {
+        for (std::vector<std::string>::const_iterator I = entry->namespaces.begin(),
+                 E = entry->namespaces.end(); I != E; ++I) {
             if (*I == ns) return true;
         }
         return false;
@@ -123,17 +243,32 @@ public:
 
     // Define lexicographic sort so this may be a key for std::map.
     bool operator<(const Name &b) const {
-        return (namespace_id < b.namespace_id ||
-                (namespace_id == b.namespace_id && name < b.name));
+        if (entry == b.entry) return false;
+        return (entry->namespaces < b.entry->namespaces ||
+                (entry->namespaces == b.entry->namespaces && entry->base < b.entry->base));
     }
 
     bool operator==(const Name &b) const {
-        return namespace_id == b.namespace_id && name == b.name;
+        return entry == b.entry;
     }
 
     bool operator!=(const Name &b) const {
         return !(*this == b);
     }
+private:
+    // The strings of a name. Entries are never freed.
+    struct Entry {
+        std::string base;
+        std::vector<std::string> namespaces;
+        // The name with namespaces joined by '_'.
+        std::string str;
+        unsigned id;
+        // The id of the unqualified name.
+        unsigned base_id;
+    };
+    const Entry *entry;
+
+    static const Entry *intern(const std::vector<std::string> &namespaces, const std::string &base);
 };
 
 class Variable : public BaseIRNode<Variable> {
@@ -144,7 +279,11 @@ public:
     bool global;
     // If non-NULL, this Variable is a reference to 'reference'.
     Variable *reference;
-    Variable(const Name &n) : name(n), global(false), reference(NULL) {}
+    // True if this Variable holds the name of another variable rather
+    // than its value: a parameter declared as a bash nameref, or the
+    // global through which the name is passed to it.
+    bool nameref;
+    Variable(const Name &n) : name(n), global(false), reference(NULL), nameref(false) {}
 
     void set_reference(Variable *r) { reference = r; }
     bool is_reference() const { return reference != NULL; }
@@ -166,16 +305,29 @@ public:
     Name name;
     std::vector<Variable *> args;
     Block *body;
-
-    Function(const Name &n) : name(n) {
+    // Global variable holding the value returned by the last call,
+    // once ReturnValuesPass has lowered the return statements (NULL
+    // if the function returns no value).
+    Variable *return_value;
+    // True if declared with 'pure def': its result depends only on
+    // its arguments, even though it runs commands (see
+    // LoopInvariantPass).
+    bool pure;
+    // True if declared with 'memo def': the value returned for each
+    // list of arguments is kept, and returned by later calls with the
+    // same arguments without running the body.
+    bool memo;
+
+    Function(const Name &n) : name(n), return_value(NULL), pure(false), memo(false) {
         body = NULL;
     }
 
-    Function(const Name &n, Block *b) : name(n) {
+    Function(const Name &n, Block *b) : name(n), return_value(NULL), pure(false), memo(false) {
         body = b;
     }
 
-    Function(const Name &n, const std::vector<Variable *> &a, Block *b) : name(n) {
+    Function(const Name &n, const std::vector<Variable *> &a, Block *b) :
+        name(n), return_value(NULL), pure(false), memo(false) {
         args.insert(args.begin(), a.begin(), a.end());
         body = b;
     }
@@ -192,7 +344,9 @@ public:
 
 class Module : public BaseIRNode<Module> {
 public:
-    // List of all functions in the module (including main)
+    // List of all functions in the module (including main). Modify it
+    // with add_function() and set_functions(), which keep the index
+    // used by get_function() in sync.
     std::vector<Function *> functions;
     // Global variables initializers.
     Block *global_variables;
@@ -211,6 +365,10 @@ public:
     void set_main(Function *f);
     // Add the given function to this module.
     void add_function(Function *f);
+    // Replace the functions of this module with the given ones.
+    void set_functions(const std::vector<Function *> &fs);
+    // Remove the given functions from this module.
+    void remove_functions(const std::set<Function *> &fs);
     // Add the given global variable assignment.
     void add_global(Assignment *a);
     // Set the module's path on disk and corresponding namespace.
@@ -219,8 +377,15 @@ public:
     // name, or NULL if no such function exists.
     Function *get_function(const Name &name) const;
     // Import functions from the given module if they are called from
-    // this module.
-    void import(Module *m);
+    // this module. Return the functions added to this module.
+    std::vector<Function *> import(Module *m);
+private:
+    // The first function of each name, regardless of its namespace,
+    // by the id of its unqualified name.
+    FlatHashMap<unsigned, Function *, IntegerHash> function_index;
+
+    void index_function(Function *f);
+    void index_functions();
 };
 
 class Assignment : public BaseIRNode<Assignment> {
@@ -260,7 +425,7 @@ public:
 };
 
 // Helper class for IfStatement
-class PredicatedBlock {
+class PredicatedBlock : public ArenaObject {
 public:
     IRNode *condition;
     IRNode *body;
@@ -298,8 +463,16 @@ public:
     Variable *variable;
     IRNode *lower, *upper;
     IRNode *body;
+    // True if 'lower' is a command whose output is iterated line by
+    // line as it is written, rather than a value.
+    bool stream;
+    // True if each iteration runs as a background job ('parallel for'),
+    // with at most 'limit' jobs running at once if 'limit' is non-NULL.
+    bool parallel;
+    IRNode *limit;
     ForLoop(Variable *v, IRNode *l, IRNode *u, IRNode *b, const IRDebugInfo &info) :
-        variable(v), lower(l), upper(u), body(b), BaseIRNode(info) {}
+        variable(v), lower(l), upper(u), body(b), stream(false), parallel(false), limit(NULL),
+        BaseIRNode(info) {}
 };
 
 class FunctionCall : public BaseIRNode<FunctionCall> {
@@ -315,8 +488,27 @@ public:
     }
 };
 
+// An operation built into the language, which code generators emit
+// directly instead of calling a function: len(x) (which also accepts
+// strings), append(x, value) and slice(x, start[, end]) on arrays, and
+// lines(path) and read_file(path), which read a file. A read is only
+// the value of an assignment to a variable, so that it can be emitted
+// as a statement of its own.
+class Intrinsic : public BaseIRNode<Intrinsic> {
+public:
+    typedef enum { Length, Append, Slice, Lines, ReadFile } Operator;
+    Operator op;
+    // The variable operated on, or NULL for a read.
+    Location *target;
+    // The appended value, the slice bounds, or the path read.
+    std::vector<IRNode *> args;
+    Intrinsic(Operator o, Location *t, const std::vector<IRNode *> &a, const IRDebugInfo &info) :
+        op(o), target(t), args(a.begin(), a.end()), BaseIRNode(info) {}
+    bool reads_file() const { return op == Lines || op == ReadFile; }
+};
+
 // Helper class to represent interpolated strings.
-class InterpolatedString {
+class InterpolatedString : public ArenaObject {
 public:
     class Item {
     public:
@@ -326,6 +518,7 @@ public:
         bool is_var() const { return ty == VAR; }
         const std::string &str() const { return str_; }
         Variable *var() const { return var_; }
+        void append(const std::string &s) { str_ += s; }
     private:
         typedef enum { STR, VAR } Type;
         Type ty;
@@ -333,36 +526,60 @@ public:
         Variable *var_;
     };
 
+    // Adjacent text is merged into one item, and empty text is
+    // dropped, so that the items alternate between text and variables.
     void push_str(const std::string &s) {
-        items.push_back(Item(s));
+        if (s.empty()) return;
+        if (!items.empty() && items.back().is_str()) {
+            items.back().append(s);
+        } else {
+            items.push_back(Item(s));
+        }
     }
 
     void push_var(Variable *v) {
         items.push_back(Item(v));
     }
 
-    std::string interpolate() {
-        return "";
+    // Replace the given variables with their text (e.g. the values of
+    // constants).
+    void substitute(const std::map<Variable *, std::string> &text) {
+        std::vector<Item> old;
+        old.swap(items);
+        for (const_iterator I = old.begin(), E = old.end(); I != E; ++I) {
+            std::map<Variable *, std::string>::const_iterator T;
+            if ((*I).is_str()) {
+                push_str((*I).str());
+            } else if ((T = text.find((*I).var())) != text.end()) {
+                push_str(T->second);
+            } else {
+                push_var((*I).var());
+            }
+        }
     }
 
     typedef std::vector<Item>::const_iterator const_iterator;
     const_iterator begin() { return items.begin(); }
     const_iterator end() { return items.end(); }
 private:
-    std::string body;
-    std::vector<Variable *> to_interpolate;
     std::vector<Item> items;
 };
 
 class ExternCall : public BaseIRNode<ExternCall> {
 public:
     InterpolatedString *body;
-    ExternCall(InterpolatedString *b, const IRDebugInfo &info) : body(b), BaseIRNode(info) {}
+    // True if this command is started once, as a coprocess, and fed a
+    // line of input each time it is evaluated (see 'persistent').
+    bool persistent;
+    ExternCall(InterpolatedString *b, const IRDebugInfo &info) : body(b), persistent(false), BaseIRNode(info) {}
 };
 
+// A pipe between two commands 'a' and 'b', or a redirection of
+// command 'a' to or from the file named 'b' ('>', '>>' and '<'), or
+// to read the value 'b' ('<<<').
 class IORedirection : public BaseIRNode<IORedirection> {
 public:
-    typedef enum { Pipe } Operator;
+    typedef enum { Pipe, Write, Append, Read, HereString } Operator;
     Operator op;
     IRNode *a, *b;
     IORedirection(Operator op_, IRNode *a_, IRNode *b_, const IRDebugInfo &info) : op(op_), a(a_), b(b_), BaseIRNode(info) {}
@@ -408,6 +625,16 @@ public:
     Boolean(bool v) : value(v) {}
 };
 
+// A map literal, {key: value, ...}, which is only assigned to a
+// variable. Keys are strings.
+class MapLiteral : public BaseIRNode<MapLiteral> {
+public:
+    std::vector<IRNode *> keys;
+    std::vector<IRNode *> values;
+    MapLiteral(const std::vector<IRNode *> &k, const std::vector<IRNode *> &v, const IRDebugInfo &info) :
+        keys(k.begin(), k.end()), values(v.begin(), v.end()), BaseIRNode(info) {}
+};
+
 // Return the Bish Type to represent the given IR node.
 Type get_primitive_type(const IRNode *n);
 
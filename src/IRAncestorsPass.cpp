@@ -52,6 +52,11 @@ void IRAncestorsPass::visit(FunctionCall *node) {
     node->set_parent(block_stack.top());
 }
 
+void IRAncestorsPass::visit(Intrinsic *node) {
+    IRVisitor::visit(node);
+    node->set_parent(block_stack.top());
+}
+
 void IRAncestorsPass::visit(ExternCall *node) {
     IRVisitor::visit(node);
     node->set_parent(block_stack.top());
@@ -13,6 +13,7 @@ public:
     virtual void visit(Block *);
     virtual void visit(Function *);
     virtual void visit(FunctionCall *);
+    virtual void visit(Intrinsic *);
     virtual void visit(ExternCall *);
     virtual void visit(IfStatement *);
     virtual void visit(ReturnStatement *);
@@ -0,0 +1,108 @@
+#include <cassert>
+#include <new>
+#include "IRArena.h"
+#include "Mutex.h"
+
+using namespace Bish;
+
+namespace {
+// Header preceding every ArenaObject allocation.
+struct ObjectHeader {
+    IRArena *owner;
+    bool live;
+};
+
+// Objects are aligned to (and preceded by a header of) this many
+// bytes, which satisfies the alignment of any IR object.
+const std::size_t ALIGNMENT = 16;
+
+inline std::size_t align(std::size_t n) {
+    return (n + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+}
+
+inline ObjectHeader *header(void *p) {
+    return (ObjectHeader *)((char *)p - ALIGNMENT);
+}
+}
+
+__thread IRArena *IRArena::current_arena = NULL;
+
+IRArena::~IRArena() {
+    for (std::vector<void *>::iterator I = objects.begin(), E = objects.end(); I != E; ++I) {
+        ObjectHeader *h = header(*I);
+        if (h->live) {
+            h->live = false;
+            ((ArenaObject *)*I)->~ArenaObject();
+        }
+    }
+    for (std::vector<char *>::iterator I = chunks.begin(), E = chunks.end(); I != E; ++I) {
+        delete[] *I;
+    }
+}
+
+// Return a canonical copy of the given string, owned by the current
+// arena (or by a global pool if there is no current arena).
+const std::string *IRArena::intern(const std::string &s) {
+    if (current_arena) {
+        return &*current_arena->strings.insert(s).first;
+    }
+    // The global pool is shared between threads.
+    static std::set<std::string> global_strings;
+    static Mutex global_strings_mutex;
+    ScopedLock lock(global_strings_mutex);
+    return &*global_strings.insert(s).first;
+}
+
+// Allocate memory for an object of the given size.
+void *IRArena::allocate(std::size_t size) {
+    const std::size_t total = align(ALIGNMENT + size);
+    char *base = NULL;
+    if (total > CHUNK_SIZE) {
+        // Oversized objects get a chunk of their own. Keep the
+        // current chunk last so bump allocation can continue in it.
+        base = new char[total];
+        chunks.insert(chunks.empty() ? chunks.end() : chunks.end() - 1, base);
+    } else {
+        if (chunk_used + total > CHUNK_SIZE) {
+            chunks.push_back(new char[CHUNK_SIZE]);
+            chunk_used = 0;
+        }
+        base = chunks.back() + chunk_used;
+        chunk_used += total;
+    }
+    ObjectHeader *h = (ObjectHeader *)base;
+    h->owner = this;
+    h->live = true;
+    void *p = base + ALIGNMENT;
+    objects.push_back(p);
+    bytes += total;
+    return p;
+}
+
+// Record that the object at the given address has been destroyed.
+void IRArena::release(void *p) {
+    ObjectHeader *h = header(p);
+    assert(h->owner == this && h->live);
+    h->live = false;
+}
+
+void *ArenaObject::operator new(std::size_t size) {
+    if (IRArena *arena = IRArena::current()) {
+        return arena->allocate(size);
+    }
+    char *base = (char *)::operator new(ALIGNMENT + size);
+    ObjectHeader *h = (ObjectHeader *)base;
+    h->owner = NULL;
+    h->live = true;
+    return base + ALIGNMENT;
+}
+
+void ArenaObject::operator delete(void *p) {
+    if (p == NULL) return;
+    ObjectHeader *h = header(p);
+    if (h->owner) {
+        h->owner->release(p);
+    } else {
+        ::operator delete(h);
+    }
+}
@@ -0,0 +1,80 @@
+#ifndef __BISH_IR_ARENA_H__
+#define __BISH_IR_ARENA_H__
+
+#include <cstddef>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace Bish {
+
+/* Bump allocator for IR objects. While an arena is current (see
+ * IRArena::Scope), every ArenaObject allocated with 'new' is placed in
+ * it. The current arena is per thread, but an arena itself must only
+ * be used by one thread at a time. Destroying the arena runs the destructors of all objects still
+ * alive in it and frees their memory in one step, so the IR of a
+ * compilation can be torn down without tracking ownership of
+ * individual nodes. Deleting an arena object early is still allowed:
+ * it is destroyed immediately and skipped on teardown.
+ * Example:
+ *     IRArena arena;
+ *     IRArena::Scope scope(&arena);
+ *     Module *m = parser.parse(path);
+ *     ...
+ *     // The IR is freed when 'arena' goes out of scope.
+ */
+class IRArena {
+public:
+    // Makes the given arena current for the lifetime of this object.
+    class Scope {
+    public:
+        Scope(IRArena *a) : previous(current_arena) { current_arena = a; }
+        ~Scope() { current_arena = previous; }
+    private:
+        IRArena *previous;
+    };
+
+    IRArena() : chunk_used(CHUNK_SIZE), bytes(0) {}
+    ~IRArena();
+
+    // Return the current arena, or NULL if there is none.
+    static IRArena *current() { return current_arena; }
+    // Return a canonical copy of the given string, owned by the
+    // current arena (or by a global pool if there is no current
+    // arena).
+    static const std::string *intern(const std::string &s);
+
+    // Allocate memory for an object of the given size.
+    void *allocate(std::size_t size);
+    // Record that the object at the given address has been destroyed.
+    void release(void *p);
+    // Return the total number of bytes allocated for objects.
+    std::size_t bytes_allocated() const { return bytes; }
+    // Return the number of objects allocated.
+    std::size_t objects_allocated() const { return objects.size(); }
+private:
+    static const std::size_t CHUNK_SIZE = 64 * 1024;
+    static __thread IRArena *current_arena;
+    std::vector<char *> chunks;
+    std::size_t chunk_used;
+    std::size_t bytes;
+    std::vector<void *> objects;
+    std::set<std::string> strings;
+
+    // Disallow copying.
+    IRArena(const IRArena &);
+    IRArena &operator=(const IRArena &);
+};
+
+/* Base class for IR objects, which are allocated in the current
+ * IRArena if there is one. */
+class ArenaObject {
+public:
+    virtual ~ArenaObject() {}
+    static void *operator new(std::size_t size);
+    static void operator delete(void *p);
+};
+
+}
+
+#endif
@@ -3,6 +3,31 @@
 
 using namespace Bish;
 
+const int VisitMarks::Slots;
+const int VisitMarks::Unclaimed;
+const int VisitMarks::Fallback;
+__thread unsigned VisitMarks::busy_slots = 0;
+
+VisitMarks::~VisitMarks() {
+    if (slot >= 0) busy_slots &= ~(1u << slot);
+}
+
+// Take a free slot of this thread, or fall back to a set if there is
+// none. Epochs are unique across threads, as nodes of the shared
+// module cache are visited by several threads in turn.
+void VisitMarks::claim() {
+    static unsigned last_epoch = 0;
+    slot = Fallback;
+    for (int i = 0; i < Slots; i++) {
+        if (!(busy_slots & (1u << i))) {
+            busy_slots |= 1u << i;
+            slot = i;
+            epoch = __sync_add_and_fetch(&last_epoch, 1);
+            return;
+        }
+    }
+}
+
 IRVisitor::~IRVisitor() { }
 
 void IRVisitor::visit(Module *node) {
@@ -77,6 +102,7 @@ void IRVisitor::visit(ForLoop *node) {
     node->variable->accept(this);
     node->lower->accept(this);
     if (node->upper) node->upper->accept(this);
+    if (node->limit) node->limit->accept(this);
     node->body->accept(this);
 }
 
@@ -101,6 +127,17 @@ void IRVisitor::visit(FunctionCall *node) {
     }
 }
 
+void IRVisitor::visit(Intrinsic *node) {
+    if (visited(node)) return;
+    visited_set.insert(node);
+
+    if (node->target) node->target->accept(this);
+    for (std::vector<IRNode *>::const_iterator I = node->args.begin(),
+             E = node->args.end(); I != E; ++I) {
+        (*I)->accept(this);
+    }
+}
+
 void IRVisitor::visit(ExternCall *node) {
     if (visited(node)) return;
     visited_set.insert(node);
@@ -159,3 +196,13 @@ void IRVisitor::visit(Boolean *node) {
     if (visited(node)) return;
     visited_set.insert(node);
 }
+
+void IRVisitor::visit(MapLiteral *node) {
+    if (visited(node)) return;
+    visited_set.insert(node);
+
+    for (unsigned i = 0; i < node->keys.size(); i++) {
+        node->keys[i]->accept(this);
+        node->values[i]->accept(this);
+    }
+}
@@ -18,6 +18,7 @@ class ForLoop;
 class Function;
 class FunctionCall;
 class ExternCall;
+class Intrinsic;
 class IORedirection;
 class Assignment;
 class BinOp;
@@ -26,6 +27,37 @@ class Integer;
 class Fractional;
 class String;
 class Boolean;
+class MapLiteral;
+
+/* A set of IR nodes, e.g. the nodes a visitor has visited, stored as
+ * marks in the nodes themselves so that inserting and looking up a
+ * node costs no allocation. Each node has Slots mark slots. The first
+ * Slots sets of a thread in use at the same time hold one slot each,
+ * and mark a node by storing their epoch, unique to each set, in
+ * it. Further sets fall back to keeping their nodes in a std::set.
+ * Copies of nodes (see CloneIR) start out unmarked. */
+class VisitMarks {
+public:
+    static const int Slots = 4;
+
+    VisitMarks() : slot(Unclaimed), epoch(0) {}
+    // Copies start out empty.
+    VisitMarks(const VisitMarks &) : slot(Unclaimed), epoch(0) {}
+    ~VisitMarks();
+    inline bool contains(IRNode *n) const;
+    inline void insert(IRNode *n);
+private:
+    static const int Unclaimed = -1;
+    static const int Fallback = -2;
+    // Slots in use by the sets of this thread, one bit each.
+    static __thread unsigned busy_slots;
+    int slot;
+    unsigned epoch;
+    std::set<IRNode *> fallback;
+
+    void claim();
+    VisitMarks &operator=(const VisitMarks &);
+};
 
 class IRVisitor {
 public:
@@ -37,6 +69,7 @@ public:
     virtual void visit(Function *);
     virtual void visit(FunctionCall *);
     virtual void visit(ExternCall *);
+    virtual void visit(Intrinsic *);
     virtual void visit(IORedirection *);
     virtual void visit(IfStatement *);
     virtual void visit(ImportStatement *);
@@ -50,9 +83,10 @@ public:
     virtual void visit(Fractional *);
     virtual void visit(String *);
     virtual void visit(Boolean *);
-private:
-    std::set<IRNode *> visited_set;
-    bool visited(IRNode *n) { return visited_set.find(n) != visited_set.end(); }
+    virtual void visit(MapLiteral *);
+protected:
+    VisitMarks visited_set;
+    bool visited(IRNode *n) { return visited_set.contains(n); }
 };
 
 }
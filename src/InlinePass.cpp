@@ -0,0 +1,324 @@
+#include <algorithm>
+#include <cassert>
+#include <cctype>
+#include <set>
+#include "CloneIR.h"
+#include "GetAllBlocks.h"
+#include "IRAncestorsPass.h"
+#include "InlinePass.h"
+#include "Util.h"
+
+using namespace Bish;
+
+namespace {
+
+// Maximum number of IR nodes (statements and expressions, at any
+// depth) in the body of a function to inline.
+const unsigned MAX_INLINE_NODES = 20;
+// Maximum number of rounds of inlining, each of which may expose new
+// calls to inline (e.g. exists() calling success()).
+const unsigned MAX_INLINE_ROUNDS = 8;
+
+// Collects what a function body refers to: the functions it calls,
+// the variables it assigns and the variables it uses. Also determines
+// whether the body is unsafe to inline.
+class InspectBody : public IRVisitor {
+public:
+    InspectBody(Block *body) : unsafe(false), has_calls(false), returns(0) {
+        body->accept(this);
+        // A trailing return is allowed.
+        if (!body->nodes.empty() && dyn_cast<ReturnStatement>(body->nodes.back())) {
+            returns--;
+        }
+        unsafe = unsafe || returns > 0;
+    }
+
+    std::set<Function *> functions;
+    std::set<Variable *> assigned;
+    std::set<Variable *> used;
+    bool unsafe;
+    // True if the body calls functions or appends to arrays, either of
+    // which can modify variables it does not assign itself.
+    bool has_calls;
+
+    // Return true if the body assigns a global variable with the
+    // given name. (Its locals are renamed when inlined.)
+    bool assigns_global(const std::string &name) const {
+        for (std::set<Variable *>::const_iterator I = assigned.begin(), E = assigned.end(); I != E; ++I) {
+            if ((*I)->global && (*I)->name.str() == name) return true;
+        }
+        return false;
+    }
+
+    virtual void visit(Variable *v) {
+        used.insert(v);
+    }
+
+    virtual void visit(Assignment *node) {
+        assigned.insert(node->location->variable);
+        IRVisitor::visit(node);
+    }
+
+    virtual void visit(ForLoop *node) {
+        assigned.insert(node->variable);
+        IRVisitor::visit(node);
+    }
+
+    virtual void visit(FunctionCall *call) {
+        functions.insert(call->function);
+        has_calls = true;
+        IRVisitor::visit(call);
+    }
+
+    virtual void visit(Intrinsic *node) {
+        if (node->op == Intrinsic::Append) {
+            assigned.insert(node->target->variable);
+            has_calls = true;
+        }
+        // A read of a file must stay the value of an assignment, which
+        // its return value might not be.
+        if (node->reads_file()) unsafe = true;
+        IRVisitor::visit(node);
+    }
+
+    virtual void visit(ReturnStatement *node) {
+        returns++;
+        IRVisitor::visit(node);
+    }
+
+    virtual void visit(ImportStatement *node) {
+        unsafe = true;
+    }
+
+    virtual void visit(ExternCall *node) {
+        visit(node->body);
+    }
+
+    virtual void visit(String *node) {
+        visit(node->value);
+    }
+private:
+    int returns;
+
+    // Literal text can refer to variables by name (e.g. "\${#arr[@]}"),
+    // which would not survive renaming. Only allow special parameters
+    // such as $?.
+    void visit(InterpolatedString *s) {
+        for (InterpolatedString::const_iterator I = s->begin(), E = s->end(); I != E; ++I) {
+            if ((*I).is_var()) {
+                visit((*I).var());
+                continue;
+            }
+            const std::string &str = (*I).str();
+            for (std::size_t i = str.find('$'); i != std::string::npos; i = str.find('$', i + 1)) {
+                if (i + 1 < str.size() && (isalpha(str[i + 1]) || str[i + 1] == '_' || str[i + 1] == '{')) {
+                    unsafe = true;
+                }
+            }
+        }
+    }
+};
+
+// Counts the IR nodes of a function body, stopping at the given limit.
+class CountNodes : public IRVisitor {
+public:
+    unsigned count;
+    CountNodes(Block *body, unsigned limit) : count(0), limit(limit) {
+        body->accept(this);
+    }
+
+    virtual void visit(Block *n) { if (add()) IRVisitor::visit(n); }
+    virtual void visit(Variable *n) { if (add()) IRVisitor::visit(n); }
+    virtual void visit(Location *n) { if (add()) IRVisitor::visit(n); }
+    virtual void visit(FunctionCall *n) { if (add()) IRVisitor::visit(n); }
+    virtual void visit(ExternCall *n) { if (add()) IRVisitor::visit(n); }
+    virtual void visit(Intrinsic *n) { if (add()) IRVisitor::visit(n); }
+    virtual void visit(IORedirection *n) { if (add()) IRVisitor::visit(n); }
+    virtual void visit(IfStatement *n) { if (add()) IRVisitor::visit(n); }
+    virtual void visit(ReturnStatement *n) { if (add()) IRVisitor::visit(n); }
+    virtual void visit(LoopControlStatement *n) { if (add()) IRVisitor::visit(n); }
+    virtual void visit(ForLoop *n) { if (add()) IRVisitor::visit(n); }
+    virtual void visit(Assignment *n) { if (add()) IRVisitor::visit(n); }
+    virtual void visit(BinOp *n) { if (add()) IRVisitor::visit(n); }
+    virtual void visit(UnaryOp *n) { if (add()) IRVisitor::visit(n); }
+    virtual void visit(Integer *n) { add(); }
+    virtual void visit(Fractional *n) { add(); }
+    virtual void visit(String *n) { add(); }
+    virtual void visit(Boolean *n) { add(); }
+    virtual void visit(MapLiteral *n) { if (add()) IRVisitor::visit(n); }
+private:
+    unsigned limit;
+
+    // Count a node, and return true if its children are to be counted.
+    bool add() { return ++count <= limit; }
+};
+
+// Return true if the given expression may be used as a statement on
+// its own, or dropped if it has no side effects.
+bool is_discardable(IRNode *value) {
+    return value == NULL || dyn_cast<FunctionCall>(value) || dyn_cast<ExternCall>(value) ||
+        dyn_cast<Variable>(value) || dyn_cast<Integer>(value) ||
+        dyn_cast<Boolean>(value) || dyn_cast<Fractional>(value);
+}
+
+bool is_side_effect_free(IRNode *value) {
+    return !dyn_cast<FunctionCall>(value) && !dyn_cast<ExternCall>(value);
+}
+
+}
+
+void InlinePass::visit(Module *m) {
+    unique_id = 0;
+    for (unsigned i = 0; i < MAX_INLINE_ROUNDS && inline_calls(m); i++);
+    IRAncestorsPass ancestors;
+    m->accept(&ancestors);
+}
+
+// Return true if calls to the given function can be inlined.
+bool InlinePass::can_inline(Function *f, CallGraph &cg) {
+    if (f->body == NULL || CountNodes(f->body, MAX_INLINE_NODES).count > MAX_INLINE_NODES) return false;
+    // A memoized function keeps its values across calls.
+    if (f->memo) return false;
+    std::vector<Function *> calls = cg.transitive_calls(f);
+    for (std::vector<Function *>::iterator I = calls.begin(), E = calls.end(); I != E; ++I) {
+        if (*I == f) return false;
+    }
+    return !InspectBody(f->body).unsafe;
+}
+
+// Append a copy of the body of the called function to 'stmts', and
+// return a copy of its return value (NULL if there is none).
+IRNode *InlinePass::inline_call(FunctionCall *call, std::vector<IRNode *> &stmts) {
+    Function *f = call->function;
+    assert(f->args.size() == call->args.size());
+    InspectBody inspect(f->body);
+    CloneIR cloner;
+    for (unsigned i = 0; i < f->args.size(); i++) {
+        // An argument that is just a variable can be used directly if
+        // nothing in the body can change it, which avoids copying
+        // (e.g. arrays) into the argument temporary; that is then
+        // left unused.
+        Assignment *arg = call->args[i];
+        Location *loc = arg->values.size() == 1 ? dyn_cast<Location>(arg->values[0]) : NULL;
+        if (loc && loc->is_variable() && !inspect.has_calls && !inspect.assigned.count(f->args[i]) &&
+            !inspect.assigns_global(loc->variable->name.str())) {
+            cloner.map(f->args[i], loc->variable);
+        } else {
+            cloner.map(f->args[i], arg->location->variable);
+        }
+    }
+    for (std::set<Function *>::iterator I = inspect.functions.begin(), E = inspect.functions.end(); I != E; ++I) {
+        cloner.map(*I, *I);
+    }
+    // Variables the callee does not assign (globals, builtins) are
+    // shared with the original.
+    for (std::set<Variable *>::iterator I = inspect.used.begin(), E = inspect.used.end(); I != E; ++I) {
+        Variable *v = *I;
+        bool param = std::find(f->args.begin(), f->args.end(), v) != f->args.end();
+        if (!param && (v->global || inspect.assigned.count(v) == 0)) cloner.map(v, v);
+    }
+
+    const std::string prefix = "_inline" + as_string(unique_id++) + "_";
+    for (std::set<Variable *>::iterator I = inspect.assigned.begin(), E = inspect.assigned.end(); I != E; ++I) {
+        Variable *v = *I;
+        if (v->global || std::find(f->args.begin(), f->args.end(), v) != f->args.end()) continue;
+        cloner.clone(v)->name = Name(prefix + v->name.str());
+    }
+
+    IRNode *value = NULL;
+    for (unsigned i = 0; i < f->body->nodes.size(); i++) {
+        ReturnStatement *ret = dyn_cast<ReturnStatement>(f->body->nodes[i]);
+        if (ret) {
+            value = cloner.clone(ret->value);
+        } else {
+            stmts.push_back(cloner.clone(f->body->nodes[i]));
+        }
+    }
+    return value;
+}
+
+// Perform one round of inlining. Return true if any call was inlined.
+bool InlinePass::inline_calls(Module *m) {
+    IRAncestorsPass ancestors;
+    m->accept(&ancestors);
+    CallGraphBuilder cgb;
+    CallGraph cg = cgb.build(m);
+    std::map<Function *, bool> inlinable;
+    for (std::vector<Function *>::iterator I = m->functions.begin(), E = m->functions.end(); I != E; ++I) {
+        inlinable[*I] = *I != m->main && can_inline(*I, cg);
+    }
+    // Inline bottom-up: a function is only substituted once the calls
+    // it makes have been inlined into it.
+    std::map<Function *, bool> pending;
+    for (std::vector<Function *>::iterator I = m->functions.begin(), E = m->functions.end(); I != E; ++I) {
+        const std::vector<Function *> &calls = cg.calls(*I);
+        for (std::vector<Function *>::const_iterator CI = calls.begin(), CE = calls.end(); CI != CE; ++CI) {
+            if (inlinable[*CI]) pending[*I] = true;
+        }
+    }
+    for (std::map<Function *, bool>::iterator I = pending.begin(), E = pending.end(); I != E; ++I) {
+        inlinable[I->first] = false;
+    }
+
+    bool changed = false;
+    GetAllBlocks all(m);
+    for (std::vector<Block *>::const_iterator BI = all.blocks().begin(), BE = all.blocks().end();
+         BI != BE; ++BI) {
+        std::vector<IRNode *> &nodes = (*BI)->nodes;
+        std::vector<IRNode *> result;
+        for (std::vector<IRNode *>::iterator I = nodes.begin(), E = nodes.end(); I != E; ++I) {
+            IRNode *stmt = *I;
+            if (FunctionCall *call = dyn_cast<FunctionCall>(stmt)) {
+                if (inlinable[call->function]) {
+                    std::vector<IRNode *> body;
+                    IRNode *value = inline_call(call, body);
+                    if (is_discardable(value)) {
+                        result.insert(result.end(), body.begin(), body.end());
+                        if (value && !is_side_effect_free(value)) result.push_back(value);
+                        changed = true;
+                        continue;
+                    }
+                }
+            } else if (Assignment *a = dyn_cast<Assignment>(stmt)) {
+                FunctionCall *call = a->values.size() == 1 ? dyn_cast<FunctionCall>(a->values[0]) : NULL;
+                if (call && inlinable[call->function]) {
+                    std::vector<IRNode *> body;
+                    if (IRNode *value = inline_call(call, body)) {
+                        result.insert(result.end(), body.begin(), body.end());
+                        a->values[0] = value;
+                        result.push_back(a);
+                        changed = true;
+                        continue;
+                    }
+                }
+            } else if (ReturnStatement *ret = dyn_cast<ReturnStatement>(stmt)) {
+                FunctionCall *call = dyn_cast<FunctionCall>(ret->value);
+                if (call && inlinable[call->function]) {
+                    std::vector<IRNode *> body;
+                    if (IRNode *value = inline_call(call, body)) {
+                        result.insert(result.end(), body.begin(), body.end());
+                        ret->value = value;
+                        result.push_back(ret);
+                        changed = true;
+                        continue;
+                    }
+                }
+            } else if (IfStatement *s = dyn_cast<IfStatement>(stmt)) {
+                FunctionCall *call = dyn_cast<FunctionCall>(s->pblock->condition);
+                if (call && inlinable[call->function]) {
+                    std::vector<IRNode *> body;
+                    if (IRNode *value = inline_call(call, body)) {
+                        result.insert(result.end(), body.begin(), body.end());
+                        s->pblock->condition = value;
+                        result.push_back(s);
+                        changed = true;
+                        continue;
+                    }
+                }
+            }
+            result.push_back(stmt);
+        }
+        nodes.swap(result);
+    }
+    return changed;
+}
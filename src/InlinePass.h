@@ -0,0 +1,30 @@
+#ifndef __BISH_INLINE_PASS_H__
+#define __BISH_INLINE_PASS_H__
+
+#include "CallGraph.h"
+#include "IR.h"
+#include "IRVisitor.h"
+
+namespace Bish {
+
+/** This pass substitutes the bodies of small, non-recursive functions
+ * (e.g. the stdlib wrappers success() and exists()) at their call
+ * sites, so calling them costs neither a bash function call nor, when
+ * the result is used, a subshell. Calls are inlined when they are a
+ * statement, the value of an assignment or return statement, or the
+ * condition of an if statement. The callee's local variables are renamed uniquely, and
+ * its parameters are replaced by the temporaries holding the
+ * arguments. */
+class InlinePass : public IRVisitor {
+public:
+    virtual void visit(Module *);
+private:
+    unsigned unique_id;
+    bool inline_calls(Module *m);
+    bool can_inline(Function *f, CallGraph &cg);
+    IRNode *inline_call(FunctionCall *call, std::vector<IRNode *> &stmts);
+};
+
+}
+
+#endif
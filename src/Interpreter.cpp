@@ -0,0 +1,2115 @@
+#include <cerrno>
+#include <climits>
+#include <clocale>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cwchar>
+#include <fcntl.h>
+#include <set>
+#include <sstream>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "CodeGen_Bash.h"
+#include "Compile.h"
+#include "Errors.h"
+#include "Interpreter.h"
+
+using namespace Bish;
+
+namespace {
+
+// Rejects the constructs the interpreter does not implement, naming
+// the first one found.
+class CheckSupported : public IRVisitor {
+public:
+    CheckSupported(Module *m) {
+        m->accept(this);
+    }
+
+    virtual void visit(Variable *node) {
+        if (node->type().fractional()) unsupported("fractional numbers", node);
+    }
+
+    virtual void visit(String *node) {
+        for (InterpolatedString::const_iterator I = node->value->begin(), E = node->value->end(); I != E; ++I) {
+            if ((*I).is_var()) visit((*I).var());
+        }
+    }
+
+    virtual void visit(Fractional *node) {
+        unsupported("fractional numbers", node);
+    }
+private:
+    void unsupported(const char *what, IRNode *node) {
+        bish_abort() << "The interp code generator does not support " << what << " " << node->debug_info();
+    }
+};
+
+// Collects the variables of a module, including those only named by
+// strings, commands and parameters passed by reference.
+class CollectVariables : public IRVisitor {
+public:
+    std::vector<Variable *> variables;
+
+    virtual void visit(Variable *node) {
+        if (visited(node)) return;
+        visited_set.insert(node);
+        variables.push_back(node);
+        if (node->reference) node->reference->accept(this);
+    }
+
+    virtual void visit(String *node) {
+        IRVisitor::visit(node);
+        add(node->value);
+    }
+
+    virtual void visit(ExternCall *node) {
+        IRVisitor::visit(node);
+        add(node->body);
+    }
+private:
+    void add(InterpolatedString *s) {
+        for (InterpolatedString::const_iterator I = s->begin(), E = s->end(); I != E; ++I) {
+            if ((*I).is_var()) (*I).var()->accept(this);
+        }
+    }
+};
+
+std::string decimal(long long i) {
+    std::ostringstream s;
+    s << i;
+    return s.str();
+}
+
+bool is_blank(char c) {
+    return c == ' ' || c == '\t' || c == '\n';
+}
+
+bool is_name_char(char c, bool first) {
+    return c == '_' || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+        (!first && c >= '0' && c <= '9');
+}
+
+// Split the given text into words at blanks, as bash splits unquoted
+// expansions with the default IFS (but without pathname expansion).
+void split_fields(const std::string &s, std::vector<std::string> &out) {
+    std::string::size_type i = 0;
+    while (i < s.size()) {
+        while (i < s.size() && is_blank(s[i])) i++;
+        std::string::size_type start = i;
+        while (i < s.size() && !is_blank(s[i])) i++;
+        if (i > start) out.push_back(s.substr(start, i - start));
+    }
+}
+
+// Remove the trailing newlines of the output of a command, as command
+// substitution does.
+void strip_newlines(std::string &s) {
+    std::string::size_type end = s.find_last_not_of('\n');
+    s.erase(end == std::string::npos ? 0 : end + 1);
+}
+
+// Remove the backslashes quoting characters in a double-quoted bash
+// string.
+std::string unquote_double(const std::string &s) {
+    if (s.find('\\') == std::string::npos) return s;
+    std::string result;
+    for (std::string::size_type i = 0; i < s.size(); i++) {
+        if (s[i] == '\\' && i + 1 < s.size()) {
+            char c = s[i + 1];
+            if (c == '$' || c == '`' || c == '"' || c == '\\') {
+                result += c;
+                i++;
+                continue;
+            }
+            if (c == '\n') {
+                i++;
+                continue;
+            }
+        }
+        result += s[i];
+    }
+    return result;
+}
+
+// Return the given string as a single-quoted shell word.
+std::string single_quote(const std::string &s) {
+    std::string result = "'";
+    for (std::string::size_type i = 0; i < s.size(); i++) {
+        if (s[i] == '\'') {
+            result += "'\\''";
+        } else {
+            result += s[i];
+        }
+    }
+    return result + "'";
+}
+
+// Return the number of characters of the given string in the current
+// locale. Invalid bytes count as one character each.
+long long characters(const std::string &s) {
+    std::mbstate_t state;
+    std::memset(&state, 0, sizeof(state));
+    long long count = 0;
+    std::string::size_type i = 0;
+    while (i < s.size()) {
+        std::size_t n = std::mbrlen(s.data() + i, s.size() - i, &state);
+        if (n == (std::size_t)-1 || n == (std::size_t)-2 || n == 0) {
+            std::memset(&state, 0, sizeof(state));
+            n = 1;
+        }
+        i += n;
+        count++;
+    }
+    return count;
+}
+
+bool read_fd(int fd, std::string &out) {
+    char buffer[4096];
+    for (;;) {
+        ssize_t n = read(fd, buffer, sizeof(buffer));
+        if (n == 0) return true;
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        out.append(buffer, n);
+    }
+}
+
+bool write_fd(int fd, const std::string &s) {
+    std::string::size_type done = 0;
+    while (done < s.size()) {
+        ssize_t n = write(fd, s.data() + done, s.size() - done);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        done += n;
+    }
+    return true;
+}
+
+// Read a line from the given descriptor into 'line', without its
+// newline, keeping what was read after it in 'buffer'. At the end of
+// the input, return false with the unterminated rest (if any) in
+// 'line', as 'read' does.
+bool read_line(int fd, std::string &buffer, std::string &line) {
+    std::string::size_type searched = 0;
+    for (;;) {
+        std::string::size_type nl = buffer.find('\n', searched);
+        if (nl != std::string::npos) {
+            line.assign(buffer, 0, nl);
+            buffer.erase(0, nl + 1);
+            return true;
+        }
+        searched = buffer.size();
+        char chunk[4096];
+        ssize_t n = read(fd, chunk, sizeof(chunk));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            line.swap(buffer);
+            buffer.clear();
+            return false;
+        }
+        buffer.append(chunk, n);
+    }
+}
+
+// Wait for the given process, and return its exit status as bash
+// reports it.
+int wait_pid(pid_t pid) {
+    int status = 0;
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) return 127;
+    }
+    if (WIFSIGNALED(status)) return 128 + WTERMSIG(status);
+    return WEXITSTATUS(status);
+}
+
+void append_utf8(unsigned long c, std::string &out) {
+    if (c < 0x80) {
+        out += (char)c;
+    } else if (c < 0x800) {
+        out += (char)(0xc0 | (c >> 6));
+        out += (char)(0x80 | (c & 0x3f));
+    } else if (c < 0x10000) {
+        out += (char)(0xe0 | (c >> 12));
+        out += (char)(0x80 | ((c >> 6) & 0x3f));
+        out += (char)(0x80 | (c & 0x3f));
+    } else {
+        out += (char)(0xf0 | ((c >> 18) & 0x07));
+        out += (char)(0x80 | ((c >> 12) & 0x3f));
+        out += (char)(0x80 | ((c >> 6) & 0x3f));
+        out += (char)(0x80 | (c & 0x3f));
+    }
+}
+
+int digit_value(char c, int base) {
+    int d = base;
+    if (c >= '0' && c <= '9') d = c - '0';
+    else if (c >= 'a' && c <= 'f') d = c - 'a' + 10;
+    else if (c >= 'A' && c <= 'F') d = c - 'A' + 10;
+    return d < base ? d : -1;
+}
+
+// Read up to 'max' digits of the given base from s[i], advancing 'i'.
+unsigned long read_digits(const std::string &s, std::string::size_type &i, int base,
+                          unsigned max, unsigned &count) {
+    unsigned long value = 0;
+    for (count = 0; count < max && i < s.size() && digit_value(s[i], base) >= 0; count++, i++) {
+        value = value * base + digit_value(s[i], base);
+    }
+    return value;
+}
+
+// Expand the backslash escape starting at s[i] into 'out', and move
+// 'i' to its last character. Escapes are those of printf's format, or
+// if 'echo' is true those of 'echo -e' and printf's %b, where octal
+// escapes start with '\0' and '\c' ends the output (returning false).
+bool expand_escape(const std::string &s, std::string::size_type &i, bool echo, std::string &out) {
+    if (i + 1 >= s.size()) {
+        out += '\\';
+        return true;
+    }
+    char c = s[++i];
+    std::string::size_type next = i + 1;
+    unsigned count;
+    switch (c) {
+    case 'a': out += '\a'; return true;
+    case 'b': out += '\b'; return true;
+    case 'e': case 'E': out += '\033'; return true;
+    case 'f': out += '\f'; return true;
+    case 'n': out += '\n'; return true;
+    case 'r': out += '\r'; return true;
+    case 't': out += '\t'; return true;
+    case 'v': out += '\v'; return true;
+    case '\\': out += '\\'; return true;
+    case 'c':
+        if (echo) return false;
+        break;
+    case 'x': {
+        unsigned long value = read_digits(s, next, 16, 2, count);
+        if (count == 0) break;
+        out += (char)value;
+        i = next - 1;
+        return true;
+    }
+    case 'u': case 'U': {
+        unsigned long value = read_digits(s, next, 16, c == 'u' ? 4 : 8, count);
+        if (count == 0) break;
+        append_utf8(value, out);
+        i = next - 1;
+        return true;
+    }
+    case '"': case '\'': case '?':
+        if (echo) break;
+        out += c;
+        return true;
+    default:
+        if (c >= '0' && c <= '7' && (!echo || c == '0')) {
+            if (!echo) next = i;
+            unsigned long value = read_digits(s, next, 8, 3, count);
+            out += (char)value;
+            i = next - 1;
+            return true;
+        }
+        break;
+    }
+    out += '\\';
+    out += c;
+    return true;
+}
+
+// Expand all backslash escapes of the given string into 'out'. Return
+// false if output ends at a '\c'.
+bool expand_escapes(const std::string &s, bool echo, std::string &out) {
+    for (std::string::size_type i = 0; i < s.size(); i++) {
+        if (s[i] != '\\') {
+            out += s[i];
+        } else if (!expand_escape(s, i, echo, out)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Parse a numeric argument of printf: an integer in C syntax, or a
+// quote followed by a character, whose code is the value.
+bool printf_integer(const std::string &s, long long &value) {
+    if (s.empty()) {
+        value = 0;
+        return true;
+    }
+    if (s[0] == '\'' || s[0] == '"') {
+        value = s.size() > 1 ? (unsigned char)s[1] : 0;
+        return true;
+    }
+    char *end;
+    errno = 0;
+    value = std::strtoll(s.c_str(), &end, 0);
+    return errno == 0 && *end == '\0';
+}
+
+// Run printf with the given words ("printf", the format, and its
+// arguments), appending its output to 'out'. Return its exit status,
+// or -1 if it uses a feature (e.g. -v or %q) or makes an error which
+// is left to bash.
+int builtin_printf(const std::vector<std::string> &words, std::string &out) {
+    std::vector<std::string>::size_type first = 1;
+    if (first < words.size() && words[first] == "--") first++;
+    if (first >= words.size() || (words[first].size() > 1 && words[first][0] == '-')) return -1;
+    const std::string &format = words[first];
+    const std::vector<std::string> args(words.begin() + first + 1, words.end());
+    std::vector<std::string>::size_type arg = 0;
+    do {
+        const std::vector<std::string>::size_type consumed = arg;
+        for (std::string::size_type i = 0; i < format.size(); i++) {
+            if (format[i] == '\\') {
+                expand_escape(format, i, false, out);
+                continue;
+            }
+            if (format[i] != '%') {
+                out += format[i];
+                continue;
+            }
+            if (i + 1 < format.size() && format[i + 1] == '%') {
+                out += '%';
+                i++;
+                continue;
+            }
+            // A conversion: flags, width and precision are passed on
+            // to snprintf; length modifiers are ignored.
+            std::string spec = "%";
+            std::string::size_type j = i + 1;
+            while (j < format.size() && std::strchr("-+ #0", format[j])) spec += format[j++];
+            for (int part = 0; part < 2; part++) {
+                if (part == 1) {
+                    if (j >= format.size() || format[j] != '.') break;
+                    spec += format[j++];
+                }
+                if (j < format.size() && format[j] == '*') {
+                    long long n = 0;
+                    if (arg < args.size() && !printf_integer(args[arg++], n)) return -1;
+                    spec += decimal(n);
+                    j++;
+                } else {
+                    while (j < format.size() && format[j] >= '0' && format[j] <= '9') spec += format[j++];
+                }
+            }
+            while (j < format.size() && std::strchr("hlLqjzt", format[j])) j++;
+            if (j >= format.size()) return -1;
+            const char conversion = format[j];
+            i = j;
+            const std::string value = arg < args.size() ? args[arg++] : "";
+            char buffer[512];
+            int n = 0;
+            switch (conversion) {
+            case 's':
+            case 'b': {
+                std::string text;
+                bool more = true;
+                if (conversion == 'b') {
+                    more = expand_escapes(value, true, text);
+                } else {
+                    text = value;
+                }
+                spec += 's';
+                std::vector<char> padded(text.size() + 512);
+                n = std::snprintf(&padded[0], padded.size(), spec.c_str(), text.c_str());
+                if (n < 0 || (std::size_t)n >= padded.size()) return -1;
+                out.append(&padded[0], n);
+                if (!more) return 0;
+                continue;
+            }
+            case 'c':
+                spec += 'c';
+                if (value.empty()) continue;
+                n = std::snprintf(buffer, sizeof(buffer), spec.c_str(), value[0]);
+                break;
+            case 'd':
+            case 'i': {
+                long long v;
+                if (!printf_integer(value, v)) return -1;
+                spec += "lld";
+                n = std::snprintf(buffer, sizeof(buffer), spec.c_str(), v);
+                break;
+            }
+            case 'o':
+            case 'u':
+            case 'x':
+            case 'X': {
+                long long v;
+                if (!printf_integer(value, v)) return -1;
+                spec += "ll";
+                spec += conversion;
+                n = std::snprintf(buffer, sizeof(buffer), spec.c_str(), (unsigned long long)v);
+                break;
+            }
+            case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A': {
+                char *end;
+                long double v = value.empty() ? 0 : std::strtold(value.c_str(), &end);
+                if (!value.empty() && *end != '\0') return -1;
+                spec += 'L';
+                spec += conversion;
+                n = std::snprintf(buffer, sizeof(buffer), spec.c_str(), v);
+                break;
+            }
+            default:
+                return -1;
+            }
+            if (n < 0 || (std::size_t)n >= sizeof(buffer)) return -1;
+            out.append(buffer, n);
+        }
+        // The format is reused for the arguments left, if it used any.
+        if (arg == consumed) break;
+    } while (arg < args.size());
+    return 0;
+}
+
+// Run echo with the given words, appending its output to 'out'.
+int builtin_echo(const std::vector<std::string> &words, std::string &out) {
+    bool newline = true, escapes = false;
+    std::vector<std::string>::size_type i = 1;
+    for (; i < words.size(); i++) {
+        const std::string &w = words[i];
+        if (w.size() < 2 || w[0] != '-' || w.find_first_not_of("neE", 1) != std::string::npos) break;
+        for (std::string::size_type j = 1; j < w.size(); j++) {
+            if (w[j] == 'n') newline = false;
+            else escapes = w[j] == 'e';
+        }
+    }
+    for (std::vector<std::string>::size_type first = i; i < words.size(); i++) {
+        if (i > first) out += ' ';
+        if (!escapes) {
+            out += words[i];
+        } else if (!expand_escapes(words[i], true, out)) {
+            return 0;
+        }
+    }
+    if (newline) out += '\n';
+    return 0;
+}
+
+// Parse an integer operand of test, in decimal.
+bool test_integer(const std::string &s, long long &value) {
+    const char *p = s.c_str();
+    while (is_blank(*p)) p++;
+    if (*p == '\0') return false;
+    char *end;
+    errno = 0;
+    value = std::strtoll(p, &end, 10);
+    while (is_blank(*end)) end++;
+    return errno == 0 && *end == '\0';
+}
+
+// Evaluate a unary test of test. Return 0 if it is true, 1 if it is
+// false, or -1 if it is left to bash.
+int test_unary(const std::string &op, const std::string &a) {
+    struct stat st;
+    bool result;
+    if (op == "-n") {
+        result = !a.empty();
+    } else if (op == "-z") {
+        result = a.empty();
+    } else if (op == "-e" || op == "-a") {
+        result = stat(a.c_str(), &st) == 0;
+    } else if (op == "-f") {
+        result = stat(a.c_str(), &st) == 0 && S_ISREG(st.st_mode);
+    } else if (op == "-d") {
+        result = stat(a.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+    } else if (op == "-s") {
+        result = stat(a.c_str(), &st) == 0 && st.st_size > 0;
+    } else if (op == "-p") {
+        result = stat(a.c_str(), &st) == 0 && S_ISFIFO(st.st_mode);
+    } else if (op == "-S") {
+        result = stat(a.c_str(), &st) == 0 && S_ISSOCK(st.st_mode);
+    } else if (op == "-b") {
+        result = stat(a.c_str(), &st) == 0 && S_ISBLK(st.st_mode);
+    } else if (op == "-c") {
+        result = stat(a.c_str(), &st) == 0 && S_ISCHR(st.st_mode);
+    } else if (op == "-L" || op == "-h") {
+        result = lstat(a.c_str(), &st) == 0 && S_ISLNK(st.st_mode);
+    } else if (op == "-r") {
+        result = access(a.c_str(), R_OK) == 0;
+    } else if (op == "-w") {
+        result = access(a.c_str(), W_OK) == 0;
+    } else if (op == "-x") {
+        result = access(a.c_str(), X_OK) == 0;
+    } else {
+        return -1;
+    }
+    return result ? 0 : 1;
+}
+
+// Evaluate a binary test of test, as test_unary.
+int test_binary(const std::string &a, const std::string &op, const std::string &b) {
+    bool result;
+    if (op == "=" || op == "==") {
+        result = a == b;
+    } else if (op == "!=") {
+        result = a != b;
+    } else if (op == "<") {
+        result = std::strcoll(a.c_str(), b.c_str()) < 0;
+    } else if (op == ">") {
+        result = std::strcoll(a.c_str(), b.c_str()) > 0;
+    } else if (op.size() == 3 && op[0] == '-') {
+        long long x, y;
+        if (!test_integer(a, x) || !test_integer(b, y)) return -1;
+        if (op == "-eq") result = x == y;
+        else if (op == "-ne") result = x != y;
+        else if (op == "-lt") result = x < y;
+        else if (op == "-le") result = x <= y;
+        else if (op == "-gt") result = x > y;
+        else if (op == "-ge") result = x >= y;
+        else return -1;
+    } else {
+        return -1;
+    }
+    return result ? 0 : 1;
+}
+
+bool is_test_binary(const std::string &op) {
+    static const char *ops[] = { "=", "==", "!=", "<", ">", "-eq", "-ne", "-lt", "-le", "-gt",
+                                 "-ge", "-nt", "-ot", "-ef", NULL };
+    for (int i = 0; ops[i]; i++) {
+        if (op == ops[i]) return true;
+    }
+    return false;
+}
+
+int negate(int status) {
+    return status < 0 ? status : !status;
+}
+
+// Evaluate the operands of test by their number, as POSIX specifies
+// for up to four operands.
+int test_operands(const std::vector<std::string> &a, std::vector<std::string>::size_type first) {
+    const std::vector<std::string>::size_type n = a.size() - first;
+    switch (n) {
+    case 0:
+        return 1;
+    case 1:
+        return a[first].empty() ? 1 : 0;
+    case 2:
+        if (a[first] == "!") return a[first + 1].empty() ? 0 : 1;
+        return test_unary(a[first], a[first + 1]);
+    case 3:
+        if (is_test_binary(a[first + 1])) return test_binary(a[first], a[first + 1], a[first + 2]);
+        if (a[first] == "!") return negate(test_operands(a, first + 1));
+        if (a[first] == "(" && a[first + 2] == ")") return a[first + 1].empty() ? 1 : 0;
+        return -1;
+    case 4:
+        if (a[first] == "!") return negate(test_operands(a, first + 1));
+        if (a[first] == "(" && a[first + 3] == ")") {
+            std::vector<std::string> inner(a.begin() + first + 1, a.begin() + first + 3);
+            return test_operands(inner, 0);
+        }
+        return -1;
+    default:
+        return -1;
+    }
+}
+
+// Shell keywords and the bash builtins not run by the interpreter:
+// commands starting with them are run by bash.
+bool is_shell_word(const std::string &w) {
+    static const char *shell_words[] = {
+        "if", "then", "else", "elif", "fi", "for", "while", "until", "do", "done", "case",
+        "esac", "select", "function", "time", "coproc", "[[", "]]", "{", "}", "!", ".",
+        "alias", "bg", "bind", "break", "builtin", "caller", "command", "compgen", "complete",
+        "compopt", "continue", "declare", "dirs", "disown", "enable", "eval", "exec", "export",
+        "fc", "fg", "getopts", "hash", "help", "history", "jobs", "let", "local", "logout",
+        "mapfile", "popd", "pushd", "read", "readarray", "readonly", "return", "set", "shift",
+        "shopt", "source", "suspend", "times", "trap", "type", "typeset", "ulimit", "umask",
+        "unalias", "unset", "wait", NULL
+    };
+    for (int i = 0; shell_words[i]; i++) {
+        if (w == shell_words[i]) return true;
+    }
+    return false;
+}
+
+// Return true if the given command uses the job list of 'spawn', i.e.
+// it is stdlib's wait().
+bool waits_for_spawned(ExternCall *n) {
+    for (InterpolatedString::const_iterator I = n->body->begin(), E = n->body->end(); I != E; ++I) {
+        if ((*I).is_str() && (*I).str().find("_bish_spawned") != std::string::npos) return true;
+    }
+    return false;
+}
+
+// Builds the words of a command from its text and expansions.
+class WordBuilder {
+public:
+    WordBuilder(std::vector<std::string> &w) : words(w), started(false), star(false), bracket(false),
+                                               glob(false) {}
+
+    // Add quoted text to the current word.
+    void quoted(const std::string &s) {
+        word += s;
+        started = true;
+    }
+
+    void quoted(char c) {
+        word += c;
+        started = true;
+    }
+
+    // Add unquoted text to the current word, noting pattern characters.
+    void unquoted(char c) {
+        if (c == '*' || c == '?') glob = true;
+        if (c == '[') bracket = true;
+        if (c == ']' && bracket) glob = true;
+        word += c;
+        started = true;
+    }
+
+    // Add an unquoted expansion, split into words at blanks. Return
+    // false if it contains pattern characters.
+    bool expansion(const std::string &s) {
+        for (std::string::size_type i = 0; i < s.size(); i++) {
+            if (is_blank(s[i])) {
+                end();
+            } else if (s[i] == '*' || s[i] == '?' || s[i] == '[') {
+                return false;
+            } else {
+                quoted(s[i]);
+            }
+        }
+        return true;
+    }
+
+    // End the current word. Return false if it is a pattern.
+    bool end() {
+        if (glob) return false;
+        if (started) words.push_back(word);
+        word.clear();
+        started = star = bracket = false;
+        return true;
+    }
+
+    bool at_word_start() const { return !started; }
+    bool first_word() const { return words.empty(); }
+    void mark() { started = true; }
+private:
+    std::vector<std::string> &words;
+    std::string word;
+    bool started, star, bracket, glob;
+};
+
+}
+
+Interpreter::Interpreter(std::ostream &os) : CodeGenerator(os) {
+    profile = false;
+    exit_status = 0;
+    last_status = 0;
+    substituted = false;
+    flow = Normal;
+    use_local = false;
+    depth = 0;
+}
+
+void Interpreter::set_options(const CompileOptions &options) {
+    profile = options.profile();
+}
+
+void Interpreter::visit(Module *m) {
+    if (profile) bish_abort() << "The interp code generator does not support profiling.";
+    CheckSupported check(m);
+    std::setlocale(LC_CTYPE, "");
+    std::setlocale(LC_COLLATE, "");
+
+    // Every variable gets its slot before running, so that slots are
+    // not added (moving the others) while a binding is in use.
+    CollectVariables collect;
+    m->accept(&collect);
+    for (unsigned i = 0; i < collect.variables.size(); i++) {
+        const unsigned slot = slot_of(collect.variables[i]);
+        // As in bash, variables start out with the value they have in
+        // the environment (e.g. $HOME in a command).
+        if (const char *value = std::getenv(slot_names[slot].c_str())) {
+            slots[slot].value = Value(std::string(value));
+        }
+    }
+
+    std::vector<std::string> args(1, m->path);
+    args.insert(args.end(), script_args.begin(), script_args.end());
+    binding(slot_of("args")).value = Value(args);
+
+    use_local = false;
+    execute_block(m->global_variables);
+    if (flow != Exit) {
+        flow = Normal;
+        assert(m->main);
+        call_function(m->main, std::vector<Value>());
+    }
+    if (flow != Exit) exit_status = last_status;
+    stream.flush();
+
+    // Coprocesses exit once their input is closed.
+    for (std::map<ExternCall *, Coprocess>::iterator I = coprocesses.begin(),
+             E = coprocesses.end(); I != E; ++I) {
+        close_fd(I->second.in);
+        close_fd(I->second.out);
+        wait_pid(I->second.pid);
+    }
+    coprocesses.clear();
+}
+
+unsigned Interpreter::slot_of(Variable *v) {
+    if (unsigned *slot = name_slots.find(v->name.id())) return *slot;
+    const unsigned slot = slot_of(v->name.str());
+    name_slots.insert(v->name.id(), slot);
+    return slot;
+}
+
+unsigned Interpreter::slot_of(const std::string &name) {
+    std::map<std::string, unsigned>::iterator I = slot_index.find(name);
+    if (I != slot_index.end()) return I->second;
+    const unsigned slot = slots.size();
+    slots.push_back(Slot());
+    slot_names.push_back(name);
+    slot_index[name] = slot;
+    return slot;
+}
+
+// Return the binding of the given slot, following namerefs.
+Interpreter::Slot &Interpreter::binding(unsigned slot) {
+    for (unsigned i = 0; slots[slot].alias >= 0; i++) {
+        if (i == slots.size()) {
+            error("circular name reference to " + slot_names[slot], NULL);
+            break;
+        }
+        slot = slots[slot].alias;
+    }
+    return slots[slot];
+}
+
+// Make the given slot local to the call in progress, as 'local' does,
+// unless it is already.
+void Interpreter::declare_local(unsigned slot) {
+    if (depth == 0 || slots[slot].depth == depth) return;
+    Shadowed s;
+    s.slot = slot;
+    s.binding = Slot();
+    s.binding.depth = depth;
+    std::swap(s.binding, slots[slot]);
+    calls[depth - 1].push_back(s);
+}
+
+void Interpreter::execute(IRNode *n) {
+    switch (n->kind()) {
+    case IRNode::AssignmentKind:
+        execute_assignment(cast<Assignment>(n));
+        break;
+    case IRNode::BlockKind: {
+        Block *b = cast<Block>(n);
+        if (b->background) {
+            spawn(b);
+        } else {
+            execute_block(b);
+        }
+        break;
+    }
+    case IRNode::IfStatementKind:
+        execute_if(cast<IfStatement>(n));
+        break;
+    case IRNode::ForLoopKind:
+        execute_for(cast<ForLoop>(n));
+        break;
+    case IRNode::ReturnStatementKind:
+        flow = Return;
+        break;
+    case IRNode::LoopControlStatementKind:
+        flow = cast<LoopControlStatement>(n)->op == LoopControlStatement::Break ? Break : Continue;
+        break;
+    case IRNode::FunctionCallKind:
+        call(cast<FunctionCall>(n));
+        break;
+    case IRNode::ExternCallKind:
+    case IRNode::IORedirectionKind:
+        last_status = run_command(n);
+        break;
+    case IRNode::IntrinsicKind:
+        if (cast<Intrinsic>(n)->op == Intrinsic::Append) {
+            execute_append(cast<Intrinsic>(n));
+        } else {
+            evaluate(n);
+        }
+        break;
+    case IRNode::ImportStatementKind:
+        break;
+    default:
+        evaluate(n);
+        break;
+    }
+}
+
+void Interpreter::execute_block(Block *b) {
+    for (std::vector<IRNode *>::const_iterator I = b->nodes.begin(), E = b->nodes.end(); I != E; ++I) {
+        execute(*I);
+        if (flow != Normal) return;
+    }
+}
+
+void Interpreter::execute_assignment(Assignment *n) {
+    Location *loc = n->location;
+    const bool local = use_local && !loc->variable->global;
+    const unsigned slot = slot_of(loc->variable);
+    substituted = false;
+    if (loc->variable->nameref) {
+        // The name of the array is passed to a nameref parameter. A
+        // nameref parameter is passed on as the name it refers to.
+        Location *value = cast<Location>(n->values[0]);
+        std::string name = value->variable->name.str();
+        if (value->variable->nameref) {
+            const int alias = slots[slot_of(value->variable)].alias;
+            if (alias >= 0) name = slot_names[alias];
+        }
+        binding(slot).value = Value(name);
+        last_status = 0;
+        return;
+    }
+    IORedirection *pipe = dyn_cast<IORedirection>(n->values[0]);
+    ExternCall *persistent = pipe ? dyn_cast<ExternCall>(pipe->b) : NULL;
+    if (persistent && persistent->persistent) {
+        int status;
+        Value line(read_coprocess(pipe, status));
+        if (local && loc->is_variable()) declare_local(slot);
+        if (loc->is_variable()) {
+            binding(slot).value = line;
+        } else if (loc->variable->type().map()) {
+            map_entries(slot)[str(evaluate(loc->offset))] = line.string;
+        } else {
+            // Stored as by 'read' into an array element.
+            long long index = integer(loc->offset);
+            Value &array = binding(slot).value;
+            if (array.kind != Value::ArrayValue) array = Value(std::vector<std::string>(1, str(array)));
+            if (index < 0) index += array.elements.size();
+            if (index >= 0) {
+                if ((unsigned long long)index >= array.elements.size()) array.elements.resize(index + 1);
+                array.elements[index] = line.string;
+            }
+        }
+        last_status = status;
+        return;
+    }
+    Intrinsic *read = dyn_cast<Intrinsic>(n->values[0]);
+    if (read && read->reads_file()) {
+        execute_read(slot, read, local);
+        return;
+    }
+
+    String *s = n->values.size() == 1 ? dyn_cast<String>(n->values[0]) : NULL;
+    if (s && loc->is_variable() && s->value->begin() != s->value->end() &&
+        (*s->value->begin()).is_var() && (*s->value->begin()).var()->name == loc->variable->name &&
+        (!local || slots[slot].depth == depth)) {
+        // A string is appended to in place, as CodeGen_Bash does with
+        // '+=', so that building it in a loop takes linear time.
+        InterpolatedString::const_iterator I = s->value->begin();
+        std::string rest;
+        for (++I; I != s->value->end(); ++I) {
+            rest += (*I).is_str() ? unquote_double((*I).str()) : str(lookup((*I).var()));
+        }
+        Value &v = binding(slot).value;
+        if (v.kind != Value::StringValue) v = Value(str(v));
+        v.string += rest;
+        last_status = 0;
+        return;
+    }
+
+    Value value;
+    const bool array = n->values.size() > 1 || n->values[0]->type().array();
+    if (array) {
+        std::vector<std::string> elements;
+        for (unsigned i = 0; i < n->values.size(); i++) {
+            words(n->values[i], true, elements);
+        }
+        value = Value(elements);
+    } else {
+        value = evaluate(n->values[0]);
+    }
+    if (flow == Exit) return;
+    if (loc->is_array_ref() && loc->variable->type().map()) {
+        // Map elements are assigned without 'local'.
+        const std::string key = str(evaluate(loc->offset));
+        map_entries(slot)[key] = str(value);
+        if (!substituted) last_status = 0;
+        return;
+    }
+    long long index = loc->is_array_ref() ? integer(loc->offset) : 0;
+    if (local && (loc->is_variable() || slots[slot].depth != depth)) declare_local(slot);
+    if (loc->is_variable()) {
+        std::swap(binding(slot).value, value);
+    } else {
+        Value &target = binding(slot).value;
+        if (target.kind != Value::ArrayValue) {
+            target = Value(std::vector<std::string>(1, str(target)));
+        }
+        if (index < 0) index += target.elements.size();
+        if (index < 0) {
+            error("bad array subscript", n);
+            return;
+        }
+        if ((unsigned long long)index >= target.elements.size()) target.elements.resize(index + 1);
+        target.elements[index] = str(value);
+    }
+    if (local || !substituted) {
+        // 'local' succeeds; a global assignment has the status of its
+        // command substitutions.
+        last_status = 0;
+    }
+}
+
+// Read a file into the variable in the given slot, as the 'mapfile'
+// (lines()) or 'read' (read_file()) of CodeGen_Bash. A file which can
+// not be opened leaves the variable empty; only 'mapfile' then fails,
+// as the status of read_file() is that of removing the trailing
+// newlines.
+void Interpreter::execute_read(unsigned slot, Intrinsic *n, bool local) {
+    const std::string path = str(evaluate(n->args[0]));
+    if (flow == Exit) return;
+    if (local) declare_local(slot);
+    if (n->op == Intrinsic::Lines) {
+        binding(slot).value = Value(std::vector<std::string>());
+    } else {
+        binding(slot).value = Value(std::string());
+    }
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        stream.flush();
+        std::cerr << "bish: " << path << ": " << std::strerror(errno) << "\n";
+        last_status = n->op == Intrinsic::Lines ? 1 : 0;
+        return;
+    }
+    std::string contents;
+    read_fd(fd, contents);
+    close(fd);
+    if (n->op == Intrinsic::Lines) {
+        std::vector<std::string> lines;
+        std::string::size_type start = 0;
+        while (start < contents.size()) {
+            std::string::size_type end = contents.find('\n', start);
+            if (end == std::string::npos) end = contents.size();
+            lines.push_back(contents.substr(start, end - start));
+            start = end + 1;
+        }
+        binding(slot).value = Value(lines);
+    } else {
+        // 'read -d' stops at a NUL byte.
+        contents = contents.substr(0, contents.find('\0'));
+        contents.erase(contents.find_last_not_of('\n') + 1);
+        binding(slot).value = Value(contents);
+    }
+    last_status = 0;
+}
+
+void Interpreter::execute_if(IfStatement *n) {
+    if (test(n->pblock->condition)) {
+        execute(n->pblock->body);
+        return;
+    }
+    for (std::vector<PredicatedBlock *>::const_iterator I = n->elses.begin(),
+             E = n->elses.end(); I != E; ++I) {
+        if (flow == Exit) return;
+        if (test((*I)->condition)) {
+            execute((*I)->body);
+            return;
+        }
+    }
+    if (flow == Exit) return;
+    if (n->elseblock) {
+        execute(n->elseblock);
+    } else {
+        last_status = 0;
+    }
+}
+
+void Interpreter::execute_for(ForLoop *n) {
+    Jobs *jobs = NULL;
+    if (n->parallel) {
+        const char *tmpdir = std::getenv("TMPDIR");
+        std::string dir = std::string(tmpdir && *tmpdir ? tmpdir : "/tmp") + "/bish.XXXXXX";
+        std::vector<char> path(dir.begin(), dir.end());
+        path.push_back('\0');
+        if (mkdtemp(&path[0]) == NULL) {
+            error(std::string("mkdtemp: ") + std::strerror(errno), n);
+            return;
+        }
+        jobs = new Jobs();
+        jobs->dir = &path[0];
+    }
+    last_status = 0;
+    const unsigned slot = slot_of(n->variable);
+    if (n->stream) {
+        execute_stream_for(n, jobs);
+    } else if (n->upper) {
+        // As 'for (( i = lower, end = upper; i <= end; i++ ))': the
+        // bound is evaluated once, and the body may change the
+        // variable.
+        long long i = integer(n->lower);
+        const long long end = integer(n->upper);
+        while (flow == Normal) {
+            binding(slot).value = Value(i);
+            if (i > end) break;
+            if (!iterate(n, jobs)) break;
+            i = integer(binding(slot).value, n) + 1;
+        }
+    } else {
+        std::vector<std::string> items;
+        words(n->lower, false, items);
+        for (std::vector<std::string>::const_iterator I = items.begin(), E = items.end();
+             I != E && flow == Normal; ++I) {
+            binding(slot).value = Value(*I);
+            if (!iterate(n, jobs)) break;
+        }
+    }
+    if (jobs) {
+        finish_jobs(*jobs);
+        delete jobs;
+    }
+}
+
+// Run the given loop over the lines written by its command, as they
+// are written.
+void Interpreter::execute_stream_for(ForLoop *n, Jobs *jobs) {
+    int p[2];
+    open_pipe(p);
+    std::vector<pid_t> pids;
+    start(n->lower, STDIN_FILENO, p[1], pids);
+    close_fd(p[1]);
+    const unsigned slot = slot_of(n->variable);
+    std::string buffer, line;
+    for (;;) {
+        // A last line without a newline is iterated too.
+        const bool more = read_line(p[0], buffer, line) || !line.empty();
+        binding(slot).value = Value(line);
+        if (!more || !iterate(n, jobs)) break;
+    }
+    close_fd(p[0]);
+    const int status = last_status;
+    wait_all(pids);
+    last_status = status;
+}
+
+// Run the body of the given loop once, or start it as a job of a
+// parallel loop. Return false if the loop ends.
+bool Interpreter::iterate(ForLoop *n, Jobs *jobs) {
+    if (jobs) {
+        start_job(n, *jobs);
+        return flow == Normal;
+    }
+    execute(n->body);
+    if (flow == Break) {
+        flow = Normal;
+        return false;
+    }
+    if (flow == Continue) flow = Normal;
+    return flow == Normal;
+}
+
+// Start the body of the given loop as a job, writing its output to a
+// file. With a limit, the job started 'limit' jobs ago is waited for
+// first.
+void Interpreter::start_job(ForLoop *n, Jobs &jobs) {
+    const std::vector<pid_t>::size_type count = jobs.pids.size();
+    if (n->limit) {
+        const long long limit = integer(n->limit);
+        if (limit > 0 && count >= (unsigned long long)limit) wait_pid(jobs.pids[count - limit]);
+    }
+    const std::string file = jobs.dir + "/" + decimal(count);
+    int fd = open(file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) {
+        error(file + ": " + std::strerror(errno), n);
+        return;
+    }
+    keep_fd(fd);
+    pid_t pid = fork_stage(STDIN_FILENO, fd);
+    if (pid == 0) {
+        execute(n->body);
+        leave_child();
+    }
+    close_fd(fd);
+    jobs.pids.push_back(pid);
+    jobs.files.push_back(file);
+    last_status = 0;
+}
+
+// Wait for the jobs of a parallel loop, and write their output in the
+// order they were started. Jobs already waited for to free a slot are
+// no longer children, and are skipped.
+void Interpreter::finish_jobs(Jobs &jobs) {
+    for (std::vector<pid_t>::const_iterator I = jobs.pids.begin(), E = jobs.pids.end(); I != E; ++I) {
+        if (*I > 0) wait_pid(*I);
+    }
+    for (std::vector<std::string>::const_iterator I = jobs.files.begin(), E = jobs.files.end(); I != E; ++I) {
+        int fd = open(I->c_str(), O_RDONLY);
+        if (fd >= 0) {
+            std::string output;
+            read_fd(fd, output);
+            close(fd);
+            write_output(output);
+        }
+        unlink(I->c_str());
+    }
+    rmdir(jobs.dir.c_str());
+    last_status = 0;
+}
+
+void Interpreter::execute_append(Intrinsic *n) {
+    std::vector<std::string> elements;
+    words(n->args[0], true, elements);
+    if (flow == Exit) return;
+    Value &target = binding(slot_of(n->target->variable)).value;
+    if (target.kind != Value::ArrayValue) {
+        target = Value(std::vector<std::string>(1, str(target)));
+    }
+    target.elements.insert(target.elements.end(), elements.begin(), elements.end());
+    last_status = 0;
+}
+
+// Run the given block as a background job, waited for by wait().
+void Interpreter::spawn(Block *b) {
+    pid_t pid = fork_stage(STDIN_FILENO, STDOUT_FILENO);
+    if (pid == 0) {
+        execute_block(b);
+        leave_child();
+    }
+    if (pid > 0) spawned.push_back(pid);
+    last_status = 0;
+}
+
+void Interpreter::wait_spawned() {
+    int status = 0;
+    for (std::vector<pid_t>::const_iterator I = spawned.begin(), E = spawned.end(); I != E; ++I) {
+        status = wait_pid(*I);
+    }
+    spawned.clear();
+    last_status = status;
+}
+
+void Interpreter::call(FunctionCall *n) {
+    Function *f = n->function;
+    std::vector<Value> positional;
+    for (unsigned i = 0; i < n->args.size(); i++) {
+        // Variables passed by reference are communicated by a global
+        // variable, not a function argument.
+        if (f->args[i]->is_reference()) continue;
+        positional.push_back(lookup(n->args[i]->location->variable));
+    }
+    call_function(f, positional);
+}
+
+// Call the given function with the given positional arguments. Its
+// status is that of its last command.
+void Interpreter::call_function(Function *f, const std::vector<Value> &positional) {
+    if (f->body == NULL) {
+        error("function " + f->name.str() + " is not defined", f);
+        return;
+    }
+    // The values of a memoized function are kept by its arguments,
+    // each preceded by its length, as CodeGen_Bash does.
+    std::string memo_key;
+    std::map<std::string, Value> *memo_table = NULL;
+    if (f->memo) {
+        memo_key = positional.empty() ? "_" : "";
+        for (std::vector<Value>::const_iterator I = positional.begin(), E = positional.end(); I != E; ++I) {
+            const std::string s = str(*I);
+            memo_key += decimal(s.size()) + ":" + s;
+        }
+        memo_table = &memo_tables[f];
+        std::map<std::string, Value>::iterator I = memo_table->find(memo_key);
+        if (I != memo_table->end()) {
+            lookup(f->return_value) = I->second;
+            last_status = 0;
+            return;
+        }
+    }
+    if (depth == calls.size()) calls.push_back(std::vector<Shadowed>());
+    depth++;
+    const bool outer_local = use_local;
+    use_local = true;
+    unsigned next = 0;
+    for (std::vector<Variable *>::const_iterator I = f->args.begin(), E = f->args.end(); I != E; ++I) {
+        const unsigned slot = slot_of(*I);
+        if ((*I)->nameref) {
+            // As 'local -n', referring to the variable named by the
+            // global passed by reference.
+            const std::string name = str(lookup((*I)->reference));
+            declare_local(slot);
+            slots[slot].alias = name.empty() ? -1 : (int)slot_of(name);
+            continue;
+        }
+        Value value;
+        if ((*I)->is_reference()) {
+            value = lookup((*I)->reference);
+        } else if (next < positional.size()) {
+            value = positional[next++];
+        } else {
+            value = Value(std::string());
+        }
+        declare_local(slot);
+        std::swap(slots[slot].value, value);
+    }
+    // The 'local' declaring the parameters succeeds; without any, the
+    // body sees the status of the command before the call.
+    if (!f->args.empty()) last_status = 0;
+    execute_block(f->body);
+    if (flow == Return && memo_table) (*memo_table)[memo_key] = lookup(f->return_value);
+    if (flow != Exit) flow = Normal;
+
+    std::vector<Shadowed> &shadowed = calls[depth - 1];
+    for (std::vector<Shadowed>::reverse_iterator I = shadowed.rbegin(), E = shadowed.rend(); I != E; ++I) {
+        std::swap(slots[I->slot], I->binding);
+    }
+    shadowed.clear();
+    depth--;
+    use_local = outer_local;
+}
+
+Interpreter::Value Interpreter::evaluate(IRNode *n) {
+    switch (n->kind()) {
+    case IRNode::IntegerKind:
+        return Value((long long)cast<Integer>(n)->value);
+    case IRNode::BooleanKind:
+        return Value((long long)(cast<Boolean>(n)->value ? 1 : 0));
+    case IRNode::StringKind:
+        return Value(interpolate(cast<String>(n)->value));
+    case IRNode::VariableKind:
+        return lookup(cast<Variable>(n));
+    case IRNode::LocationKind:
+        return evaluate_location(cast<Location>(n));
+    case IRNode::BinOpKind:
+        return evaluate_binop(cast<BinOp>(n));
+    case IRNode::UnaryOpKind: {
+        UnaryOp *u = cast<UnaryOp>(n);
+        if (u->op == UnaryOp::Negate) return Value(-integer(u->a));
+        return Value((long long)(test(n) ? 1 : 0));
+    }
+    case IRNode::IntrinsicKind:
+        return evaluate_intrinsic(cast<Intrinsic>(n));
+    case IRNode::MapLiteralKind:
+        return evaluate_map(cast<MapLiteral>(n));
+    case IRNode::FunctionCallKind: {
+        FunctionCall *call_node = cast<FunctionCall>(n);
+        if (call_node->function->return_value) {
+            call(call_node);
+            return lookup(call_node->function->return_value);
+        }
+        return Value(capture(n));
+    }
+    case IRNode::ExternCallKind:
+        // $(echo $?) is just $?, without the subshell.
+        if (CodeGen_Bash::is_echo_status(cast<ExternCall>(n)->body)) {
+            return Value((long long)last_status);
+        }
+        return Value(capture(n));
+    case IRNode::IORedirectionKind:
+        return Value(capture(n));
+    default:
+        error("unexpected value", n);
+        return Value(std::string());
+    }
+}
+
+Interpreter::Value Interpreter::evaluate_binop(BinOp *n) {
+    long long a, b;
+    switch (n->op) {
+    case BinOp::Add:
+        a = integer(n->a);
+        return Value(a + integer(n->b));
+    case BinOp::Sub:
+        a = integer(n->a);
+        return Value(a - integer(n->b));
+    case BinOp::Mul:
+        a = integer(n->a);
+        return Value(a * integer(n->b));
+    case BinOp::Div:
+    case BinOp::Mod:
+        a = integer(n->a);
+        b = integer(n->b);
+        if (b == 0) {
+            error("division by 0", n);
+            return Value(0LL);
+        }
+        if (b == -1) return Value(n->op == BinOp::Div ? -a : 0LL);
+        return Value(n->op == BinOp::Div ? a / b : a % b);
+    default:
+        return Value((long long)(test(n) ? 1 : 0));
+    }
+}
+
+Interpreter::Value Interpreter::evaluate_intrinsic(Intrinsic *n) {
+    // Reads of files are run by their assignment (see execute_read).
+    assert(!n->reads_file());
+    const Value &target = binding(slot_of(n->target->variable)).value;
+    switch (n->op) {
+    case Intrinsic::Length:
+        if (target.kind == Value::MapValue) return Value((long long)target.entries.size());
+        if (n->target->variable->type().array()) {
+            if (target.kind == Value::ArrayValue) return Value((long long)target.elements.size());
+            return Value(1LL);
+        }
+        return Value(characters(str(target)));
+    case Intrinsic::Slice: {
+        std::vector<std::string> elements;
+        words(n, true, elements);
+        return Value(elements);
+    }
+    case Intrinsic::Append:
+        execute_append(n);
+        break;
+    default:
+        break;
+    }
+    return Value(std::string());
+}
+
+Interpreter::Value Interpreter::evaluate_location(Location *n) {
+    if (n->is_variable()) return lookup(n->variable);
+    if (n->variable->type().map()) {
+        const std::string key = str(evaluate(n->offset));
+        const Value &v = lookup(n->variable);
+        if (v.kind != Value::MapValue) return Value(std::string());
+        std::map<std::string, std::string>::const_iterator I = v.entries.find(key);
+        return Value(I == v.entries.end() ? std::string() : I->second);
+    }
+    long long index = integer(n->offset);
+    const Value &v = lookup(n->variable);
+    if (v.kind != Value::ArrayValue) return Value(index == 0 || index == -1 ? str(v) : std::string());
+    if (index < 0) index += v.elements.size();
+    if (index < 0 || (unsigned long long)index >= v.elements.size()) return Value(std::string());
+    return Value(v.elements[index]);
+}
+
+Interpreter::Value Interpreter::evaluate_map(MapLiteral *n) {
+    std::map<std::string, std::string> entries;
+    for (unsigned i = 0; i < n->keys.size(); i++) {
+        const std::string key = str(evaluate(n->keys[i]));
+        entries[key] = str(evaluate(n->values[i]));
+    }
+    return Value(entries);
+}
+
+// Return the entries of the map in the given slot, which becomes an
+// empty map if it holds another value.
+std::map<std::string, std::string> &Interpreter::map_entries(unsigned slot) {
+    Value &v = binding(slot).value;
+    if (v.kind != Value::MapValue) v = Value(std::map<std::string, std::string>());
+    return v.entries;
+}
+
+// Append the words the given value expands to, e.g. in an array
+// literal or the list of a loop. Variables are split into words at
+// blanks unless 'quoted', and the output of commands always is.
+void Interpreter::words(IRNode *n, bool quoted, std::vector<std::string> &out) {
+    std::vector<std::string> values;
+    switch (n->kind()) {
+    case IRNode::VariableKind:
+    case IRNode::LocationKind: {
+        Location *loc = dyn_cast<Location>(n);
+        if (loc && loc->is_array_ref()) {
+            values.push_back(str(evaluate_location(loc)));
+            break;
+        }
+        const Value &v = lookup(loc ? loc->variable : cast<Variable>(n));
+        if (v.kind == Value::MapValue) {
+            // The keys of a map are always quoted.
+            for (std::map<std::string, std::string>::const_iterator I = v.entries.begin(),
+                     E = v.entries.end(); I != E; ++I) {
+                out.push_back(I->first);
+            }
+            return;
+        } else if (v.kind == Value::ArrayValue) {
+            values = v.elements;
+        } else {
+            values.push_back(str(v));
+        }
+        break;
+    }
+    case IRNode::IntrinsicKind: {
+        Intrinsic *i = cast<Intrinsic>(n);
+        if (i->op != Intrinsic::Slice) {
+            values.push_back(str(evaluate(n)));
+            break;
+        }
+        // As ${x[@]:start:end-start}.
+        const long long start = integer(i->args[0]);
+        const bool bounded = i->args.size() > 1;
+        const long long length = bounded ? integer(i->args[1]) - start : 0;
+        const Value &v = lookup(i->target->variable);
+        std::vector<std::string> all;
+        if (v.kind == Value::ArrayValue) {
+            all = v.elements;
+        } else {
+            all.push_back(str(v));
+        }
+        long long first = start < 0 ? start + (long long)all.size() : start;
+        if (bounded && length < 0) {
+            error("substring expression < 0", n);
+            return;
+        }
+        if (first < 0) break;
+        for (long long k = first; k < (long long)all.size() && (!bounded || k < first + length); k++) {
+            values.push_back(all[k]);
+        }
+        break;
+    }
+    case IRNode::ExternCallKind:
+    case IRNode::FunctionCallKind:
+    case IRNode::IORedirectionKind:
+        split_fields(str(evaluate(n)), out);
+        return;
+    default:
+        out.push_back(str(evaluate(n)));
+        return;
+    }
+    if (quoted) {
+        out.insert(out.end(), values.begin(), values.end());
+        return;
+    }
+    for (std::vector<std::string>::const_iterator I = values.begin(), E = values.end(); I != E; ++I) {
+        split_fields(*I, out);
+    }
+}
+
+// Return the value of the given double-quoted string.
+std::string Interpreter::interpolate(InterpolatedString *s) {
+    std::string result;
+    for (InterpolatedString::const_iterator I = s->begin(), E = s->end(); I != E; ++I) {
+        if ((*I).is_str()) {
+            result += unquote_double((*I).str());
+        } else {
+            result += str(lookup((*I).var()));
+        }
+    }
+    return result;
+}
+
+// Evaluate the given condition, as the '[[ ... ]]' test emitted by
+// CodeGen_Bash.
+bool Interpreter::test(IRNode *n) {
+    if (BinOp *b = dyn_cast<BinOp>(n)) {
+        const bool string = b->a->type().string() || b->b->type().string();
+        switch (b->op) {
+        case BinOp::And:
+            return test(b->a) && flow != Exit && test(b->b);
+        case BinOp::Or:
+            return test(b->a) || (flow != Exit && test(b->b));
+        case BinOp::Eq:
+        case BinOp::NotEq:
+            if (string) {
+                const std::string x = str(evaluate(b->a));
+                return (x == str(evaluate(b->b))) == (b->op == BinOp::Eq);
+            }
+            break;
+        case BinOp::LT:
+        case BinOp::GT:
+            if (string) {
+                const std::string x = str(evaluate(b->a));
+                const int c = std::strcoll(x.c_str(), str(evaluate(b->b)).c_str());
+                return b->op == BinOp::LT ? c < 0 : c > 0;
+            }
+            break;
+        default:
+            break;
+        }
+        const long long x = integer(b->a), y = integer(b->b);
+        switch (b->op) {
+        case BinOp::Eq: return x == y;
+        case BinOp::NotEq: return x != y;
+        case BinOp::LT: return x < y;
+        case BinOp::LTE: return x <= y;
+        case BinOp::GT: return x > y;
+        case BinOp::GTE: return x >= y;
+        default:
+            // Arithmetic, stored as 1 or 0.
+            return evaluate_binop(b).integer == 1;
+        }
+    }
+    UnaryOp *u = dyn_cast<UnaryOp>(n);
+    if (u && u->op == UnaryOp::Not) return !test(u->a);
+    return integer(n) == 1;
+}
+
+long long Interpreter::integer(IRNode *n) {
+    switch (n->kind()) {
+    case IRNode::IntegerKind:
+        return cast<Integer>(n)->value;
+    case IRNode::BinOpKind:
+        return evaluate_binop(cast<BinOp>(n)).integer;
+    case IRNode::VariableKind:
+        return integer(lookup(cast<Variable>(n)), n);
+    default:
+        return integer(evaluate(n), n);
+    }
+}
+
+long long Interpreter::integer(const Value &v, IRNode *n) {
+    if (v.kind == Value::IntegerValue) return v.integer;
+    return integer(str(v), n);
+}
+
+// Return the value of the given string in arithmetic, as bash reads
+// it: an integer (octal with a leading 0, or hexadecimal with 0x), or
+// the name of a variable holding one.
+long long Interpreter::integer(const std::string &s, IRNode *n, unsigned nesting) {
+    std::string::size_type i = 0, end = s.size();
+    while (i < end && is_blank(s[i])) i++;
+    while (end > i && is_blank(s[end - 1])) end--;
+    if (i == end) return 0;
+    if (is_name_char(s[i], true)) {
+        std::string name = s.substr(i, end - i);
+        for (std::string::size_type k = 1; k < name.size(); k++) {
+            if (!is_name_char(name[k], false)) {
+                error(s + ": syntax error in expression", n);
+                return 0;
+            }
+        }
+        std::map<std::string, unsigned>::iterator I = slot_index.find(name);
+        if (I == slot_index.end()) return 0;
+        if (nesting > 16) {
+            error(s + ": expression recursion level exceeded", n);
+            return 0;
+        }
+        return integer(str(binding(I->second).value), n, nesting + 1);
+    }
+    bool negative = false;
+    if (s[i] == '-' || s[i] == '+') {
+        negative = s[i++] == '-';
+    }
+    int base = 10;
+    if (i + 1 < end && s[i] == '0' && (s[i + 1] == 'x' || s[i + 1] == 'X')) {
+        base = 16;
+        i += 2;
+    } else if (i < end && s[i] == '0') {
+        base = 8;
+    }
+    if (i == end) {
+        error(s + ": syntax error in expression", n);
+        return 0;
+    }
+    unsigned long long value = 0;
+    for (; i < end; i++) {
+        const int d = digit_value(s[i], base);
+        if (d < 0) {
+            error(s + ": syntax error in expression", n);
+            return 0;
+        }
+        value = value * base + d;
+    }
+    return negative ? -(long long)value : (long long)value;
+}
+
+std::string Interpreter::str(const Value &v) const {
+    switch (v.kind) {
+    case Value::IntegerValue:
+        return decimal(v.integer);
+    case Value::StringValue:
+        return v.string;
+    case Value::MapValue: {
+        // As ${m}, which is ${m[0]}.
+        std::map<std::string, std::string>::const_iterator I = v.entries.find("0");
+        return I == v.entries.end() ? std::string() : I->second;
+    }
+    case Value::ArrayValue:
+        break;
+    }
+    std::string result;
+    for (std::vector<std::string>::const_iterator I = v.elements.begin(), E = v.elements.end(); I != E; ++I) {
+        if (I != v.elements.begin()) result += ' ';
+        result += *I;
+    }
+    return result;
+}
+
+// Run the given command statement, and return its exit status.
+int Interpreter::run_command(IRNode *n) {
+    if (ExternCall *call_node = dyn_cast<ExternCall>(n)) return run_extern(call_node, false, NULL);
+    std::vector<pid_t> pids;
+    start(n, STDIN_FILENO, STDOUT_FILENO, pids);
+    return wait_all(pids);
+}
+
+// Return the output of the given command, as $(...) does.
+std::string Interpreter::capture(IRNode *n) {
+    std::string output;
+    substituted = true;
+    if (ExternCall *call_node = dyn_cast<ExternCall>(n)) {
+        last_status = run_extern(call_node, true, &output);
+        strip_newlines(output);
+        substituted = true;
+        return output;
+    }
+    int p[2];
+    open_pipe(p);
+    std::vector<pid_t> pids;
+    if (FunctionCall *call_node = dyn_cast<FunctionCall>(n)) {
+        pid_t pid = fork_stage(STDIN_FILENO, p[1]);
+        if (pid == 0) {
+            call(call_node);
+            leave_child();
+        }
+        pids.push_back(pid);
+    } else {
+        start(n, STDIN_FILENO, p[1], pids);
+    }
+    close_fd(p[1]);
+    read_fd(p[0], output);
+    close_fd(p[0]);
+    last_status = wait_all(pids);
+    strip_newlines(output);
+    substituted = true;
+    return output;
+}
+
+// Send the value piped to a persistent command to its coprocess, and
+// return the line it answers. The coprocess is started when it is
+// first used by a process.
+std::string Interpreter::read_coprocess(IORedirection *pipe, int &status) {
+    ExternCall *command = cast<ExternCall>(pipe->b);
+    const std::string input = str(evaluate(pipe->a)) + "\n";
+    std::map<ExternCall *, Coprocess>::iterator I = coprocesses.find(command);
+    if (I == coprocesses.end() || I->second.owner != getpid()) {
+        int to[2], from[2];
+        open_pipe(to);
+        open_pipe(from);
+        pid_t pid = fork_stage(to[0], from[1]);
+        if (pid == 0) exec_extern(command);
+        close_fd(to[0]);
+        close_fd(from[1]);
+        Coprocess c;
+        c.owner = getpid();
+        c.pid = pid;
+        c.in = to[1];
+        c.out = from[0];
+        I = coprocesses.insert(std::make_pair(command, c)).first;
+        I->second = c;
+    }
+    std::string line;
+    status = write_fd(I->second.in, input) && read_line(I->second.out, I->second.buffer, line) ? 0 : 1;
+    return line;
+}
+
+// Start the given pipeline or redirected command, reading from 'in'
+// and writing to 'out', and append the processes started to 'pids'.
+// Files are opened by the interpreter, so no process copies them.
+void Interpreter::start(IRNode *n, int in, int out, std::vector<pid_t> &pids) {
+    IORedirection *r = dyn_cast<IORedirection>(n);
+    if (r == NULL) {
+        pid_t pid = fork_stage(in, out);
+        if (pid == 0) run_stage(n);
+        pids.push_back(pid);
+        return;
+    }
+    if (r->op == IORedirection::Pipe) {
+        int p[2];
+        open_pipe(p);
+        start(r->a, in, p[1], pids);
+        start(r->b, p[0], out, pids);
+        close_fd(p[0]);
+        close_fd(p[1]);
+        return;
+    }
+    const std::string value = str(evaluate(r->b));
+    int fd = -1;
+    switch (r->op) {
+    case IORedirection::Write:
+        fd = open(value.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        break;
+    case IORedirection::Append:
+        fd = open(value.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0666);
+        break;
+    case IORedirection::Read:
+        fd = open(value.c_str(), O_RDONLY);
+        break;
+    case IORedirection::HereString: {
+        // The string is read from a deleted temporary file, as bash
+        // does.
+        const char *tmpdir = std::getenv("TMPDIR");
+        std::string path = std::string(tmpdir && *tmpdir ? tmpdir : "/tmp") + "/bish.XXXXXX";
+        std::vector<char> name(path.begin(), path.end());
+        name.push_back('\0');
+        fd = mkstemp(&name[0]);
+        if (fd >= 0) {
+            unlink(&name[0]);
+            write_fd(fd, value + "\n");
+            lseek(fd, 0, SEEK_SET);
+        }
+        break;
+    }
+    default:
+        break;
+    }
+    if (fd < 0) {
+        stream.flush();
+        std::cerr << "bish: " << value << ": " << std::strerror(errno) << "\n";
+        // The command is not run, and fails.
+        pids.push_back(-1);
+        return;
+    }
+    keep_fd(fd);
+    if (r->op == IORedirection::Read || r->op == IORedirection::HereString) {
+        start(r->a, fd, out, pids);
+    } else {
+        start(r->a, in, fd, pids);
+    }
+    close_fd(fd);
+}
+
+// Fork a process reading from 'in' and writing to 'out', closing the
+// descriptors of the interpreter. Return its pid, or 0 in the child.
+pid_t Interpreter::fork_stage(int in, int out) {
+    stream.flush();
+    pid_t pid = fork();
+    if (pid < 0) {
+        error(std::string("fork: ") + std::strerror(errno), NULL);
+        return -1;
+    }
+    if (pid > 0) return pid;
+    if (in != STDIN_FILENO) dup2(in, STDIN_FILENO);
+    if (out != STDOUT_FILENO) dup2(out, STDOUT_FILENO);
+    for (std::vector<int>::const_iterator I = pipe_fds.begin(), E = pipe_fds.end(); I != E; ++I) {
+        if (*I != STDIN_FILENO && *I != STDOUT_FILENO) close(*I);
+    }
+    pipe_fds.clear();
+    spawned.clear();
+    return 0;
+}
+
+// Run the given node as a command of a pipeline, in a forked process.
+// A function called there prints its return value after returning,
+// so that it becomes the output of the stage, and any other value is
+// printed as a line.
+void Interpreter::run_stage(IRNode *n) {
+    if (ExternCall *call_node = dyn_cast<ExternCall>(n)) exec_extern(call_node);
+    if (FunctionCall *call_node = dyn_cast<FunctionCall>(n)) {
+        call(call_node);
+        Variable *retval = call_node->function->return_value;
+        if (retval && flow != Exit) write_output(str(lookup(retval)) + "\n");
+    } else if (isa<IORedirection>(n)) {
+        last_status = run_command(n);
+    } else {
+        write_output(str(evaluate(n)) + "\n");
+        last_status = 0;
+    }
+    leave_child();
+}
+
+// Run the given command, writing its output to 'output' if it is not
+// NULL. A 'subshell' (a command substitution) can not change the
+// directory of the script, or exit it. Return its exit status.
+int Interpreter::run_extern(ExternCall *n, bool subshell, std::string *output) {
+    if (waits_for_spawned(n)) {
+        wait_spawned();
+        return last_status;
+    }
+    std::vector<std::string> command;
+    if (split_command(n->body, command)) {
+        if (command.empty()) return 0;
+        std::string out;
+        const int status = run_builtin(command, subshell, out);
+        if (status >= 0) {
+            if (output) {
+                *output += out;
+            } else {
+                write_output(out);
+            }
+            return status;
+        }
+    }
+    int p[2] = { -1, -1 };
+    if (output) open_pipe(p);
+    pid_t pid = fork_stage(STDIN_FILENO, output ? p[1] : STDOUT_FILENO);
+    if (pid == 0) exec_extern(n);
+    if (output) {
+        close_fd(p[1]);
+        read_fd(p[0], *output);
+        close_fd(p[0]);
+    }
+    return pid < 0 ? 1 : wait_pid(pid);
+}
+
+// Replace the process with the given command: a builtin is run and
+// the process exits, a simple command is executed directly, and any
+// other command is run by bash.
+void Interpreter::exec_extern(ExternCall *n) {
+    if (waits_for_spawned(n)) leave_child();
+    std::vector<std::string> command;
+    if (split_command(n->body, command)) {
+        if (command.empty()) _exit(0);
+        std::string out;
+        last_status = run_builtin(command, false, out);
+        if (last_status >= 0) {
+            write_output(out);
+            leave_child();
+        }
+        stream.flush();
+        std::vector<char *> argv;
+        for (std::vector<std::string>::iterator I = command.begin(), E = command.end(); I != E; ++I) {
+            argv.push_back(const_cast<char *>(I->c_str()));
+        }
+        argv.push_back(NULL);
+        execvp(argv[0], &argv[0]);
+        const int e = errno;
+        std::cerr << "bish: " << command[0] << ": "
+                  << (e == ENOENT ? "command not found" : std::strerror(e)) << "\n";
+        _exit(e == ENOENT ? 127 : 126);
+    }
+    stream.flush();
+    const std::string script = bash_script(n);
+    execlp("bash", "bash", "-c", script.c_str(), (char *)NULL);
+    perror("bash");
+    _exit(127);
+}
+
+// Split the given command into words as bash would, expanding its
+// variables, if it is a simple command: words of plain, quoted or
+// backslash-escaped text. Return false if it uses any other shell
+// syntax, which is left to bash.
+bool Interpreter::split_command(InterpolatedString *s, std::vector<std::string> &result) {
+    typedef enum { Plain, Single, Double } Quoting;
+    Quoting quoting = Plain;
+    WordBuilder word(result);
+    for (InterpolatedString::const_iterator I = s->begin(), E = s->end(); I != E; ++I) {
+        if ((*I).is_var()) {
+            Variable *v = (*I).var();
+            const Value &value = lookup(v);
+            if (quoting == Single) {
+                word.quoted("${" + v->name.str() + (v->type().array() ? "[@]" : "") + "}");
+            } else if (!v->type().array() || value.kind != Value::ArrayValue) {
+                if (quoting == Double) {
+                    word.quoted(str(value));
+                } else if (!word.expansion(str(value))) {
+                    return false;
+                }
+            } else {
+                // Each element of an array is a word of its own.
+                for (unsigned i = 0; i < value.elements.size(); i++) {
+                    if (i > 0 && !word.end()) return false;
+                    if (quoting == Double) {
+                        word.quoted(value.elements[i]);
+                    } else if (!word.expansion(value.elements[i])) {
+                        return false;
+                    }
+                }
+            }
+            continue;
+        }
+        const std::string &text = (*I).str();
+        for (std::string::size_type i = 0; i < text.size(); i++) {
+            const char c = text[i];
+            if (quoting == Single) {
+                if (c == '\'') {
+                    quoting = Plain;
+                } else {
+                    word.quoted(c);
+                }
+                continue;
+            }
+            if (quoting == Double) {
+                if (c == '"') {
+                    quoting = Plain;
+                } else if (c == '$' || c == '`') {
+                    return false;
+                } else if (c == '\\' && i + 1 < text.size() && std::strchr("$`\"\\\n", text[i + 1])) {
+                    if (text[++i] != '\n') word.quoted(text[i]);
+                } else {
+                    word.quoted(c);
+                }
+                continue;
+            }
+            if (is_blank(c)) {
+                if (!word.end()) return false;
+            } else if (c == '\'') {
+                quoting = Single;
+                word.mark();
+            } else if (c == '"') {
+                quoting = Double;
+                word.mark();
+            } else if (c == '\\') {
+                if (i + 1 == text.size()) return false;
+                if (text[++i] != '\n') word.quoted(text[i]);
+            } else if (std::strchr("|&;<>()$`{}", c) ||
+                       (word.at_word_start() && (c == '#' || c == '~')) ||
+                       (word.first_word() && (c == '=' || c == '!'))) {
+                return false;
+            } else {
+                word.unquoted(c);
+            }
+        }
+    }
+    if (quoting != Plain || !word.end()) return false;
+    return result.empty() || !is_shell_word(result[0]);
+}
+
+// Run the given command if it is a builtin run by the interpreter,
+// appending its output to 'output'. Return its exit status, or -1 if
+// it is not such a builtin, or its use is left to bash.
+int Interpreter::run_builtin(const std::vector<std::string> &command, bool subshell,
+                             std::string &output) {
+    const std::string &name = command[0];
+    if (name == "printf") return builtin_printf(command, output);
+    if (name == "echo") return builtin_echo(command, output);
+    if (name == "true" || name == ":") return 0;
+    if (name == "false") return 1;
+    if (name == "test" || name == "[") {
+        if (name == "[" && command.back() != "]") return -1;
+        std::vector<std::string> operands(command.begin(), command.end() - (name == "[" ? 1 : 0));
+        return test_operands(operands, 1);
+    }
+    if (name == "pwd") {
+        if (command.size() > 1) return -1;
+        std::vector<char> cwd(PATH_MAX + 1);
+        if (getcwd(&cwd[0], cwd.size()) == NULL) return -1;
+        output += std::string(&cwd[0]) + "\n";
+        return 0;
+    }
+    // A command substitution runs in a subshell, whose directory and
+    // exit do not matter.
+    if (subshell) return -1;
+    if (name == "cd") {
+        if (command.size() > 2) return -1;
+        const char *home = std::getenv("HOME");
+        std::string dir = command.size() == 1 ? (home ? home : "") : command[1];
+        if (dir == "-") return -1;
+        if (chdir(dir.c_str()) < 0) {
+            stream.flush();
+            std::cerr << "bish: cd: " << dir << ": " << std::strerror(errno) << "\n";
+            return 1;
+        }
+        std::vector<char> cwd(PATH_MAX + 1);
+        const char *pwd = std::getenv("PWD");
+        if (pwd) setenv("OLDPWD", pwd, 1);
+        if (getcwd(&cwd[0], cwd.size())) setenv("PWD", &cwd[0], 1);
+        return 0;
+    }
+    if (name == "exit") {
+        if (command.size() > 2) return -1;
+        long long status = last_status;
+        if (command.size() == 2 && !test_integer(command[1], status)) return -1;
+        exit_status = status & 0xff;
+        flow = Exit;
+        return exit_status;
+    }
+    return -1;
+}
+
+// Return a bash script running the given command, after defining the
+// variables it expands or names (e.g. "echo ${#arr[@]}"), and setting
+// '$?' to the status of the last command.
+std::string Interpreter::bash_script(ExternCall *n) {
+    std::set<std::string> names;
+    std::string text;
+    for (InterpolatedString::const_iterator I = n->body->begin(), E = n->body->end(); I != E; ++I) {
+        if ((*I).is_var()) {
+            Variable *v = (*I).var();
+            names.insert(v->name.str());
+            text += "${" + v->name.str() + (v->type().array() ? "[@]" : "") + "}";
+            continue;
+        }
+        const std::string &s = (*I).str();
+        for (std::string::size_type i = 0; i < s.size(); i++) {
+            if (s[i] != '$') continue;
+            std::string::size_type j = i + 1;
+            if (j < s.size() && s[j] == '{') j++;
+            if (j < s.size() && (s[j] == '#' || s[j] == '!')) j++;
+            std::string::size_type k = j;
+            while (k < s.size() && is_name_char(s[k], k == j)) k++;
+            if (k > j) names.insert(s.substr(j, k - j));
+        }
+        text += s;
+    }
+    std::string script;
+    for (std::set<std::string>::const_iterator I = names.begin(), E = names.end(); I != E; ++I) {
+        std::map<std::string, unsigned>::iterator S = slot_index.find(*I);
+        if (S == slot_index.end()) continue;
+        const Value &v = binding(S->second).value;
+        if (v.kind == Value::MapValue) {
+            script += "declare -A " + *I + "=(";
+            for (std::map<std::string, std::string>::const_iterator EI = v.entries.begin(),
+                     EE = v.entries.end(); EI != EE; ++EI) {
+                script += " [" + single_quote(EI->first) + "]=" + single_quote(EI->second);
+            }
+            script += " ); ";
+            continue;
+        }
+        if (v.kind != Value::ArrayValue) {
+            script += *I + "=" + single_quote(str(v)) + "; ";
+            continue;
+        }
+        script += *I + "=(";
+        for (std::vector<std::string>::const_iterator EI = v.elements.begin(), EE = v.elements.end();
+             EI != EE; ++EI) {
+            script += " " + single_quote(*EI);
+        }
+        script += " ); ";
+    }
+    if (text.find("$?") != std::string::npos) {
+        script += "_bish_status () { return " + decimal(last_status) + "; }; _bish_status; ";
+    }
+    return script + text;
+}
+
+// Wait for the given processes, and return the status of the last.
+int Interpreter::wait_all(const std::vector<pid_t> &pids) {
+    int status = 0;
+    for (std::vector<pid_t>::const_iterator I = pids.begin(), E = pids.end(); I != E; ++I) {
+        status = *I < 0 ? 1 : wait_pid(*I);
+    }
+    return status;
+}
+
+// Open a pipe whose descriptors are closed by exec and in forked
+// processes.
+void Interpreter::open_pipe(int p[2]) {
+    if (pipe(p) < 0) {
+        error(std::string("pipe: ") + std::strerror(errno), NULL);
+        p[0] = open("/dev/null", O_RDONLY);
+        p[1] = open("/dev/null", O_WRONLY);
+    }
+    keep_fd(p[0]);
+    keep_fd(p[1]);
+}
+
+// Close the given descriptor in commands and forked processes.
+void Interpreter::keep_fd(int fd) {
+    if (fd < 0) return;
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    pipe_fds.push_back(fd);
+}
+
+void Interpreter::close_fd(int fd) {
+    if (fd < 0) return;
+    close(fd);
+    for (std::vector<int>::iterator I = pipe_fds.begin(), E = pipe_fds.end(); I != E; ++I) {
+        if (*I == fd) {
+            pipe_fds.erase(I);
+            break;
+        }
+    }
+}
+
+void Interpreter::write_output(const std::string &s) {
+    stream << s;
+}
+
+// Exit a forked process with the status of its last command.
+void Interpreter::leave_child() {
+    stream.flush();
+    _exit(flow == Exit ? exit_status : last_status);
+}
+
+// Report an error which ends the script with status 1, as an error in
+// an expansion ends a bash script.
+void Interpreter::error(const std::string &message, IRNode *n) {
+    stream.flush();
+    std::cerr << "bish: " << message;
+    if (n && !n->debug_info().str().empty()) std::cerr << " " << n->debug_info();
+    std::cerr << "\n";
+    exit_status = 1;
+    flow = Exit;
+}
@@ -0,0 +1,171 @@
+#ifndef __BISH_INTERPRETER_H__
+#define __BISH_INTERPRETER_H__
+
+#include <map>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+#include "CodeGen.h"
+#include "FlatHash.h"
+#include "IR.h"
+
+namespace Bish {
+
+/** Runs a linked module directly, with the semantics of the script
+ * CodeGen_Bash emits for it, instead of emitting a script: registered
+ * as the "interp" code generator, for 'bish -u interp -r'. Values are
+ * native integers, strings and arrays, variables are dynamically
+ * scoped as in bash, and only commands fork. Simple commands are split
+ * into words and run directly, and the builtins printf, echo, test,
+ * true, false, pwd, cd and exit run in the interpreter; any other
+ * shell syntax in a command (e.g. '$?', loops or globs) is run by
+ * 'bash -c', with the variables it mentions defined before it, so it
+ * can not change the variables or directory of the script. Maps are
+ * iterated in the order of their keys, where bash uses an unspecified
+ * order. Fractional values and profiling are not supported. */
+class Interpreter : public CodeGenerator {
+public:
+    Interpreter(std::ostream &os);
+    virtual void set_options(const CompileOptions &options);
+    virtual bool executes() const { return true; }
+    virtual std::string interpreter() const { return ""; }
+    virtual void set_args(const std::vector<std::string> &a) { script_args = a; }
+    virtual int status() const { return exit_status; }
+    virtual void visit(Module *);
+
+    // A value is an integer, a string, an array of strings or a map
+    // from strings to strings. An unset variable is an empty array,
+    // whose value as a string is empty.
+    class Value {
+    public:
+        typedef enum { IntegerValue, StringValue, ArrayValue, MapValue } Kind;
+        Value() : kind(ArrayValue), integer(0) {}
+        Value(long long i) : kind(IntegerValue), integer(i) {}
+        Value(const std::string &s) : kind(StringValue), integer(0), string(s) {}
+        Value(const std::vector<std::string> &a) : kind(ArrayValue), integer(0), elements(a) {}
+        Value(const std::map<std::string, std::string> &m) : kind(MapValue), integer(0), entries(m) {}
+        Kind kind;
+        long long integer;
+        std::string string;
+        std::vector<std::string> elements;
+        std::map<std::string, std::string> entries;
+    };
+private:
+    // The binding of a variable. 'depth' is the depth of the call
+    // which declared it local (0 for globals), and 'alias' the slot of
+    // the variable a nameref refers to, or -1.
+    struct Slot {
+        Value value;
+        unsigned depth;
+        int alias;
+        Slot() : depth(0), alias(-1) {}
+    };
+    // A binding shadowed by a local variable, restored when the call
+    // declaring it returns.
+    struct Shadowed {
+        unsigned slot;
+        Slot binding;
+    };
+    // What ends the execution of a block.
+    typedef enum { Normal, Break, Continue, Return, Exit } Flow;
+    // A coprocess running a persistent command, started by process
+    // 'owner', with the part of its output read but not yet used.
+    struct Coprocess {
+        pid_t owner, pid;
+        int in, out;
+        std::string buffer;
+    };
+    // The jobs of a parallel loop. The output of each job is written
+    // to a file of its own in 'dir', and copied to the output in order
+    // once all of them finished.
+    struct Jobs {
+        std::string dir;
+        std::vector<pid_t> pids;
+        std::vector<std::string> files;
+    };
+
+    std::vector<std::string> script_args;
+    bool profile;
+    int exit_status;
+    int last_status;
+    // True if a command was substituted in the statement being run,
+    // whose status it then keeps.
+    bool substituted;
+    Flow flow;
+    // True while the statements executed may declare local variables.
+    bool use_local;
+    // Variables are bound by name, in the slot of their name.
+    std::vector<Slot> slots;
+    std::vector<std::string> slot_names;
+    std::map<std::string, unsigned> slot_index;
+    FlatHashMap<unsigned, unsigned, IntegerHash> name_slots;
+    // The bindings shadowed by each call in progress; only the first
+    // 'depth' entries are in use.
+    std::vector<std::vector<Shadowed> > calls;
+    unsigned depth;
+    // Descriptors to close in forked processes.
+    std::vector<int> pipe_fds;
+    std::vector<pid_t> spawned;
+    std::map<ExternCall *, Coprocess> coprocesses;
+    // The values returned by each memoized function, by arguments.
+    std::map<Function *, std::map<std::string, Value> > memo_tables;
+
+    unsigned slot_of(Variable *v);
+    unsigned slot_of(const std::string &name);
+    Slot &binding(unsigned slot);
+    Value &lookup(Variable *v) { return binding(slot_of(v)).value; }
+    void declare_local(unsigned slot);
+
+    void execute(IRNode *n);
+    void execute_block(Block *b);
+    void execute_assignment(Assignment *n);
+    void execute_if(IfStatement *n);
+    void execute_for(ForLoop *n);
+    void execute_stream_for(ForLoop *n, Jobs *jobs);
+    bool iterate(ForLoop *n, Jobs *jobs);
+    void start_job(ForLoop *n, Jobs &jobs);
+    void finish_jobs(Jobs &jobs);
+    void execute_append(Intrinsic *n);
+    void execute_read(unsigned slot, Intrinsic *n, bool local);
+    void spawn(Block *b);
+    void wait_spawned();
+    void call(FunctionCall *n);
+    void call_function(Function *f, const std::vector<Value> &positional);
+
+    Value evaluate(IRNode *n);
+    Value evaluate_binop(BinOp *n);
+    Value evaluate_intrinsic(Intrinsic *n);
+    Value evaluate_location(Location *n);
+    Value evaluate_map(MapLiteral *n);
+    std::map<std::string, std::string> &map_entries(unsigned slot);
+    void words(IRNode *n, bool quoted, std::vector<std::string> &out);
+    std::string interpolate(InterpolatedString *s);
+    bool test(IRNode *n);
+    long long integer(IRNode *n);
+    long long integer(const Value &v, IRNode *n);
+    long long integer(const std::string &s, IRNode *n, unsigned nesting=0);
+    std::string str(const Value &v) const;
+
+    int run_command(IRNode *n);
+    std::string capture(IRNode *n);
+    std::string read_coprocess(IORedirection *pipe, int &status);
+    void start(IRNode *n, int in, int out, std::vector<pid_t> &pids);
+    pid_t fork_stage(int in, int out);
+    void run_stage(IRNode *n);
+    int run_extern(ExternCall *n, bool subshell, std::string *output);
+    void exec_extern(ExternCall *n);
+    bool split_command(InterpolatedString *s, std::vector<std::string> &words);
+    int run_builtin(const std::vector<std::string> &words, bool subshell, std::string &output);
+    std::string bash_script(ExternCall *n);
+    int wait_all(const std::vector<pid_t> &pids);
+    void open_pipe(int p[2]);
+    void keep_fd(int fd);
+    void close_fd(int fd);
+    void write_output(const std::string &s);
+    void leave_child();
+    void error(const std::string &message, IRNode *n);
+};
+
+}
+
+#endif
@@ -1,30 +1,28 @@
-#include "Parser.h"
 #include "LinkImportsPass.h"
 
 using namespace Bish;
 
 void LinkImportsPass::visit(Module *node) {
     module = node;
+    // Visiting functions which have import statements in them changes
+    // the list of functions in the module: imported functions are
+    // added, and the dummy functions they replace are erased. Thus,
+    // the functions are visited from a worklist, to which imports
+    // append the functions they added. Dummy functions have no body,
+    // so they are left out of it.
+    worklist.clear();
+    for (std::vector<Function *>::const_iterator I = node->functions.begin(),
+             E = node->functions.end(); I != E; ++I) {
+        if ((*I)->body) worklist.push_back(*I);
+    }
     node->global_variables->accept(this);
-    // There's probably a better way to do this. The issue is that
-    // visiting functions which have import statements in them can
-    // cause the list of functions in the module to change. Thus, we
-    // can't simply iterate over the list at this point, as it might
-    // change dynamically.
-    std::set<Function *> functions(node->functions.begin(), node->functions.end());
-    std::set<Function *> finished;
-    while (!functions.empty()) {
-        Function *f = *functions.begin();
-        functions.erase(functions.begin());
-        if (finished.find(f) != finished.end()) continue;
-        finished.insert(f);
-        f->accept(this);
-        functions.insert(node->functions.begin(), node->functions.end());
+    for (unsigned i = 0; i < worklist.size(); i++) {
+        worklist[i]->accept(this);
     }
 }
 
 void LinkImportsPass::visit(ImportStatement *node) {
-    Parser p;
-    Module *m = p.parse(node->path);
-    module->import(m);
+    Module *m = cache->get(node->path);
+    std::vector<Function *> added = module->import(m);
+    worklist.insert(worklist.end(), added.begin(), added.end());
 }
@@ -3,6 +3,7 @@
 
 #include "IR.h"
 #include "IRVisitor.h"
+#include "ModuleCache.h"
 
 namespace Bish {
 
@@ -11,13 +12,19 @@ namespace Bish {
  * (functions belonging to other modules). This pass parses modules
  * specified with import statements, determines which functions are
  * needed by the calling module, and adds those functions to the
- * calling module's list of external functions. */
+ * calling module's list of external functions. Imported modules are
+ * obtained from the given cache, so each is parsed once. */
 class LinkImportsPass : public IRVisitor {
 public:
+    LinkImportsPass(ModuleCache *c) : cache(c) {}
     virtual void visit(Module *);
     virtual void visit(ImportStatement *);
 private:
     Module *module;
+    ModuleCache *cache;
+    // The functions of the module left to visit: those it had, then
+    // those added by its import statements.
+    std::vector<Function *> worklist;
 };
 
 }
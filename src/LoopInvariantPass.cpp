@@ -0,0 +1,414 @@
+#include <algorithm>
+#include <map>
+#include <vector>
+#include "IRAncestorsPass.h"
+#include "LoopInvariantPass.h"
+#include "ReplaceIRNodes.h"
+#include "Util.h"
+
+using namespace Bish;
+
+namespace {
+
+// Determines whether the body of a function is pure, apart from the
+// functions it calls.
+class InspectPurity : public IRVisitor {
+public:
+    InspectPurity(Function *f) : impure(false), function(f) {
+        f->body->accept(this);
+    }
+
+    bool impure;
+
+    virtual void visit(Block *node) {
+        // A job outlives the call.
+        if (node->background) impure = true;
+        IRVisitor::visit(node);
+    }
+
+    virtual void visit(Variable *node) {
+        if (node->global) impure = true;
+    }
+
+    virtual void visit(Assignment *node) {
+        if (is_arg(node->location->variable)) impure = true;
+        IRVisitor::visit(node);
+    }
+
+    virtual void visit(Intrinsic *node) {
+        if (node->op == Intrinsic::Append && is_arg(node->target->variable)) impure = true;
+        IRVisitor::visit(node);
+    }
+
+    virtual void visit(ForLoop *node) {
+        if (is_arg(node->variable)) impure = true;
+        IRVisitor::visit(node);
+    }
+
+    virtual void visit(String *node) {
+        for (InterpolatedString::const_iterator I = node->value->begin(), E = node->value->end(); I != E; ++I) {
+            if ((*I).is_var()) visit((*I).var());
+        }
+    }
+
+    virtual void visit(ExternCall *) { impure = true; }
+    virtual void visit(IORedirection *) { impure = true; }
+    virtual void visit(ImportStatement *) { impure = true; }
+private:
+    Function *function;
+
+    bool is_arg(Variable *v) const {
+        return std::find(function->args.begin(), function->args.end(), v) != function->args.end();
+    }
+};
+
+// Collects the names of the global variables of a module.
+class GetGlobalNames : public IRVisitor {
+public:
+    GetGlobalNames(Module *m, std::set<std::string> &n) : names(n) {
+        m->accept(this);
+    }
+
+    virtual void visit(Variable *node) {
+        if (node->global) names.insert(node->name.str());
+    }
+private:
+    std::set<std::string> &names;
+};
+
+// What the body of a loop may change.
+struct LoopInfo {
+    ForLoop *loop;
+    // Names of the variables it assigns.
+    std::set<std::string> assigned;
+    // The text of its external commands, which may assign any
+    // variable.
+    std::string commands;
+    // True if it calls functions which are not pure, which may assign
+    // any global variable.
+    bool impure_calls;
+};
+
+class ScanLoop : public IRVisitor {
+public:
+    ScanLoop(LoopInfo &i, const std::set<Function *> &p) : info(i), pure(p) {
+        info.impure_calls = false;
+        info.assigned.insert(info.loop->variable->name.str());
+        info.loop->body->accept(this);
+    }
+
+    virtual void visit(Assignment *node) {
+        info.assigned.insert(node->location->variable->name.str());
+        IRVisitor::visit(node);
+    }
+
+    virtual void visit(Intrinsic *node) {
+        if (node->op == Intrinsic::Append) info.assigned.insert(node->target->variable->name.str());
+        IRVisitor::visit(node);
+    }
+
+    virtual void visit(ForLoop *node) {
+        info.assigned.insert(node->variable->name.str());
+        IRVisitor::visit(node);
+    }
+
+    virtual void visit(FunctionCall *node) {
+        if (!pure.count(node->function)) {
+            info.impure_calls = true;
+            // Arrays are passed by reference, and may be modified.
+            for (unsigned i = 0; i < node->args.size(); i++) {
+                const std::vector<IRNode *> &values = node->args[i]->values;
+                Location *loc = values.size() == 1 ? dyn_cast<Location>(values[0]) : NULL;
+                if (loc) info.assigned.insert(loc->variable->name.str());
+            }
+        }
+        IRVisitor::visit(node);
+    }
+
+    virtual void visit(ExternCall *node) {
+        for (InterpolatedString::const_iterator I = node->body->begin(), E = node->body->end(); I != E; ++I) {
+            if ((*I).is_str()) info.commands += (*I).str() + "\n";
+        }
+    }
+private:
+    LoopInfo &info;
+    const std::set<Function *> &pure;
+};
+
+// Finds the calls of pure functions to move out of loops. Only the
+// calls which run in every iteration of the innermost loop around
+// them are moved: a call in a branch, or in a nested loop, may never
+// run (e.g. 'if (d != 0) { s = s + f(100 / d) }').
+class HoistCalls : public IRVisitor {
+public:
+    HoistCalls(const std::set<Function *> &p, const std::set<std::string> &g) :
+        pure(p), global_names(g), unique_id(0), every_iteration(false) {}
+
+    // Replacements of the moved calls by their temporaries.
+    std::map<IRNode *, IRNode *> replaced;
+    // Statements to run once, in the first iteration of each loop.
+    std::map<ForLoop *, std::vector<IRNode *> > hoisted;
+    // Statements moved out of their block.
+    std::set<IRNode *> moved;
+    // The variable counting whether each loop ran its first iteration.
+    std::map<ForLoop *, Variable *> started;
+
+    virtual void visit(Block *node) {
+        if (visited(node)) return;
+        visited_set.insert(node);
+        // A job may still be running in the next iteration.
+        const bool saved = every_iteration;
+        if (node->background) every_iteration = false;
+        for (std::vector<IRNode *>::const_iterator I = node->nodes.begin(), E = node->nodes.end(); I != E; ++I) {
+            // A call whose value is unused is not moved.
+            if (FunctionCall *call = dyn_cast<FunctionCall>(*I)) {
+                IRVisitor::visit(call);
+            } else {
+                (*I)->accept(this);
+            }
+        }
+        every_iteration = saved;
+    }
+
+    virtual void visit(IfStatement *node) {
+        if (visited(node)) return;
+        visited_set.insert(node);
+        // Only the first condition is always evaluated.
+        node->pblock->condition->accept(this);
+        const bool saved = every_iteration;
+        every_iteration = false;
+        node->pblock->body->accept(this);
+        for (std::vector<PredicatedBlock *>::const_iterator I = node->elses.begin(),
+                 E = node->elses.end(); I != E; ++I) {
+            (*I)->condition->accept(this);
+            (*I)->body->accept(this);
+        }
+        if (node->elseblock) node->elseblock->accept(this);
+        every_iteration = saved;
+    }
+
+    virtual void visit(BinOp *node) {
+        if (visited(node)) return;
+        visited_set.insert(node);
+        node->a->accept(this);
+        // The right operand of 'and' and 'or' may not be evaluated.
+        const bool saved = every_iteration;
+        if (node->op == BinOp::And || node->op == BinOp::Or) every_iteration = false;
+        node->b->accept(this);
+        every_iteration = saved;
+    }
+
+    virtual void visit(ForLoop *node) {
+        if (visited(node)) return;
+        visited_set.insert(node);
+        // The bounds are computed once, before the loop.
+        node->variable->accept(this);
+        node->lower->accept(this);
+        if (node->upper) node->upper->accept(this);
+        if (node->limit) node->limit->accept(this);
+        loops.push_back(LoopInfo());
+        loops.back().loop = node;
+        {
+            ScanLoop scan(loops.back(), pure);
+        }
+        // The iterations of a parallel loop are jobs of their own, so
+        // a value computed by the first one is lost to the others.
+        const bool saved = every_iteration;
+        every_iteration = !node->parallel;
+        node->body->accept(this);
+        every_iteration = saved;
+        loops.pop_back();
+    }
+
+    // The stages of a pipeline run as commands.
+    virtual void visit(IORedirection *) {}
+
+    virtual void visit(FunctionCall *node) {
+        if (visited(node)) return;
+        IRVisitor::visit(node);
+        if (!pure.count(node->function) || !every_iteration) return;
+        if (invariant_args(node, loops.back())) hoist(node, loops.back().loop);
+    }
+private:
+    const std::set<Function *> &pure;
+    const std::set<std::string> &global_names;
+    unsigned unique_id;
+    // The loops enclosing the visited node, outermost first.
+    std::vector<LoopInfo> loops;
+    // True if the visited node runs in every iteration of the
+    // innermost loop.
+    bool every_iteration;
+
+    bool invariant_args(FunctionCall *call, const LoopInfo &l) const {
+        for (unsigned i = 0; i < call->args.size(); i++) {
+            const std::vector<IRNode *> &values = call->args[i]->values;
+            for (unsigned j = 0; j < values.size(); j++) {
+                if (!invariant(values[j], l)) return false;
+            }
+        }
+        return true;
+    }
+
+    bool invariant(IRNode *n, const LoopInfo &l) const {
+        switch (n->kind()) {
+        case IRNode::IntegerKind:
+        case IRNode::FractionalKind:
+        case IRNode::BooleanKind:
+            return true;
+        case IRNode::StringKind: {
+            InterpolatedString *s = cast<String>(n)->value;
+            for (InterpolatedString::const_iterator I = s->begin(), E = s->end(); I != E; ++I) {
+                if ((*I).is_var() && !invariant_variable((*I).var(), l)) return false;
+            }
+            return true;
+        }
+        case IRNode::VariableKind:
+            return invariant_variable(cast<Variable>(n), l);
+        case IRNode::LocationKind: {
+            Location *loc = cast<Location>(n);
+            return invariant_variable(loc->variable, l) && (loc->offset == NULL || invariant(loc->offset, l));
+        }
+        case IRNode::BinOpKind:
+            return invariant(cast<BinOp>(n)->a, l) && invariant(cast<BinOp>(n)->b, l);
+        case IRNode::UnaryOpKind:
+            return invariant(cast<UnaryOp>(n)->a, l);
+        case IRNode::IntrinsicKind: {
+            Intrinsic *i = cast<Intrinsic>(n);
+            // The file read may be changed by the loop.
+            if (i->op == Intrinsic::Append || i->reads_file()) return false;
+            if (!invariant_variable(i->target->variable, l)) return false;
+            for (unsigned j = 0; j < i->args.size(); j++) {
+                if (!invariant(i->args[j], l)) return false;
+            }
+            return true;
+        }
+        default:
+            return false;
+        }
+    }
+
+    bool invariant_variable(Variable *v, const LoopInfo &l) const {
+        const std::string &name = v->name.str();
+        if (l.assigned.count(name) || l.commands.find(v->name.base()) != std::string::npos) return false;
+        // Variables are dynamically scoped, so a function assigning a
+        // global also assigns a local of the same name of its caller.
+        return !l.impure_calls || (!v->global && !global_names.count(name));
+    }
+
+    // Move the given call, and the assignments of its arguments, to
+    // the start of the first iteration of the given loop.
+    void hoist(FunctionCall *call, ForLoop *loop) {
+        if (!started.count(loop)) started[loop] = new Variable(Name("_licm" + as_string(unique_id++)));
+        std::vector<IRNode *> &stmts = hoisted[loop];
+        for (unsigned i = 0; i < call->args.size(); i++) {
+            stmts.push_back(call->args[i]);
+            moved.insert(call->args[i]);
+        }
+        Variable *v = new Variable(Name("_licm" + as_string(unique_id++)));
+        stmts.push_back(new Assignment(new Location(v), call, call->debug_info()));
+        replaced[call] = new Location(v);
+    }
+};
+
+// Removes the moved statements from their blocks, and inserts them at
+// the start of the body of their loops, where they run in the first
+// iteration only: e.g. 'for (...) { s = s + f(x) }' becomes
+//     _licm1 = 0
+//     for (...) {
+//         if (_licm1 == 0) { _licm0 = f(x); _licm1 = 1 }
+//         s = s + _licm0
+//     }
+// so that they do not run at all if the loop runs no iteration.
+class InsertHoisted : public IRVisitor {
+public:
+    InsertHoisted(const HoistCalls &h) : hoist(h) {}
+
+    virtual void visit(Block *node) {
+        if (visited(node)) return;
+        std::vector<IRNode *> nodes;
+        for (std::vector<IRNode *>::const_iterator I = node->nodes.begin(), E = node->nodes.end(); I != E; ++I) {
+            if (hoist.moved.count(*I)) continue;
+            if (ForLoop *loop = dyn_cast<ForLoop>(*I)) {
+                std::map<ForLoop *, std::vector<IRNode *> >::const_iterator H = hoist.hoisted.find(loop);
+                if (H != hoist.hoisted.end()) {
+                    Variable *started = hoist.started.find(loop)->second;
+                    nodes.push_back(new Assignment(new Location(started), new Integer("0"), loop->debug_info()));
+                    std::vector<IRNode *> first(H->second);
+                    first.push_back(new Assignment(new Location(started), new Integer("1"), loop->debug_info()));
+                    IRNode *test = new BinOp(BinOp::Eq, new Location(started), new Integer("0"), loop->debug_info());
+                    Block *once = new Block(first);
+                    // The moved statements are not to be removed again.
+                    visited_set.insert(once);
+                    Block *body = cast<Block>(loop->body);
+                    body->nodes.insert(body->nodes.begin(), new IfStatement(test, once));
+                }
+            }
+            nodes.push_back(*I);
+        }
+        node->nodes.swap(nodes);
+        IRVisitor::visit(node);
+    }
+private:
+    const HoistCalls &hoist;
+};
+
+}
+
+void LoopInvariantPass::visit(Module *m) {
+    IRAncestorsPass ancestors;
+    m->accept(&ancestors);
+    CallGraphBuilder cgb;
+    CallGraph cg = cgb.build(m);
+    find_pure_functions(m, cg);
+    GetGlobalNames globals(m, global_names);
+
+    HoistCalls hoist(pure, global_names);
+    m->accept(&hoist);
+    if (hoist.replaced.empty()) return;
+    // The moved calls are replaced before they are inserted in their
+    // new place.
+    ReplaceIRNodes replace(hoist.replaced);
+    m->accept(&replace);
+    InsertHoisted insert(hoist);
+    m->accept(&insert);
+    IRAncestorsPass parents;
+    m->accept(&parents);
+}
+
+// Find the pure functions of the given module: those declared pure,
+// and those whose body is pure and only calls pure functions.
+void LoopInvariantPass::find_pure_functions(Module *m, CallGraph &cg) {
+    for (std::vector<Function *>::iterator I = m->functions.begin(), E = m->functions.end(); I != E; ++I) {
+        Function *f = *I;
+        if (f != m->main && (f->pure || (f->body && !InspectPurity(f).impure))) pure.insert(f);
+    }
+    // Functions calling impure ones are not pure either.
+    std::vector<Function *> worklist;
+    for (std::vector<Function *>::iterator I = m->functions.begin(), E = m->functions.end(); I != E; ++I) {
+        Function *f = *I;
+        if (!pure.count(f)) {
+            worklist.push_back(f);
+            continue;
+        }
+        if (f->pure) continue;
+        const std::vector<Function *> &calls = cg.calls(f);
+        for (std::vector<Function *>::const_iterator CI = calls.begin(), CE = calls.end(); CI != CE; ++CI) {
+            if (!pure.count(*CI)) {
+                pure.erase(f);
+                worklist.push_back(f);
+                break;
+            }
+        }
+    }
+    while (!worklist.empty()) {
+        Function *f = worklist.back();
+        worklist.pop_back();
+        const std::vector<Function *> &callers = cg.callers(f);
+        for (std::vector<Function *>::const_iterator I = callers.begin(), E = callers.end(); I != E; ++I) {
+            if (pure.count(*I) && !(*I)->pure) {
+                pure.erase(*I);
+                worklist.push_back(*I);
+            }
+        }
+    }
+}
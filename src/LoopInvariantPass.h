@@ -0,0 +1,41 @@
+#ifndef __BISH_LOOP_INVARIANT_PASS_H__
+#define __BISH_LOOP_INVARIANT_PASS_H__
+
+#include <set>
+#include <string>
+#include "CallGraph.h"
+#include "IR.h"
+#include "IRVisitor.h"
+
+namespace Bish {
+
+/** This pass moves calls of pure functions whose arguments do not
+ * change in a loop out of the loop body, into a temporary assigned
+ * before the loop, so the call (and any subshell it costs) runs once
+ * instead of once per iteration. Calls are only moved from the
+ * statements which run in every iteration (not from branches or
+ * nested loops), and run in the first iteration, so that a loop which
+ * runs no iteration does not run them either. A function is pure if it is declared
+ * with 'pure def' (e.g. a wrapper of an external command whose output
+ * does not change, such as '@(date +%Y)'), or if it only computes
+ * with its arguments and local variables and calls pure functions:
+ * it runs no commands, and neither reads nor assigns global
+ * variables, nor assigns its arguments (arrays are passed by
+ * reference). The assignments of the arguments of a call are moved
+ * with it. Parallel loops are left alone, as each iteration runs in a
+ * job of its own.
+ * Must run before InlinePass, which would substitute the calls. */
+class LoopInvariantPass : public IRVisitor {
+public:
+    virtual void visit(Module *);
+private:
+    std::set<Function *> pure;
+    // Names of the global variables of the module.
+    std::set<std::string> global_names;
+
+    void find_pure_functions(Module *m, CallGraph &cg);
+};
+
+}
+
+#endif
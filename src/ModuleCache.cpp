@@ -0,0 +1,114 @@
+#include <set>
+#include "CloneIR.h"
+#include "IRAncestorsPass.h"
+#include "ModuleCache.h"
+#include "Parser.h"
+#include "Util.h"
+
+using namespace Bish;
+
+ModuleCache::~ModuleCache() {
+    for (EntryMap::iterator I = modules.begin(), E = modules.end(); I != E; ++I) {
+        delete I->second;
+    }
+}
+
+// Return a copy of the module at the given path, parsing the module
+// first if it is not cached or out of date.
+Module *ModuleCache::get(const std::string &path) {
+    ScopedLock lock(mutex);
+    Entry *e = lookup(path);
+    CloneIR cloner;
+    Module *copy = cloner.clone(e->module);
+    IRAncestorsPass ancestors;
+    copy->accept(&ancestors);
+    return copy;
+}
+
+// Parse the module at the given path into the cache if it is not
+// cached or out of date.
+void ModuleCache::warm(const std::string &path) {
+    ScopedLock lock(mutex);
+    lookup(path);
+}
+
+// Return the paths of all cached modules.
+std::vector<std::string> ModuleCache::paths() const {
+    ScopedLock lock(mutex);
+    std::vector<std::string> result;
+    for (EntryMap::const_iterator I = modules.begin(), E = modules.end(); I != E; ++I) {
+        result.push_back(I->first);
+    }
+    return result;
+}
+
+// Return the paths of the modules imported, directly or not, by the
+// cached module at the given path.
+std::vector<std::string> ModuleCache::imports(const std::string &path) const {
+    ScopedLock lock(mutex);
+    std::string key = abspath(path);
+    if (key.empty()) key = path;
+    std::vector<std::string> result;
+    EntryMap::const_iterator I = modules.find(key);
+    if (I == modules.end()) return result;
+    std::set<std::string> seen;
+    const std::vector<std::pair<std::string, std::string> > &deps = I->second->deps;
+    for (std::vector<std::pair<std::string, std::string> >::const_iterator DI = deps.begin(),
+             DE = deps.end(); DI != DE; ++DI) {
+        if (seen.insert(DI->first).second) result.push_back(DI->first);
+    }
+    return result;
+}
+
+// Return the up-to-date cache entry for the module at the given path,
+// parsing the module if necessary.
+ModuleCache::Entry *ModuleCache::lookup(const std::string &path) {
+    std::string key = abspath(path);
+    if (key.empty()) key = path;
+    EntryMap::iterator I = modules.find(key);
+    Entry *e = I == modules.end() ? NULL : I->second;
+    if (e && !is_current(key, e)) {
+        delete e;
+        modules.erase(I);
+        e = NULL;
+    }
+    if (e == NULL) {
+        e = new Entry(file_stamp(key));
+        parsing.push(e);
+        {
+            IRArena::Scope scope(&e->arena);
+            Parser p(this);
+            e->module = p.parse(path);
+        }
+        parsing.pop();
+        modules[key] = e;
+    }
+    // Record this module (and what it imports) as a dependency of the
+    // module that is importing it.
+    if (!parsing.empty()) {
+        Entry *importer = parsing.top();
+        importer->add_dep(key, e->stamp);
+        for (std::vector<std::pair<std::string, std::string> >::const_iterator I = e->deps.begin(),
+                 E = e->deps.end(); I != E; ++I) {
+            importer->add_dep(I->first, I->second);
+        }
+    }
+    return e;
+}
+
+// Return true if the given entry reflects the current version of its
+// source file and of all modules it imports.
+bool ModuleCache::is_current(const std::string &key, const Entry *e) const {
+    if (file_stamp(key) != e->stamp) return false;
+    for (std::vector<std::pair<std::string, std::string> >::const_iterator I = e->deps.begin(),
+             E = e->deps.end(); I != E; ++I) {
+        if (file_stamp(I->first) != I->second) return false;
+    }
+    return true;
+}
+
+// Record a dependency, unless its path is already one.
+void ModuleCache::Entry::add_dep(const std::string &path, const std::string &stamp) {
+    if (!dep_paths.insert(path).second) return;
+    deps.push_back(std::make_pair(path, stamp));
+}
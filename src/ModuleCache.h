@@ -0,0 +1,72 @@
+#ifndef __BISH_MODULE_CACHE_H__
+#define __BISH_MODULE_CACHE_H__
+
+#include <map>
+#include <set>
+#include <stack>
+#include <string>
+#include <vector>
+#include "IR.h"
+#include "IRArena.h"
+#include "Mutex.h"
+
+namespace Bish {
+
+/* Cache of parsed modules, keyed by absolute path. A module is parsed
+ * (including linking its own imports) only the first time it is
+ * requested. Because linking a module into another one modifies it,
+ * each request returns a fresh copy of the cached IR, allocated in
+ * the current IRArena.
+ *
+ * Each cached module records the version of its source file and of
+ * every module it (transitively) imports. A module is parsed again if
+ * any of those files has changed since, which lets a cache be kept
+ * across compilations.
+ *
+ * A cache may be shared by several threads compiling at once; parsing
+ * and copying modules is serialized. */
+class ModuleCache {
+public:
+    ModuleCache() : mutex(true) {}
+    ~ModuleCache();
+    // Return a copy of the module at the given path, parsing the
+    // module first if it is not cached or out of date.
+    Module *get(const std::string &path);
+    // Parse the module at the given path into the cache if it is not
+    // cached or out of date.
+    void warm(const std::string &path);
+    // Return the paths of all cached modules.
+    std::vector<std::string> paths() const;
+    // Return the paths of the modules imported, directly or not, by
+    // the cached module at the given path.
+    std::vector<std::string> imports(const std::string &path) const;
+private:
+    class Entry {
+    public:
+        Entry(const std::string &s) : stamp(s), module(NULL) {}
+        // Version of the source file when it was parsed.
+        std::string stamp;
+        // Paths and versions of all modules imported while parsing,
+        // each path once.
+        std::vector<std::pair<std::string, std::string> > deps;
+        std::set<std::string> dep_paths;
+        void add_dep(const std::string &path, const std::string &stamp);
+        // Arena holding the parsed IR.
+        IRArena arena;
+        Module *module;
+    };
+    typedef std::map<std::string, Entry *> EntryMap;
+    EntryMap modules;
+    // Entries of the modules currently being parsed, innermost last.
+    std::stack<Entry *> parsing;
+    // Held while looking up, parsing or copying modules. Recursive,
+    // because parsing a module requests the modules it imports.
+    mutable Mutex mutex;
+
+    Entry *lookup(const std::string &path);
+    bool is_current(const std::string &key, const Entry *e) const;
+};
+
+}
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef __BISH_MUTEX_H__
+#define __BISH_MUTEX_H__
+
+#include <pthread.h>
+
+namespace Bish {
+
+// A pthread mutex. A recursive mutex may be locked again by the
+// thread that holds it.
+class Mutex {
+public:
+    Mutex(bool recursive=false) {
+        pthread_mutexattr_t attr;
+        pthread_mutexattr_init(&attr);
+        if (recursive) pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+        pthread_mutex_init(&mutex, &attr);
+        pthread_mutexattr_destroy(&attr);
+    }
+    ~Mutex() { pthread_mutex_destroy(&mutex); }
+    void lock() { pthread_mutex_lock(&mutex); }
+    void unlock() { pthread_mutex_unlock(&mutex); }
+private:
+    pthread_mutex_t mutex;
+
+    // Disallow copying.
+    Mutex(const Mutex &);
+    Mutex &operator=(const Mutex &);
+};
+
+// Holds the given mutex for the lifetime of this object.
+class ScopedLock {
+public:
+    ScopedLock(Mutex &m) : mutex(m) { mutex.lock(); }
+    ~ScopedLock() { mutex.unlock(); }
+private:
+    Mutex &mutex;
+};
+
+}
+
+#endif
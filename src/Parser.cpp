@@ -11,6 +11,7 @@
 #include "TypeChecker.h"
 #include "LinkImportsPass.h"
 #include "IRAncestorsPass.h"
+#include "Stats.h"
 
 namespace Bish {
 
@@ -27,17 +28,15 @@ Module *ParseScope::module() {
 }
 
 void ParseScope::push_symbol_table() {
-    symbol_table_stack.push(new SymbolTable());
+    variable_symbol_table.push_scope();
 }
 
 void ParseScope::pop_symbol_table() {
-    delete symbol_table_stack.top();
-    symbol_table_stack.pop();
+    variable_symbol_table.pop_scope();
 }
 
 void ParseScope::add_symbol(const Name &name, Variable *v) {
-    assert(!symbol_table_stack.empty());
-    symbol_table_stack.top()->insert(name, v);
+    variable_symbol_table.insert(name, v);
 }
 
 Name ParseScope::get_unique_name() {
@@ -54,7 +53,7 @@ Name ParseScope::get_unique_name() {
 Variable *ParseScope::get_defined_variable(Variable *v) {
     Variable *sym = lookup_variable(v->name);
     if (!sym) {
-        bish_abort() << "Undefined variable \"" << v->name.name << "\"";
+        bish_abort() << "Undefined variable \"" << v->name.base() << "\"";
     }
     bish_assert(sym != v);
     delete v;
@@ -64,22 +63,8 @@ Variable *ParseScope::get_defined_variable(Variable *v) {
 // Return the symbol table entry corresponding to the given variable
 // name, or NULL if none exists.
 Variable *ParseScope::lookup_variable(const Name &name) {
-    IRNode *result = NULL;
-    std::stack<SymbolTable *> aux;
-    while (!symbol_table_stack.empty()) {
-        SymbolTableEntry *e = symbol_table_stack.top()->lookup(name);
-        if (e) {
-            result = e->node;
-            break;
-        }
-        aux.push(symbol_table_stack.top());
-        symbol_table_stack.pop();
-    }
-    while (!aux.empty()) {
-        symbol_table_stack.push(aux.top());
-        aux.pop();
-    }
-    Variable *v = dynamic_cast<Variable*>(result);
+    IRNode *result = variable_symbol_table.lookup(name);
+    Variable *v = dyn_cast<Variable>(result);
     if (result) bish_assert(v);
     return v;
 }
@@ -87,9 +72,8 @@ Variable *ParseScope::lookup_variable(const Name &name) {
 // Return the symbol table entry corresponding to the given function
 // name, or NULL if none exists.
 Function *ParseScope::lookup_function(const Name &name) {
-    SymbolTableEntry *e = function_symbol_table->lookup(name);
-    if (e) {
-        Function *f = dynamic_cast<Function*>(e->node);
+    if (IRNode *n = function_symbol_table.lookup(name)) {
+        Function *f = dyn_cast<Function>(n);
         assert(f);
         return f;
     } else {
@@ -115,7 +99,7 @@ Function *ParseScope::lookup_or_new_function(const Name &name) {
     Function *f = lookup_function(name);
     if (f == NULL) {
         f = new Function(name);
-        function_symbol_table->insert(name, f);
+        function_symbol_table.insert(name, f);
     }
     bish_assert(f);
     return f;
@@ -123,6 +107,7 @@ Function *ParseScope::lookup_or_new_function(const Name &name) {
 
 Parser::~Parser() {
     if (tokenizer) delete tokenizer;
+    if (owns_cache) delete cache;
 }
 
 // Read all contents from the given input stream and return it as a
@@ -133,21 +118,15 @@ std::string Parser::read_stream(std::istream &is) {
     return buffer.str();
 }
 
-// Return the entire contents of the file at the given path.
-std::string Parser::read_file(const std::string &path) {
-    std::ifstream t(path.c_str());
-    if (!is_file(path) || !t.is_open()) {
+// Parse the given file into Bish IR. The file is tokenized where it
+// is mapped into memory, without copying it.
+Module *Parser::parse(const std::string &path) {
+    SourceFile *source = is_file(path) ? SourceFile::open(path) : NULL;
+    if (source == NULL) {
         bish_abort() << "Failed to open file at " << path;
     }
-    std::string result = read_stream(t);
-    t.close();
-    return result;
-}
-
-// Parse the given file into Bish IR.
-Module *Parser::parse(const std::string &path) {
-    std::string contents = read_file(path);
-    Module *m = parse_string(contents, path);
+    Module *m = parse_text(source->text(), path);
+    SourceFile::release(source);
     bish_assert(m->path.size() > 0) << "Unable to resolve module path";
     return m;
 }
@@ -162,14 +141,23 @@ Module *Parser::parse(std::istream &is) {
 // Parse the given string into Bish IR. If a path is given, set the
 // resulting Module's path to that value.
 Module *Parser::parse_string(const std::string &text, const std::string &path) {
-    if (tokenizer) delete tokenizer;
+    return parse_text(StringRef(text), path);
+}
 
-    // Insert a dummy block for root scope.
-    std::string preprocessed = "{\n" + text + "\n}";
-    tokenizer = new Tokenizer(path, preprocessed);
+// Parse the given text into Bish IR. The statements of the text form
+// the root block of the module, which the parser ends at the end of
+// the text rather than at a closing brace.
+Module *Parser::parse_text(StringRef text, const std::string &path) {
+    CompileStats::Timer timer("parse");
+    if (CompileStats *stats = CompileStats::current()) stats->module_parsed();
+    if (tokenizer) delete tokenizer;
+    tokenizer = new Tokenizer(path, text);
 
     Module *m = module(path);
     expect(tokenizer->peek(), Token::EOSType, "Expected end of string");
+    // The tokenizer must not outlive the text.
+    delete tokenizer;
+    tokenizer = NULL;
 
     post_parse_passes(m);
     return m;
@@ -177,8 +165,9 @@ Module *Parser::parse_string(const std::string &text, const std::string &path) {
 
 // Run an ordered list of postprocessing passes over the IR.
 void Parser::post_parse_passes(Module *m) {
+    CompileStats::Timer timer("post_parse_passes");
     // Link modules from import statements.
-    LinkImportsPass link;
+    LinkImportsPass link(cache);
     m->accept(&link);
 
     // Construct IRNode hierarchy
@@ -242,16 +231,13 @@ std::string Parser::scan_until(char c) {
     return result;
 }
 
-// Scan until a statement ending (semicolon or newline).
+// Scan until a statement ending (semicolon, newline or the end of
+// the text).
 std::string Parser::scan_until_stmt_end() {
     std::set<char> ending_chars;
     ending_chars.insert(';');
     ending_chars.insert('\n');
-    std::string result = tokenizer->scan_until(ending_chars);
-    if (tokenizer->peek().isa(Token::EOSType)) {
-        bish_abort() << "Unexpected end of input.";
-    }
-    return result;
+    return tokenizer->scan_until(ending_chars);
 }
 
 // Terminate the parsing process with the given error message, and the
@@ -269,7 +255,7 @@ Module *Parser::module(const std::string &path) {
     // Install built-in symbols (e.g. 'args' for command line args).
     setup_builtin_symbols();
 
-    Function *main = new Function(Name("main"), block());
+    Function *main = new Function(Name("main"), block(true));
     m->set_main(main);
     setup_global_variables(m);
     scope.pop_module();
@@ -297,7 +283,7 @@ void Parser::setup_global_variables(Module *m) {
     std::set<Variable *> handled;
     bish_assert(m->main != NULL);
     for (Block::iterator I = m->main->body->begin(), E = m->main->body->end(); I != E; ++I) {
-        if (Assignment *a = dynamic_cast<Assignment*>(*I)) {
+        if (Assignment *a = dyn_cast<Assignment>(*I)) {
             Location *loc = a->location;
             if (handled.find(loc->variable) == handled.end()) {
                 handled.insert(loc->variable);
@@ -319,21 +305,29 @@ void Parser::setup_global_variables(Module *m) {
     }
 }
 
-// Parse a Bish block.
-Block *Parser::block() {
+// Parse a Bish block. The root block of a module is not enclosed in
+// braces, and ends at the end of the text.
+Block *Parser::block(bool root) {
+    const Token::Type end = root ? Token::EOSType : Token::RBraceType;
     Block *result = new Block();
     scope.push_symbol_table();
     push_block(result);
-    expect(tokenizer->peek(), Token::LBraceType, "Expected block to begin with '{'");
-    do {
-        while (tokenizer->peek().isa(Token::SharpType)) {
-            scan_until('\n');
+    if (!root) expect(tokenizer->peek(), Token::LBraceType, "Expected block to begin with '{'");
+    while (!tokenizer->peek().isa(end)) {
+        if (tokenizer->peek().isa(Token::SharpType)) {
+            // A comment on the last line of the text need not end in
+            // a newline.
+            if (root) {
+                tokenizer->scan_until('\n');
+            } else {
+                scan_until('\n');
+            }
+            continue;
         }
-        if (tokenizer->peek().isa(Token::RBraceType)) break;
         IRNode *s = stmt();
         if (s) result->nodes.push_back(s);
-    } while (!tokenizer->peek().isa(Token::RBraceType));
-    expect(tokenizer->peek(), Token::RBraceType, "Expected block to end with '}'");
+    }
+    if (!root) expect(tokenizer->peek(), Token::RBraceType, "Expected block to end with '}'");
     scope.pop_symbol_table();
     pop_block();
     return result;
@@ -345,7 +339,7 @@ IRNode *Parser::stmt() {
     case Token::LBraceType:
         return block();
     case Token::AtType: {
-        IRNode *a = externcall();
+        IRNode *a = redirections(externcall());
         end_stmt();
         return a;
     }
@@ -361,9 +355,26 @@ IRNode *Parser::stmt() {
         return ifstmt();
     case Token::ForType:
         return forloop();
+    case Token::ParallelType:
+        tokenizer->next();
+        if (!tokenizer->peek().isa(Token::ForType)) abort_with_position("Expected 'for' after 'parallel'");
+        return forloop(true);
+    case Token::SpawnType:
+        return spawnstmt();
+    case Token::PureType:
+    case Token::MemoType:
+        tokenizer->next();
+        if (!tokenizer->peek().isa(Token::DefType)) {
+            abort_with_position("Expected 'def' after '" + t.value() + "'");
+        }
+        // Fall through.
     case Token::DefType: {
         Function *f = functiondef();
-        if (f) scope.module()->add_function(f);
+        if (f) {
+            f->pure = t.isa(Token::PureType);
+            f->memo = t.isa(Token::MemoType);
+            scope.module()->add_function(f);
+        }
         return NULL;
     }
     default:
@@ -379,9 +390,16 @@ IRNode *Parser::otherstmt() {
     case Token::EqualsType:
         s = assignment(sym);
         break;
-    case Token::LParenType:
-        s = funcall(sym);
+    case Token::LParenType: {
+        Intrinsic::Operator op;
+        if (is_intrinsic(sym, op)) {
+            if (op != Intrinsic::Append) abort_with_position("Unused result of builtin function");
+            s = intrinsic(op);
+        } else {
+            s = redirections(funcall(sym));
+        }
         break;
+    }
     default:
         abort_with_position("Unexpected token in statement");
         s = NULL;
@@ -411,6 +429,8 @@ Assignment *Parser::assignment(const Name &name) {
         tokenizer->next();
         values = exprlist();
         expect(tokenizer->peek(), Token::RBracketType, "Expected matching ']'");
+    } else if (tokenizer->peek().isa(Token::LBraceType)) {
+        values.push_back(mapliteral());
     } else {
         values.push_back(expr());
     }
@@ -419,6 +439,25 @@ Assignment *Parser::assignment(const Name &name) {
     return new Assignment(loc, values, debug_info.get());
 }
 
+MapLiteral *Parser::mapliteral() {
+    Tokenizer::Info debug_info(tokenizer);
+    expect(tokenizer->peek(), Token::LBraceType, "Expected opening '{'");
+    std::vector<IRNode *> keys, values;
+    if (!tokenizer->peek().isa(Token::RBraceType)) {
+        keys.push_back(expr());
+        expect(tokenizer->peek(), Token::ColonType, "Expected ':' after map key");
+        values.push_back(expr());
+        while (tokenizer->peek().isa(Token::CommaType)) {
+            tokenizer->next();
+            keys.push_back(expr());
+            expect(tokenizer->peek(), Token::ColonType, "Expected ':' after map key");
+            values.push_back(expr());
+        }
+    }
+    expect(tokenizer->peek(), Token::RBraceType, "Expected matching '}'");
+    return new MapLiteral(keys, values, debug_info.get());
+}
+
 FunctionCall *Parser::funcall(const Name &name) {
     Tokenizer::Info debug_info(tokenizer);
     bish_assert(!scope.lookup_variable(name)) << "Symbol \"" <<
@@ -448,6 +487,39 @@ FunctionCall *Parser::funcall(const Name &name) {
     return new FunctionCall(f, assignment_args, debug_info.get());
 }
 
+// Return true (and the operator in 'op') if the given name refers to a
+// builtin function.
+bool Parser::is_intrinsic(const Name &name, Intrinsic::Operator &op) const {
+    return builtins.function(name, op);
+}
+
+// Parse the arguments of a builtin function. The first argument of an
+// array operation must name a variable.
+Intrinsic *Parser::intrinsic(Intrinsic::Operator op) {
+    Tokenizer::Info debug_info(tokenizer);
+    expect(tokenizer->peek(), Token::LParenType, "Expected opening '('");
+    std::vector<IRNode *> args;
+    if (!tokenizer->peek().isa(Token::RParenType)) {
+        args = exprlist();
+    }
+    expect(tokenizer->peek(), Token::RParenType, "Expected closing ')'");
+    if (op == Intrinsic::Lines || op == Intrinsic::ReadFile) {
+        if (args.size() != 1) abort_with_position("Wrong number of arguments for builtin function");
+        return new Intrinsic(op, NULL, args, debug_info.get());
+    }
+    Location *target = args.empty() ? NULL : dyn_cast<Location>(args[0]);
+    if (target == NULL || !target->is_variable()) {
+        abort_with_position("Expected a variable as first argument of builtin function");
+    }
+    args.erase(args.begin());
+    const unsigned min_args = op == Intrinsic::Length ? 0 : 1;
+    const unsigned max_args = op == Intrinsic::Length ? 0 : op == Intrinsic::Append ? 1 : 2;
+    if (args.size() < min_args || args.size() > max_args) {
+        abort_with_position("Wrong number of arguments for builtin function");
+    }
+    return new Intrinsic(op, target, args, debug_info.get());
+}
+
 ExternCall *Parser::externcall() {
     Tokenizer::Info debug_info(tokenizer);
     expect(tokenizer->peek(), Token::AtType, "Expected '@' to begin extern call.");
@@ -457,6 +529,43 @@ ExternCall *Parser::externcall() {
     return new ExternCall(body, debug_info.get());
 }
 
+// Return true if the given node is a command started as a coprocess.
+bool Parser::is_persistent(IRNode *n) const {
+    ExternCall *call = dyn_cast<ExternCall>(n);
+    return call && call->persistent;
+}
+
+// Return true if the given node runs a command, or a pipeline or
+// redirection of commands, whose output can be redirected.
+bool Parser::is_command(IRNode *n) const {
+    if (IORedirection *r = dyn_cast<IORedirection>(n)) return !is_persistent(r->b);
+    return dyn_cast<ExternCall>(n) || dyn_cast<FunctionCall>(n);
+}
+
+// Parse the pipes and redirections following a command statement,
+// e.g. '@(sort) < "in" > "out"'. These are only parsed in statement
+// context, where '<' and '>' can not be comparisons.
+IRNode *Parser::redirections(IRNode *command) {
+    while (true) {
+        Tokenizer::Info debug_info(tokenizer);
+        Token t = tokenizer->peek();
+        IRNode *b = NULL;
+        if (t.isa(Token::PipeType)) {
+            tokenizer->next();
+            b = factor();
+            if (!is_command(b)) abort_with_position("Expected a command after '|'");
+            if (is_persistent(b)) abort_with_position("The input of a persistent command must be a value");
+        } else if (t.isa(Token::RAngleType) || t.isa(Token::DoubleRAngleType) ||
+                   t.isa(Token::LAngleType) || t.isa(Token::TripleLAngleType)) {
+            tokenizer->next();
+            b = arith();
+        } else {
+            return command;
+        }
+        command = new IORedirection(get_redirection_operator(t), command, b, debug_info.get());
+    }
+}
+
 ImportStatement *Parser::importstmt() {
     Tokenizer::Info debug_info(tokenizer);
     expect(tokenizer->peek(), Token::ImportType, "Expected import statement");
@@ -517,35 +626,74 @@ IfStatement *Parser::ifstmt() {
     return new IfStatement(cond, body, elses, elseblock);
 }
 
-ForLoop *Parser::forloop() {
+ForLoop *Parser::forloop(bool parallel) {
     Tokenizer::Info debug_info(tokenizer);
     expect(tokenizer->peek(), Token::ForType, "Expected for statement");
     expect(tokenizer->peek(), Token::LParenType, "Expected opening '('");
     Variable *v = var();
     expect(tokenizer->peek(), Token::InType, "Expected keyword 'in'");
-    IRNode *lower = atom(), *upper = NULL;
+    IRNode *lower = expr(), *upper = NULL;
+    // The lines written by a command or pipeline are iterated as they
+    // are written. The values of function calls are iterated as usual.
+    bool stream = is_command(lower) && !dyn_cast<FunctionCall>(lower);
     if (tokenizer->peek().isa(Token::DoubleDotType)) {
         tokenizer->next();
         upper = atom();
     }
-    if (Location *loc = dynamic_cast<Location*>(lower)) {
-        lower = scope.get_defined_variable(loc->variable);
+    if (Location *loc = dyn_cast<Location>(lower)) {
+        // Already resolved by expr().
+        lower = loc->variable;
     }
-    if (Location *loc = dynamic_cast<Location*>(upper)) {
+    if (Location *loc = dyn_cast<Location>(upper)) {
         upper = scope.get_defined_variable(loc->variable);
     }
     expect(tokenizer->peek(), Token::RParenType, "Expected closing ')'");
+    IRNode *limit = NULL;
+    // 'limit' is only a keyword here, e.g. 'parallel for (x in xs) limit 4 { ... }'.
+    if (parallel && tokenizer->peek().isa(Token::SymbolType) && tokenizer->peek().value() == "limit") {
+        tokenizer->next();
+        limit = factor();
+    }
     IRDebugInfo info = debug_info.get();
     IRNode *body = block();
-    return new ForLoop(v, lower, upper, body, info);
+    ForLoop *loop = new ForLoop(v, lower, upper, body, info);
+    loop->stream = stream;
+    loop->parallel = parallel;
+    loop->limit = limit;
+    return loop;
+}
+
+// Parse a block, or a single statement (e.g. a function call), run as
+// a background job.
+Block *Parser::spawnstmt() {
+    expect(tokenizer->peek(), Token::SpawnType, "Expected spawn statement");
+    Block *b = NULL;
+    if (tokenizer->peek().isa(Token::LBraceType)) {
+        b = block();
+    } else {
+        // The arguments of a function call are computed by the job too.
+        b = new Block();
+        push_block(b);
+        IRNode *s = stmt();
+        pop_block();
+        if (s == NULL) abort_with_position("Expected a statement after 'spawn'");
+        b->nodes.push_back(s);
+    }
+    b->background = true;
+    return b;
 }
 
 Function *Parser::functiondef() {
+    Tokenizer::Info debug_info(tokenizer);
     expect(tokenizer->peek(), Token::DefType, "Expected def statement");
     Name name = namespacedvar();
     if (name == Name("main")) {
         abort_with_position("Cannot redefine default 'main' function");
     }
+    Intrinsic::Operator op;
+    if (is_intrinsic(name, op)) {
+        abort_with_position("Cannot redefine builtin function");
+    }
     expect(tokenizer->peek(), Token::LParenType, "Expected opening '('");
     std::vector<Variable *> args;
     scope.push_symbol_table();
@@ -557,6 +705,7 @@ Function *Parser::functiondef() {
         }
     }
     expect(tokenizer->peek(), Token::RParenType, "Expected closing ')'");
+    IRDebugInfo info = debug_info.get();
     Block *body = block();
     scope.pop_symbol_table();
     // It's possible the function was called before it was defined. In
@@ -566,10 +715,11 @@ Function *Parser::functiondef() {
     // If the arguments and body have already been initialized, throw
     // a redefinition error.
     if (f->body != NULL) {
-        abort_with_position("Function '" + name.name + "' is already defined");
+        abort_with_position("Function '" + name.base() + "' is already defined");
     }
     f->set_args(args);
     f->set_body(body);
+    f->set_debug_info(info);
     return f;
 }
 
@@ -577,9 +727,24 @@ IRNode *Parser::expr() {
     Tokenizer::Info debug_info(tokenizer);
     IRNode *a = logical();
     Token t = tokenizer->peek();
+    if (is_persistent(a)) {
+        abort_with_position("A persistent command must read from a pipe");
+    }
     if (t.isa(Token::PipeType)) {
         tokenizer->next();
-        a = new IORedirection(get_redirection_operator(t), a, logical(), debug_info.get());
+        IRNode *b = logical();
+        if (is_persistent(b) && (dyn_cast<ExternCall>(a) || dyn_cast<FunctionCall>(a))) {
+            // A coprocess reads values, not the output of commands.
+            abort_with_position("The input of a persistent command must be a value");
+        }
+        a = new IORedirection(get_redirection_operator(t), a, b, debug_info.get());
+        t = tokenizer->peek();
+    }
+    if (t.isa(Token::TripleLAngleType)) {
+        if (!is_command(a)) abort_with_position("Expected a command before '<<<'");
+        tokenizer->next();
+        IRNode *b = logical();
+        a = new IORedirection(get_redirection_operator(t), a, b, debug_info.get());
     }
     return a;
 }
@@ -625,6 +790,13 @@ IRNode *Parser::relative() {
     Token t = tokenizer->peek();
     if (t.isa(Token::LAngleType) || t.isa(Token::LAngleEqualsType) ||
         t.isa(Token::RAngleType) || t.isa(Token::RAngleEqualsType)) {
+        // '@(sort) < "in"' only redirects as a statement (see
+        // redirections()); as a value it would compare the output.
+        if ((t.isa(Token::LAngleType) || t.isa(Token::RAngleType)) &&
+            (dyn_cast<ExternCall>(a) || (dyn_cast<IORedirection>(a) && is_command(a)))) {
+            abort_with_position("A command can not be redirected with '<' or '>' in an expression; "
+                                "redirect it in a statement of its own, or pass it a value with '<<<'");
+        }
         tokenizer->next();
         a = new BinOp(get_binop_operator(t), a, arith(), debug_info.get());
         t = tokenizer->peek();
@@ -677,15 +849,26 @@ IRNode *Parser::factor() {
         return e;
     } else if (tokenizer->peek().isa(Token::AtType)) {
         return externcall();
+    } else if (tokenizer->peek().isa(Token::PersistentType)) {
+        tokenizer->next();
+        ExternCall *call = externcall();
+        call->persistent = true;
+        return call;
     } else {
         IRNode *a = atom();
         if (tokenizer->peek().isa(Token::LParenType)) {
-            Location *loc = dynamic_cast<Location*>(a);
+            Location *loc = dyn_cast<Location>(a);
             if (loc == NULL) {
                 abort_with_position("Invalid atom type for function call");
             }
-            a = funcall(loc->variable->name);
-        } else if (Location *loc = dynamic_cast<Location*>(a)) {
+            Intrinsic::Operator op;
+            if (is_intrinsic(loc->variable->name, op)) {
+                if (op == Intrinsic::Append) abort_with_position("append() does not have a value");
+                a = intrinsic(op);
+            } else {
+                a = funcall(loc->variable->name);
+            }
+        } else if (Location *loc = dyn_cast<Location>(a)) {
             Variable *sym = scope.get_defined_variable(loc->variable);
             loc->variable = sym;
         }
@@ -802,7 +985,7 @@ InterpolatedString *Parser::interpolated_string(const Token &stop, bool keep_lit
 void Parser::end_stmt() {
     if (tokenizer->peek().isa(Token::SemicolonType)) {
         tokenizer->next();
-    } else if (!tokenizer->was_newline()) {
+    } else if (!tokenizer->was_newline() && !tokenizer->peek().isa(Token::EOSType)) {
         abort_with_position("Expected end of statement");
     }
 }
@@ -4,6 +4,7 @@
 #include <stack>
 #include <string>
 #include "IR.h"
+#include "ModuleCache.h"
 #include "SymbolTable.h"
 #include "Tokenizer.h"
 
@@ -27,6 +28,7 @@ stmt ::= assign ';'
        | block
 assign ::= location '=' expr
          | location '=' '[' exprlist ']'
+         | location '=' '{' [ maplist ] '}'
 funcall ::= namespacedvar '(' exprlist ')'
 externcall ::= '@' '(' interp ')'
 expr ::= expr '|' logical | logical
@@ -45,6 +47,7 @@ location ::= namespacedvar | namespacedvar '[' expr ']'
 namespacedvar ::= [ var '.' ] var
 varlist ::= var { ',' var }
 exprlist ::= expr { ',' expr }
+maplist ::= expr ':' expr { ',' expr ':' expr }
 interp ::= { str | '$' namespacedvar | '$' '(' any ')'}
 */
 
@@ -55,14 +58,9 @@ namespace Bish {
 class ParseScope {
 public:
     ParseScope() {
-        function_symbol_table = new SymbolTable();
         unique_id = 0;
     }
 
-    ~ParseScope() {
-        delete function_symbol_table;
-    }
-
     // Set the current module.
     void set_module(Module *m);
     // Unset the current module.
@@ -96,17 +94,21 @@ public:
 private:
     // Current Module being parsed.
     Module *current_module;
-    // Current scope stack of symbol tables for variables.
-    std::stack<SymbolTable *> symbol_table_stack;
+    // Symbol table for variables, with a scope per block.
+    SymbolTable variable_symbol_table;
     // Symbol table for functions (which are defined globally).
-    SymbolTable *function_symbol_table;
+    SymbolTable function_symbol_table;
     // Counter for unique names.
     unsigned unique_id;
 };
 
 class Parser {
 public:
-    Parser() : tokenizer(NULL) {}
+    // Imported modules are parsed through the given cache. If no cache
+    // is given, the parser uses a private one.
+    Parser(ModuleCache *c=NULL) : tokenizer(NULL), cache(c), owns_cache(c == NULL) {
+        if (owns_cache) cache = new ModuleCache();
+    }
     ~Parser();
     Module *parse(const std::string &path);
     Module *parse(std::istream &is);
@@ -114,11 +116,13 @@ public:
 private:
     ParseScope scope;
     Tokenizer *tokenizer;
+    ModuleCache *cache;
+    bool owns_cache;
     std::set<std::string> namespaces;
     std::stack<Block *> block_stack;
 
     std::string read_stream(std::istream &is);
-    std::string read_file(const std::string &path);
+    Module *parse_text(StringRef text, const std::string &path);
     void abort_with_position(const std::string &msg);
     void expect(const Token &t, Token::Type ty, const std::string &msg);
     std::string scan_until(const std::vector<Token> &tokens, bool keep_literal_backslash=true);
@@ -133,18 +137,25 @@ private:
     void pop_block();
     
     Module *module(const std::string &path);
-    Block *block();
+    Block *block(bool root=false);
     IRNode *stmt();
     IRNode *otherstmt();
     Assignment *assignment(const Name &name);
+    MapLiteral *mapliteral();
     FunctionCall *funcall(const Name &name);
+    bool is_intrinsic(const Name &name, Intrinsic::Operator &op) const;
+    Intrinsic *intrinsic(Intrinsic::Operator op);
     ExternCall *externcall();
+    bool is_persistent(IRNode *n) const;
+    bool is_command(IRNode *n) const;
+    IRNode *redirections(IRNode *command);
     ImportStatement *importstmt();
     ReturnStatement *returnstmt();
     LoopControlStatement *breakstmt();
     LoopControlStatement *continuestmt();
     IfStatement *ifstmt();
-    ForLoop *forloop();
+    ForLoop *forloop(bool parallel=false);
+    Block *spawnstmt();
     Function *functiondef();
     IRNode *expr();
     std::vector<IRNode *> exprlist();
@@ -0,0 +1,106 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <vector>
+#include "Profile.h"
+
+using namespace Bish;
+
+namespace {
+
+struct FunctionProfile {
+    std::string name, where;
+    unsigned long calls, forks;
+    long long inclusive, exclusive;
+};
+
+struct LoopProfile {
+    std::string where;
+    unsigned long iterations;
+    long long time;
+};
+
+bool by_exclusive_time(const FunctionProfile &a, const FunctionProfile &b) {
+    return a.exclusive > b.exclusive;
+}
+
+bool by_time(const LoopProfile &a, const LoopProfile &b) {
+    return a.time > b.time;
+}
+
+// Split the given line at tabs.
+std::vector<std::string> fields(const std::string &line) {
+    std::vector<std::string> result;
+    std::size_t start = 0, tab;
+    while ((tab = line.find('\t', start)) != std::string::npos) {
+        result.push_back(line.substr(start, tab - start));
+        start = tab + 1;
+    }
+    result.push_back(line.substr(start));
+    return result;
+}
+
+// Format the given number of microseconds as milliseconds.
+std::string ms(long long us) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.3f", us / 1000.0);
+    return buf;
+}
+
+}
+
+bool Bish::print_profile(const std::string &path, std::ostream &os) {
+    std::ifstream in(path.c_str());
+    if (!in) return false;
+    std::vector<FunctionProfile> functions;
+    std::vector<LoopProfile> loops;
+    std::string line, clock;
+    while (std::getline(in, line)) {
+        std::vector<std::string> f = fields(line);
+        if (f[0] == "function" && f.size() == 7) {
+            FunctionProfile p;
+            p.name = f[1];
+            p.where = f[2];
+            p.calls = strtoul(f[3].c_str(), NULL, 10);
+            p.inclusive = strtoll(f[4].c_str(), NULL, 10);
+            p.exclusive = strtoll(f[5].c_str(), NULL, 10);
+            p.forks = strtoul(f[6].c_str(), NULL, 10);
+            functions.push_back(p);
+        } else if (f[0] == "loop" && f.size() == 4) {
+            LoopProfile p;
+            p.where = f[1];
+            p.iterations = strtoul(f[2].c_str(), NULL, 10);
+            p.time = strtoll(f[3].c_str(), NULL, 10);
+            loops.push_back(p);
+        } else if (f[0] == "# bish profile" && f.size() == 2) {
+            clock = f[1];
+        }
+    }
+    std::stable_sort(functions.begin(), functions.end(), by_exclusive_time);
+    std::stable_sort(loops.begin(), loops.end(), by_time);
+
+    char buf[512];
+    if (clock == "clock SECONDS") {
+        os << "Times were measured in whole seconds (bash 5 measures microseconds).\n\n";
+    }
+    snprintf(buf, sizeof(buf), "%-24s %8s %14s %14s %8s  %s\n",
+             "Function", "Calls", "Inclusive ms", "Exclusive ms", "Forks", "Location");
+    os << buf;
+    for (unsigned i = 0; i < functions.size(); i++) {
+        const FunctionProfile &p = functions[i];
+        snprintf(buf, sizeof(buf), "%-24s %8lu %14s %14s %8lu  %s\n", p.name.c_str(), p.calls,
+                 ms(p.inclusive).c_str(), ms(p.exclusive).c_str(), p.forks, p.where.c_str());
+        os << buf;
+    }
+    if (loops.empty()) return true;
+    snprintf(buf, sizeof(buf), "\n%-40s %12s %14s\n", "Loop", "Iterations", "Time ms");
+    os << buf;
+    for (unsigned i = 0; i < loops.size(); i++) {
+        const LoopProfile &p = loops[i];
+        snprintf(buf, sizeof(buf), "%-40s %12lu %14s\n", p.where.c_str(), p.iterations,
+                 ms(p.time).c_str());
+        os << buf;
+    }
+    return true;
+}
@@ -0,0 +1,17 @@
+#ifndef __BISH_PROFILE_H__
+#define __BISH_PROFILE_H__
+
+#include <iostream>
+#include <string>
+
+namespace Bish {
+
+// Print the profile written by a script compiled with -p (see
+// CodeGen_Bash::output_profile_helpers) as tables of the functions,
+// by exclusive time, and of the loops, by time. Return false if the
+// file can not be read.
+bool print_profile(const std::string &path, std::ostream &os);
+
+}
+
+#endif
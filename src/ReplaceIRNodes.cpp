@@ -1,18 +1,8 @@
-#include <cassert>
 #include "IR.h"
 #include "ReplaceIRNodes.h"
 
 using namespace Bish;
 
-namespace {
-template <class T>
-T assert_cast(IRNode *n) {
-    T t = dynamic_cast<T>(n);
-    assert(t != NULL);
-    return t;
-}
-}
-
 IRNode *ReplaceIRNodes::replacement(IRNode *node) {
     std::map<IRNode *, IRNode *>::iterator I = replace_map.find(node);
     if (I == replace_map.end()) {
@@ -39,13 +29,22 @@ void ReplaceIRNodes::visit(Block *node) {
 void ReplaceIRNodes::visit(FunctionCall *node) {
     for (unsigned i = 0; i < node->args.size(); i++) {
         if (IRNode *n = replacement(node->args[i])) {
-            Assignment *a = assert_cast<Assignment*>(n);
+            Assignment *a = cast<Assignment>(n);
             node->args[i] = a;
         }
     }
     IRVisitor::visit(node);
 }
 
+void ReplaceIRNodes::visit(Intrinsic *node) {
+    for (unsigned i = 0; i < node->args.size(); i++) {
+        if (IRNode *n = replacement(node->args[i])) {
+            node->args[i] = n;
+        }
+    }
+    IRVisitor::visit(node);
+}
+
 void ReplaceIRNodes::visit(IORedirection *node) {
     if (IRNode *na = replacement(node->a)) {
         node->a = na;
@@ -56,7 +55,19 @@ void ReplaceIRNodes::visit(IORedirection *node) {
     IRVisitor::visit(node);
 }
 
+void ReplaceIRNodes::visit(Location *node) {
+    if (node->offset) {
+        if (IRNode *n = replacement(node->offset)) {
+            node->offset = n;
+        }
+    }
+    IRVisitor::visit(node);
+}
+
 void ReplaceIRNodes::visit(IfStatement *node) {
+    if (IRNode *n = replacement(node->pblock->condition)) {
+        node->pblock->condition = n;
+    }
     for (std::vector<PredicatedBlock *>::const_iterator I = node->elses.begin(),
              E = node->elses.end(); I != E; ++I) {
         if (IRNode *n = replacement((*I)->condition)) {
@@ -75,7 +86,7 @@ void ReplaceIRNodes::visit(ReturnStatement *node) {
 
 void ReplaceIRNodes::visit(ForLoop *node) {
     if (IRNode *n = replacement(node->variable)) {
-        Variable *v = assert_cast<Variable*>(n);
+        Variable *v = cast<Variable>(n);
         node->variable = v;
     }
     if (IRNode *n = replacement(node->lower)) {
@@ -84,12 +95,15 @@ void ReplaceIRNodes::visit(ForLoop *node) {
     if (IRNode *n = replacement(node->upper)) {
         node->upper = n;
     }
+    if (IRNode *n = replacement(node->limit)) {
+        node->limit = n;
+    }
     IRVisitor::visit(node);
 }
 
 void ReplaceIRNodes::visit(Assignment *node) {
     if (IRNode *n = replacement(node->location)) {
-        Location *l = assert_cast<Location*>(n);
+        Location *l = cast<Location>(n);
         node->location = l;
     }
     for (unsigned i = 0; i < node->values.size(); i++) {
@@ -116,3 +130,15 @@ void ReplaceIRNodes::visit(UnaryOp *node) {
     }
     IRVisitor::visit(node);
 }
+
+void ReplaceIRNodes::visit(MapLiteral *node) {
+    for (unsigned i = 0; i < node->keys.size(); i++) {
+        if (IRNode *n = replacement(node->keys[i])) {
+            node->keys[i] = n;
+        }
+        if (IRNode *n = replacement(node->values[i])) {
+            node->values[i] = n;
+        }
+    }
+    IRVisitor::visit(node);
+}
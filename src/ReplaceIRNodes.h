@@ -24,7 +24,9 @@ public:
 
     virtual void visit(Module *);
     virtual void visit(Block *);
+    virtual void visit(Location *);
     virtual void visit(FunctionCall *);
+    virtual void visit(Intrinsic *);
     virtual void visit(IORedirection *);
     virtual void visit(IfStatement *);
     virtual void visit(ReturnStatement *);
@@ -32,6 +34,7 @@ public:
     virtual void visit(Assignment *);
     virtual void visit(BinOp *);
     virtual void visit(UnaryOp *);
+    virtual void visit(MapLiteral *);
 private:
     std::map<IRNode *, IRNode *> replace_map;
     IRNode *replacement(IRNode *node);
@@ -1,56 +1,145 @@
-#include "ReplaceIRNodes.h"
+#include "GetAllBlocks.h"
 #include "ReturnValuesPass.h"
 
 using namespace Bish;
 
 namespace {
 
-// Constructs an ordered list of all Block nodes in a function.
-class GetAllBlocks : public IRVisitor {
+// Collects the FunctionCall nodes of statements, in order, each with
+// the field holding it so that it can be replaced. Blocks are not
+// recursively visited, and neither are pipelines: each stage runs in a
+// subshell whose output is the pipeline input, so its calls cannot be
+// moved out of it. Nodes shared between statements (the arguments of
+// calls) are collected once, for the first statement containing them.
+class CollectCalls : public IRVisitor {
 public:
-    GetAllBlocks(Function *f) {
-        f->accept(this);
-    }
+    typedef ReturnValuesPass::CallSite Call;
+
+    CollectCalls() : slot(NULL) {}
 
-    std::vector<Block *> blocks() { return block_vec; }
+    // Return the calls of the given statement.
+    std::vector<Call> calls(IRNode *stmt) {
+        call_vec.clear();
+        slot = NULL;
+        stmt->accept(this);
+        return call_vec;
+    }
 
     virtual void visit(Block *b) {
-        block_vec.push_back(b);
-        IRVisitor::visit(b);
+        // Do nothing.
     }
-private:
-    std::vector<Block *> block_vec;
-};
 
-// Constructs an ordered list of all FunctionCall nodes in a statement
-// IRNode. Any Blocks encountered are not recursively visited.
-class GetAllCalls : public IRVisitor {
-public:
-    GetAllCalls(IRNode *stmt) {
-        stmt->accept(this);
+    virtual void visit(Location *node) {
+        if (visited(node)) return;
+        visited_set.insert(node);
+        if (node->offset) visit_slot(node->offset);
     }
 
-    std::vector<FunctionCall *> calls() { return call_vec; }
+    virtual void visit(ReturnStatement *node) {
+        if (visited(node)) return;
+        visited_set.insert(node);
+        if (node->value) visit_slot(node->value);
+    }
 
-    virtual void visit(Block *b) {
-        // Do nothing.
+    virtual void visit(IfStatement *node) {
+        if (visited(node)) return;
+        visited_set.insert(node);
+        visit_slot(node->pblock->condition);
+        for (std::vector<PredicatedBlock *>::const_iterator I = node->elses.begin(),
+                 E = node->elses.end(); I != E; ++I) {
+            visit_slot((*I)->condition);
+        }
+    }
+
+    virtual void visit(ForLoop *node) {
+        if (visited(node)) return;
+        visited_set.insert(node);
+        visit_slot(node->lower);
+        if (node->upper) visit_slot(node->upper);
+        if (node->limit) visit_slot(node->limit);
+    }
+
+    virtual void visit(FunctionCall *node) {
+        if (visited(node)) return;
+        visited_set.insert(node);
+        Call c = { node, slot };
+        call_vec.push_back(c);
+        for (std::vector<Assignment *>::const_iterator I = node->args.begin(),
+                 E = node->args.end(); I != E; ++I) {
+            (*I)->accept(this);
+        }
+    }
+
+    virtual void visit(Intrinsic *node) {
+        if (visited(node)) return;
+        visited_set.insert(node);
+        if (node->target) node->target->accept(this);
+        for (unsigned i = 0; i < node->args.size(); i++) {
+            visit_slot(node->args[i]);
+        }
+    }
+
+    virtual void visit(IORedirection *node) {
+        if (visited(node)) return;
+        visited_set.insert(node);
+        // Commands are left in place; only the file name or value a
+        // command is redirected to is computed beforehand.
+        if (node->op != IORedirection::Pipe) visit_slot(node->b);
     }
 
-    virtual void visit(FunctionCall *call) {
-        call_vec.push_back(call);
-        IRVisitor::visit(call);
+    virtual void visit(Assignment *node) {
+        if (visited(node)) return;
+        visited_set.insert(node);
+        node->location->accept(this);
+        for (unsigned i = 0; i < node->values.size(); i++) {
+            visit_slot(node->values[i]);
+        }
+    }
+
+    virtual void visit(BinOp *node) {
+        if (visited(node)) return;
+        visited_set.insert(node);
+        visit_slot(node->a);
+        visit_slot(node->b);
+    }
+
+    virtual void visit(UnaryOp *node) {
+        if (visited(node)) return;
+        visited_set.insert(node);
+        visit_slot(node->a);
+    }
+
+    virtual void visit(MapLiteral *node) {
+        if (visited(node)) return;
+        visited_set.insert(node);
+        for (unsigned i = 0; i < node->keys.size(); i++) {
+            visit_slot(node->keys[i]);
+            visit_slot(node->values[i]);
+        }
     }
 private:
-    std::vector<FunctionCall *> call_vec;
+    std::vector<Call> call_vec;
+    // The field holding the node being visited.
+    IRNode **slot;
+
+    void visit_slot(IRNode *&n) {
+        IRNode **outer = slot;
+        slot = &n;
+        n->accept(this);
+        slot = outer;
+    }
 };
 
+// A block, with the calls of each of its statements.
+typedef std::pair<Block *, std::vector<std::vector<ReturnValuesPass::CallSite> > > BlockCalls;
+
 } // end anonymous namespace
 
 void ReturnValuesPass::initialize_unique_naming(Module *m) {
     unique_id = 0;
     for (Block::iterator I = m->global_variables->begin(),
              E = m->global_variables->end(); I != E; ++I) {
-        if (const Assignment *A = dynamic_cast<const Assignment *>(*I)) {
+        if (const Assignment *A = dyn_cast<Assignment>(*I)) {
             used_names.insert(A->location->variable->name);
         }
     }
@@ -66,30 +155,14 @@ Name ReturnValuesPass::get_unique_name(const std::string &prefix) {
     return name;
 }
 
-void ReturnValuesPass::initialize_blacklist(Module *m) {
-    class GetAllIORedirections : public IRVisitor {
-    public:
-        std::vector<IORedirection *> iors;
-        virtual void visit(IORedirection *ior) {
-            iors.push_back(ior);
-            IRVisitor::visit(ior);
-        }
-    };
-    GetAllIORedirections get;
-    m->accept(&get);
-    for (std::vector<IORedirection *>::iterator I = get.iors.begin(), E = get.iors.end(); I != E; ++I) {
-        GetAllCalls get_calls(*I);
-        std::vector<FunctionCall *> calls = get_calls.calls();
-        for (std::vector<FunctionCall *>::iterator FI = calls.begin(), FE = calls.end(); FI != FE; ++FI) {
-            Function *call = (*FI)->function;
-            blacklist.insert(call);
-        }
-    }
-}
-
 void ReturnValuesPass::visit(Module *node) {
     initialize_unique_naming(node);
-    initialize_blacklist(node);
+
+    // Every function that returns a value does so through a global
+    // variable, so that no call needs a subshell to capture it.
+    for (std::vector<Function *>::iterator I = node->functions.begin(), E = node->functions.end(); I != E; ++I) {
+        get_return_value(*I);
+    }
 
     std::vector<Block *> gv_block(1, node->global_variables);
     lower_blocks(gv_block);
@@ -100,87 +173,86 @@ void ReturnValuesPass::visit(Module *node) {
     }
 }
 
-template <class T>
-void ReturnValuesPass::process_statements(std::vector<T *> &stmts) {
-    typename std::vector<T*>::iterator SI;
-    for (SI = stmts.begin(); SI != stmts.end(); ++SI) {
-        IRNode *stmt = dynamic_cast<IRNode*>(*SI);
-        assert(stmt);
-        GetAllCalls get_calls(stmt);
-        std::vector<FunctionCall *> calls = get_calls.calls();
-        std::map<FunctionCall *, Variable *> replace;
-        // goal here: for each call in stmt S, move the call to
-        // before S. then add a local variable after the call that
-        // saves the global retval of the function. then replace
-        // the functioncall in S with that local var.
-        for (std::vector<FunctionCall *>::iterator I = calls.begin(), E = calls.end(); I != E; ++I) {
-            Function *call = (*I)->function;
-            assert(call);
-            if (blacklist.count(call)) continue;
-            Variable *retval = get_return_value(call);
+// Move each call returning a value in the statements of a block to
+// before its statement, followed by a local variable saving the
+// global return value of the function. The call in the statement is
+// then replaced with that variable. 'calls' holds the calls of each
+// statement.
+void ReturnValuesPass::process_statements(Block *b, const std::vector<std::vector<CallSite> > &calls) {
+    std::vector<IRNode *> nodes;
+    nodes.reserve(b->nodes.size());
+    for (unsigned i = 0; i < b->nodes.size(); i++) {
+        for (std::vector<CallSite>::const_iterator I = calls[i].begin(),
+                 E = calls[i].end(); I != E; ++I) {
+            // A call which is the statement itself already runs in place.
+            if (I->slot == NULL) continue;
+            FunctionCall *call = I->call;
+            assert(call->function);
+            Variable *retval = get_return_value(call->function);
             if (retval == NULL) continue;
             Variable *v = new Variable(get_unique_name());
+            v->set_type(retval->type());
             Location *loc = new Location(v);
-            Assignment *a = new Assignment(loc, retval, IRDebugInfo());
-            SI = stmts.insert(SI, a);
-            SI = stmts.insert(SI, *I);
-            SI++; SI++;
-            replace[*I] = v; // replace the function call with the saved retval.
+            nodes.push_back(call);
+            nodes.push_back(new Assignment(loc, retval, IRDebugInfo()));
+            *I->slot = v;
         }
-        ReplaceIRNodes replace_calls(replace);
-        stmt->accept(&replace_calls);
+        nodes.push_back(b->nodes[i]);
     }
+    b->nodes.swap(nodes);
 }
 
 void ReturnValuesPass::lower_function(Function *f) {
-    GetAllBlocks get_blocks(f);
-    std::vector<Block *> blocks = get_blocks.blocks();
-    lower_blocks(blocks);
+    lower_blocks(get_blocks(f));
 }
 
-void ReturnValuesPass::lower_blocks(std::vector<Block *> &blocks) {
-    std::set<Block *> block_set;
-    std::set<FunctionCall *> call_set;
-    for (std::vector<Block *>::iterator BI = blocks.begin(), BE = blocks.end(); BI != BE; ++BI) {
+void ReturnValuesPass::lower_blocks(const std::vector<Block *> &blocks) {
+    // The calls of every statement are collected in one walk, before
+    // any is moved.
+    CollectCalls collect;
+    std::vector<BlockCalls> block_calls;
+    for (std::vector<Block *>::const_iterator BI = blocks.begin(), BE = blocks.end(); BI != BE; ++BI) {
         Block *b = *BI;
+        std::vector<std::vector<CallSite> > calls;
+        bool any = false;
         for (std::vector<IRNode *>::iterator I = b->nodes.begin(), E = b->nodes.end(); I != E; ++I) {
-            GetAllCalls get_calls(*I);
-            std::vector<FunctionCall *> calls = get_calls.calls();
-            call_set.insert(calls.begin(), calls.end());
+            calls.push_back(collect.calls(*I));
+            any = any || !calls.back().empty();
         }
+        if (any) block_calls.push_back(BlockCalls(b, calls));
     }
-
-    // Create return values.
-    for (std::set<FunctionCall *>::iterator I = call_set.begin(), E = call_set.end(); I != E; ++I) {
-        Function *call = (*I)->function;
-        assert(call);
-        if (blacklist.count((*I)->function)) continue;
-        get_return_value(call);
-        Block *parent = dynamic_cast<Block*>((*I)->parent());
-        assert(parent);
-        block_set.insert(parent);
+    // Blocks are lowered in the order they were found, so that the
+    // names of the temporaries do not depend on where the blocks
+    // were allocated.
+    for (std::vector<BlockCalls>::iterator I = block_calls.begin(), E = block_calls.end(); I != E; ++I) {
+        process_statements(I->first, I->second);
     }
+}
 
-    // Now convert function calls to use the return value.
-    for (std::set<Block *>::iterator BI = block_set.begin(), BE = block_set.end(); BI != BE; ++BI) {
-        Block *b = *BI;
-        process_statements(b->nodes);
+// Return the blocks of the given function, in order. They are
+// collected once per function: lowering adds statements, but no
+// blocks.
+const std::vector<Block *> &ReturnValuesPass::get_blocks(Function *f) {
+    std::map<Function *, std::vector<Block *> >::iterator I = function_blocks.find(f);
+    if (I == function_blocks.end()) {
+        GetAllBlocks get_blocks(f);
+        I = function_blocks.insert(std::make_pair(f, get_blocks.blocks())).first;
     }
+    return I->second;
 }
 
 Variable *ReturnValuesPass::get_return_value(Function *f) {
-    if (return_values.find(f) != return_values.end()) {
-        return return_values[f];
-    }
+    std::map<Function *, Variable *>::iterator I = return_values.find(f);
+    if (I != return_values.end()) return I->second;
     bool ret_void = true;
     Variable *gv = new Variable(get_unique_name("_global_retval_"));
     gv->global = true;
-    GetAllBlocks get_blocks(f);
-    std::vector<Block *> blocks = get_blocks.blocks();
-    for (std::vector<Block *>::iterator BI = blocks.begin(), BE = blocks.end(); BI != BE; ++BI) {
+    gv->set_type(f->type());
+    const std::vector<Block *> &blocks = get_blocks(f);
+    for (std::vector<Block *>::const_iterator BI = blocks.begin(), BE = blocks.end(); BI != BE; ++BI) {
         Block *b = *BI;
         for (std::vector<IRNode *>::iterator SI = b->nodes.begin(); SI != b->nodes.end(); ++SI) {
-            if (ReturnStatement *ret = dynamic_cast<ReturnStatement*>(*SI)) {
+            if (ReturnStatement *ret = dyn_cast<ReturnStatement>(*SI)) {
                 ret_void = false;
                 // Replace return statement with assignment to global variable
                 Assignment *a = new Assignment(new Location(gv), ret->value, IRDebugInfo());
@@ -196,5 +268,6 @@ Variable *ReturnValuesPass::get_return_value(Function *f) {
         gv = NULL;
     }
     return_values[f] = gv;
+    f->return_value = gv;
     return gv;
 }
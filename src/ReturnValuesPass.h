@@ -9,20 +9,28 @@ namespace Bish {
 
 class ReturnValuesPass : public IRVisitor {
 public:
+    // A function call in a statement.
+    struct CallSite {
+        FunctionCall *call;
+        // The field holding the call, or NULL if the call is the
+        // statement itself.
+        IRNode **slot;
+    };
+
     virtual void visit(Module *);
 private:
     unsigned unique_id;
-    std::set<Function *> blacklist;
     std::set<Name> used_names;
     std::map<Function *, std::map<unsigned, Variable *> > reference_vars;
     std::map<Function *, Variable *> return_values;
+    std::map<Function *, std::vector<Block *> > function_blocks;
     Name get_unique_name(const std::string &prefix="_rv_");
     void initialize_unique_naming(Module *m);
-    void initialize_blacklist(Module *m);
     void lower_function(Function *f);
-    void lower_blocks(std::vector<Block *> &blocks);
+    void lower_blocks(const std::vector<Block *> &blocks);
+    const std::vector<Block *> &get_blocks(Function *f);
     Variable *get_return_value(Function *f);
-    template <class T> void process_statements(std::vector<T *> &stmts);
+    void process_statements(Block *b, const std::vector<std::vector<CallSite> > &calls);
 };
 
 }
@@ -0,0 +1,312 @@
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <set>
+#include <sstream>
+#include <vector>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "CodeGen.h"
+#include "Compile.h"
+#include "IRArena.h"
+#include "Server.h"
+#include "Util.h"
+
+using namespace Bish;
+
+namespace {
+
+// Write all of the given data to the file descriptor.
+bool write_all(int fd, const std::string &data) {
+    const char *p = data.data();
+    std::size_t left = data.size();
+    while (left > 0) {
+        ssize_t n = write(fd, p, left);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        left -= n;
+    }
+    return true;
+}
+
+// Read from the file descriptor until end of file.
+std::string read_all(int fd) {
+    std::string data;
+    char buf[4096];
+    for (;;) {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        data.append(buf, n);
+    }
+    return data;
+}
+
+// Read from both file descriptors until end of file on both, so that
+// a writer blocked on a full pipe can not stall the other.
+void read_all(int fd1, std::string &data1, int fd2, std::string &data2) {
+    struct pollfd fds[2];
+    std::string *data[2] = { &data1, &data2 };
+    fds[0].fd = fd1;
+    fds[1].fd = fd2;
+    fds[0].events = fds[1].events = POLLIN;
+    char buf[4096];
+    while (fds[0].fd >= 0 || fds[1].fd >= 0) {
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        for (int i = 0; i < 2; i++) {
+            if (fds[i].fd < 0 || fds[i].revents == 0) continue;
+            ssize_t n = read(fds[i].fd, buf, sizeof(buf));
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) {
+                // Negative descriptors are ignored by poll().
+                fds[i].fd = -1;
+                continue;
+            }
+            data[i]->append(buf, n);
+        }
+    }
+}
+
+// Read a newline-terminated line (without the newline) from the file
+// descriptor.
+bool read_line(int fd, std::string &line) {
+    line.clear();
+    char c;
+    for (;;) {
+        ssize_t n = read(fd, &c, 1);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        if (c == '\n') return true;
+        line += c;
+    }
+}
+
+// Fill in the address of the Unix domain socket at the given path.
+bool socket_address(const std::string &path, struct sockaddr_un &addr) {
+    if (path.size() >= sizeof(addr.sun_path)) {
+        std::cerr << "Socket path too long: " << path << "\n";
+        return false;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path.c_str());
+    return true;
+}
+
+}
+
+// Serve requests until an error occurs. Return nonzero on error.
+int Server::run() {
+    struct sockaddr_un addr;
+    if (!socket_address(socket_path, addr)) return 1;
+    int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock < 0) {
+        perror("socket");
+        return 1;
+    }
+    // Replace the socket of a previous server, but nothing else: the
+    // path may name a file by mistake.
+    struct stat st;
+    if (lstat(socket_path.c_str(), &st) == 0) {
+        if (!S_ISSOCK(st.st_mode)) {
+            std::cerr << socket_path << ": File exists and is not a socket\n";
+            close(sock);
+            return 1;
+        }
+        unlink(socket_path.c_str());
+    }
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(sock, 16) < 0) {
+        perror(socket_path.c_str());
+        close(sock);
+        return 1;
+    }
+    // A client hanging up early must not kill the server.
+    signal(SIGPIPE, SIG_IGN);
+
+    // Parse the standard library up front, so the first request is
+    // as fast as the rest.
+    cache.warm(get_stdlib_path());
+
+    for (;;) {
+        int conn = accept(sock, NULL, NULL);
+        if (conn < 0) {
+            if (errno == EINTR) continue;
+            perror("accept");
+            break;
+        }
+        handle(conn);
+        close(conn);
+    }
+    close(sock);
+    unlink(socket_path.c_str());
+    return 1;
+}
+
+// Compile the request on the given connection and send the response.
+void Server::handle(int conn) {
+    std::string generator = "bash", path, line;
+    CompileOptions options;
+    while (path.empty()) {
+        if (!read_line(conn, line)) return;
+        std::size_t space = line.find(' ');
+        std::string key = line.substr(0, space);
+        std::string value = space == std::string::npos ? "" : line.substr(space + 1);
+        if (key == "generator") {
+            generator = value;
+        } else if (key == "target" && options.set_target(value)) {
+            continue;
+        } else if (key == "profile") {
+            options.set_profile(true);
+        } else if (key == "compact") {
+            options.set_compact(true);
+        } else if (key == "compile" && !value.empty()) {
+            path = value;
+        } else {
+            write_all(conn, "status 1\nbish server: invalid request: " + line + "\n");
+            return;
+        }
+    }
+
+    int out[2], err[2];
+    if (pipe(out) < 0 || pipe(err) < 0) {
+        write_all(conn, "status 1\nbish server: pipe failed\n");
+        return;
+    }
+    pid_t pid = fork();
+    if (pid < 0) {
+        write_all(conn, "status 1\nbish server: fork failed\n");
+        close(out[0]); close(out[1]); close(err[0]); close(err[1]);
+        return;
+    }
+    if (pid == 0) {
+        close(conn);
+        close(out[0]);
+        close(err[0]);
+        compile_in_child(generator, path, options, out[1], err[1]);
+        _exit(0);
+    }
+    close(out[1]);
+    close(err[1]);
+    std::string output, errors;
+    read_all(out[0], output, err[0], errors);
+    close(out[0]);
+    close(err[0]);
+    int status = 0;
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR);
+    const int exit_status = WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+
+    std::ostringstream response;
+    response << "status " << exit_status << "\n";
+    if (exit_status == 0) {
+        // The output starts with the modules the child parsed, one
+        // "<stamp> <path>" per line, terminated by an empty line.
+        std::istringstream lines(output);
+        std::string line, root = abspath(path);
+        if (root.empty()) root = path;
+        while (std::getline(lines, line) && !line.empty()) {
+            std::size_t space = line.find(' ');
+            std::string stamp = line.substr(0, space), module = line.substr(space + 1);
+            // The child's modules are lost when it exits, so the
+            // server parses the imported ones again for the children
+            // of later requests to inherit, if they have not changed
+            // since. The compiled file itself is left out: it is the
+            // one most likely to be edited before the next request.
+            if (module != root && file_stamp(module) == stamp) cache.warm(module);
+        }
+        std::size_t pos = lines.tellg();
+        response << output.substr(pos == std::string::npos ? output.size() : pos);
+    } else {
+        response << errors;
+    }
+    write_all(conn, response.str());
+}
+
+// Compile the file at the given path, writing the parsed modules and
+// the generated script to 'out' and errors to 'err'. Runs in the child
+// process.
+void Server::compile_in_child(const std::string &generator, const std::string &path,
+                              const CompileOptions &options, int out, int err) {
+    dup2(err, STDERR_FILENO);
+    close(err);
+
+    CodeGenerators::CodeGeneratorConstructor cg_constructor = CodeGenerators::get(generator);
+    if (cg_constructor == NULL) {
+        std::cerr << "No code generator " << generator << std::endl;
+        _exit(1);
+    }
+    if (CodeGenerators::executes(generator)) {
+        std::cerr << "The " << generator << " code generator can not be used by a server." << std::endl;
+        _exit(1);
+    }
+    std::vector<std::string> cached = cache.paths();
+    std::set<std::string> before(cached.begin(), cached.end());
+
+    IRArena arena;
+    IRArena::Scope arena_scope(&arena);
+    std::stringstream s;
+    CodeGenerator *cg = cg_constructor(s);
+    Module *m = cache.get(path);
+    compile(m, cg, &cache, options);
+
+    std::ostringstream result;
+    std::vector<std::string> after = cache.paths();
+    for (std::vector<std::string>::iterator I = after.begin(), E = after.end(); I != E; ++I) {
+        if (before.count(*I) == 0) result << file_stamp(*I) << " " << *I << "\n";
+    }
+    result << "\n" << s.str();
+    write_all(out, result.str());
+    close(out);
+}
+
+// Request the compilation of the file at the given path from the
+// server listening on the given socket.
+int Bish::request_compile(const std::string &socket_path, const std::string &generator,
+                          const std::string &path, const CompileOptions &options,
+                          std::ostream &os) {
+    struct sockaddr_un addr;
+    if (!socket_address(socket_path, addr)) return -1;
+    int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock < 0 || connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror(socket_path.c_str());
+        if (sock >= 0) close(sock);
+        return -1;
+    }
+    const std::string file = abspath(path);
+    std::ostringstream request;
+    request << "generator " << generator << "\n"
+            << "target " << options.target() << "\n"
+            << (options.profile() ? "profile\n" : "")
+            << (options.compact() ? "compact\n" : "")
+            << "compile " << (file.empty() ? path : file) << "\n";
+    if (!write_all(sock, request.str())) {
+        perror(socket_path.c_str());
+        close(sock);
+        return -1;
+    }
+    std::string status_line;
+    if (!read_line(sock, status_line) || status_line.compare(0, 7, "status ") != 0) {
+        std::cerr << "Invalid response from bish server.\n";
+        close(sock);
+        return -1;
+    }
+    const int status = atoi(status_line.c_str() + 7);
+    const std::string body = read_all(sock);
+    close(sock);
+    if (status == 0) {
+        os << body;
+        os.flush();
+    } else {
+        std::cerr << body;
+    }
+    return status;
+}
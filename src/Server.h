@@ -0,0 +1,51 @@
+#ifndef __BISH_SERVER_H__
+#define __BISH_SERVER_H__
+
+#include <iostream>
+#include <string>
+#include "Compile.h"
+#include "ModuleCache.h"
+
+namespace Bish {
+
+/* A persistent compile server, listening on a Unix domain socket. The
+ * server keeps the parsed standard library and every module it has
+ * compiled in a ModuleCache, so a request only parses the modules that
+ * changed since they were last compiled.
+ *
+ * Each request is compiled in a child process that inherits the warm
+ * cache, so a compile error (which aborts) cannot take the server
+ * down. The child reports the modules it parsed, which the server then
+ * adds to its own cache.
+ *
+ * Protocol: the client sends newline-terminated "<key> <value>" lines
+ * setting the code generator ("generator <name>") and compile options
+ * ("target <version>", "profile" or "compact"), and then "compile <path>" with the absolute
+ * path of the input file. The server replies with "status <N>\n"
+ * followed by the generated script (if N is 0) or the error messages
+ * of the compilation.
+ */
+class Server {
+public:
+    Server(const std::string &path) : socket_path(path) {}
+    // Serve requests until an error occurs. Return nonzero on error.
+    int run();
+private:
+    std::string socket_path;
+    ModuleCache cache;
+
+    void handle(int conn);
+    void compile_in_child(const std::string &generator, const std::string &path,
+                          const CompileOptions &options, int out, int err);
+};
+
+// Request the compilation of the file at the given path from the
+// server listening on the given socket. The generated script is
+// written to 'os' and any errors to std::cerr. Return the exit status
+// of the compilation, or -1 if the server could not be reached.
+int request_compile(const std::string &socket_path, const std::string &generator,
+                    const std::string &path, const CompileOptions &options, std::ostream &os);
+
+}
+
+#endif
@@ -0,0 +1,114 @@
+#include <cstring>
+#include <fcntl.h>
+#include <map>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "Mutex.h"
+#include "SourceFile.h"
+#include "Util.h"
+
+using namespace Bish;
+
+namespace {
+
+typedef std::map<std::string, SourceFile *> Registry;
+
+// The current version of each opened path. Shared between threads.
+Registry &registry() {
+    static Registry files;
+    return files;
+}
+
+Mutex &registry_mutex() {
+    static Mutex mutex;
+    return mutex;
+}
+
+}
+
+// Load the file at the given path, making it the current version of
+// that path, or return NULL if it can not be read.
+SourceFile *SourceFile::open(const std::string &path) {
+    SourceFile *f = new SourceFile(path);
+    if (!f->load()) {
+        delete f;
+        return NULL;
+    }
+    ScopedLock lock(registry_mutex());
+    SourceFile *&current = registry()[path];
+    if (current && --current->refs == 0) delete current;
+    current = f;
+    f->refs = 2;
+    return f;
+}
+
+// Release a file returned by open().
+void SourceFile::release(SourceFile *f) {
+    ScopedLock lock(registry_mutex());
+    if (--f->refs == 0) delete f;
+}
+
+// Return the given line (counting from 1) of the file at the given
+// path, without its newline. A file deleted since it was opened (e.g.
+// a temporary one) is still looked up in the version opened.
+std::string SourceFile::line(const std::string &path, unsigned lineno) {
+    {
+        ScopedLock lock(registry_mutex());
+        Registry::iterator I = registry().find(path);
+        if (I != registry().end()) {
+            const std::string stamp = file_stamp(path);
+            if (stamp.empty() || stamp == I->second->stamp) return I->second->get_line(lineno);
+        }
+    }
+    return read_line_from_file(path, lineno);
+}
+
+SourceFile::~SourceFile() {
+    if (mapped) munmap((void *)data, size);
+}
+
+// Map the file into memory, or read it if it can not be mapped (e.g.
+// a pipe). Return false if it can not be read.
+bool SourceFile::load() {
+    stamp = file_stamp(path);
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat info;
+    if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0) {
+        void *p = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED) {
+            data = (const char *)p;
+            size = info.st_size;
+            mapped = true;
+            close(fd);
+            return true;
+        }
+    }
+    char buffer[64 * 1024];
+    ssize_t n;
+    while ((n = read(fd, buffer, sizeof(buffer))) > 0) {
+        contents.append(buffer, n);
+    }
+    close(fd);
+    if (n < 0) return false;
+    data = contents.data();
+    size = contents.size();
+    return true;
+}
+
+// Return the given line (counting from 1), or the empty string if
+// there is no such line.
+std::string SourceFile::get_line(unsigned lineno) {
+    if (line_starts.empty()) {
+        line_starts.push_back(0);
+        for (const char *p = data, *end = data + size;
+             (p = (const char *)memchr(p, '\n', end - p)) != NULL; p++) {
+            line_starts.push_back(p + 1 - data);
+        }
+    }
+    if (lineno == 0 || lineno > line_starts.size()) return "";
+    const std::size_t start = line_starts[lineno - 1];
+    const std::size_t end = lineno < line_starts.size() ? line_starts[lineno] - 1 : size;
+    return std::string(data + start, end - start);
+}
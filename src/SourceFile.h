@@ -0,0 +1,91 @@
+#ifndef __BISH_SOURCE_FILE_H__
+#define __BISH_SOURCE_FILE_H__
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace Bish {
+
+// A range of characters owned by someone else, like std::string_view
+// (which C++03 does not have). Reading past the end yields '\0', as
+// does std::string::operator[] at size(), so a scanner only needs to
+// check for the end where it could otherwise loop.
+class StringRef {
+public:
+    StringRef() : data_(""), size_(0) {}
+    StringRef(const char *d, std::size_t n) : data_(d), size_(n) {}
+    StringRef(const std::string &s) : data_(s.data()), size_(s.size()) {}
+
+    const char *data() const { return data_; }
+    std::size_t size() const { return size_; }
+    char operator[](std::size_t i) const { return i < size_ ? data_[i] : '\0'; }
+    // Return (a copy of) the given part of the range, clamped to its
+    // end.
+    std::string substr(std::size_t pos, std::size_t n) const {
+        if (pos >= size_) return "";
+        return std::string(data_ + pos, n < size_ - pos ? n : size_ - pos);
+    }
+private:
+    const char *data_;
+    std::size_t size_;
+};
+
+/* The text of a source file, mapped into memory once and tokenized in
+ * place. The current version of each path is kept while any of its
+ * users need it, together with an index of the offsets at which its
+ * lines begin, so that diagnostics (IRDebugInfo::str()) look up the
+ * line of a node without reading the file again.
+ *
+ * A file is mapped afresh each time it is opened, e.g. when the module
+ * cache parses a changed module again. A version replaced by a newer
+ * one is unmapped once the last parser using it releases it. Files
+ * which can not be mapped are read into memory instead.
+ *
+ * Example:
+ *     SourceFile *f = SourceFile::open(path);
+ *     ... tokenize f->text() ...
+ *     SourceFile::release(f);
+ */
+class SourceFile {
+public:
+    // Load the file at the given path, making it the current version
+    // of that path, or return NULL if it can not be read. The result
+    // must be released.
+    static SourceFile *open(const std::string &path);
+    // Release a file returned by open().
+    static void release(SourceFile *f);
+    // Return the given line (counting from 1) of the file at the given
+    // path, without its newline. Files which were not opened, or have
+    // changed since, are read again.
+    static std::string line(const std::string &path, unsigned lineno);
+
+    StringRef text() const { return StringRef(data, size); }
+private:
+    std::string path;
+    // The version of the file mapped (see file_stamp()).
+    std::string stamp;
+    const char *data;
+    std::size_t size;
+    bool mapped;
+    // The contents of a file which could not be mapped.
+    std::string contents;
+    // The number of users, including the registry while this is the
+    // current version of its path.
+    unsigned refs;
+    // Offsets at which each line begins, built on first use.
+    std::vector<std::size_t> line_starts;
+
+    SourceFile(const std::string &p) : path(p), data(""), size(0), mapped(false), refs(0) {}
+    ~SourceFile();
+    bool load();
+    std::string get_line(unsigned lineno);
+
+    // Disallow copying.
+    SourceFile(const SourceFile &);
+    SourceFile &operator=(const SourceFile &);
+};
+
+}
+
+#endif
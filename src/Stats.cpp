@@ -0,0 +1,108 @@
+#include <cstdio>
+#include <map>
+#include <sys/time.h>
+#include "Config.h"
+#include "IRVisitor.h"
+#include "Stats.h"
+
+using namespace Bish;
+
+namespace {
+
+// Return the current wall time in seconds.
+double now() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+std::string seconds(double s) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.6f", s);
+    return buf;
+}
+
+// Counts the IR nodes of a module by class.
+class CountNodes : public IRVisitor {
+public:
+    std::map<std::string, unsigned> counts;
+
+    virtual void visit(Module *n) { counts["Module"]++; IRVisitor::visit(n); }
+    virtual void visit(Block *n) { counts["Block"]++; IRVisitor::visit(n); }
+    virtual void visit(Variable *n) { counts["Variable"]++; IRVisitor::visit(n); }
+    virtual void visit(Location *n) { counts["Location"]++; IRVisitor::visit(n); }
+    virtual void visit(Function *n) { counts["Function"]++; IRVisitor::visit(n); }
+    virtual void visit(FunctionCall *n) { counts["FunctionCall"]++; IRVisitor::visit(n); }
+    virtual void visit(ExternCall *n) { counts["ExternCall"]++; IRVisitor::visit(n); }
+    virtual void visit(Intrinsic *n) { counts["Intrinsic"]++; IRVisitor::visit(n); }
+    virtual void visit(IORedirection *n) { counts["IORedirection"]++; IRVisitor::visit(n); }
+    virtual void visit(IfStatement *n) { counts["IfStatement"]++; IRVisitor::visit(n); }
+    virtual void visit(ImportStatement *n) { counts["ImportStatement"]++; IRVisitor::visit(n); }
+    virtual void visit(ReturnStatement *n) { counts["ReturnStatement"]++; IRVisitor::visit(n); }
+    virtual void visit(LoopControlStatement *n) { counts["LoopControlStatement"]++; IRVisitor::visit(n); }
+    virtual void visit(ForLoop *n) { counts["ForLoop"]++; IRVisitor::visit(n); }
+    virtual void visit(Assignment *n) { counts["Assignment"]++; IRVisitor::visit(n); }
+    virtual void visit(BinOp *n) { counts["BinOp"]++; IRVisitor::visit(n); }
+    virtual void visit(UnaryOp *n) { counts["UnaryOp"]++; IRVisitor::visit(n); }
+    virtual void visit(Integer *n) { counts["Integer"]++; IRVisitor::visit(n); }
+    virtual void visit(Fractional *n) { counts["Fractional"]++; IRVisitor::visit(n); }
+    virtual void visit(String *n) { counts["String"]++; IRVisitor::visit(n); }
+    virtual void visit(Boolean *n) { counts["Boolean"]++; IRVisitor::visit(n); }
+    virtual void visit(MapLiteral *n) { counts["MapLiteral"]++; IRVisitor::visit(n); }
+};
+
+}
+
+__thread CompileStats *CompileStats::current_stats = NULL;
+
+CompileStats::Timer::Timer(const std::string &p) : stats(current()), phase(p), start(0) {
+    if (stats && !stats->running.insert(phase).second) stats = NULL;
+    if (stats == NULL) return;
+    // Phases are listed in the order they start.
+    stats->add(phase, 0);
+    start = now();
+}
+
+CompileStats::Timer::~Timer() {
+    if (stats == NULL) return;
+    stats->add(phase, now() - start);
+    stats->running.erase(phase);
+}
+
+CompileStats::CompileStats() : start(now()), modules(0) {}
+
+void CompileStats::add(const std::string &phase, double s) {
+    for (unsigned i = 0; i < phases.size(); i++) {
+        if (phases[i].first == phase) {
+            phases[i].second += s;
+            return;
+        }
+    }
+    phases.push_back(std::make_pair(phase, s));
+}
+
+void CompileStats::write_json(std::ostream &os, Module *m, const IRArena *arena) const {
+    CountNodes nodes;
+    if (m) m->accept(&nodes);
+    os << "{\n";
+    os << "  \"bish_version\": \"" << BISH_VERSION << "\",\n";
+    os << "  \"wall_seconds\": " << seconds(now() - start) << ",\n";
+    os << "  \"modules_parsed\": " << modules << ",\n";
+    os << "  \"phases\": [";
+    for (unsigned i = 0; i < phases.size(); i++) {
+        os << (i ? ",\n" : "\n") << "    {\"name\": \"" << phases[i].first <<
+            "\", \"seconds\": " << seconds(phases[i].second) << "}";
+    }
+    os << "\n  ],\n";
+    os << "  \"ir\": {\n";
+    os << "    \"bytes_allocated\": " << (arena ? arena->bytes_allocated() : 0) << ",\n";
+    os << "    \"objects_allocated\": " << (arena ? arena->objects_allocated() : 0) << ",\n";
+    os << "    \"nodes\": {";
+    for (std::map<std::string, unsigned>::const_iterator I = nodes.counts.begin(),
+             E = nodes.counts.end(); I != E; ++I) {
+        os << (I == nodes.counts.begin() ? "\n" : ",\n") << "      \"" << I->first << "\": " << I->second;
+    }
+    os << "\n    }\n";
+    os << "  }\n";
+    os << "}\n";
+}
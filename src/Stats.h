@@ -0,0 +1,73 @@
+#ifndef __BISH_STATS_H__
+#define __BISH_STATS_H__
+
+#include <iostream>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+#include "IR.h"
+#include "IRArena.h"
+
+namespace Bish {
+
+/* Statistics of a compilation, reported with --stats. While a
+ * CompileStats object is current (see CompileStats::Scope), the
+ * compiler records in it the wall time of each phase and the number
+ * of modules parsed. The current stats are per thread, like the
+ * current IRArena.
+ * Example:
+ *     CompileStats stats;
+ *     CompileStats::Scope scope(&stats);
+ *     Module *m = parser.parse(path);
+ *     compile(m, cg);
+ *     stats.write_json(std::cerr, m, &arena);
+ */
+class CompileStats {
+public:
+    // Makes the given stats current for the lifetime of this object.
+    class Scope {
+    public:
+        Scope(CompileStats *s) : previous(current_stats) { current_stats = s; }
+        ~Scope() { current_stats = previous; }
+    private:
+        CompileStats *previous;
+    };
+
+    // Adds the wall time from its construction to its destruction to
+    // the given phase of the current stats, if there are any. A phase
+    // running inside itself (e.g. parsing an imported module while
+    // parsing the importing one) is only timed once.
+    class Timer {
+    public:
+        Timer(const std::string &phase);
+        ~Timer();
+    private:
+        CompileStats *stats;
+        std::string phase;
+        double start;
+    };
+
+    CompileStats();
+
+    // Return the current stats, or NULL if there are none.
+    static CompileStats *current() { return current_stats; }
+    // Record that a module was parsed.
+    void module_parsed() { modules++; }
+    // Write the statistics as a JSON object, including the sizes of
+    // the given module's IR and of the arena it is allocated in.
+    void write_json(std::ostream &os, Module *m, const IRArena *arena) const;
+private:
+    static __thread CompileStats *current_stats;
+    double start;
+    unsigned modules;
+    // Total seconds of each phase, in the order they first started.
+    std::vector<std::pair<std::string, double> > phases;
+    std::set<std::string> running;
+
+    void add(const std::string &phase, double seconds);
+};
+
+}
+
+#endif
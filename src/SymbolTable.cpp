@@ -1,29 +1,50 @@
-#include <iostream>
 #include <cassert>
 #include "SymbolTable.h"
 
 using namespace Bish;
 
-void SymbolTable::insert(const Name &v, IRNode *n) {
-    table[v] = new SymbolTableEntry(n);
+const int SymbolTable::None;
+
+SymbolTable::SymbolTable() {
+    push_scope();
+}
+
+void SymbolTable::push_scope() {
+    scopes.push_back(bindings.size());
 }
 
-void SymbolTable::remove(const Name &v) {
-    table.erase(v);
+void SymbolTable::pop_scope() {
+    assert(!scopes.empty());
+    while (bindings.size() > scopes.back()) {
+        const Binding &b = bindings.back();
+        innermost.insert(b.name, b.shadowed);
+        bindings.pop_back();
+    }
+    scopes.pop_back();
 }
 
-SymbolTableEntry *SymbolTable::lookup(const Name &v) const {
-    std::map<Name, SymbolTableEntry *>::const_iterator I = table.find(v);
-    if (I == table.end()) {
-        if (parent) {
-            return parent->lookup(v);
-        } else {
-            return NULL;
-        }
+void SymbolTable::insert(const Name &name, IRNode *n) {
+    assert(!scopes.empty());
+    const int *i = innermost.find(name.id());
+    int shadowed = i ? *i : None;
+    if (shadowed != None && (unsigned)shadowed >= scopes.back()) {
+        bindings[shadowed].node = n;
+        return;
     }
-    return I->second;
+    Binding b;
+    b.name = name.id();
+    b.node = n;
+    b.shadowed = shadowed;
+    bindings.push_back(b);
+    innermost.insert(name.id(), bindings.size() - 1);
+}
+
+IRNode *SymbolTable::lookup(const Name &name) const {
+    const int *i = innermost.find(name.id());
+    return i && *i != None ? bindings[*i].node : NULL;
 }
 
-bool SymbolTable::contains(const Name &v) const {
-    return table.find(v) != table.end();
+bool SymbolTable::contains(const Name &name) const {
+    const int *i = innermost.find(name.id());
+    return i && *i != None && !scopes.empty() && (unsigned)*i >= scopes.back();
 }
@@ -1,28 +1,52 @@
 #ifndef __BISH_SYMBOL_TABLE_H__
 #define __BISH_SYMBOL_TABLE_H__
 
-#include <map>
+#include <vector>
+#include "FlatHash.h"
 #include "IR.h"
 
 namespace Bish {
 
-class SymbolTableEntry {
-public:
-    IRNode *node;
-    SymbolTableEntry(IRNode *n) : node(n) {}
-};
-
+/* Maps names to IR nodes in a stack of nested scopes. The bindings of
+ * all scopes are kept in one contiguous stack, and a hash table keyed
+ * by name id points at the innermost binding of each name, so a
+ * lookup costs the same however deep the scope is. Popping a scope
+ * restores the bindings it shadowed.
+ * Example:
+ *     SymbolTable t;
+ *     t.insert(Name("x"), a);
+ *     t.push_scope();
+ *     t.insert(Name("x"), b);   // lookup(Name("x")) == b
+ *     t.pop_scope();            // lookup(Name("x")) == a
+ */
 class SymbolTable {
 public:
-    SymbolTable() : parent(NULL) {}
-    SymbolTable(SymbolTable *p) : parent(p) {}
+    SymbolTable();
+    // Start a new innermost scope.
+    void push_scope();
+    // Remove the innermost scope and its bindings.
+    void pop_scope();
+    // Bind the given name in the innermost scope. A binding the name
+    // already has in that scope is replaced.
     void insert(const Name &name, IRNode *n);
-    void remove(const Name &name);
-    SymbolTableEntry *lookup(const Name &name) const;
-    bool contains(const Name &v) const;
+    // Return the node the given name is bound to in the innermost
+    // scope binding it, or NULL.
+    IRNode *lookup(const Name &name) const;
+    // Return true if the innermost scope binds the given name.
+    bool contains(const Name &name) const;
 private:
-    std::map<Name, SymbolTableEntry *> table;
-    SymbolTable *parent;
+    static const int None = -1;
+    struct Binding {
+        unsigned name;
+        IRNode *node;
+        // The binding this one shadows, or None.
+        int shadowed;
+    };
+    std::vector<Binding> bindings;
+    // Index in 'bindings' where each scope starts.
+    std::vector<unsigned> scopes;
+    // Innermost binding of each name id, or None.
+    FlatHashMap<unsigned, int, IntegerHash> innermost;
 };
 
 }
@@ -0,0 +1,182 @@
+#include <algorithm>
+#include "CallGraph.h"
+#include "IRAncestorsPass.h"
+#include "TailRecursionPass.h"
+
+using namespace Bish;
+
+namespace {
+
+// Collects the calls a function makes to itself.
+class FindSelfCalls : public IRVisitor {
+public:
+    FindSelfCalls(Function *f) : function(f) {
+        f->body->accept(this);
+    }
+
+    const std::vector<FunctionCall *> &calls() const { return call_vec; }
+
+    virtual void visit(FunctionCall *call) {
+        if (visited(call)) return;
+        visited_set.insert(call);
+        if (call->function == function) call_vec.push_back(call);
+        IRVisitor::visit(call);
+    }
+private:
+    Function *function;
+    std::vector<FunctionCall *> call_vec;
+};
+
+Location *typed_location(Variable *v) {
+    Location *loc = new Location(v);
+    loc->set_type(v->type());
+    return loc;
+}
+
+Integer *typed_integer(const std::string &value) {
+    Integer *i = new Integer(value);
+    i->set_type(Type::Integer());
+    return i;
+}
+
+}
+
+Name TailRecursionPass::get_unique_name() {
+    std::string base = "_tail_" + as_string(unique_id++);
+    Name name(base);
+    unsigned i = 0;
+    while (used_names.count(name)) {
+        name = Name(base + "_" + as_string(i++));
+    }
+    return name;
+}
+
+void TailRecursionPass::visit(Module *node) {
+    unique_id = 0;
+    for (Block::iterator I = node->global_variables->begin(),
+             E = node->global_variables->end(); I != E; ++I) {
+        if (const Assignment *A = dyn_cast<Assignment>(*I)) {
+            used_names.insert(A->location->variable->name);
+        }
+    }
+
+    // The call graph and the tail positions rely on parent links,
+    // which earlier passes do not maintain.
+    IRAncestorsPass ancestors;
+    node->accept(&ancestors);
+    CallGraphBuilder cgb;
+    CallGraph cg = cgb.build(node);
+
+    bool changed = false;
+    for (std::vector<Function *>::iterator I = node->functions.begin(), E = node->functions.end(); I != E; ++I) {
+        Function *f = *I;
+        if (!f->body) continue;
+        const std::vector<Function *> &calls = cg.calls(f);
+        if (std::find(calls.begin(), calls.end(), f) == calls.end()) continue;
+        if (!can_rewrite(f)) continue;
+        rewrite_function(f);
+        changed = true;
+    }
+
+    if (changed) {
+        IRAncestorsPass parents;
+        node->accept(&parents);
+    }
+}
+
+// Return true if the given function may run as a loop: its arguments
+// are reassigned in place, which only works for values.
+bool TailRecursionPass::can_rewrite(Function *f) {
+    if (f->memo) return false;
+    for (std::vector<Variable *>::const_iterator I = f->args.begin(), E = f->args.end(); I != E; ++I) {
+        if ((*I)->type().array() || (*I)->type().undef()) return false;
+    }
+    return true;
+}
+
+// Add the blocks whose last statement is in tail position of the
+// function to the given set: the body of the function, and the
+// branches of an if statement that is itself in tail position. The
+// bodies of loops and background blocks are not, as 'continue' there
+// would apply to the loop or not return to the function at all.
+void TailRecursionPass::find_tail_blocks(IRNode *n, std::set<Block *> &blocks) {
+    Block *b = dyn_cast<Block>(n);
+    if (!b || b->background) return;
+    blocks.insert(b);
+    if (b->nodes.empty()) return;
+    if (IfStatement *s = dyn_cast<IfStatement>(b->nodes.back())) {
+        find_tail_blocks(s->pblock->body, blocks);
+        for (std::vector<PredicatedBlock *>::const_iterator I = s->elses.begin(),
+                 E = s->elses.end(); I != E; ++I) {
+            find_tail_blocks((*I)->body, blocks);
+        }
+        if (s->elseblock) find_tail_blocks(s->elseblock, blocks);
+    }
+}
+
+// Replace the given tail call with the reassignment of the arguments
+// of its function, and a jump to the next iteration of the loop over
+// 'loop_var'. Return false if the call is left as it is.
+bool TailRecursionPass::rewrite_call(FunctionCall *call, Variable *loop_var) {
+    Function *f = call->function;
+    Block *b = dyn_cast<Block>(call->parent());
+    if (!b || b->nodes.empty() || call->args.size() != f->args.size()) return false;
+    IRNode *last = b->nodes.back();
+    if (ReturnStatement *ret = dyn_cast<ReturnStatement>(last)) {
+        if (ret->value != call) return false;
+    } else if (last != call || f->type().defined()) {
+        // A call whose value is discarded is only a tail call of a
+        // function which returns nothing.
+        return false;
+    }
+    // The arguments are evaluated into temporaries by the statements
+    // preceding the call, before any argument is reassigned.
+    std::vector<IRNode *>::iterator end = b->nodes.end() - 1;
+    for (std::vector<Assignment *>::const_iterator I = call->args.begin(), E = call->args.end(); I != E; ++I) {
+        if (std::find(b->nodes.begin(), end, *I) == end) return false;
+    }
+
+    const IRDebugInfo info = last->debug_info();
+    b->nodes.pop_back();
+    for (unsigned i = 0; i < f->args.size(); i++) {
+        Variable *temp = call->args[i]->location->variable;
+        Assignment *a = new Assignment(typed_location(f->args[i]), typed_location(temp), info);
+        a->set_type(f->args[i]->type());
+        b->nodes.push_back(a);
+    }
+    // The loop increments its variable before the next iteration.
+    Assignment *restart = new Assignment(typed_location(loop_var), typed_integer("-1"), info);
+    restart->set_type(Type::Integer());
+    b->nodes.push_back(restart);
+    b->nodes.push_back(new LoopControlStatement(LoopControlStatement::Continue, info));
+    return true;
+}
+
+// Run the body of the given function in a loop, once unless a tail
+// call starts another iteration:
+//     _tail_0 = 0
+//     for (_tail_0 in 0 .. 0) { body }
+void TailRecursionPass::rewrite_function(Function *f) {
+    std::set<Block *> tail_blocks;
+    find_tail_blocks(f->body, tail_blocks);
+    Variable *loop_var = new Variable(get_unique_name());
+    loop_var->set_type(Type::Integer());
+
+    bool rewritten = false;
+    FindSelfCalls self_calls(f);
+    for (std::vector<FunctionCall *>::const_iterator I = self_calls.calls().begin(),
+             E = self_calls.calls().end(); I != E; ++I) {
+        if (!tail_blocks.count(dyn_cast<Block>((*I)->parent()))) continue;
+        if (rewrite_call(*I, loop_var)) rewritten = true;
+    }
+    if (!rewritten) return;
+
+    const IRDebugInfo info = f->debug_info();
+    Assignment *init = new Assignment(typed_location(loop_var), typed_integer("0"), info);
+    init->set_type(Type::Integer());
+    ForLoop *loop = new ForLoop(loop_var, typed_integer("0"), typed_integer("0"), f->body, info);
+    Block *body = new Block();
+    body->nodes.push_back(init);
+    body->nodes.push_back(loop);
+    f->set_body(body);
+}
@@ -0,0 +1,32 @@
+#ifndef __BISH_TAIL_RECURSION_PASS_H__
+#define __BISH_TAIL_RECURSION_PASS_H__
+
+#include <set>
+#include "IR.h"
+#include "IRVisitor.h"
+
+namespace Bish {
+
+/* Rewrites functions which call themselves in tail position into
+ * loops, so that deep recursion does not nest bash function calls
+ * (bounded by FUNCNEST and memory). The body of such a function runs
+ * in a loop, and each tail call reassigns the arguments and starts
+ * the next iteration. It runs after type checking, and only rewrites
+ * functions whose arguments are all scalars: arrays are later passed
+ * by reference, and memo functions record their results on return. */
+class TailRecursionPass : public IRVisitor {
+public:
+    virtual void visit(Module *);
+private:
+    unsigned unique_id;
+    std::set<Name> used_names;
+    Name get_unique_name();
+    bool can_rewrite(Function *f);
+    void find_tail_blocks(IRNode *n, std::set<Block *> &blocks);
+    bool rewrite_call(FunctionCall *call, Variable *loop_var);
+    void rewrite_function(Function *f);
+};
+
+}
+
+#endif
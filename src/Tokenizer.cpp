@@ -100,7 +100,7 @@ std::string Tokenizer::scan_until(const std::vector<Token> &tokens, bool keep_li
 // characters.
 std::string Tokenizer::scan_until(const std::set<char> &chars) {
     unsigned start = idx;
-    while (chars.count(curchar()) == 0) {
+    while (!eos() && chars.count(curchar()) == 0) {
         idx++;
     }
     return text.substr(start, idx - start);
@@ -119,7 +119,11 @@ std::string Tokenizer::scan_until(char c) {
 // in the string.
 std::string Tokenizer::position() const {
     std::stringstream s;
-    s << "character '" << text[idx] << "', line " << lineno;
+    if (eos()) {
+        s << "end of input, line " << lineno;
+    } else {
+        s << "character '" << text[idx] << "', line " << lineno;
+    }
     return s.str();
 }
 
@@ -152,13 +156,13 @@ inline char Tokenizer::nextchar() const {
 }
 
 inline std::string Tokenizer::lookahead(int n) const {
-    if (idx + n >= text.length()) return "";
+    if (idx + n > text.size()) return "";
     return text.substr(idx, n);
 }
 
 // Return true if the tokenizer is at "end of string".
 inline bool Tokenizer::eos() const {
-    return idx >= text.length();
+    return idx >= text.size();
 }
 
 // Skip ahead until the next non-whitespace character.
@@ -172,10 +176,21 @@ inline void Tokenizer::skip_whitespace() {
     }
 }
 
-// Form the next token. The result is a pair (T, n) where T is the
-// token and n is the new index after skipping past T.
+// Return the next token, forming it only if it is not already
+// cached. The result is a pair (T, n) where T is the token and n is
+// the new index after skipping past T.
 Tokenizer::ResultState Tokenizer::get_token() {
     skip_whitespace();
+    if (!has_cached_token || cached_idx != idx) {
+        cached_token = form_token();
+        cached_idx = idx;
+        has_cached_token = true;
+    }
+    return cached_token;
+}
+
+// Form the token beginning at the current index.
+Tokenizer::ResultState Tokenizer::form_token() {
     char c = curchar();
     if (eos()) {
         return ResultState(Token::EOS(), idx);
@@ -209,6 +224,8 @@ Tokenizer::ResultState Tokenizer::get_token() {
         }
     } else if (c == ',') {
         return ResultState(Token::Comma(), idx + 1);
+    } else if (c == ':') {
+        return ResultState(Token::Colon(), idx + 1);
     } else if (c == '=') {
         if (nextchar() == '=') {
             return ResultState(Token::DoubleEquals(), idx + 2);
@@ -218,7 +235,9 @@ Tokenizer::ResultState Tokenizer::get_token() {
     } else if (c == '!' && nextchar() == '=') {
         return ResultState(Token::NotEquals(), idx + 2);
     } else if (c == '<') {
-        if (nextchar() == '=') {
+        if (lookahead(3) == "<<<") {
+            return ResultState(Token::TripleLAngle(), idx + 3);
+        } else if (nextchar() == '=') {
             return ResultState(Token::LAngleEquals(), idx + 2);
         } else {
             return ResultState(Token::LAngle(), idx + 1);
@@ -226,6 +245,8 @@ Tokenizer::ResultState Tokenizer::get_token() {
     } else if (c == '>') {
         if (nextchar() == '=') {
             return ResultState(Token::RAngleEquals(), idx + 2);
+        } else if (nextchar() == '>') {
+            return ResultState(Token::DoubleRAngle(), idx + 2);
         } else {
             return ResultState(Token::RAngle(), idx + 1);
         }
@@ -313,6 +334,16 @@ Token Tokenizer::get_multichar_token(const std::string &s) {
         return Token::For();
     } else if (s.compare(Token::In().value()) == 0) {
         return Token::In();
+    } else if (s.compare(Token::Persistent().value()) == 0) {
+        return Token::Persistent();
+    } else if (s.compare(Token::Parallel().value()) == 0) {
+        return Token::Parallel();
+    } else if (s.compare(Token::Spawn().value()) == 0) {
+        return Token::Spawn();
+    } else if (s.compare(Token::Pure().value()) == 0) {
+        return Token::Pure();
+    } else if (s.compare(Token::Memo().value()) == 0) {
+        return Token::Memo();
     } else if (s.compare(Token::And().value()) == 0) {
         return Token::And();
     } else if (s.compare(Token::Or().value()) == 0) {
@@ -394,6 +425,14 @@ IORedirection::Operator Bish::get_redirection_operator(const Token &t) {
     switch (t.type()) {
     case Token::PipeType:
         return IORedirection::Pipe;
+    case Token::RAngleType:
+        return IORedirection::Write;
+    case Token::DoubleRAngleType:
+        return IORedirection::Append;
+    case Token::LAngleType:
+        return IORedirection::Read;
+    case Token::TripleLAngleType:
+        return IORedirection::HereString;
     default:
         assert(false && "Invalid operator for I/O redirection.");
         return IORedirection::Pipe;
@@ -6,6 +6,7 @@
 #include <string>
 #include <vector>
 #include "IR.h"
+#include "SourceFile.h"
 
 namespace Bish {
 
@@ -15,6 +16,7 @@ public:
                    AtType,
                    BackslashType,
                    BreakType,
+                   ColonType,
                    CommaType,
                    ContinueType,
                    DefType,
@@ -22,6 +24,7 @@ public:
                    DotType,
                    DoubleDotType,
                    DoubleEqualsType,
+                   DoubleRAngleType,
                    EOSType,
                    ElseType,
                    EqualsType,
@@ -42,21 +45,27 @@ public:
                    RBracketType,
                    LParenType,
                    RParenType,
+                   MemoType,
                    MinusType,
                    NotEqualsType,
                    NotType,
                    OrType,
+                   ParallelType,
                    PercentType,
+                   PersistentType,
                    PipeType,
                    PlusType,
+                   PureType,
                    QuoteType,
                    ReturnType,
                    SemicolonType,
                    SharpType,
                    SlashType,
+                   SpawnType,
                    StarType,
                    SymbolType,
                    TrueType,
+                   TripleLAngleType,
                    UnderscoreType,
                    NoneType } Type;
 
@@ -121,6 +130,10 @@ public:
         return Token(CommaType, ",");
     }
 
+    static Token Colon() {
+        return Token(ColonType, ":");
+    }
+
     static Token Import() {
         return Token(ImportType, "import");
     }
@@ -153,6 +166,26 @@ public:
         return Token(ForType, "for");
     }
 
+    static Token Persistent() {
+        return Token(PersistentType, "persistent");
+    }
+
+    static Token Parallel() {
+        return Token(ParallelType, "parallel");
+    }
+
+    static Token Spawn() {
+        return Token(SpawnType, "spawn");
+    }
+
+    static Token Pure() {
+        return Token(PureType, "pure");
+    }
+
+    static Token Memo() {
+        return Token(MemoType, "memo");
+    }
+
     static Token In() {
         return Token(InType, "in");
     }
@@ -205,6 +238,14 @@ public:
         return Token(RAngleEqualsType, ">=");
     }
 
+    static Token DoubleRAngle() {
+        return Token(DoubleRAngleType, ">>");
+    }
+
+    static Token TripleLAngle() {
+        return Token(TripleLAngleType, "<<<");
+    }
+
     static Token Plus() {
         return Token(PlusType, "+");
     }
@@ -263,11 +304,13 @@ private:
 
 /*
  * The Bish tokenizer. Given a string to tokenize, use the peek() and
- * next() methods to produce a stream of tokens.
+ * next() methods to produce a stream of tokens. The text is not
+ * copied, and must outlive the tokenizer. Lines are numbered from 1.
  */
 class Tokenizer {
 public:
-    Tokenizer(const std::string &p, const std::string &t) : path(p), text(t), idx(0), lineno(0), got_newline(false) {}
+    Tokenizer(const std::string &p, StringRef t) : path(IRArena::intern(p)), text(t), idx(0), lineno(1), got_newline(false),
+                                                   cached_idx(0), has_cached_token(false) {}
 
     // Return the token at the head of the stream, but do not skip it.
     Token peek();
@@ -315,11 +358,17 @@ public:
 private:
     typedef std::pair<Token, unsigned> ResultState;
     std::stack<IRDebugInfo> debug_info_stack;
-    const std::string path;
-    const std::string &text;
+    const std::string *path;
+    StringRef text;
     unsigned idx;
     unsigned lineno;
     bool got_newline;
+    // The most recently formed token, and the index at which it
+    // begins. Tokens depend only on the text at their starting index,
+    // so this remains valid even when idx is moved by scan_until().
+    ResultState cached_token;
+    unsigned cached_idx;
+    bool has_cached_token;
 
     // Start a debug record.
     void start_debug_info();
@@ -338,9 +387,12 @@ private:
     inline bool eos() const;
     // Skip ahead until the next non-whitespace character.
     inline void skip_whitespace();
-    // Form the next token. The result is a pair (T, n) where T is the
-    // token and n is the new index after skipping past T.
+    // Return the next token, forming it only if it is not already
+    // cached. The result is a pair (T, n) where T is the token and n
+    // is the new index after skipping past T.
     ResultState get_token();
+    // Form the token beginning at the current index.
+    ResultState form_token();
     // Read a multi-digit (and possibly fractional) number token.
     ResultState read_number();
     // Read a multi-character string of characters.
@@ -8,7 +8,7 @@ namespace Bish {
 class Type {
 private:
     typedef enum {
-        UndefinedTy, IntegerTy, FractionalTy, StringTy, BooleanTy, ArrayTy
+        UndefinedTy, IntegerTy, FractionalTy, StringTy, BooleanTy, ArrayTy, MapTy
     } InternalType;
     InternalType type;
     Type *element_type;
@@ -43,6 +43,12 @@ public:
         t.element_type = new Type(ty);
         return t;
     }
+    // A map from string keys to values of the given type.
+    static Type Map(Type ty) {
+        Type t(MapTy);
+        t.element_type = new Type(ty);
+        return t;
+    }
 
     bool defined() const { return type != UndefinedTy; }
     bool undef() const { return type == UndefinedTy; }
@@ -51,8 +57,10 @@ public:
     bool string() const { return type == StringTy; }
     bool boolean() const { return type == BooleanTy; }
     bool array() const { return type == ArrayTy; }
+    bool map() const { return type == MapTy; }
+    // The type of the elements of an array, or of the values of a map.
     const Type &element() const {
-        assert(array());
+        assert(array() || map());
         assert(element_type);
         return *element_type;
     }
@@ -71,6 +79,8 @@ public:
             return "bool";
         case ArrayTy:
             return "array[?]";
+        case MapTy:
+            return "map[?]";
         }
     }
 
@@ -1,24 +1,90 @@
 #include <iostream>
 #include <cassert>
+#include "Builtins.h"
 #include "Errors.h"
 #include "IR.h"
 #include "TypeChecker.h"
 
 using namespace Bish;
 
+namespace {
+
+// Rejects the statements of a background job (a spawned block or the
+// body of a parallel loop) that can not have their effect outside of
+// the job, which runs in a subshell.
+class BackgroundCheck : public IRVisitor {
+public:
+    BackgroundCheck(IRNode *job) : loops(0) {
+        job->accept(this);
+    }
+
+    virtual void visit(Assignment *node) {
+        check_write(node->location->variable, node);
+        IRVisitor::visit(node);
+    }
+
+    virtual void visit(Intrinsic *node) {
+        if (node->op == Intrinsic::Append) check_write(node->target->variable, node);
+        IRVisitor::visit(node);
+    }
+
+    virtual void visit(ForLoop *node) {
+        loops++;
+        IRVisitor::visit(node);
+        loops--;
+    }
+
+    virtual void visit(LoopControlStatement *node) {
+        bish_assert(loops > 0) <<
+            "Cannot leave a loop from a background job " << node->debug_info();
+    }
+
+    virtual void visit(ReturnStatement *node) {
+        bish_abort() << "Cannot return from a background job " << node->debug_info();
+    }
+private:
+    int loops;
+
+    void check_write(Variable *v, IRNode *node) {
+        bish_assert(!v->global) << "Cannot assign global variable '" << v->name.str() <<
+            "' in a background job " << node->debug_info();
+    }
+};
+
+}
+
 void TypeChecker::visit(Module *node) {
     if (visited(node)) return;
-    visited_set.insert(node);
+    checked.insert(node);
     module = node;
     node->global_variables->accept(this);
     // Functions are not visited here: only via function calls.
     if (node->main) node->main->accept(this);
+    // The values of a memoized function are kept by its arguments,
+    // which must be scalars.
+    for (std::vector<Function *>::const_iterator I = node->functions.begin(),
+             E = node->functions.end(); I != E; ++I) {
+        Function *f = *I;
+        if (!f->memo || !IRVisitor::visited(f)) continue;
+        bish_assert(f->type().defined()) <<
+            "Memo function " << f->name.str() << " must return a value " << f->debug_info();
+        for (std::vector<Variable *>::const_iterator AI = f->args.begin(),
+                 AE = f->args.end(); AI != AE; ++AI) {
+            bish_assert(!(*AI)->type().array()) <<
+                "Arguments of memo function " << f->name.str() << " must be scalars " << f->debug_info();
+        }
+    }
 }
 
 void TypeChecker::visit(Location *node) {
     if (visited(node) || node->type().defined()) return;
-    visited_set.insert(node);
-    if (node->is_array_ref()) {
+    checked.insert(node);
+    if (node->is_array_ref() && node->variable->type().map()) {
+        node->offset->accept(this);
+        bish_assert(node->offset->type().string()) <<
+            "Map keys must be strings " << node->debug_info();
+        node->set_type(node->variable->type().element());
+    } else if (node->is_array_ref()) {
         bish_assert(node->variable->type().array()) <<
             "Invalid use of array reference on non-array variable";
         node->set_type(node->variable->type().element());
@@ -29,12 +95,14 @@ void TypeChecker::visit(Location *node) {
 
 void TypeChecker::visit(ReturnStatement *node) {
     if (visited(node) || node->type().defined()) return;
-    visited_set.insert(node);
+    checked.insert(node);
     if (node->value == NULL) return;
+    allow_read(node->value);
     node->value->accept(this);
+    bish_assert(!node->value->type().map()) << "Cannot return a map " << node->debug_info();
     node->set_type(node->value->type());
     // Propagate type of this return statement to the parent function.
-    Function *f = dynamic_cast<Function*>(node->parent()->parent());
+    Function *f = dyn_cast<Function>(node->parent()->parent());
     assert(f);
     if (f->type().defined()) {
         bish_assert(f->type() == node->value->type()) <<
@@ -44,9 +112,23 @@ void TypeChecker::visit(ReturnStatement *node) {
     }
 }
 
+void TypeChecker::visit(Block *node) {
+    if (visited(node)) return;
+    checked.insert(node);
+    if (node->background) BackgroundCheck check(node);
+    IRVisitor::visit(node);
+}
+
 void TypeChecker::visit(ForLoop *node) {
     if (visited(node) || node->type().defined()) return;
-    visited_set.insert(node);
+    checked.insert(node);
+
+    if (node->parallel) BackgroundCheck check(node->body);
+    if (node->limit) {
+        node->limit->accept(this);
+        bish_assert(node->limit->type().integer()) <<
+            "The job limit of a parallel loop must be an integer " << node->debug_info();
+    }
 
     node->variable->accept(this);
     node->lower->accept(this);
@@ -55,9 +137,15 @@ void TypeChecker::visit(ForLoop *node) {
     if (node->upper) {
         bish_assert(node->lower->type() == node->upper->type()) <<
             "Type mismatch for lower and upper loop bounds " << node->debug_info();
+        bish_assert(node->lower->type().integer()) <<
+            "Loop bounds must be integers " << node->debug_info() <<
+            "\nexpected int got " << node->lower->type().str();
     }
 
-    Type ty = node->lower->type().array() ? node->lower->type().element() : node->lower->type();
+    // The lines of a command's output, and the keys of a map, are
+    // strings.
+    const Type &lower = node->lower->type();
+    Type ty = node->stream || lower.map() ? Type::String() : lower.array() ? lower.element() : lower;
     node->variable->set_type(ty);
 
     node->body->accept(this);
@@ -65,7 +153,7 @@ void TypeChecker::visit(ForLoop *node) {
 
 void TypeChecker::visit(FunctionCall *node) {
     if (visited(node) || node->type().defined()) return;
-    visited_set.insert(node);
+    checked.insert(node);
     unsigned i = 0;
     bish_assert(node->function->name != module->main->name) <<
         "Cannot call default 'main' function directly " << node->debug_info();
@@ -87,10 +175,58 @@ void TypeChecker::visit(FunctionCall *node) {
 
 void TypeChecker::visit(ExternCall *node) {
     if (visited(node) || node->type().defined()) return;
-    visited_set.insert(node);
+    checked.insert(node);
     node->set_type(Type::Undef());
 }
 
+void TypeChecker::visit(Intrinsic *node) {
+    if (visited(node) || node->type().defined()) return;
+    checked.insert(node);
+    if (node->target) node->target->accept(this);
+    for (std::vector<IRNode *>::const_iterator I = node->args.begin(),
+             E = node->args.end(); I != E; ++I) {
+        (*I)->accept(this);
+    }
+    if (node->reads_file()) {
+        bish_assert(statement_reads.count(node)) <<
+            "lines() and read_file() can only be assigned to a variable " << node->debug_info();
+        bish_assert(node->args[0]->type().string() || node->args[0]->type().undef()) <<
+            "The path to read must be a string " << node->debug_info();
+        node->set_type(builtins.function_type(node->op));
+        return;
+    }
+    const Type &ty = node->target->type();
+    switch (node->op) {
+    case Intrinsic::Length:
+        bish_assert(ty.array() || ty.map() || ty.string() || ty.undef()) <<
+            "len() requires an array, map or string " << node->debug_info();
+        node->set_type(Type::Integer());
+        break;
+    case Intrinsic::Append:
+        bish_assert(ty.array()) << "append() requires an array " << node->debug_info();
+        bish_assert(node->args[0]->type() == ty.element() || node->args[0]->type() == ty) <<
+            "Invalid type for appended value " << node->debug_info();
+        node->set_type(Type::Undef());
+        break;
+    case Intrinsic::Slice:
+        bish_assert(ty.array()) << "slice() requires an array " << node->debug_info();
+        for (unsigned i = 0; i < node->args.size(); i++) {
+            bish_assert(node->args[i]->type().integer()) <<
+                "Slice bounds must be integers " << node->debug_info();
+        }
+        node->set_type(ty);
+        break;
+    default:
+        assert(false && "Unknown intrinsic");
+    }
+}
+
+// Allow the given value to be a read of a file.
+void TypeChecker::allow_read(IRNode *value) {
+    Intrinsic *i = dyn_cast<Intrinsic>(value);
+    if (i && i->reads_file()) statement_reads.insert(i);
+}
+
 void TypeChecker::visit(IORedirection *node) {
     if (node->type().defined()) return;
     node->a->accept(this);
@@ -100,8 +236,9 @@ void TypeChecker::visit(IORedirection *node) {
 
 void TypeChecker::visit(Assignment *node) {
     if (visited(node) || node->type().defined()) return;
-    visited_set.insert(node);
+    checked.insert(node);
     node->location->accept(this);
+    if (node->values.size() == 1 && node->location->is_variable()) allow_read(node->values[0]);
     Type ty = Type::Undef();
     for (std::vector<IRNode *>::const_iterator I = node->values.begin(),
              E = node->values.end(); I != E; ++I) {
@@ -114,6 +251,21 @@ void TypeChecker::visit(Assignment *node) {
         }
     }
     Location *loc = node->location;
+    if (ty.map()) {
+        // Maps are never copied, so they are not passed to functions
+        // either (arguments are assigned to temporaries).
+        bish_assert(node->values.size() == 1 && isa<MapLiteral>(node->values[0]) && loc->is_variable()) <<
+            "Maps can only be assigned a map literal, and not be passed to functions " <<
+            node->debug_info();
+        // An empty map may replace any map.
+        const Type &var_ty = loc->variable->type();
+        if (ty.element().undef() && var_ty.map()) ty = var_ty;
+    } else if (loc->is_array_ref() && loc->variable->type().map() &&
+               loc->variable->type().element().undef() && ty.defined()) {
+        // The first value stored in an empty map sets its type.
+        loc->variable->set_type(Type::Map(ty));
+        loc->set_type(ty);
+    }
     bool array_initialization = node->values.size() > 1;
     Type dest_ty = loc->is_array_ref() && loc->variable->type().defined() ? loc->variable->type().element() : loc->variable->type();
     Type array_ty = Type::Array(ty);
@@ -148,7 +300,7 @@ void TypeChecker::visit(Assignment *node) {
 
 void TypeChecker::visit(BinOp *node) {
     if (visited(node) || node->type().defined()) return;
-    visited_set.insert(node);
+    checked.insert(node);
     node->a->accept(this);
     node->b->accept(this);
     propagate_if_undef(node->a, node->b);
@@ -177,7 +329,7 @@ void TypeChecker::visit(BinOp *node) {
 
 void TypeChecker::visit(UnaryOp *node) {
     if (visited(node)) return;
-    visited_set.insert(node);
+    checked.insert(node);
     node->a->accept(this);
     node->set_type(node->a->type());
 }
@@ -198,6 +350,27 @@ void TypeChecker::visit(Boolean *node) {
     node->set_type(Type::Boolean());
 }
 
+void TypeChecker::visit(MapLiteral *node) {
+    if (visited(node)) return;
+    checked.insert(node);
+    Type ty = Type::Undef();
+    for (unsigned i = 0; i < node->keys.size(); i++) {
+        node->keys[i]->accept(this);
+        node->values[i]->accept(this);
+        bish_assert(node->keys[i]->type().string()) <<
+            "Map keys must be strings " << node->debug_info();
+        const Type &value_ty = node->values[i]->type();
+        bish_assert(value_ty.integer() || value_ty.string()) <<
+            "Map values must be integers or strings " << node->debug_info();
+        if (ty.defined()) {
+            bish_assert(value_ty == ty) << "Mixed types in map literal " << node->debug_info();
+        } else {
+            ty = value_ty;
+        }
+    }
+    node->set_type(Type::Map(ty));
+}
+
 void TypeChecker::propagate_if_undef(IRNode *a, IRNode *b) {
     if (a->type().undef()) {
         a->set_type(b->type());
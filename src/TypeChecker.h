@@ -9,11 +9,13 @@ namespace Bish {
 class TypeChecker : public IRVisitor {
 public:
     virtual void visit(Module *);
+    virtual void visit(Block *);
     virtual void visit(Location *);
     virtual void visit(ReturnStatement *);
     virtual void visit(ForLoop *);
     virtual void visit(FunctionCall *);
     virtual void visit(ExternCall *);
+    virtual void visit(Intrinsic *);
     virtual void visit(IORedirection *);
     virtual void visit(Assignment *);
     virtual void visit(BinOp *);
@@ -22,11 +24,19 @@ public:
     virtual void visit(Fractional *);
     virtual void visit(String *);
     virtual void visit(Boolean *);
+    virtual void visit(MapLiteral *);
 private:
     Module *module;
-    std::set<IRNode *> visited_set;
+    // Nodes checked by this pass, apart from the nodes visited by
+    // IRVisitor.
+    VisitMarks checked;
+    // The reads of files (lines(), read_file()) which are the value of
+    // an assignment to a variable or of a return statement, the only
+    // places they may appear.
+    std::set<IRNode *> statement_reads;
     void propagate_if_undef(IRNode *a, IRNode *b);
-    bool visited(IRNode *n) { return visited_set.find(n) != visited_set.end(); }
+    bool visited(IRNode *n) { return checked.contains(n); }
+    void allow_read(IRNode *value);
 };
 
 }
@@ -2,6 +2,7 @@
 #include <sys/stat.h>
 #include <cassert>
 #include <cstdlib>
+#include <ctime>
 #include "Errors.h"
 #include "Config.h"
 #include "Util.h"
@@ -25,6 +26,38 @@ std::string get_stdlib_path() {
     }
 }
 
+std::string file_stamp(const std::string &path) {
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0) return "";
+    std::ostringstream s;
+    s << info.st_mtime << "." << info.st_mtim.tv_nsec << ":" << info.st_size;
+    // The time stamps of some file systems are coarser than
+    // nanoseconds, so a file changed again soon after it was stamped
+    // may keep its time and size. The stamp of a file modified that
+    // recently also identifies its contents.
+    if (time(NULL) - info.st_mtime <= 1) s << ":" << file_hash(path);
+    return s.str();
+}
+
+// 64-bit FNV-1a.
+std::string hash_string(const std::string &s) {
+    unsigned long long hash = 14695981039346656037ULL;
+    for (std::string::size_type i = 0; i < s.size(); i++) {
+        hash = (hash ^ (unsigned char)s[i]) * 1099511628211ULL;
+    }
+    std::ostringstream out;
+    out << std::hex << hash;
+    return out.str();
+}
+
+std::string file_hash(const std::string &path) {
+    std::ifstream in(path.c_str(), std::ios::binary);
+    if (!in) return "";
+    std::ostringstream contents;
+    contents << in.rdbuf();
+    return hash_string(contents.str());
+}
+
 std::string abspath(const std::string &path) {
     const char *s = path.c_str();
     char abs[PATH_MAX];
@@ -25,6 +25,16 @@ inline std::string as_string(const std::string &s) {
 
 // Return true if the given path is a valid file.
 bool is_file(const std::string &path);
+// Return a string identifying the current version of the file at the
+// given path (its modification time, in nanoseconds, and size, and the
+// hash of its contents if it was modified within the last second), or
+// the empty string if the file does not exist.
+std::string file_stamp(const std::string &path);
+// Return a hash of the given string, in hexadecimal.
+std::string hash_string(const std::string &s);
+// Return a hash of the contents of the file at the given path, as
+// hash_string, or the empty string if the file can not be read.
+std::string file_hash(const std::string &path);
 // Return the absolute path to the standard library.
 std::string get_stdlib_path();
 // Return the absolute path from the given path.
@@ -4,35 +4,79 @@
 #include <cstring>
 #include <set>
 #include <string>
+#include <vector>
 #include <iostream>
+#include <fstream>
+#include <csignal>
+#include <cerrno>
+#include <getopt.h>
 #include <unistd.h>
+#include <sys/wait.h>
+#include "Batch.h"
+#include "BuildCache.h"
 #include "Compile.h"
+#include "FdStream.h"
 #include "Parser.h"
+#include "Profile.h"
 #include "CodeGen.h"
+#include "Server.h"
+#include "Stats.h"
 
-int run_on(const std::string &sh, std::istream &is, const std::string &args) {
-    // Must pass the -s parameter to bash to set the positional
-    // parameters to 'args'.  The '--' disables any of the arguments
-    // from being treated as arguments to the shell.
-    std::string cmd = sh + " -s -- " + args;
-    FILE *shell = popen(cmd.c_str(), "w");
-    char buf[4096];
-
-    do {
-        is.read(buf, sizeof(buf));
-        fwrite(buf, 1, is.gcount(), shell);
-    } while (is.gcount() > 0);
-
-    fflush(shell);
-
-    // pclose returns the exit status of the process,
-    // but shifted to the left by 8 bits.
-    int e = pclose(shell) >> 8;
-    return e;
+// Start the given shell reading a script from a pipe, with the given
+// arguments as its positional parameters. Return the pid of the
+// shell, and the write end of the pipe in 'fd', or -1 on error.
+pid_t start_shell(const std::string &sh, const std::vector<std::string> &args, int &fd) {
+    int p[2];
+    if (pipe(p) < 0) {
+        perror("pipe");
+        return -1;
+    }
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        close(p[0]);
+        close(p[1]);
+        return -1;
+    }
+    if (pid == 0) {
+        dup2(p[0], STDIN_FILENO);
+        close(p[0]);
+        close(p[1]);
+        // Must pass the -s parameter to bash to set the positional
+        // parameters to 'args'.  The '--' disables any of the arguments
+        // from being treated as arguments to the shell.
+        std::vector<char *> argv;
+        argv.push_back(const_cast<char *>(sh.c_str()));
+        argv.push_back(const_cast<char *>("-s"));
+        argv.push_back(const_cast<char *>("--"));
+        for (std::vector<std::string>::const_iterator I = args.begin(), E = args.end(); I != E; ++I) {
+            argv.push_back(const_cast<char *>(I->c_str()));
+        }
+        argv.push_back(NULL);
+        execvp(argv[0], &argv[0]);
+        perror(argv[0]);
+        _exit(127);
+    }
+    close(p[0]);
+    fd = p[1];
+    // The script may exit before reading all of its input.
+    signal(SIGPIPE, SIG_IGN);
+    return pid;
+}
+
+// Wait for the given shell to exit, and return its exit status.
+int wait_shell(pid_t pid) {
+    int status = 0;
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) return 1;
+    }
+    if (WIFSIGNALED(status)) return 128 + WTERMSIG(status);
+    return WEXITSTATUS(status);
 }
 
 void usage(char *argv0) {
     std::cerr << "USAGE: " << argv0 << " [-r] <INPUT> [<args>]\n";
+    std::cerr << "       " << argv0 << " -o <DIR> [-j <N>] <INPUT>...\n";
     std::cerr << "  Compiles Bish file <INPUT> to bash. Specifying '-' for <INPUT>\n";
     std::cerr << "  reads from standard input.\n";
     std::cerr << "\nOPTIONS:\n";
@@ -40,7 +84,25 @@ void usage(char *argv0) {
     std::cerr << "  -r: Compiles and runs the script.\n";
     std::cerr << "  <ARGS>: With -r, passes <ARGS> as arguments to script.\n";
     std::cerr << "  -l: list all code generators.\n";
-    std::cerr << "  -u <NAME>: use code generator <NAME>.\n";
+    std::cerr << "  -u <NAME>: use code generator <NAME> (default bash; sh emits POSIX sh,\n";
+    std::cerr << "     and interp runs the script with -r without emitting one).\n";
+    std::cerr << "  -t <VERSION>: oldest bash version to target (default 4.0). With 4.3 or\n";
+    std::cerr << "     later, arrays are passed to functions by nameref instead of copied,\n";
+    std::cerr << "     and parallel loops start a job as soon as any other one finished.\n";
+    std::cerr << "  -F, --report-forks: lists the function calls that run in a subshell.\n";
+    std::cerr << "  -p, --profile: makes the script write a profile of its functions and\n";
+    std::cerr << "     loops to $BISH_PROFILE (default bish.prof) when it exits.\n";
+    std::cerr << "  --report <FILE>: prints the profile written by a script compiled with -p.\n";
+    std::cerr << "  --stats[=<FILE>]: writes the time taken by each compiler phase and the\n";
+    std::cerr << "     size of the IR as JSON to <FILE>, or to stderr.\n";
+    std::cerr << "  --compact: emits the script without indentation, comments or empty\n";
+    std::cerr << "     functions, and with short names for compiler temporaries.\n";
+    std::cerr << "  --cache <DIR>: keeps the scripts compiled from each <INPUT> in <DIR>, and\n";
+    std::cerr << "     reuses them while none of the modules they import changed.\n";
+    std::cerr << "  -o <DIR>: compiles each <INPUT> to a file in <DIR>.\n";
+    std::cerr << "  -j <N>: with -o, compiles <N> files in parallel (default: number of CPUs).\n";
+    std::cerr << "  -s, --server <SOCKET>: run a compile server listening on <SOCKET>.\n";
+    std::cerr << "  -c, --client <SOCKET>: compile <INPUT> using the server on <SOCKET>.\n";
 }
 
 void show_generators_list() {
@@ -53,12 +115,31 @@ void show_generators_list() {
 
 int main(int argc, char **argv) {
     Bish::CodeGenerators::initialize();
+    // All IR for this compilation is allocated in (and freed with)
+    // this arena.
+    Bish::IRArena arena;
+    Bish::IRArena::Scope arena_scope(&arena);
 
     int c;
     bool run_after_compile = false;
     std::string code_generator_name = "bash";
+    std::string server_socket, client_socket, output_dir, stats_path, cache_dir;
+    bool report_stats = false;
+    Bish::CompileOptions options;
+    long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    static struct option long_options[] = {
+        {"server", required_argument, NULL, 's'},
+        {"client", required_argument, NULL, 'c'},
+        {"report-forks", no_argument, NULL, 'F'},
+        {"stats", optional_argument, NULL, 'S'},
+        {"profile", no_argument, NULL, 'p'},
+        {"report", required_argument, NULL, 'R'},
+        {"cache", required_argument, NULL, 'C'},
+        {"compact", no_argument, NULL, 'm'},
+        {NULL, 0, NULL, 0}
+    };
 
-    while ((c = getopt(argc,argv, "hrlu:")) != -1) {
+    while ((c = getopt_long(argc, argv, "hrlu:t:s:c:o:j:Fp", long_options, NULL)) != -1) {
         switch (c) {
         case 'h':
             usage(argv[0]);
@@ -72,45 +153,211 @@ int main(int argc, char **argv) {
         case 'u':
             code_generator_name = std::string(optarg);
             break;
+        case 't':
+            if (!options.set_target(optarg)) {
+                std::cerr << "Invalid target version " << optarg << "\n";
+                return 1;
+            }
+            break;
+        case 's':
+            server_socket = std::string(optarg);
+            break;
+        case 'c':
+            client_socket = std::string(optarg);
+            break;
+        case 'o':
+            output_dir = std::string(optarg);
+            break;
+        case 'j':
+            jobs = atol(optarg);
+            break;
+        case 'F':
+            options.set_report_forks(true);
+            break;
+        case 'p':
+            options.set_profile(true);
+            break;
+        case 'R':
+            if (!Bish::print_profile(optarg, std::cout)) {
+                std::cerr << "Failed to read profile " << optarg << "\n";
+                return 1;
+            }
+            return 0;
+        case 'm':
+            options.set_compact(true);
+            break;
+        case 'C':
+            cache_dir = std::string(optarg);
+            break;
+        case 'S':
+            report_stats = true;
+            if (optarg) stats_path = std::string(optarg);
+            break;
         default:
             break;
         }
     }
 
+    if (!server_socket.empty()) {
+        Bish::Server server(server_socket);
+        return server.run();
+    }
+
     if (optind >= argc) {
         usage(argv[0]);
         return 1;
     }
 
-    std::string path(argv[optind]);
-    std::stringstream s;
-    Bish::Parser p;
-    Bish::Module *m = path.compare("-") == 0 ? p.parse(std::cin) : p.parse(path);
+    if (!cache_dir.empty()) {
+        if (options.report_forks()) {
+            std::cerr << "Can't use --report-forks with --cache.\n";
+            return 1;
+        }
+        if (report_stats) {
+            std::cerr << "Can't use --stats with --cache.\n";
+            return 1;
+        }
+        if (!client_socket.empty()) {
+            std::cerr << "Can't use --cache with --client.\n";
+            return 1;
+        }
+        if (Bish::CodeGenerators::executes(code_generator_name)) {
+            std::cerr << "Can't use the " << code_generator_name << " code generator with --cache.\n";
+            return 1;
+        }
+    }
 
-    std::string args;
-    if (optind + 1 < argc) {
-        if (!run_after_compile) {
-            std::cerr << "Can't pass arguments to script without -r.\n";
+    if (!output_dir.empty()) {
+        if (run_after_compile) {
+            std::cerr << "Can't use -r with -o.\n";
             return 1;
         }
-        for (unsigned i = optind+1; i < argc; i++) {
-            args += argv[i];
-            args += " ";
+        if (report_stats) {
+            std::cerr << "Can't use --stats with -o.\n";
+            return 1;
         }
+        std::vector<std::string> inputs(argv + optind, argv + argc);
+        return Bish::compile_batch(inputs, output_dir, code_generator_name, jobs > 0 ? jobs : 1,
+                                   options, cache_dir);
+    }
+
+    std::string path(argv[optind]);
+    std::vector<std::string> args(argv + optind + 1, argv + argc);
+    if (!args.empty() && !run_after_compile) {
+        std::cerr << "Can't pass arguments to script without -r.\n";
+        return 1;
+    }
+
+    // A code generator which runs the script itself needs no shell.
+    const bool executes = Bish::CodeGenerators::executes(code_generator_name);
+    if (executes && !run_after_compile) {
+        std::cerr << "The " << code_generator_name << " code generator only runs scripts, with -r.\n";
+        return 1;
     }
     
+    if (!cache_dir.empty() && path.compare("-") == 0) {
+        std::cerr << "Can't read from standard input with --cache.\n";
+        return 1;
+    }
+
+    if (!client_socket.empty()) {
+        if (path.compare("-") == 0) {
+            std::cerr << "Can't read from standard input with --client.\n";
+            return 1;
+        }
+        if (options.report_forks()) {
+            std::cerr << "Can't use --report-forks with --client.\n";
+            return 1;
+        }
+        if (report_stats) {
+            std::cerr << "Can't use --stats with --client.\n";
+            return 1;
+        }
+        if (executes) {
+            std::cerr << "Can't use the " << code_generator_name << " code generator with --client.\n";
+            return 1;
+        }
+        std::stringstream s;
+        int status = Bish::request_compile(client_socket, code_generator_name, path, options,
+                                           run_after_compile ? s : std::cout);
+        if (status != 0) return status < 0 ? 1 : status;
+        if (run_after_compile) {
+            int fd;
+            pid_t shell = start_shell(code_generator_name, args, fd);
+            if (shell < 0) return 1;
+            Bish::FdOStream script(fd);
+            script << s.rdbuf();
+            script.close();
+            return wait_shell(shell);
+        }
+        return 0;
+    }
+
     Bish::CodeGenerators::CodeGeneratorConstructor cg_constructor =
         Bish::CodeGenerators::get(code_generator_name);
     if (cg_constructor == NULL) {
         std::cerr << "No code generator " << code_generator_name << std::endl;
         return 1;
     }
-    Bish::CodeGenerator *cg = cg_constructor(run_after_compile ? s : std::cout);
-    Bish::compile(m, cg);
-    if (run_after_compile) {
-        const int exit_status = run_on(code_generator_name, s, args);
-        exit(exit_status);
+
+    // With -r, the shell starts while the script is compiled, and
+    // reads the script as it is generated.
+    pid_t shell = -1;
+    Bish::FdOStream *script = NULL;
+    if (run_after_compile && !executes) {
+        int fd;
+        shell = start_shell(code_generator_name, args, fd);
+        if (shell < 0) return 1;
+        script = new Bish::FdOStream(fd);
+    }
+
+    if (!cache_dir.empty()) {
+        // The module is parsed through the module cache, which records
+        // the modules it imports.
+        Bish::BuildCache build_cache(cache_dir, code_generator_name, options);
+        std::string compiled;
+        if (!build_cache.fetch(path, compiled)) {
+            Bish::ModuleCache cache;
+            std::ostringstream s;
+            Bish::CodeGenerator *cg = cg_constructor(s);
+            Bish::compile(cache.get(path), cg, &cache, options);
+            delete cg;
+            compiled = s.str();
+            build_cache.store(path, &cache, compiled);
+        }
+        if (script) {
+            *script << compiled;
+            delete script;
+            return wait_shell(shell);
+        }
+        std::cout << compiled;
+        return 0;
+    }
+
+    Bish::CompileStats stats;
+    Bish::CompileStats::Scope stats_scope(report_stats ? &stats : NULL);
+    Bish::ModuleCache cache;
+    Bish::Parser p(&cache);
+    Bish::Module *m = path.compare("-") == 0 ? p.parse(std::cin) : p.parse(path);
+
+    Bish::CodeGenerator *cg = cg_constructor(script ? *script : std::cout);
+    cg->set_args(args);
+    Bish::compile(m, cg, &cache, options);
+    const int status = cg->status();
+    delete cg;
+    if (report_stats) {
+        if (stats_path.empty()) {
+            stats.write_json(std::cerr, m, &arena);
+        } else {
+            std::ofstream out(stats_path.c_str());
+            if (!out) std::cerr << "Failed to open " << stats_path << "\n";
+            stats.write_json(out, m, &arena);
+        }
+    }
+    if (script) {
+        delete script;
+        return wait_shell(shell);
     }
 
-    return 0;
+    return status;
 }
@@ -0,0 +1,201 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Generates large bish programs to measure how compile time and memory
+// scale with the size of the input. The program has N functions in
+// M+1 modules: main.bish, which imports stress0.bish .. stressM-1.bish.
+// The functions of each module form call chains of depth D, and main
+// calls the head of every chain, through the imports.
+
+namespace {
+
+struct Shape {
+    unsigned functions, depth, imports;
+};
+
+std::string module_name(unsigned k) {
+    std::ostringstream s;
+    s << "stress" << k;
+    return s.str();
+}
+
+std::string function_name(unsigned i) {
+    std::ostringstream s;
+    s << "f" << i;
+    return s.str();
+}
+
+// Write the function with the given index. It calls the next function
+// of its module unless it ends a chain, and is large enough not to be
+// inlined.
+void write_function(std::ostream &os, unsigned i, bool calls_next) {
+    os << "def " << function_name(i) << "(x, y) {\n";
+    os << "    total = x * " << (i % 7 + 1) << " + y\n";
+    os << "    for (k in 0 .. 2) {\n";
+    os << "        if (total > " << (i % 13) << ") {\n";
+    os << "            total = total - k\n";
+    os << "        } else {\n";
+    os << "            total = total + k\n";
+    os << "        }\n";
+    os << "    }\n";
+    if (calls_next) {
+        os << "    return " << function_name(i + 1) << "(total, x)\n";
+    } else {
+        os << "    return total\n";
+    }
+    os << "}\n\n";
+}
+
+// Write the functions [first, last) of a module, and return the
+// statements calling the heads of their chains.
+std::string write_functions(std::ostream &os, const Shape &shape, unsigned first,
+                            unsigned last) {
+    std::ostringstream calls;
+    for (unsigned i = first; i < last; i++) {
+        bool head = (i - first) % shape.depth == 0;
+        bool calls_next = i + 1 < last && (i + 1 - first) % shape.depth != 0;
+        write_function(os, i, calls_next);
+        if (head) {
+            calls << "    sum = sum + " << function_name(i) << "(sum, " << i << ")\n";
+        }
+    }
+    return calls.str();
+}
+
+bool write_program(const std::string &dir, const Shape &shape) {
+    unsigned modules = shape.imports + 1;
+    unsigned per_module = (shape.functions + modules - 1) / modules;
+    std::ostringstream main_calls;
+    for (unsigned k = 0; k < shape.imports; k++) {
+        std::string name = module_name(k);
+        std::ofstream os((dir + "/" + name + ".bish").c_str());
+        if (!os) return false;
+        unsigned first = k * per_module;
+        unsigned last = std::min(first + per_module, shape.functions);
+        os << "# Generated by StressGen.\n\n";
+        std::string calls = write_functions(os, shape, first, std::max(first, last));
+        // Functions are linked by name alone, so names are unique
+        // across modules.
+        os << "def run" << k << "(sum) {\n" << calls << "    return sum\n}\n";
+        main_calls << "    sum = " << name << ".run" << k << "(sum)\n";
+    }
+    std::ofstream os((dir + "/main.bish").c_str());
+    if (!os) return false;
+    os << "# Generated by StressGen.\n\n";
+    for (unsigned k = 0; k < shape.imports; k++) {
+        os << "import " << module_name(k) << "\n";
+    }
+    os << "\n";
+    unsigned first = std::min(shape.imports * per_module, shape.functions);
+    std::string calls = write_functions(os, shape, first, shape.functions);
+    os << "def run() {\n    sum = 0\n" << calls << main_calls.str();
+    os << "    println(sum)\n}\n\nrun()\n";
+    return true;
+}
+
+double now() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+// Compile the generated program with the given compiler, and print
+// the shape, the wall time, the peak resident set size of the
+// compiler and its exit status.
+int measure(const std::string &bish, const std::string &dir, const Shape &shape) {
+    std::string main_path = dir + "/main.bish";
+    double start = now();
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return 1;
+    }
+    if (pid == 0) {
+        int null = open("/dev/null", O_WRONLY);
+        dup2(null, STDOUT_FILENO);
+        execl(bish.c_str(), bish.c_str(), main_path.c_str(), (char *)NULL);
+        perror(bish.c_str());
+        _exit(127);
+    }
+    int status;
+    struct rusage usage;
+    while (wait4(pid, &status, 0, &usage) < 0) {
+        if (errno != EINTR) {
+            perror("wait4");
+            return 1;
+        }
+    }
+    double seconds = now() - start;
+    int code = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+    printf("%u\t%u\t%u\t%.6f\t%ld\t%d\n", shape.functions, shape.depth, shape.imports,
+           seconds, usage.ru_maxrss, code);
+    return code;
+}
+
+void usage(const char *argv0) {
+    std::cerr << "USAGE: " << argv0 << " [-n N] [-d D] [-m M] [-x BISH] <DIR>\n";
+    std::cerr << "  Writes a bish program with N functions (default 1000) in call chains\n";
+    std::cerr << "  of depth D (default 4), split over main.bish and M imported modules\n";
+    std::cerr << "  (default 4), to directory <DIR>.\n";
+    std::cerr << "  -x BISH: compiles the program with the compiler BISH, and prints\n";
+    std::cerr << "     N, D, M, the compile time in seconds, the peak RSS of the compiler\n";
+    std::cerr << "     in KB and its exit status, separated by tabs.\n";
+}
+
+}
+
+int main(int argc, char **argv) {
+    Shape shape;
+    shape.functions = 1000;
+    shape.depth = 4;
+    shape.imports = 4;
+    std::string bish;
+    int c;
+    while ((c = getopt(argc, argv, "hn:d:m:x:")) != -1) {
+        switch (c) {
+        case 'n':
+            shape.functions = strtoul(optarg, NULL, 10);
+            break;
+        case 'd':
+            shape.depth = strtoul(optarg, NULL, 10);
+            break;
+        case 'm':
+            shape.imports = strtoul(optarg, NULL, 10);
+            break;
+        case 'x':
+            bish = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (optind != argc - 1 || shape.depth == 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    std::string dir(argv[optind]);
+    if (mkdir(dir.c_str(), 0777) < 0 && errno != EEXIST) {
+        perror(dir.c_str());
+        return 1;
+    }
+    if (!write_program(dir, shape)) {
+        std::cerr << "Failed to write the program to " << dir << "\n";
+        return 1;
+    }
+    if (!bish.empty()) return measure(bish, dir, shape);
+    return 0;
+}
@@ -258,8 +258,6 @@ public:
 private:
     unsigned indent_level;
     std::ostream &stream;
-    std::set<IRNode *> visited_set;
-    bool visited(IRNode *n) { return visited_set.find(n) != visited_set.end(); }
     void indent() {
         for (unsigned i = 0; i < indent_level; i++) {
             stream << "    ";